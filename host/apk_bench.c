@@ -0,0 +1,277 @@
+/* apk_bench.c -- host harness for loading modules out of a zip
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * Packs a synthetic module into one stored and one deflated APK, next to
+ * another entry, and loads it back with so_zip_load. The segments, the
+ * dynamic tables and the module hash have to match so_file_load on the same
+ * bytes. Done once for a module with hash tables and once for one that only
+ * has section headers to size its dynsym with. Prints one JSON object:
+ *   ./apk_bench
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "config.h"
+#include "dialog.h"
+#include "so_util.h"
+#include "host_dynlib.h"
+#include "synth_elf.h"
+
+#define ZIP_STORED 0
+#define ZIP_DEFLATED 8
+
+// zipalign pads stored entries with an extra field the central directory lacks
+#define ALIGN_EXTRA 4
+
+typedef struct {
+  size_t text_size;
+  int n_data;
+  size_t data_size[MAX_DATA_SEG];
+  uint8_t *text;
+  uint8_t *data[MAX_DATA_SEG];
+  int num_dynsym;
+  int num_reldyn;
+  int num_relplt;
+  uint8_t sha1[20];
+} module_copy;
+
+static void put_u16(uint8_t *p, uint16_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+  put_u16(p, v);
+  put_u16(p + 2, v >> 16);
+}
+
+typedef struct {
+  const char *name;
+  int method;
+  const uint8_t *data;
+  size_t size;
+} zip_entry;
+
+static int write_zip(const char *path, const zip_entry *entries, int count) {
+  FILE *file = fopen(path, "wb");
+  if (!file)
+    return -1;
+
+  uint8_t *cdir = malloc(count * (46 + 256));
+  size_t cdir_size = 0;
+  uint32_t offset = 0;
+
+  for (int i = 0; i < count; i++) {
+    const zip_entry *e = &entries[i];
+    uint32_t crc = crc32(0, e->data, e->size);
+    uint16_t name_len = strlen(e->name);
+    uint16_t extra_len = e->method == ZIP_STORED ? ALIGN_EXTRA : 0;
+
+    uint8_t *out = (uint8_t *)e->data;
+    uLongf out_size = e->size;
+    if (e->method == ZIP_DEFLATED) {
+      out_size = compressBound(e->size);
+      out = malloc(out_size);
+      z_stream z;
+      memset(&z, 0, sizeof(z));
+      deflateInit2(&z, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+      z.next_in = (uint8_t *)e->data;
+      z.avail_in = e->size;
+      z.next_out = out;
+      z.avail_out = out_size;
+      deflate(&z, Z_FINISH);
+      out_size = z.total_out;
+      deflateEnd(&z);
+    }
+
+    uint8_t local[30];
+    memset(local, 0, sizeof(local));
+    put_u32(local, 0x04034b50);
+    put_u16(local + 4, 20);
+    put_u16(local + 8, e->method);
+    put_u32(local + 14, crc);
+    put_u32(local + 18, out_size);
+    put_u32(local + 22, e->size);
+    put_u16(local + 26, name_len);
+    put_u16(local + 28, extra_len);
+    uint8_t extra[ALIGN_EXTRA] = { 0 };
+    fwrite(local, 1, sizeof(local), file);
+    fwrite(e->name, 1, name_len, file);
+    fwrite(extra, 1, extra_len, file);
+    fwrite(out, 1, out_size, file);
+
+    uint8_t *c = cdir + cdir_size;
+    memset(c, 0, 46);
+    put_u32(c, 0x02014b50);
+    put_u16(c + 4, 20);
+    put_u16(c + 6, 20);
+    put_u16(c + 10, e->method);
+    put_u32(c + 16, crc);
+    put_u32(c + 20, out_size);
+    put_u32(c + 24, e->size);
+    put_u16(c + 28, name_len);
+    put_u32(c + 42, offset);
+    memcpy(c + 46, e->name, name_len);
+    cdir_size += 46 + name_len;
+
+    offset += sizeof(local) + name_len + extra_len + out_size;
+    if (out != e->data)
+      free(out);
+  }
+
+  uint8_t eocd[22];
+  memset(eocd, 0, sizeof(eocd));
+  put_u32(eocd, 0x06054b50);
+  put_u16(eocd + 8, count);
+  put_u16(eocd + 10, count);
+  put_u32(eocd + 12, cdir_size);
+  put_u32(eocd + 16, offset);
+  fwrite(cdir, 1, cdir_size, file);
+  fwrite(eocd, 1, sizeof(eocd), file);
+
+  free(cdir);
+  return fclose(file) == 0 ? 0 : -1;
+}
+
+static void copy_module(module_copy *copy, so_module *mod) {
+  memset(copy, 0, sizeof(module_copy));
+  copy->text_size = mod->text_size;
+  copy->text = malloc(mod->text_size);
+  memcpy(copy->text, (void *)mod->text_base, mod->text_size);
+  copy->n_data = mod->n_data;
+  for (int i = 0; i < mod->n_data; i++) {
+    copy->data_size[i] = mod->data_size[i];
+    copy->data[i] = malloc(mod->data_size[i]);
+    memcpy(copy->data[i], (void *)mod->data_base[i], mod->data_size[i]);
+  }
+  copy->num_dynsym = mod->num_dynsym;
+  copy->num_reldyn = mod->num_reldyn;
+  copy->num_relplt = mod->num_relplt;
+  memcpy(copy->sha1, mod->sha1, sizeof(copy->sha1));
+}
+
+static void free_copy(module_copy *copy) {
+  free(copy->text);
+  for (int i = 0; i < copy->n_data; i++)
+    free(copy->data[i]);
+}
+
+static int same_module(const module_copy *a, const module_copy *b) {
+  if (a->text_size != b->text_size || a->n_data != b->n_data || a->num_dynsym != b->num_dynsym ||
+      a->num_reldyn != b->num_reldyn || a->num_relplt != b->num_relplt ||
+      memcmp(a->sha1, b->sha1, sizeof(a->sha1)) != 0 || memcmp(a->text, b->text, a->text_size) != 0)
+    return 0;
+  for (int i = 0; i < a->n_data; i++) {
+    if (a->data_size[i] != b->data_size[i] || memcmp(a->data[i], b->data[i], a->data_size[i]) != 0)
+      return 0;
+  }
+  return 1;
+}
+
+static int load_copy(module_copy *copy, const char *path, const char *entry, SceUInt64 *time) {
+  so_module mod;
+  SceUInt64 start = sceKernelGetProcessTimeWide();
+  int res = entry ? so_zip_load(&mod, path, entry, LOAD_ADDRESS) : so_file_load(&mod, path, LOAD_ADDRESS);
+  *time = sceKernelGetProcessTimeWide() - start;
+  if (res < 0)
+    return res;
+  copy_module(copy, &mod);
+  so_unload(&mod);
+  return 0;
+}
+
+// Returns 1 when both archives load the same module as the plain file
+static int check_module(const synth_elf_opts *opts, const char *name, SceUInt64 *times) {
+  size_t size;
+  uint8_t *image = synth_elf_build(opts, &size);
+  if (!image)
+    fatal_error("Error could not build the synthetic module.");
+
+  char so_path[64], stored_path[64], deflated_path[64];
+  snprintf(so_path, sizeof(so_path), "/tmp/apk_bench_%s_%d.so", name, getpid());
+  snprintf(stored_path, sizeof(stored_path), "/tmp/apk_bench_%s_stored_%d.apk", name, getpid());
+  snprintf(deflated_path, sizeof(deflated_path), "/tmp/apk_bench_%s_deflated_%d.apk", name, getpid());
+
+  FILE *file = fopen(so_path, "wb");
+  if (!file || fwrite(image, 1, size, file) != size)
+    fatal_error("Error could not write %s.", so_path);
+  fclose(file);
+
+  static const char manifest[] = "<manifest package=\"com.sega.CrazyTaxi\"/>";
+  zip_entry entries[2] = {
+    { "AndroidManifest.xml", ZIP_DEFLATED, (const uint8_t *)manifest, sizeof(manifest) },
+    { APK_SO_ENTRY, ZIP_STORED, image, size },
+  };
+  if (write_zip(stored_path, entries, 2) < 0)
+    fatal_error("Error could not write %s.", stored_path);
+  entries[1].method = ZIP_DEFLATED;
+  if (write_zip(deflated_path, entries, 2) < 0)
+    fatal_error("Error could not write %s.", deflated_path);
+  free(image);
+
+  module_copy plain, stored, deflated;
+  if (load_copy(&plain, so_path, NULL, &times[0]) < 0)
+    fatal_error("Error could not load %s.", so_path);
+
+  int ok = plain.num_dynsym == 1 + opts->num_imports + opts->num_exports;
+  if (load_copy(&stored, stored_path, APK_SO_ENTRY, &times[1]) == 0) {
+    ok &= same_module(&plain, &stored);
+    free_copy(&stored);
+  } else {
+    ok = 0;
+  }
+  if (load_copy(&deflated, deflated_path, APK_SO_ENTRY, &times[2]) == 0) {
+    ok &= same_module(&plain, &deflated);
+    free_copy(&deflated);
+  } else {
+    ok = 0;
+  }
+  free_copy(&plain);
+
+  unlink(so_path);
+  unlink(stored_path);
+  unlink(deflated_path);
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  static const char *imports[64];
+  for (int i = 0; i < 64; i++)
+    imports[i] = default_dynlib[i].symbol;
+
+  synth_elf_opts opts;
+  memset(&opts, 0, sizeof(synth_elf_opts));
+  opts.num_exports = 1024;
+  opts.num_relative = 4096;
+  opts.num_init = 16;
+  opts.text_size = 512 * 1024;
+  opts.imports = imports;
+  opts.num_imports = 64;
+  opts.gnu_hash = 1;
+
+  SceUInt64 times[3];
+  int hashed = check_module(&opts, "hashed", times);
+
+  opts.gnu_hash = 0;
+  opts.no_hash = 1;
+  opts.section_headers = 1;
+  SceUInt64 shdr_times[3];
+  int shdr = check_module(&opts, "shdr", shdr_times);
+
+  int ok = hashed && shdr;
+  printf("{\"file_us\":%llu,\"stored_us\":%llu,\"deflated_us\":%llu,\"hashed\":%s,\"section_headers\":%s,\"ok\":%s}\n",
+         (unsigned long long)times[0], (unsigned long long)times[1], (unsigned long long)times[2],
+         hashed ? "true" : "false", shdr ? "true" : "false", ok ? "true" : "false");
+
+  return ok ? 0 : 1;
+}
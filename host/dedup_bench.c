@@ -0,0 +1,218 @@
+/* dedup_bench.c -- host harness for texture deduplication
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * Uploads a few payloads under several names each, the way the game loads
+ * its shared sign textures, and checks that every payload reaches GL once
+ * while each name still samples its own contents. Then writes to shared
+ * names (a sub image update, a different wrap mode) and checks only the
+ * writer gets a copy, also with the name bound on a second unit through the
+ * state cache, uploads a texture with its own mips twice, a square
+ * PVRTC texture twice, a payload whose first copy changed in video memory
+ * behind its hash, and deletes everything in an order that leaves
+ * shared textures without the name that uploaded them. Prints one JSON
+ * object:
+ *   ./dedup_bench
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "dedup.h"
+#include "gl_state.h"
+#include "pvrtc.h"
+#include "texture.h"
+#include "gl_stubs.h"
+
+#define GROUPS 4
+#define COPIES 3
+#define SIZE 256
+#define TEXTURE_BYTES (SIZE * SIZE * 4)
+
+#define MIP_NAME 20
+#define MIP_LEVELS 4
+#define PVR_NAME 30
+#define PVR_SIZE 128
+#define STALE_NAME 40
+
+static uint8_t *make_texture(int seed, int size) {
+  uint8_t *data = malloc(size * size * 4);
+  for (int i = 0; i < size * size; i++) {
+    data[i * 4] = i + seed;
+    data[i * 4 + 1] = seed * 40;
+    data[i * 4 + 2] = i >> 8;
+    data[i * 4 + 3] = 255;
+  }
+  return data;
+}
+
+static GLuint name_of(int group, int copy) {
+  return 1 + group * COPIES + copy;
+}
+
+static void upload(GLuint texture, const uint8_t *data) {
+  glBindTextureHook(GL_TEXTURE_2D, texture);
+  glTexImage2DHook(GL_TEXTURE_2D, 0, GL_RGBA, SIZE, SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+  glTexParameteriHook(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteriHook(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteriHook(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+// What a draw with the name bound would sample
+static int samples(GLuint texture, const uint8_t *data, int size) {
+  glBindTextureHook(GL_TEXTURE_2D, texture);
+  GLint bound = 0;
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+  const uint8_t *level0 = gl_stubs_texture_level(bound, 0);
+  return level0 && memcmp(level0, data, size) == 0;
+}
+
+int main(int argc, char *argv[]) {
+  uint8_t *data[GROUPS];
+  for (int i = 0; i < GROUPS; i++)
+    data[i] = make_texture(i, SIZE);
+
+  gl_stubs_reset();
+  texture_init(NULL);
+  dedup_stats *stats = dedup_get_stats();
+
+  SceUInt64 start = sceKernelGetProcessTimeWide();
+  for (int copy = 0; copy < COPIES; copy++) {
+    for (int group = 0; group < GROUPS; group++)
+      upload(name_of(group, copy), data[group]);
+  }
+  SceUInt64 upload_time = sceKernelGetProcessTimeWide() - start;
+
+  int uploads = gl_calls.tex_images;
+  int ok = uploads == GROUPS;
+  for (int group = 0; group < GROUPS; group++) {
+    for (int copy = 0; copy < COPIES; copy++)
+      ok &= samples(name_of(group, copy), data[group], TEXTURE_BYTES);
+  }
+  dedup_get_stats();
+  uint64_t saved = stats->saved_bytes;
+  uint32_t hits = stats->hits;
+  uint64_t hash_time = stats->hash_time;
+  ok &= hits == GROUPS * (COPIES - 1) && stats->shared == GROUPS * (COPIES - 1) &&
+        saved == (uint64_t)GROUPS * (COPIES - 1) * TEXTURE_BYTES;
+
+  // A sub image update copies the writer off, the rest keep the original
+  uint8_t patch[16 * 16 * 4];
+  memset(patch, 0x5a, sizeof(patch));
+  glBindTextureHook(GL_TEXTURE_2D, name_of(0, 1));
+  glTexSubImage2DHook(GL_TEXTURE_2D, 0, 0, 0, 16, 16, GL_RGBA, GL_UNSIGNED_BYTE, patch);
+  const uint8_t *patched = gl_stubs_texture_level(dedup_backing(name_of(0, 1)), 0);
+  ok &= stats->copies == 1 && patched && patched[0] == 0x5a && memcmp(patched + 16 * 4, data[0] + 16 * 4, 4) == 0;
+  ok &= samples(name_of(0, 0), data[0], TEXTURE_BYTES) && samples(name_of(0, 2), data[0], TEXTURE_BYTES);
+
+  // Same wrap mode again is free, a different one needs a copy
+  glBindTextureHook(GL_TEXTURE_2D, name_of(1, 2));
+  glTexParameteriHook(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  int free_param = stats->copies == 1;
+  glTexParameteriHook(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  ok &= free_param && stats->copies == 2 && dedup_backing(name_of(1, 2)) != dedup_backing(name_of(1, 0)) &&
+        samples(name_of(1, 2), data[1], TEXTURE_BYTES);
+
+  // Bound on two units and written through one, the other unit has to pick up
+  // the copy on its next bind instead of the cache dropping it as a repeat
+  gl_state_init(NULL, 1);
+  GLuint written = name_of(3, 1);
+  glActiveTextureCached(GL_TEXTURE0);
+  glBindTextureCached(GL_TEXTURE_2D, written);
+  glActiveTextureCached(GL_TEXTURE0 + 1);
+  glBindTextureCached(GL_TEXTURE_2D, written);
+  glTexSubImage2DHook(GL_TEXTURE_2D, 0, 0, 0, 16, 16, GL_RGBA, GL_UNSIGNED_BYTE, patch);
+  glActiveTextureCached(GL_TEXTURE0);
+  glBindTextureCached(GL_TEXTURE_2D, written);
+  gl_stub_state state;
+  gl_stubs_state(&state);
+  ok &= stats->copies == 3 && state.textures[0] == dedup_backing(written) && state.textures[0] != dedup_backing(name_of(3, 0));
+
+  // Supplied mips that match are skipped as well
+  uint8_t *level0 = make_texture(9, SIZE);
+  uint8_t *mip = make_texture(10, SIZE / 2);
+  int mip_uploads = gl_calls.mip_images;
+  for (int copy = 0; copy < 2; copy++) {
+    glBindTextureHook(GL_TEXTURE_2D, MIP_NAME + copy);
+    glTexImage2DHook(GL_TEXTURE_2D, 0, GL_RGBA, SIZE, SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, level0);
+    for (int level = 1, size = SIZE / 2; level < MIP_LEVELS; level++, size /= 2)
+      glTexImage2DHook(GL_TEXTURE_2D, level, GL_RGBA, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, mip);
+  }
+  ok &= gl_calls.mip_images - mip_uploads == MIP_LEVELS - 1 && dedup_backing(MIP_NAME + 1) == MIP_NAME;
+
+  // Square PVRTC goes to GL compressed and is shared the same way
+  uint32_t pvr_size = pvrtc_4bpp_size(PVR_SIZE, PVR_SIZE);
+  uint8_t *pvr = make_texture(11, PVR_SIZE);
+  int pvr_uploads = gl_calls.tex_images;
+  for (int copy = 0; copy < 2; copy++) {
+    glBindTextureHook(GL_TEXTURE_2D, PVR_NAME + copy);
+    glCompressedTexImage2DHook(GL_TEXTURE_2D, 0, GL_COMPRESSED_RGBA_PVRTC_4BPPV1_IMG, PVR_SIZE, PVR_SIZE, 0, pvr_size, pvr);
+  }
+  ok &= gl_calls.tex_images - pvr_uploads == 1 && samples(PVR_NAME + 1, pvr, pvr_size);
+
+  // A hash match whose bytes differ, as a collision would, gets its own copy
+  uint8_t *stale = make_texture(12, SIZE);
+  glBindTextureHook(GL_TEXTURE_2D, STALE_NAME);
+  glTexImage2DHook(GL_TEXTURE_2D, 0, GL_RGBA, SIZE, SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, stale);
+  uint8_t *stored = (uint8_t *)gl_stubs_texture_level(STALE_NAME, 0);
+  stored[0] ^= 0xff;
+  int stale_uploads = gl_calls.tex_images;
+  glBindTextureHook(GL_TEXTURE_2D, STALE_NAME + 1);
+  glTexImage2DHook(GL_TEXTURE_2D, 0, GL_RGBA, SIZE, SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, stale);
+  ok &= gl_calls.tex_images - stale_uploads == 1 && dedup_backing(STALE_NAME + 1) == STALE_NAME + 1 &&
+        samples(STALE_NAME + 1, stale, TEXTURE_BYTES);
+
+  // The uploading name goes first, its texture stays for the others
+  GLuint owner = name_of(2, 0);
+  glDeleteTexturesHook(1, &owner);
+  ok &= samples(name_of(2, 1), data[2], TEXTURE_BYTES) && samples(name_of(2, 2), data[2], TEXTURE_BYTES);
+
+  GLuint ids[GROUPS * COPIES + 6];
+  int count = 0;
+  for (int group = 0; group < GROUPS; group++) {
+    for (int copy = 0; copy < COPIES; copy++) {
+      if (name_of(group, copy) != owner)
+        ids[count++] = name_of(group, copy);
+    }
+  }
+  ids[count++] = MIP_NAME;
+  ids[count++] = MIP_NAME + 1;
+  ids[count++] = PVR_NAME;
+  ids[count++] = PVR_NAME + 1;
+  ids[count++] = STALE_NAME;
+  ids[count++] = STALE_NAME + 1;
+  glBindTextureHook(GL_TEXTURE_2D, 0);
+  texture_wait();
+  texture_frame();
+  glDeleteTexturesHook(count, ids);
+
+  // Nothing shared is left and no texture leaked, the loader's copies included
+  dedup_get_stats();
+  ok &= stats->shared == 0 && stats->saved_bytes == 0;
+  for (GLuint texture = 1; texture < 64; texture++)
+    ok &= gl_stubs_texture_level(texture, 0) == NULL;
+
+  uint64_t hashed = stats->hash_bytes;
+  printf("{\"names\":%d,\"payloads\":%d,\"uploads\":%d,\"hits\":%u,\"saved_bytes\":%llu,"
+         "\"hashed_bytes\":%llu,\"hash_us\":%llu,\"upload_us\":%llu,\"copies\":%u,\"ok\":%s}\n",
+         GROUPS * COPIES, GROUPS, uploads, hits, (unsigned long long)saved,
+         (unsigned long long)hashed, (unsigned long long)hash_time, (unsigned long long)upload_time,
+         stats->copies, ok ? "true" : "false");
+
+  for (int i = 0; i < GROUPS; i++)
+    free(data[i]);
+  free(level0);
+  free(mip);
+  free(pvr);
+  free(stale);
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,118 @@
+/* framebuffer_bench.c -- host harness for the framebuffer copy path
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * Plays the pattern of a render-to-texture pass on a texture vitaGL cannot
+ * render into: bind the framebuffer, attach the texture, draw a small
+ * viewport, then draw the scene to the screen. Checks that each readback is
+ * uploaded after the swap of its frame and only covers the viewport. A
+ * texture attached only once must still get its pixels, and more copies in a
+ * frame than the ring holds must not lose any. Prints one JSON object:
+ *   ./framebuffer_bench
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "framebuffer.h"
+#include "shader_variant.h"
+#include "gl_stubs.h"
+
+#define FRAMES 300
+#define FBO 1
+#define TEXTURE 7
+#define ONCE_TEXTURE 8
+#define BURST_TEXTURE 9
+#define BURST 5
+#define PASS_W 256
+#define PASS_H 128
+
+static void copy_pass(GLuint texture) {
+  glBindFramebufferHook(GL_FRAMEBUFFER, FBO);
+  glFramebufferTexture2DHook(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+  glViewportHook(0, 0, PASS_W, PASS_H);
+  glClearHook(GL_COLOR_BUFFER_BIT);
+  glDrawArraysHook(GL_TRIANGLES, 0, 6);
+  glBindFramebufferHook(GL_FRAMEBUFFER, 0);
+  glViewportHook(0, 0, SCREEN_W, SCREEN_H);
+}
+
+// A texture captured once and never attached again
+static int check_once(void) {
+  glBindTexture(GL_TEXTURE_2D, ONCE_TEXTURE);
+  framebuffer_texture_image(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4);
+
+  int uploads = gl_calls.tex_sub_images;
+  copy_pass(ONCE_TEXTURE);
+  for (int i = 0; i < FB_READBACK_LATENCY + 1; i++)
+    framebuffer_frame();
+  return gl_calls.tex_sub_images - uploads == 1;
+}
+
+// More copies in one frame than the ring has slots
+static int check_burst(void) {
+  glBindTexture(GL_TEXTURE_2D, BURST_TEXTURE);
+  framebuffer_texture_image(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4);
+
+  int uploads = gl_calls.tex_sub_images;
+  for (int i = 0; i < BURST; i++)
+    copy_pass(BURST_TEXTURE);
+  for (int i = 0; i < FB_READBACK_LATENCY + 1; i++)
+    framebuffer_frame();
+  return gl_calls.tex_sub_images - uploads == BURST;
+}
+
+int main(int argc, char *argv[]) {
+  gl_stubs_reset();
+
+  // RGBA4444 is not renderable, so the framebuffer takes the copy path
+  glBindTexture(GL_TEXTURE_2D, TEXTURE);
+  framebuffer_texture_image(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4);
+
+  int ok = 1;
+  int late = 0;
+
+  for (int i = 0; i < FRAMES; i++) {
+    int uploads = gl_calls.tex_sub_images;
+
+    copy_pass(TEXTURE);
+    glDrawArraysHook(GL_TRIANGLES, 0, 6);
+
+    // Nothing lands before the swap, the readback FB_READBACK_LATENCY frames
+    // back lands right after it
+    if (gl_calls.tex_sub_images != uploads)
+      late++;
+    framebuffer_frame();
+    if (gl_calls.tex_sub_images - uploads != (i + 1 >= FB_READBACK_LATENCY))
+      late++;
+  }
+
+  // Only the first copy reads the whole screen, the others just the pass
+  uint64_t full = (uint64_t)FRAMES * SCREEN_W * SCREEN_H * 4;
+  uint64_t expected = (uint64_t)SCREEN_W * SCREEN_H * 4 + (uint64_t)(FRAMES - 1) * PASS_W * PASS_H * 4;
+  if (gl_calls.read_bytes != expected || late || gl_calls.tex_images != 1)
+    ok = 0;
+  uint64_t read_bytes = gl_calls.read_bytes, upload_bytes = gl_calls.upload_bytes;
+  int readbacks = gl_calls.read_pixels, uploads = gl_calls.tex_sub_images;
+
+  int once = check_once();
+  int burst = check_burst();
+  ok = ok && once && burst;
+
+  printf("{\"frames\":%d,\"readbacks\":%d,\"uploads\":%d,\"late_uploads\":%d,\"tex_images\":%d,"
+         "\"read_bytes_per_frame\":%llu,\"full_copy_bytes_per_frame\":%llu,\"upload_bytes_per_frame\":%llu,",
+         FRAMES, readbacks, uploads, late, gl_calls.tex_images,
+         (unsigned long long)(read_bytes / FRAMES), (unsigned long long)(full / FRAMES),
+         (unsigned long long)(upload_bytes / FRAMES));
+  printf("\"single_attach\":%s,\"burst\":%s,\"early_uploads\":%u,\"ok\":%s}\n",
+         once ? "true" : "false", burst ? "true" : "false", framebuffer_get_stats()->early, ok ? "true" : "false");
+
+  return ok ? 0 : 1;
+}
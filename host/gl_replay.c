@@ -0,0 +1,418 @@
+/* gl_replay.c -- host replay of GL state traces
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * Replays a trace written with GL_TRACE through the state cache twice, once
+ * passing every call on and once dropping the redundant ones, and checks GL
+ * is left in the same state at every frame marker. Without a trace, one is
+ * first recorded from a frame loop shaped like the game's: the whole render
+ * state and every uniform set again before each draw, a second texture unit
+ * for some of them, and textures and programs deleted or relinked between
+ * frames. Prints one JSON object:
+ *   ./gl_replay [trace]
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "gl_state.h"
+#include "gl_stubs.h"
+#include "shader_variant.h"
+#include "uniform_cache.h"
+
+#define SYNTHETIC_TRACE "/tmp/gl_replay_trace.bin"
+#define FRAMES 120
+#define DRAWS 200
+#define OPAQUE_DRAWS 150
+#define TEXTURES 12
+#define PROGRAMS 3
+
+enum {
+  LOCATION_WVP,
+  LOCATION_LIGHT,
+  LOCATION_PARAM,
+  LOCATION_SAMPLER,
+  LOCATION_FOG,
+};
+
+static const char *uniform_names[] = { "matWorldViewProj", "vLightDirection", "vsShaderParam", "sTexture", "vFogColor" };
+
+// Words per element of each uniform call
+static const int uniform_words[GL_STATE_CALLS] = {
+  [GL_STATE_UNIFORM_1I] = 1, [GL_STATE_UNIFORM_1F] = 1, [GL_STATE_UNIFORM_2F] = 2,
+  [GL_STATE_UNIFORM_3F] = 3, [GL_STATE_UNIFORM_4F] = 4, [GL_STATE_UNIFORM_MATRIX2] = 4,
+  [GL_STATE_UNIFORM_MATRIX3] = 9, [GL_STATE_UNIFORM_MATRIX4] = 16,
+};
+
+typedef struct {
+  uint8_t *data;
+  long size;
+} trace_file;
+
+typedef struct {
+  int frames;
+  uint64_t hits[GL_STATE_CALLS];
+  uint64_t misses[GL_STATE_CALLS];
+  uint64_t uniform_bytes; // uniform data not uploaded
+  uint64_t max_frame_uniforms; // most uniform uploads dropped in a frame
+} replay_result;
+
+// The stubs only keep uniforms of locations they handed out
+static void synthetic_programs(void) {
+  for (GLuint prog = 1; prog <= PROGRAMS; prog++) {
+    for (int i = 0; i < sizeof(uniform_names) / sizeof(*uniform_names); i++)
+      glGetUniformLocation(prog, uniform_names[i]);
+  }
+}
+
+// Objects are drawn in pairs, the camera moves every frame and the light
+// every ten, materials change every eight draws and the fog never does
+static void synthetic_uniforms(int frame, int draw) {
+  GLfloat wvp[16];
+  for (int i = 0; i < 16; i++)
+    wvp[i] = (i % 5 == 0 ? 1.0f : 0.0f) + frame * 0.01f + (draw / 2) * 0.1f;
+  GLfloat light[4] = { 0.0f, -1.0f, (frame / 10) * 0.1f, 0.0f };
+  GLfloat param[4] = { (draw / 8) % 2 ? 1.0f : 0.0f, 0.0f, (draw / 16) % 2 ? 1.0f : 0.0f, 0.5f };
+  GLfloat fog[3] = { 0.5f, 0.6f, 0.7f };
+
+  glUniformMatrix4fvCached(LOCATION_WVP, 1, GL_FALSE, wvp);
+  glUniform4fvCached(LOCATION_LIGHT, 1, light);
+  glUniform4fvCached(LOCATION_PARAM, 1, param);
+  glUniform1iCached(LOCATION_SAMPLER, 0);
+  glUniform3fvCached(LOCATION_FOG, 1, fog);
+}
+
+static void synthetic_frame(int frame) {
+  glViewportCached(0, 0, SCREEN_W, SCREEN_H);
+  glScissorCached(0, 0, SCREEN_W, SCREEN_H);
+  glClearColorCached(0.0f, 0.0f, 0.0f, 1.0f);
+  glColorMaskCached(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  glDepthMaskCached(GL_TRUE);
+
+  for (int draw = 0; draw < DRAWS; draw++) {
+    int opaque = draw < OPAQUE_DRAWS;
+
+    glUseProgramCached(1 + (draw / 20) % 3);
+    glActiveTextureCached(GL_TEXTURE0);
+    glBindTextureCached(GL_TEXTURE_2D, 1 + (draw / 4) % TEXTURES);
+
+    // Lightmapped geometry
+    if (draw % 25 == 0) {
+      glActiveTextureCached(GL_TEXTURE0 + 1);
+      glBindTextureCached(GL_TEXTURE_2D, TEXTURES + 1);
+      glActiveTextureCached(GL_TEXTURE0);
+    }
+
+    glEnableCached(GL_DEPTH_TEST);
+    glDepthFuncCached(GL_LEQUAL);
+    glDepthMaskCached(opaque);
+    if (opaque) {
+      glDisableCached(GL_BLEND);
+    } else {
+      glEnableCached(GL_BLEND);
+      glBlendFuncCached(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+    glEnableCached(GL_CULL_FACE);
+    glCullFaceCached(GL_BACK);
+    glBindBufferCached(GL_ARRAY_BUFFER, 1 + (draw / 10) % 2);
+    glBindBufferCached(GL_ELEMENT_ARRAY_BUFFER, 3);
+    synthetic_uniforms(frame, draw);
+  }
+
+  // The HUD is drawn clipped
+  glEnableCached(GL_SCISSOR_TEST);
+  glScissorCached(0, 0, SCREEN_W, SCREEN_H / 4);
+  glDisableCached(GL_SCISSOR_TEST);
+
+  // Reloading the lightmap and index buffer frees names that are still bound
+  if (frame % 30 == 29) {
+    GLuint texture = TEXTURES + 1;
+    glDeleteTexturesCached(1, &texture);
+    GLuint buffer = 3;
+    glDeleteBuffersCached(1, &buffer);
+  }
+  if (frame % 40 == 39) {
+    glDeleteProgramCached(3);
+    glLinkProgramCached(1);
+  }
+}
+
+static int record_synthetic(const char *path) {
+  gl_stubs_reset();
+  synthetic_programs();
+  gl_state_init(path, 1);
+  for (int frame = 0; frame < FRAMES; frame++) {
+    synthetic_frame(frame);
+    gl_state_frame();
+  }
+  gl_state_init(NULL, 1);
+  return 0;
+}
+
+static int read_trace(const char *path, trace_file *trace) {
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return -1;
+
+  fseek(file, 0, SEEK_END);
+  trace->size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  trace->data = malloc(trace->size);
+  if (!trace->data || fread(trace->data, 1, trace->size, file) != trace->size) {
+    fclose(file);
+    return -1;
+  }
+  fclose(file);
+
+  uint32_t magic = 0;
+  if (trace->size >= sizeof(magic))
+    memcpy(&magic, trace->data, sizeof(magic));
+  return magic == GL_TRACE_MAGIC ? 0 : -1;
+}
+
+static GLfloat bits_float(uint32_t bits) {
+  GLfloat value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+static void replay_call(int call, const uint32_t *a, int count) {
+  switch (call) {
+    case GL_STATE_ACTIVE_TEXTURE:
+      glActiveTextureCached(a[0]);
+      break;
+    case GL_STATE_BIND_TEXTURE:
+      glBindTextureCached(a[0], a[1]);
+      break;
+    case GL_STATE_BIND_BUFFER:
+      glBindBufferCached(a[0], a[1]);
+      break;
+    case GL_STATE_USE_PROGRAM:
+      glUseProgramCached(a[0]);
+      break;
+    case GL_STATE_ENABLE:
+      glEnableCached(a[0]);
+      break;
+    case GL_STATE_DISABLE:
+      glDisableCached(a[0]);
+      break;
+    case GL_STATE_BLEND_FUNC:
+      glBlendFuncCached(a[0], a[1]);
+      break;
+    case GL_STATE_DEPTH_FUNC:
+      glDepthFuncCached(a[0]);
+      break;
+    case GL_STATE_DEPTH_MASK:
+      glDepthMaskCached(a[0]);
+      break;
+    case GL_STATE_CULL_FACE:
+      glCullFaceCached(a[0]);
+      break;
+    case GL_STATE_COLOR_MASK:
+      glColorMaskCached(a[0], a[1], a[2], a[3]);
+      break;
+    case GL_STATE_CLEAR_COLOR:
+      glClearColorCached(bits_float(a[0]), bits_float(a[1]), bits_float(a[2]), bits_float(a[3]));
+      break;
+    case GL_STATE_VIEWPORT:
+      glViewportCached(a[0], a[1], a[2], a[3]);
+      break;
+    case GL_STATE_SCISSOR:
+      glScissorCached(a[0], a[1], a[2], a[3]);
+      break;
+    case GL_STATE_UNIFORM_1I:
+      glUniform1iCached(a[0], a[2]);
+      break;
+    case GL_STATE_UNIFORM_1F:
+      glUniform1fvCached(a[0], a[1], (const GLfloat *)(a + 2));
+      break;
+    case GL_STATE_UNIFORM_2F:
+      glUniform2fvCached(a[0], a[1], (const GLfloat *)(a + 2));
+      break;
+    case GL_STATE_UNIFORM_3F:
+      glUniform3fvCached(a[0], a[1], (const GLfloat *)(a + 2));
+      break;
+    case GL_STATE_UNIFORM_4F:
+      glUniform4fvCached(a[0], a[1], (const GLfloat *)(a + 2));
+      break;
+    case GL_STATE_UNIFORM_MATRIX2:
+      glUniformMatrix2fvCached(a[0], a[1], GL_FALSE, (const GLfloat *)(a + 2));
+      break;
+    case GL_STATE_UNIFORM_MATRIX3:
+      glUniformMatrix3fvCached(a[0], a[1], GL_FALSE, (const GLfloat *)(a + 2));
+      break;
+    case GL_STATE_UNIFORM_MATRIX4:
+      glUniformMatrix4fvCached(a[0], a[1], GL_FALSE, (const GLfloat *)(a + 2));
+      break;
+    case GL_TRACE_DELETE_TEXTURES:
+      glDeleteTexturesCached(count, a);
+      break;
+    case GL_TRACE_DELETE_BUFFERS:
+      glDeleteBuffersCached(count, a);
+      break;
+    case GL_TRACE_DELETE_PROGRAM:
+      glDeleteProgramCached(a[0]);
+      break;
+    case GL_TRACE_LINK_PROGRAM:
+      glLinkProgramCached(a[0]);
+      break;
+  }
+}
+
+// Minimum argument counts, so a truncated record can't read past the trace
+static const int min_args[GL_TRACE_FRAME + 1] = {
+  [GL_STATE_ACTIVE_TEXTURE] = 1, [GL_STATE_BIND_TEXTURE] = 2, [GL_STATE_BIND_BUFFER] = 2,
+  [GL_STATE_USE_PROGRAM] = 1, [GL_STATE_ENABLE] = 1, [GL_STATE_DISABLE] = 1,
+  [GL_STATE_BLEND_FUNC] = 2, [GL_STATE_DEPTH_FUNC] = 1, [GL_STATE_DEPTH_MASK] = 1,
+  [GL_STATE_CULL_FACE] = 1, [GL_STATE_COLOR_MASK] = 4, [GL_STATE_CLEAR_COLOR] = 4,
+  [GL_STATE_VIEWPORT] = 4, [GL_STATE_SCISSOR] = 4, [GL_STATE_UNIFORM_1I] = 3,
+  [GL_STATE_UNIFORM_1F] = 2, [GL_STATE_UNIFORM_2F] = 2, [GL_STATE_UNIFORM_3F] = 2,
+  [GL_STATE_UNIFORM_4F] = 2, [GL_STATE_UNIFORM_MATRIX2] = 2, [GL_STATE_UNIFORM_MATRIX3] = 2,
+  [GL_STATE_UNIFORM_MATRIX4] = 2, [GL_TRACE_DELETE_PROGRAM] = 1, [GL_TRACE_LINK_PROGRAM] = 1,
+};
+
+// Replays the whole trace, either storing the GL state at each frame marker
+// in states or comparing against it. Returns -1 if the trace is malformed
+static int replay(const trace_file *trace, int synthetic, int filter, gl_stub_state *states, int max_states,
+                  int *mismatches, replay_result *result) {
+  gl_stubs_reset();
+  if (synthetic)
+    synthetic_programs();
+  gl_state_init(NULL, filter);
+  gl_state_stats *stats = gl_state_get_stats();
+  uniform_cache_stats *uniforms = uniform_cache_get_stats();
+
+  memset(result, 0, sizeof(replay_result));
+  int frames = 0;
+  long offset = sizeof(uint32_t);
+  while (offset + 4 <= trace->size) {
+    uint16_t header[2];
+    memcpy(header, trace->data + offset, sizeof(header));
+    offset += sizeof(header);
+
+    int call = header[0], count = header[1];
+    if (call > GL_TRACE_FRAME || count < min_args[call] || offset + count * 4 > trace->size)
+      return -1;
+
+    // Records are whole words, the arguments stay aligned
+    const uint32_t *args = (const uint32_t *)(trace->data + offset);
+    offset += count * sizeof(uint32_t);
+    if (call < GL_STATE_CALLS && uniform_words[call] && count - 2 < (uint64_t)uniform_words[call] * args[1])
+      return -1;
+
+    if (call != GL_TRACE_FRAME) {
+      replay_call(call, args, count);
+      continue;
+    }
+
+    // Stats are taken here so the periodic log never resets them under us
+    for (int i = 0; i < GL_STATE_CALLS; i++) {
+      result->hits[i] += stats->hits[i];
+      result->misses[i] += stats->misses[i];
+      stats->hits[i] = stats->misses[i] = 0;
+    }
+    gl_state_frame();
+    result->uniform_bytes += uniforms->frame_skipped_bytes;
+    if (uniforms->frame_skipped > result->max_frame_uniforms)
+      result->max_frame_uniforms = uniforms->frame_skipped;
+
+    if (frames < max_states) {
+      gl_stub_state state;
+      gl_stubs_state(&state);
+      if (!mismatches)
+        states[frames] = state;
+      else if (memcmp(&states[frames], &state, sizeof(state)) != 0)
+        (*mismatches)++;
+    }
+    frames++;
+  }
+
+  // The loader's hooks skip binding what they think is bound, and the next run
+  // starts from freshly reset stubs
+  glUseProgramHook(0);
+
+  result->frames = frames;
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  const char *path = argc > 1 ? argv[1] : SYNTHETIC_TRACE;
+  if (argc <= 1)
+    record_synthetic(path);
+
+  trace_file trace;
+  if (read_trace(path, &trace) < 0) {
+    printf("{\"error\":\"could not read trace %s\",\"ok\":false}\n", path);
+    return 1;
+  }
+
+  // One state per frame marker, counted up front
+  int max_states = 0;
+  for (long offset = sizeof(uint32_t); offset + 4 <= trace.size;) {
+    uint16_t header[2];
+    memcpy(header, trace.data + offset, sizeof(header));
+    offset += sizeof(header) + header[1] * sizeof(uint32_t);
+    max_states += header[0] == GL_TRACE_FRAME;
+  }
+  gl_stub_state *states = calloc(max_states + 1, sizeof(gl_stub_state));
+
+  int synthetic = argc <= 1;
+  replay_result passed, filtered;
+  int mismatches = 0;
+
+  SceUInt64 start = sceKernelGetProcessTimeWide();
+  int ok = replay(&trace, synthetic, 0, states, max_states, NULL, &passed) == 0;
+  SceUInt64 unfiltered_time = sceKernelGetProcessTimeWide() - start;
+
+  start = sceKernelGetProcessTimeWide();
+  ok &= replay(&trace, synthetic, 1, states, max_states, &mismatches, &filtered) == 0;
+  SceUInt64 filtered_time = sceKernelGetProcessTimeWide() - start;
+
+  uint64_t calls = 0, dropped = 0, uniform_calls = 0, uniform_dropped = 0;
+  printf("{\"frames\":%d,\"by_call\":{", filtered.frames);
+  int first = 1;
+  for (int i = 0; i < GL_STATE_CALLS; i++) {
+    uint64_t total = filtered.hits[i] + filtered.misses[i];
+    if (!total)
+      continue;
+    printf("%s\"%s\":{\"calls\":%llu,\"dropped\":%llu}", first ? "" : ",", gl_state_call_name(i),
+           (unsigned long long)total, (unsigned long long)filtered.hits[i]);
+    calls += total;
+    dropped += filtered.hits[i];
+    if (i >= GL_STATE_UNIFORM_1I) {
+      uniform_calls += total;
+      uniform_dropped += filtered.hits[i];
+    }
+    first = 0;
+  }
+
+  ok &= passed.frames > 0 && filtered.frames == passed.frames && mismatches == 0;
+  if (synthetic)
+    ok &= dropped > 0 && uniform_dropped > 0 && uniform_dropped < uniform_calls;
+
+  printf("},\"calls\":%llu,\"dropped\":%llu,\"dropped_pct\":%.1f,\"mismatches\":%d,"
+         "\"uniform_calls\":%llu,\"uniform_dropped\":%llu,\"uniform_bytes_per_frame\":%llu,"
+         "\"max_uniforms_per_frame\":%llu,\"unfiltered_us\":%llu,\"filtered_us\":%llu,\"ok\":%s}\n",
+         (unsigned long long)calls, (unsigned long long)dropped, calls ? dropped * 100.0 / calls : 0.0,
+         mismatches, (unsigned long long)uniform_calls, (unsigned long long)uniform_dropped,
+         (unsigned long long)(filtered.frames ? filtered.uniform_bytes / filtered.frames : 0),
+         (unsigned long long)filtered.max_frame_uniforms, (unsigned long long)unfiltered_time,
+         (unsigned long long)filtered_time, ok ? "true" : "false");
+
+  free(states);
+  free(trace.data);
+  if (synthetic)
+    unlink(path);
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,587 @@
+/* gl_stubs.c -- host stand-in for the vitaGL and vitaShaRK shader compilers
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * Records every call and "compiles" a shader by wrapping its source in a
+ * small blob, so the binary cache can be exercised without a GPU. Programs
+ * keep their attached shaders and uniform values for inspection. Texture and
+ * framebuffer calls only count what they would move. Fixed function state is
+ * kept so two runs of the same calls can be compared.
+ */
+
+#include <vitaGL.h>
+#include <vitashark.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gl_stubs.h"
+
+#define MAX_SHADERS 1024
+#define MAX_PROGRAMS 64
+#define MAX_TEXTURES 64
+#define MAX_LEVELS 16
+#define MAX_UNIFORMS 32
+#define FIRST_CREATED_SHADER 512
+#define BLOB_MAGIC "GXP\0"
+
+typedef struct {
+  char *source;
+  char *blob;
+  GLsizei blob_size;
+  GLint compiled;
+} stub_shader;
+
+typedef struct {
+  int used;
+  GLuint shaders[2];
+  int num_shaders;
+  GLint linked;
+  int num_uniforms;
+  char uniform_names[MAX_UNIFORMS][64];
+  GLfloat uniform_values[MAX_UNIFORMS][16];
+} stub_program;
+
+typedef struct {
+  GLint min_filter;
+  GLsizei width;
+  void *levels[MAX_LEVELS];
+} stub_texture;
+
+gl_stub_calls gl_calls;
+
+static stub_shader shaders[MAX_SHADERS];
+static GLenum error = GL_NO_ERROR;
+
+// Shaders created by the loader itself stay clear of the ids tests pick
+static GLuint next_shader = FIRST_CREATED_SHADER;
+
+static stub_program programs[MAX_PROGRAMS];
+static GLuint bound_program = 0;
+static stub_texture textures[MAX_TEXTURES];
+static GLuint bound_texture = 0;
+static GLuint unit_textures[GL_STUB_UNITS];
+static int active_unit = 0;
+static gl_stub_state render;
+
+static const GLenum caps[] = {
+  GL_BLEND, GL_CULL_FACE, GL_DEPTH_TEST, GL_DITHER, GL_POLYGON_OFFSET_FILL, GL_SCISSOR_TEST, GL_STENCIL_TEST,
+};
+
+// Textures the loader creates count down from the top, tests pick low ids
+static GLuint next_texture = MAX_TEXTURES - 1;
+
+static uint8_t *shark_output = NULL;
+
+void gl_stubs_reset(void) {
+  for (int i = 0; i < MAX_SHADERS; i++) {
+    free(shaders[i].source);
+    free(shaders[i].blob);
+  }
+  memset(shaders, 0, sizeof(shaders));
+  memset(programs, 0, sizeof(programs));
+  for (int i = 0; i < MAX_TEXTURES; i++) {
+    for (int j = 0; j < MAX_LEVELS; j++)
+      free(textures[i].levels[j]);
+  }
+  memset(textures, 0, sizeof(textures));
+  memset(&gl_calls, 0, sizeof(gl_calls));
+  error = GL_NO_ERROR;
+  next_shader = FIRST_CREATED_SHADER;
+  bound_program = 0;
+  bound_texture = 0;
+  memset(unit_textures, 0, sizeof(unit_textures));
+  active_unit = 0;
+  memset(&render, 0, sizeof(render));
+  render.depth_mask = GL_TRUE;
+  render.depth_func = GL_LESS;
+  render.cull_face = GL_BACK;
+  render.blend[0] = GL_ONE;
+  render.blend[1] = GL_ZERO;
+  memset(render.color_mask, GL_TRUE, sizeof(render.color_mask));
+  render.caps = 1 << 3; // GL_DITHER
+  next_texture = MAX_TEXTURES - 1;
+}
+
+void gl_stubs_state(gl_stub_state *state) {
+  memcpy(state, &render, sizeof(render));
+  memcpy(state->textures, unit_textures, sizeof(unit_textures));
+  state->textures[active_unit] = bound_texture;
+  state->active_unit = active_unit;
+  state->program = bound_program;
+
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < MAX_PROGRAMS; i++) {
+    const uint8_t *values = (const uint8_t *)programs[i].uniform_values;
+    for (int j = 0; j < sizeof(programs[i].uniform_values); j++)
+      hash = (hash ^ values[j]) * 16777619u;
+  }
+  state->uniforms = hash;
+}
+
+GLuint gl_stubs_bound_program(void) {
+  return bound_program;
+}
+
+GLuint gl_stubs_program_shader(GLuint program, int i) {
+  return program < MAX_PROGRAMS && i < programs[program].num_shaders ? programs[program].shaders[i] : 0;
+}
+
+const GLfloat *gl_stubs_uniform(GLuint program, const char *name) {
+  if (program >= MAX_PROGRAMS)
+    return NULL;
+  for (int i = 0; i < programs[program].num_uniforms; i++) {
+    if (strcmp(programs[program].uniform_names[i], name) == 0)
+      return programs[program].uniform_values[i];
+  }
+  return NULL;
+}
+
+const char *gl_stubs_source(GLuint shader) {
+  return shader < MAX_SHADERS ? shaders[shader].source : NULL;
+}
+
+static stub_shader *get_shader(GLuint shader) {
+  if (shader >= MAX_SHADERS) {
+    error = GL_INVALID_VALUE;
+    return NULL;
+  }
+  return &shaders[shader];
+}
+
+void glShaderSource(GLuint shader, GLsizei count, const GLchar *const *string, const GLint *length) {
+  stub_shader *s = get_shader(shader);
+  gl_calls.shader_sources++;
+  if (!s)
+    return;
+
+  free(s->source);
+  s->source = strdup(string[0]);
+  s->compiled = GL_FALSE;
+}
+
+static char *compile(const char *source, GLsizei *size) {
+  size_t len = strlen(source);
+  char *blob = malloc(4 + len);
+  memcpy(blob, BLOB_MAGIC, 4);
+  memcpy(blob + 4, source, len);
+  *size = 4 + len;
+  return blob;
+}
+
+void glCompileShader(GLuint shader) {
+  stub_shader *s = get_shader(shader);
+  gl_calls.compiles++;
+  if (!s || !s->source) {
+    error = GL_INVALID_OPERATION;
+    return;
+  }
+
+  free(s->blob);
+  s->blob = compile(s->source, &s->blob_size);
+  s->compiled = GL_TRUE;
+}
+
+void glShaderBinary(GLsizei count, const GLuint *handles, GLenum binaryFormat, const void *binary, GLsizei length) {
+  stub_shader *s = get_shader(handles[0]);
+  gl_calls.binaries++;
+  if (!s)
+    return;
+
+  if (length < 4 || memcmp(binary, BLOB_MAGIC, 4) != 0) {
+    error = GL_INVALID_VALUE;
+    return;
+  }
+
+  free(s->blob);
+  s->blob = malloc(length);
+  memcpy(s->blob, binary, length);
+  s->blob_size = length;
+  s->compiled = GL_TRUE;
+
+  // The stand-in binary is the source, keep it visible like a compiled one
+  free(s->source);
+  s->source = strndup((const char *)binary + 4, length - 4);
+}
+
+void glGetShaderiv(GLuint shader, GLenum pname, GLint *params) {
+  stub_shader *s = get_shader(shader);
+  if (s && pname == GL_COMPILE_STATUS)
+    *params = s->compiled;
+}
+
+GLenum glGetError(void) {
+  GLenum ret = error;
+  error = GL_NO_ERROR;
+  return ret;
+}
+
+void vglGetShaderBinary(GLuint shader, GLsizei bufSize, GLsizei *length, void *binary) {
+  stub_shader *s = get_shader(shader);
+  gl_calls.binary_reads++;
+  if (!s || !s->blob) {
+    *length = 0;
+    return;
+  }
+
+  *length = s->blob_size < bufSize ? s->blob_size : bufSize;
+  memcpy(binary, s->blob, *length);
+}
+
+GLuint glCreateShader(GLenum shaderType) {
+  return next_shader < MAX_SHADERS ? next_shader++ : 0;
+}
+
+void glDeleteShader(GLuint shader) {
+  stub_shader *s = get_shader(shader);
+  if (!s)
+    return;
+  free(s->source);
+  free(s->blob);
+  memset(s, 0, sizeof(stub_shader));
+}
+
+GLuint glCreateProgram(void) {
+  for (GLuint i = 1; i < MAX_PROGRAMS; i++) {
+    if (!programs[i].used) {
+      programs[i].used = 1;
+      return i;
+    }
+  }
+  return 0;
+}
+
+void glDeleteProgram(GLuint program) {
+  if (program < MAX_PROGRAMS)
+    memset(&programs[program], 0, sizeof(stub_program));
+}
+
+void glAttachShader(GLuint program, GLuint shader) {
+  if (program < MAX_PROGRAMS && programs[program].num_shaders < 2)
+    programs[program].shaders[programs[program].num_shaders++] = shader;
+}
+
+void glBindAttribLocation(GLuint program, GLuint index, const GLchar *name) {
+}
+
+void glLinkProgram(GLuint program) {
+  gl_calls.links++;
+  if (program < MAX_PROGRAMS) {
+    programs[program].linked = programs[program].num_shaders == 2;
+    memset(programs[program].uniform_values, 0, sizeof(programs[program].uniform_values));
+  }
+}
+
+void glGetProgramiv(GLuint program, GLenum pname, GLint *params) {
+  if (program < MAX_PROGRAMS && pname == GL_LINK_STATUS)
+    *params = programs[program].linked;
+}
+
+void glUseProgram(GLuint program) {
+  gl_calls.use_programs++;
+  bound_program = program;
+}
+
+GLint glGetUniformLocation(GLuint program, const GLchar *name) {
+  if (program >= MAX_PROGRAMS)
+    return -1;
+
+  stub_program *p = &programs[program];
+  for (int i = 0; i < p->num_uniforms; i++) {
+    if (strcmp(p->uniform_names[i], name) == 0)
+      return i;
+  }
+  if (p->num_uniforms == MAX_UNIFORMS)
+    return -1;
+
+  snprintf(p->uniform_names[p->num_uniforms], sizeof(p->uniform_names[0]), "%s", name);
+  return p->num_uniforms++;
+}
+
+static void set_uniform(GLint location, const void *value, size_t size) {
+  gl_calls.uniforms++;
+  if (bound_program >= MAX_PROGRAMS || location < 0 || location >= programs[bound_program].num_uniforms)
+    return;
+  memcpy(programs[bound_program].uniform_values[location], value, size < 16 * sizeof(GLfloat) ? size : 16 * sizeof(GLfloat));
+}
+
+void glUniform1i(GLint location, GLint v0) {
+  set_uniform(location, &v0, sizeof(GLint));
+}
+
+void glUniform1fv(GLint location, GLsizei count, const GLfloat *value) {
+  set_uniform(location, value, count * sizeof(GLfloat));
+}
+
+void glUniform2fv(GLint location, GLsizei count, const GLfloat *value) {
+  set_uniform(location, value, count * 2 * sizeof(GLfloat));
+}
+
+void glUniform3fv(GLint location, GLsizei count, const GLfloat *value) {
+  set_uniform(location, value, count * 3 * sizeof(GLfloat));
+}
+
+void glUniform4fv(GLint location, GLsizei count, const GLfloat *value) {
+  set_uniform(location, value, count * 4 * sizeof(GLfloat));
+}
+
+void glUniformMatrix2fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value) {
+  set_uniform(location, value, count * 4 * sizeof(GLfloat));
+}
+
+void glUniformMatrix3fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value) {
+  set_uniform(location, value, count * 9 * sizeof(GLfloat));
+}
+
+void glUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value) {
+  set_uniform(location, value, count * 16 * sizeof(GLfloat));
+}
+
+void glDrawArrays(GLenum mode, GLint first, GLsizei count) {
+  gl_calls.draws++;
+}
+
+void glDrawElements(GLenum mode, GLsizei count, GLenum type, const void *indices) {
+  gl_calls.draws++;
+}
+
+void glGetIntegerv(GLenum pname, GLint *data) {
+  if (pname == GL_TEXTURE_BINDING_2D)
+    *data = bound_texture;
+}
+
+void glActiveTexture(GLenum texture) {
+  int unit = texture - GL_TEXTURE0;
+  if (unit < 0 || unit >= GL_STUB_UNITS)
+    return;
+  unit_textures[active_unit] = bound_texture;
+  active_unit = unit;
+  bound_texture = unit_textures[unit];
+}
+
+void glGenTextures(GLsizei n, GLuint *ids) {
+  for (int i = 0; i < n; i++)
+    ids[i] = next_texture--;
+}
+
+void glBindTexture(GLenum target, GLuint texture) {
+  bound_texture = texture;
+}
+
+GLint gl_stubs_min_filter(GLuint texture) {
+  return texture < MAX_TEXTURES ? textures[texture].min_filter : 0;
+}
+
+const void *gl_stubs_texture_level(GLuint texture, GLint level) {
+  return texture < MAX_TEXTURES && level < MAX_LEVELS ? textures[texture].levels[level] : NULL;
+}
+
+static int texel_size(GLenum format, GLenum type) {
+  if (type != GL_UNSIGNED_BYTE)
+    return 2;
+  return format == GL_RGBA ? 4 : format == GL_RGB ? 3 : format == GL_LUMINANCE_ALPHA ? 2 : 1;
+}
+
+static void store_level(GLint level, const void *data, size_t size) {
+  if (bound_texture >= MAX_TEXTURES || level >= MAX_LEVELS)
+    return;
+  stub_texture *t = &textures[bound_texture];
+  free(t->levels[level]);
+  t->levels[level] = NULL;
+  if (data) {
+    t->levels[level] = malloc(size);
+    memcpy(t->levels[level], data, size);
+  }
+}
+
+void *vglGetTexDataPointer(GLenum target) {
+  return bound_texture < MAX_TEXTURES ? textures[bound_texture].levels[0] : NULL;
+}
+
+void glDeleteTextures(GLsizei n, const GLuint *ids) {
+  for (int i = 0; i < n; i++) {
+    if (ids[i] >= MAX_TEXTURES)
+      continue;
+    for (int j = 0; j < MAX_LEVELS; j++)
+      free(textures[ids[i]].levels[j]);
+    memset(&textures[ids[i]], 0, sizeof(stub_texture));
+    for (int j = 0; j < GL_STUB_UNITS; j++) {
+      if (unit_textures[j] == ids[i])
+        unit_textures[j] = 0;
+    }
+    if (bound_texture == ids[i])
+      bound_texture = 0;
+  }
+}
+
+void glTexImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void *data) {
+  if (level == 0)
+    gl_calls.tex_images++;
+  else
+    gl_calls.mip_images++;
+
+  size_t size = width * height * texel_size(format, type);
+  if (data)
+    gl_calls.upload_bytes += size;
+  store_level(level, data, size);
+  if (level == 0 && bound_texture < MAX_TEXTURES)
+    textures[bound_texture].width = width;
+}
+
+void glCompressedTexImage2D(GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const void *data) {
+  if (level == 0)
+    gl_calls.tex_images++;
+  else
+    gl_calls.mip_images++;
+  gl_calls.upload_bytes += imageSize;
+  store_level(level, data, imageSize);
+}
+
+void glTexParameteri(GLenum target, GLenum pname, GLint param) {
+  if (pname == GL_TEXTURE_MIN_FILTER && bound_texture < MAX_TEXTURES) {
+    gl_calls.min_filters++;
+    textures[bound_texture].min_filter = param;
+  }
+}
+
+void glGenerateMipmap(GLenum target) {
+}
+
+void glTexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const void *data) {
+  gl_calls.tex_sub_images++;
+  gl_calls.upload_bytes += width * height * 4;
+
+  // Patched into stored levels so tests can see where the update landed
+  uint8_t *dst = bound_texture < MAX_TEXTURES && level < MAX_LEVELS ? textures[bound_texture].levels[level] : NULL;
+  GLsizei stride = bound_texture < MAX_TEXTURES ? textures[bound_texture].width : 0;
+  int size = texel_size(format, type);
+  if (dst && data && stride) {
+    for (int y = 0; y < height; y++)
+      memcpy(dst + ((yoffset + y) * stride + xoffset) * size, (const uint8_t *)data + y * width * size, width * size);
+  }
+}
+
+void glReadPixels(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, void *data) {
+  gl_calls.read_pixels++;
+  gl_calls.read_bytes += width * height * 4;
+  memset(data, 0, width * height * 4);
+}
+
+void glBindFramebuffer(GLenum target, GLuint framebuffer) {
+}
+
+void glDeleteFramebuffers(GLsizei n, const GLuint *framebuffers) {
+}
+
+void glFramebufferTexture2D(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level) {
+}
+
+void glFramebufferRenderbuffer(GLenum target, GLenum attachment, GLenum renderbuffertarget, GLuint renderbuffer) {
+}
+
+GLenum glCheckFramebufferStatus(GLenum target) {
+  return GL_FRAMEBUFFER_COMPLETE;
+}
+
+static void set_rect(GLint *rect, GLint x, GLint y, GLsizei width, GLsizei height) {
+  rect[0] = x;
+  rect[1] = y;
+  rect[2] = width;
+  rect[3] = height;
+}
+
+void glViewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+  set_rect(render.viewport, x, y, width, height);
+}
+
+void glScissor(GLint x, GLint y, GLsizei width, GLsizei height) {
+  set_rect(render.scissor, x, y, width, height);
+}
+
+static uint32_t cap_bit(GLenum cap) {
+  for (int i = 0; i < sizeof(caps) / sizeof(GLenum); i++) {
+    if (caps[i] == cap)
+      return 1 << i;
+  }
+  return 0;
+}
+
+void glEnable(GLenum cap) {
+  render.caps |= cap_bit(cap);
+}
+
+void glDisable(GLenum cap) {
+  render.caps &= ~cap_bit(cap);
+}
+
+void glBlendFunc(GLenum sfactor, GLenum dfactor) {
+  render.blend[0] = sfactor;
+  render.blend[1] = dfactor;
+}
+
+void glDepthFunc(GLenum func) {
+  render.depth_func = func;
+}
+
+void glDepthMask(GLboolean flag) {
+  render.depth_mask = flag;
+}
+
+void glCullFace(GLenum mode) {
+  render.cull_face = mode;
+}
+
+void glColorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha) {
+  render.color_mask[0] = red;
+  render.color_mask[1] = green;
+  render.color_mask[2] = blue;
+  render.color_mask[3] = alpha;
+}
+
+void glClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha) {
+  render.clear_color[0] = red;
+  render.clear_color[1] = green;
+  render.clear_color[2] = blue;
+  render.clear_color[3] = alpha;
+}
+
+void glBindBuffer(GLenum target, GLuint buffer) {
+  if (target == GL_ARRAY_BUFFER)
+    render.array_buffer = buffer;
+  else if (target == GL_ELEMENT_ARRAY_BUFFER)
+    render.element_buffer = buffer;
+}
+
+void glDeleteBuffers(GLsizei n, const GLuint *buffers) {
+  for (int i = 0; i < n; i++) {
+    if (render.array_buffer == buffers[i])
+      render.array_buffer = 0;
+    if (render.element_buffer == buffers[i])
+      render.element_buffer = 0;
+  }
+}
+
+void glClear(GLbitfield mask) {
+}
+
+uint8_t *shark_compile_shader_extended(const char *src, uint32_t *size, shark_type type, shark_opt opt,
+                                       int32_t use_fastmath, int32_t use_fastprecision, int32_t use_fastint) {
+  GLsizei blob_size;
+  shark_clear_output();
+  shark_output = (uint8_t *)compile(src, &blob_size);
+  *size = blob_size;
+  if (type == SHARK_VERTEX_SHADER)
+    gl_calls.shark_vertex++;
+  else
+    gl_calls.shark_fragment++;
+  return shark_output;
+}
+
+void shark_clear_output(void) {
+  free(shark_output);
+  shark_output = NULL;
+}
@@ -0,0 +1,58 @@
+#ifndef __GL_STUBS_H__
+#define __GL_STUBS_H__
+
+#include <vitaGL.h>
+
+typedef struct {
+  int shader_sources;
+  int compiles;
+  int binaries;
+  int binary_reads;
+  int shark_vertex;
+  int shark_fragment;
+  int links;
+  int use_programs;
+  int uniforms;
+  int draws;
+  int read_pixels;
+  int tex_images;
+  int tex_sub_images;
+  int mip_images;
+  int min_filters;
+  uint64_t read_bytes;
+  uint64_t upload_bytes;
+} gl_stub_calls;
+
+extern gl_stub_calls gl_calls;
+
+#define GL_STUB_UNITS 8
+
+// Render state as GL would hold it, zeroed before filling so it compares with memcmp
+typedef struct {
+  int active_unit;
+  GLuint textures[GL_STUB_UNITS];
+  GLuint program;
+  GLuint array_buffer;
+  GLuint element_buffer;
+  uint32_t caps;     // bit per cap, in gl_stubs.c order
+  GLenum blend[2];
+  GLenum depth_func;
+  GLboolean depth_mask;
+  GLenum cull_face;
+  GLboolean color_mask[4];
+  GLfloat clear_color[4];
+  GLint viewport[4];
+  GLint scissor[4];
+  uint32_t uniforms; // hash of every program's uniform values
+} gl_stub_state;
+
+void gl_stubs_reset(void);
+const char *gl_stubs_source(GLuint shader);
+GLuint gl_stubs_bound_program(void);
+GLuint gl_stubs_program_shader(GLuint program, int i);
+const GLfloat *gl_stubs_uniform(GLuint program, const char *name);
+GLint gl_stubs_min_filter(GLuint texture);
+const void *gl_stubs_texture_level(GLuint texture, GLint level);
+void gl_stubs_state(gl_stub_state *state);
+
+#endif
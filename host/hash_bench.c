@@ -0,0 +1,246 @@
+/* hash_bench.c -- shader fingerprinting benchmark
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * Hashes the shipped Cg sources with the original byte-wise SHA1, the
+ * unrolled one from loader/sha1.c and the 64-bit fingerprint, then times
+ * shader_index_lookup() cold and from its memo. The digests of both SHA1
+ * implementations are compared on every source and on random buffers.
+ * Prints one JSON object:
+ *   ./hash_bench [cg_dir]
+ */
+
+#include <vitasdk.h>
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dialog.h"
+#include "murmur.h"
+#include "sha1.h"
+#include "shader_index.h"
+
+#define ITERATIONS 1000
+#define MAX_SHADERS 64
+
+#define ROTLEFT(a, b) ((a << b) | (a >> (32 - b)))
+
+// The SHA1 this loader shipped with, kept as the reference
+static void ref_transform(SHA1_CTX *ctx, const BYTE data[]) {
+  WORD a, b, c, d, e, i, j, t, m[80];
+
+  for (i = 0, j = 0; i < 16; ++i, j += 4)
+    m[i] = (data[j] << 24) + (data[j + 1] << 16) + (data[j + 2] << 8) + (data[j + 3]);
+  for (; i < 80; ++i) {
+    m[i] = (m[i - 3] ^ m[i - 8] ^ m[i - 14] ^ m[i - 16]);
+    m[i] = (m[i] << 1) | (m[i] >> 31);
+  }
+
+  a = ctx->state[0];
+  b = ctx->state[1];
+  c = ctx->state[2];
+  d = ctx->state[3];
+  e = ctx->state[4];
+
+  for (i = 0; i < 80; ++i) {
+    WORD f, k;
+    if (i < 20) {
+      f = (b & c) ^ (~b & d);
+      k = 0x5a827999;
+    } else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ed9eba1;
+    } else if (i < 60) {
+      f = (b & c) ^ (b & d) ^ (c & d);
+      k = 0x8f1bbcdc;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xca62c1d6;
+    }
+    t = ROTLEFT(a, 5) + f + e + k + m[i];
+    e = d;
+    d = c;
+    c = ROTLEFT(b, 30);
+    b = a;
+    a = t;
+  }
+
+  ctx->state[0] += a;
+  ctx->state[1] += b;
+  ctx->state[2] += c;
+  ctx->state[3] += d;
+  ctx->state[4] += e;
+}
+
+static void ref_sha1(const BYTE *data, size_t len, BYTE hash[20]) {
+  SHA1_CTX ctx;
+  sha1_init(&ctx);
+
+  for (size_t i = 0; i < len; ++i) {
+    ctx.data[ctx.datalen++] = data[i];
+    if (ctx.datalen == 64) {
+      ref_transform(&ctx, ctx.data);
+      ctx.bitlen += 512;
+      ctx.datalen = 0;
+    }
+  }
+
+  WORD i = ctx.datalen;
+  ctx.data[i++] = 0x80;
+  if (ctx.datalen >= 56) {
+    while (i < 64)
+      ctx.data[i++] = 0x00;
+    ref_transform(&ctx, ctx.data);
+    i = 0;
+  }
+  while (i < 56)
+    ctx.data[i++] = 0x00;
+
+  ctx.bitlen += ctx.datalen * 8;
+  for (i = 0; i < 8; i++)
+    ctx.data[63 - i] = ctx.bitlen >> (i * 8);
+  ref_transform(&ctx, ctx.data);
+
+  for (i = 0; i < 20; i++)
+    hash[i] = ctx.state[i / 4] >> (24 - (i % 4) * 8);
+}
+
+static void new_sha1(const BYTE *data, size_t len, BYTE hash[20]) {
+  SHA1_CTX ctx;
+  sha1_init(&ctx);
+  sha1_update(&ctx, data, len);
+  sha1_final(&ctx, hash);
+}
+
+static int load_sources(const char *cg_dir, char **sources, size_t *sizes) {
+  int count = 0;
+  DIR *dir = opendir(cg_dir);
+  struct dirent *entry;
+
+  while (dir && (entry = readdir(dir)) && count < MAX_SHADERS) {
+    if (entry->d_name[0] == '.')
+      continue;
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", cg_dir, entry->d_name);
+    FILE *file = fopen(path, "rb");
+    if (!file)
+      continue;
+    fseek(file, 0, SEEK_END);
+    sizes[count] = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    sources[count] = malloc(sizes[count] + 1);
+    sizes[count] = fread(sources[count], 1, sizes[count], file);
+    sources[count][sizes[count]] = '\0';
+    fclose(file);
+    count++;
+  }
+
+  if (dir)
+    closedir(dir);
+  return count;
+}
+
+// Random buffers of every length around the block and padding boundaries
+static int check_random(void) {
+  uint8_t buf[300];
+  srand(1);
+  for (int len = 0; len <= sizeof(buf); len++) {
+    for (int i = 0; i < len; i++)
+      buf[i] = rand();
+    uint8_t a[20], b[20];
+    ref_sha1(buf, len, a);
+    new_sha1(buf, len, b);
+    if (memcmp(a, b, 20) != 0)
+      return 0;
+
+    // Split updates have to land on the same digest
+    SHA1_CTX ctx;
+    sha1_init(&ctx);
+    sha1_update(&ctx, buf, len / 3);
+    sha1_update(&ctx, buf + len / 3, len - len / 3);
+    sha1_final(&ctx, b);
+    if (memcmp(a, b, 20) != 0)
+      return 0;
+  }
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
+  const char *cg_dir = argc > 1 ? argv[1] : CG_DIR;
+  char *sources[MAX_SHADERS];
+  size_t sizes[MAX_SHADERS];
+  size_t total = 0;
+
+  int count = load_sources(cg_dir, sources, sizes);
+  if (count == 0)
+    fatal_error("Error no shaders in %s.", cg_dir);
+
+  int match = check_random();
+  for (int i = 0; i < count; i++) {
+    uint8_t a[20], b[20];
+    ref_sha1((uint8_t *)sources[i], sizes[i], a);
+    new_sha1((uint8_t *)sources[i], sizes[i], b);
+    match = match && memcmp(a, b, 20) == 0;
+    total += sizes[i];
+  }
+
+  volatile uint32_t sink = 0;
+  SceUInt64 start, t_ref, t_sha1, t_fp, t_cold, t_memo;
+
+  start = sceKernelGetProcessTimeWide();
+  for (int it = 0; it < ITERATIONS; it++) {
+    for (int i = 0; i < count; i++) {
+      uint8_t hash[20];
+      ref_sha1((uint8_t *)sources[i], sizes[i], hash);
+      sink += hash[0];
+    }
+  }
+  t_ref = sceKernelGetProcessTimeWide() - start;
+
+  start = sceKernelGetProcessTimeWide();
+  for (int it = 0; it < ITERATIONS; it++) {
+    for (int i = 0; i < count; i++) {
+      uint8_t hash[20];
+      new_sha1((uint8_t *)sources[i], sizes[i], hash);
+      sink += hash[0];
+    }
+  }
+  t_sha1 = sceKernelGetProcessTimeWide() - start;
+
+  start = sceKernelGetProcessTimeWide();
+  for (int it = 0; it < ITERATIONS; it++) {
+    for (int i = 0; i < count; i++)
+      sink += murmur64(sources[i], strlen(sources[i]));
+  }
+  t_fp = sceKernelGetProcessTimeWide() - start;
+
+  // What glShaderSourceHook pays per call, the first time and for repeats
+  shader_index_load(cg_dir);
+  start = sceKernelGetProcessTimeWide();
+  for (int i = 0; i < count; i++)
+    sink += shader_index_lookup(sources[i], strlen(sources[i])) != NULL;
+  t_cold = sceKernelGetProcessTimeWide() - start;
+
+  start = sceKernelGetProcessTimeWide();
+  for (int it = 0; it < ITERATIONS; it++) {
+    for (int i = 0; i < count; i++)
+      sink += shader_index_lookup(sources[i], strlen(sources[i])) != NULL;
+  }
+  t_memo = sceKernelGetProcessTimeWide() - start;
+  shader_index_free();
+
+  printf("{\"shaders\":%d,\"shader_bytes\":%zu,\"digests_match\":%s,", count, total, match ? "true" : "false");
+  printf("\"sha1_ref_us\":%.3f,\"sha1_us\":%.3f,\"fingerprint_us\":%.3f,",
+         (double)t_ref / ITERATIONS, (double)t_sha1 / ITERATIONS, (double)t_fp / ITERATIONS);
+  printf("\"lookup_cold_us\":%llu,\"lookup_memo_us\":%.3f}\n", (unsigned long long)t_cold, (double)t_memo / ITERATIONS);
+
+  for (int i = 0; i < count; i++)
+    free(sources[i]);
+
+  return match ? 0 : 1;
+}
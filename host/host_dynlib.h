@@ -0,0 +1,13 @@
+#ifndef __HOST_DYNLIB_H__
+#define __HOST_DYNLIB_H__
+
+#include "so_util.h"
+
+// Generated at configure time from loader/main.c and loader/jni_patch.c
+extern so_default_dynlib default_dynlib[];
+extern const int size_default_dynlib;
+
+extern const char *loader_symbols[];
+extern const int num_loader_symbols;
+
+#endif
@@ -0,0 +1,194 @@
+/* import_bench.c -- host benchmark for import resolution against default_dynlib
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * Build and run on the host:
+ *   cc -O2 -Iloader host/import_bench.c loader/so_hash.c -o import_bench
+ *   ./import_bench libgl2jni.so loader/main.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "elf.h"
+#include "so_hash.h"
+
+#define ITERATIONS 100
+
+typedef struct {
+  char *symbol;
+  uintptr_t func;
+} dynlib_entry;
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+static void *read_file(const char *path, size_t *size) {
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return NULL;
+  fseek(file, 0, SEEK_END);
+  *size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  char *data = malloc(*size + 1);
+  if (fread(data, 1, *size, file) != *size) {
+    free(data);
+    fclose(file);
+    return NULL;
+  }
+  data[*size] = '\0';
+  fclose(file);
+  return data;
+}
+
+// Collect the names of the default_dynlib table straight out of main.c
+static int load_table(const char *path, dynlib_entry **table) {
+  size_t size;
+  char *src = read_file(path, &size);
+  if (!src)
+    return -1;
+
+  int count = 0, cap = 512;
+  *table = malloc(cap * sizeof(dynlib_entry));
+
+  char *line = strstr(src, "default_dynlib[] = {");
+  while (line && (line = strchr(line, '\n'))) {
+    line++;
+    if (strncmp(line, "};", 2) == 0)
+      break;
+    if (strncmp(line, "  { \"", 5) != 0)
+      continue;
+    char *name = line + 5;
+    char *end = strchr(name, '"');
+    if (!end)
+      break;
+    if (count == cap) {
+      cap *= 2;
+      *table = realloc(*table, cap * sizeof(dynlib_entry));
+    }
+    (*table)[count].symbol = strndup(name, end - name);
+    (*table)[count].func = count + 1;
+    count++;
+  }
+
+  free(src);
+  return count;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s libgl2jni.so main.c\n", argv[0]);
+    return 1;
+  }
+
+  size_t so_size;
+  uint8_t *so_data = read_file(argv[1], &so_size);
+  if (!so_data || memcmp(so_data, ELFMAG, SELFMAG) != 0) {
+    fprintf(stderr, "could not read %s\n", argv[1]);
+    return 1;
+  }
+
+  dynlib_entry *table;
+  int table_count = load_table(argv[2], &table);
+  if (table_count <= 0) {
+    fprintf(stderr, "could not parse default_dynlib from %s\n", argv[2]);
+    return 1;
+  }
+
+  Elf32_Ehdr *ehdr = (Elf32_Ehdr *)so_data;
+  Elf32_Shdr *shdr = (Elf32_Shdr *)(so_data + ehdr->e_shoff);
+  char *shstr = (char *)so_data + shdr[ehdr->e_shstrndx].sh_offset;
+
+  Elf32_Sym *dynsym = NULL;
+  char *dynstr = NULL;
+  Elf32_Rel *rels[2] = { NULL, NULL };
+  int num_rels[2] = { 0, 0 };
+
+  for (int i = 0; i < ehdr->e_shnum; i++) {
+    char *sh_name = shstr + shdr[i].sh_name;
+    void *sh_data = so_data + shdr[i].sh_offset;
+    if (strcmp(sh_name, ".dynsym") == 0) {
+      dynsym = sh_data;
+    } else if (strcmp(sh_name, ".dynstr") == 0) {
+      dynstr = sh_data;
+    } else if (strcmp(sh_name, ".rel.dyn") == 0) {
+      rels[0] = sh_data;
+      num_rels[0] = shdr[i].sh_size / sizeof(Elf32_Rel);
+    } else if (strcmp(sh_name, ".rel.plt") == 0) {
+      rels[1] = sh_data;
+      num_rels[1] = shdr[i].sh_size / sizeof(Elf32_Rel);
+    }
+  }
+
+  if (!dynsym || !dynstr) {
+    fprintf(stderr, "missing .dynsym/.dynstr in %s\n", argv[1]);
+    return 1;
+  }
+
+  // Same set of lookups so_resolve performs
+  int num_imports = 0;
+  const char **imports = malloc((num_rels[0] + num_rels[1]) * sizeof(char *));
+  for (int r = 0; r < 2; r++) {
+    for (int i = 0; i < num_rels[r]; i++) {
+      int type = ELF32_R_TYPE(rels[r][i].r_info);
+      Elf32_Sym *sym = &dynsym[ELF32_R_SYM(rels[r][i].r_info)];
+      if ((type == R_ARM_ABS32 || type == R_ARM_GLOB_DAT || type == R_ARM_JUMP_SLOT) && sym->st_shndx == SHN_UNDEF)
+        imports[num_imports++] = dynstr + sym->st_name;
+    }
+  }
+
+  volatile uintptr_t sink = 0;
+  int linear_found = 0, index_found = 0;
+
+  double start = now_us();
+  for (int it = 0; it < ITERATIONS; it++) {
+    for (int i = 0; i < num_imports; i++) {
+      for (int j = 0; j < table_count; j++) {
+        if (strcmp(imports[i], table[j].symbol) == 0) {
+          sink += table[j].func;
+          if (it == 0)
+            linear_found++;
+          break;
+        }
+      }
+    }
+  }
+  double linear_us = (now_us() - start) / ITERATIONS;
+
+  start = now_us();
+  so_index idx;
+  so_index_build(&idx, table, sizeof(dynlib_entry), table_count);
+  double build_us = now_us() - start;
+
+  start = now_us();
+  for (int it = 0; it < ITERATIONS; it++) {
+    for (int i = 0; i < num_imports; i++) {
+      int j = so_index_find(&idx, imports[i]);
+      if (j >= 0) {
+        sink += table[j].func;
+        if (it == 0)
+          index_found++;
+      }
+    }
+  }
+  double index_us = (now_us() - start) / ITERATIONS;
+
+  if (linear_found != index_found) {
+    fprintf(stderr, "mismatch: linear resolved %d, index resolved %d\n", linear_found, index_found);
+    return 1;
+  }
+
+  printf("{\"table\":%d,\"imports\":%d,\"resolved\":%d,\"linear_us\":%.2f,\"index_build_us\":%.2f,\"index_us\":%.2f}\n",
+         table_count, num_imports, index_found, linear_us, build_us, index_us);
+
+  so_index_free(&idx);
+  return 0;
+}
@@ -0,0 +1,22 @@
+// Host stand-in for the kubridge calls the loader core uses
+
+#ifndef __HOST_KUBRIDGE_H__
+#define __HOST_KUBRIDGE_H__
+
+#include <vitasdk.h>
+
+typedef struct SceKernelAllocMemBlockKernelOpt {
+  SceSize size;
+  SceUInt32 field_4;
+  SceUInt32 attr;
+  SceUInt32 field_C;
+  SceUInt32 paddr;
+  SceSize alignment;
+  SceUInt32 reserved[12];
+} SceKernelAllocMemBlockKernelOpt;
+
+SceUID kuKernelAllocMemBlock(const char *name, SceUInt32 type, SceSize size, SceKernelAllocMemBlockKernelOpt *opt);
+int kuKernelCpuUnrestrictedMemcpy(void *dst, const void *src, SceSize len);
+void kuKernelFlushCaches(const void *ptr, SceSize len);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef __HOST_PSP2_APPUTIL_H__
+#define __HOST_PSP2_APPUTIL_H__
+
+#include <vitasdk.h>
+
+int sceAppUtilSystemParamGetInt(unsigned int paramId, int *value);
+
+#endif
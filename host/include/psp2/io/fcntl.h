@@ -0,0 +1,6 @@
+#ifndef __HOST_PSP2_IO_FCNTL_H__
+#define __HOST_PSP2_IO_FCNTL_H__
+
+#include <vitasdk.h>
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef __HOST_PSP2_SYSTEM_PARAM_H__
+#define __HOST_PSP2_SYSTEM_PARAM_H__
+
+#define SCE_SYSTEM_PARAM_ID_LANG 1
+
+#define SCE_SYSTEM_PARAM_LANG_ENGLISH_US 1
+#define SCE_SYSTEM_PARAM_LANG_FRENCH 2
+#define SCE_SYSTEM_PARAM_LANG_SPANISH 3
+#define SCE_SYSTEM_PARAM_LANG_GERMAN 4
+#define SCE_SYSTEM_PARAM_LANG_ITALIAN 5
+#define SCE_SYSTEM_PARAM_LANG_PORTUGUESE_PT 7
+#define SCE_SYSTEM_PARAM_LANG_RUSSIAN 8
+#define SCE_SYSTEM_PARAM_LANG_PORTUGUESE_BR 17
+
+#endif
@@ -0,0 +1,133 @@
+// Host stand-in for the parts of vitaGL the loader core uses
+
+#ifndef __HOST_VITAGL_H__
+#define __HOST_VITAGL_H__
+
+#include <stdint.h>
+
+typedef unsigned int GLenum;
+typedef unsigned int GLuint;
+typedef int GLint;
+typedef int GLsizei;
+typedef unsigned char GLboolean;
+typedef char GLchar;
+typedef float GLfloat;
+typedef unsigned int GLbitfield;
+
+#define GL_FALSE 0
+#define GL_TRUE  1
+
+#define GL_NO_ERROR         0
+#define GL_ZERO             0
+#define GL_ONE              1
+#define GL_TRIANGLES        0x0004
+#define GL_LESS             0x0201
+#define GL_LEQUAL           0x0203
+#define GL_SRC_ALPHA        0x0302
+#define GL_ONE_MINUS_SRC_ALPHA 0x0303
+#define GL_BACK             0x0405
+#define GL_CULL_FACE        0x0B44
+#define GL_DEPTH_TEST       0x0B71
+#define GL_STENCIL_TEST     0x0B90
+#define GL_DITHER           0x0BD0
+#define GL_BLEND            0x0BE2
+#define GL_SCISSOR_TEST     0x0C11
+#define GL_TEXTURE_2D       0x0DE1
+#define GL_COLOR_BUFFER_BIT 0x00004000
+#define GL_UNSIGNED_BYTE    0x1401
+#define GL_ALPHA            0x1906
+#define GL_LUMINANCE        0x1909
+#define GL_LUMINANCE_ALPHA  0x190A
+#define GL_NEAREST          0x2600
+#define GL_LINEAR           0x2601
+#define GL_LINEAR_MIPMAP_NEAREST 0x2701
+#define GL_NEAREST_MIPMAP_LINEAR 0x2702
+#define GL_TEXTURE_MAG_FILTER 0x2800
+#define GL_TEXTURE_MIN_FILTER 0x2801
+#define GL_TEXTURE_WRAP_S   0x2802
+#define GL_TEXTURE_WRAP_T   0x2803
+#define GL_REPEAT           0x2901
+#define GL_CLAMP_TO_EDGE    0x812F
+#define GL_RGB              0x1907
+#define GL_RGBA             0x1908
+#define GL_UNSIGNED_SHORT_4_4_4_4 0x8033
+#define GL_UNSIGNED_SHORT_5_5_5_1 0x8034
+#define GL_UNSIGNED_SHORT_5_6_5 0x8363
+#define GL_POLYGON_OFFSET_FILL 0x8037
+#define GL_TEXTURE_BINDING_2D 0x8069
+#define GL_TEXTURE0         0x84C0
+#define GL_ARRAY_BUFFER     0x8892
+#define GL_ELEMENT_ARRAY_BUFFER 0x8893
+#define GL_COMPRESSED_RGB_PVRTC_4BPPV1_IMG 0x8C00
+#define GL_COMPRESSED_RGB_PVRTC_2BPPV1_IMG 0x8C01
+#define GL_COMPRESSED_RGBA_PVRTC_4BPPV1_IMG 0x8C02
+#define GL_COMPRESSED_RGBA_PVRTC_2BPPV1_IMG 0x8C03
+#define GL_FRAMEBUFFER      0x8D40
+#define GL_RENDERBUFFER     0x8D41
+#define GL_FRAMEBUFFER_COMPLETE 0x8CD5
+#define GL_COLOR_ATTACHMENT0 0x8CE0
+#define GL_INVALID_VALUE    0x0501
+#define GL_INVALID_OPERATION 0x0502
+#define GL_VERTEX_SHADER    0x8B31
+#define GL_FRAGMENT_SHADER  0x8B30
+#define GL_COMPILE_STATUS   0x8B81
+#define GL_LINK_STATUS      0x8B82
+
+void glShaderSource(GLuint shader, GLsizei count, const GLchar *const *string, const GLint *length);
+void glCompileShader(GLuint shader);
+void glShaderBinary(GLsizei count, const GLuint *handles, GLenum binaryFormat, const void *binary, GLsizei length);
+void glGetShaderiv(GLuint shader, GLenum pname, GLint *params);
+GLenum glGetError(void);
+GLuint glCreateShader(GLenum shaderType);
+void glDeleteShader(GLuint shader);
+GLuint glCreateProgram(void);
+void glDeleteProgram(GLuint program);
+void glAttachShader(GLuint program, GLuint shader);
+void glBindAttribLocation(GLuint program, GLuint index, const GLchar *name);
+void glLinkProgram(GLuint program);
+void glGetProgramiv(GLuint program, GLenum pname, GLint *params);
+void glUseProgram(GLuint program);
+GLint glGetUniformLocation(GLuint program, const GLchar *name);
+void glUniform1i(GLint location, GLint v0);
+void glUniform1fv(GLint location, GLsizei count, const GLfloat *value);
+void glUniform2fv(GLint location, GLsizei count, const GLfloat *value);
+void glUniform3fv(GLint location, GLsizei count, const GLfloat *value);
+void glUniform4fv(GLint location, GLsizei count, const GLfloat *value);
+void glUniformMatrix2fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value);
+void glUniformMatrix3fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value);
+void glUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value);
+void glDrawArrays(GLenum mode, GLint first, GLsizei count);
+void glDrawElements(GLenum mode, GLsizei count, GLenum type, const void *indices);
+void glGetIntegerv(GLenum pname, GLint *data);
+void glActiveTexture(GLenum texture);
+void glGenTextures(GLsizei n, GLuint *textures);
+void glBindTexture(GLenum target, GLuint texture);
+void glDeleteTextures(GLsizei n, const GLuint *textures);
+void glTexImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void *data);
+void glCompressedTexImage2D(GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const void *data);
+void glTexParameteri(GLenum target, GLenum pname, GLint param);
+void glGenerateMipmap(GLenum target);
+void glTexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const void *data);
+void glReadPixels(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, void *data);
+void glBindFramebuffer(GLenum target, GLuint framebuffer);
+void glDeleteFramebuffers(GLsizei n, const GLuint *framebuffers);
+void glFramebufferTexture2D(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level);
+void glFramebufferRenderbuffer(GLenum target, GLenum attachment, GLenum renderbuffertarget, GLuint renderbuffer);
+GLenum glCheckFramebufferStatus(GLenum target);
+void glViewport(GLint x, GLint y, GLsizei width, GLsizei height);
+void glScissor(GLint x, GLint y, GLsizei width, GLsizei height);
+void glEnable(GLenum cap);
+void glDisable(GLenum cap);
+void glClear(GLbitfield mask);
+void glBlendFunc(GLenum sfactor, GLenum dfactor);
+void glDepthFunc(GLenum func);
+void glDepthMask(GLboolean flag);
+void glCullFace(GLenum mode);
+void glColorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha);
+void glClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha);
+void glBindBuffer(GLenum target, GLuint buffer);
+void glDeleteBuffers(GLsizei n, const GLuint *buffers);
+void *vglGetTexDataPointer(GLenum target);
+void vglGetShaderBinary(GLuint shader, GLsizei bufSize, GLsizei *length, void *binary);
+
+#endif
@@ -0,0 +1,60 @@
+// Host stand-in for the parts of vitasdk the loader core uses
+
+#ifndef __HOST_VITASDK_H__
+#define __HOST_VITASDK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int SceUID;
+typedef int SceInt32;
+typedef unsigned int SceUInt32;
+typedef unsigned int SceSize;
+typedef int64_t SceOff;
+typedef int64_t SceInt64;
+typedef uint64_t SceUInt64;
+typedef int SceMode;
+
+#define SCE_KERNEL_MEMBLOCK_TYPE_USER_RW 0x0C20D060
+
+#define SCE_O_RDONLY 0x0001
+#define SCE_O_WRONLY 0x0002
+#define SCE_O_RDWR   (SCE_O_RDONLY | SCE_O_WRONLY)
+#define SCE_O_APPEND 0x0100
+#define SCE_O_CREAT  0x0200
+#define SCE_O_TRUNC  0x0400
+
+#define SCE_SEEK_SET 0
+#define SCE_SEEK_CUR 1
+#define SCE_SEEK_END 2
+
+typedef struct {
+  SceMode st_mode;
+  unsigned int st_attr;
+  SceOff st_size;
+} SceIoStat;
+
+typedef struct {
+  SceIoStat d_stat;
+  char d_name[256];
+  void *d_private;
+  int dummy;
+} SceIoDirent;
+
+SceUID sceKernelAllocMemBlock(const char *name, SceUInt32 type, SceSize size, void *opt);
+int sceKernelGetMemBlockBase(SceUID uid, void **base);
+int sceKernelFreeMemBlock(SceUID uid);
+SceUInt64 sceKernelGetProcessTimeWide(void);
+
+SceUID sceIoOpen(const char *file, int flags, SceMode mode);
+int sceIoClose(SceUID fd);
+int sceIoRead(SceUID fd, void *data, SceSize size);
+int sceIoWrite(SceUID fd, const void *data, SceSize size);
+SceOff sceIoLseek(SceUID fd, SceOff offset, int whence);
+int sceIoMkdir(const char *dir, SceMode mode);
+int sceIoRemove(const char *file);
+SceUID sceIoDopen(const char *dirname);
+int sceIoDread(SceUID fd, SceIoDirent *dir);
+int sceIoDclose(SceUID fd);
+
+#endif
@@ -0,0 +1,28 @@
+// Host stand-in for the parts of vitaShaRK the loader core uses
+
+#ifndef __HOST_VITASHARK_H__
+#define __HOST_VITASHARK_H__
+
+#include <stdint.h>
+
+typedef enum {
+  SHARK_VERTEX_SHADER,
+  SHARK_FRAGMENT_SHADER
+} shark_type;
+
+typedef enum {
+  SHARK_OPT_SLOW,
+  SHARK_OPT_SAFE,
+  SHARK_OPT_DEFAULT,
+  SHARK_OPT_FAST,
+  SHARK_OPT_UNSAFE
+} shark_opt;
+
+#define SHARK_DISABLE 0
+#define SHARK_ENABLE  1
+
+uint8_t *shark_compile_shader_extended(const char *src, uint32_t *size, shark_type type, shark_opt opt,
+                                       int32_t use_fastmath, int32_t use_fastprecision, int32_t use_fastint);
+void shark_clear_output(void);
+
+#endif
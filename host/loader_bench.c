@@ -0,0 +1,305 @@
+/* loader_bench.c -- host benchmark for the loader core
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * Times loading, relocation, import resolution, symbol lookup and shader
+ * hashing and prints one JSON object. Without arguments it runs against a
+ * synthetic module that imports the whole default_dynlib table. Also checks
+ * that modules without hash tables still get their whole dynsym, from the
+ * section headers or else from the relocations, and that overlapping patches
+ * land in table order:
+ *   ./loader_bench [libgl2jni.so] [base.apk]
+ */
+
+#include <vitasdk.h>
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "dialog.h"
+#include "so_util.h"
+#include "sha1.h"
+#include "host_dynlib.h"
+#include "synth_elf.h"
+
+#define ITERATIONS 20
+#define HASH_ITERATIONS 1000
+#define MAX_SHADERS 64
+
+static int sample_cmp(const void *a, const void *b) {
+  SceUInt64 x = *(const SceUInt64 *)a, y = *(const SceUInt64 *)b;
+  return x < y ? -1 : (x > y);
+}
+
+static SceUInt64 median(SceUInt64 *samples, int count) {
+  qsort(samples, count, sizeof(SceUInt64), sample_cmp);
+  return samples[count / 2];
+}
+
+static const char *synth_write(const synth_elf_opts *opts, char *path, size_t path_size, const char *name) {
+  size_t size;
+  uint8_t *image = synth_elf_build(opts, &size);
+  if (!image)
+    return NULL;
+
+  snprintf(path, path_size, "/tmp/loader_bench_%s_%d.so", name, getpid());
+  FILE *file = fopen(path, "wb");
+  if (!file || fwrite(image, 1, size, file) != size) {
+    if (file)
+      fclose(file);
+    free(image);
+    return NULL;
+  }
+
+  fclose(file);
+  free(image);
+  return path;
+}
+
+static const char *synth_path(void) {
+  static char path[64];
+  static const char *imports[1024];
+
+  int num_imports = size_default_dynlib / sizeof(so_default_dynlib);
+  if (num_imports > 1024)
+    num_imports = 1024;
+  for (int i = 0; i < num_imports; i++)
+    imports[i] = default_dynlib[i].symbol;
+
+  synth_elf_opts opts;
+  memset(&opts, 0, sizeof(synth_elf_opts));
+  opts.num_exports = 4096;
+  opts.num_relative = 32768;
+  opts.num_init = 64;
+  opts.text_size = 2 * 1024 * 1024;
+  opts.imports = imports;
+  opts.num_imports = num_imports;
+  opts.names = loader_symbols;
+  opts.num_names = num_loader_symbols;
+  opts.gnu_hash = 1;
+
+  return synth_write(&opts, path, sizeof(path), "synth");
+}
+
+// Loads and links a module without hash tables, returns its dynsym count
+static int dynsym_without_hash(int section_headers) {
+  static const char *imports[8];
+  for (int i = 0; i < 8; i++)
+    imports[i] = default_dynlib[i].symbol;
+
+  synth_elf_opts opts;
+  memset(&opts, 0, sizeof(synth_elf_opts));
+  opts.num_exports = 64;
+  opts.num_relative = 16;
+  opts.text_size = 4096;
+  opts.imports = imports;
+  opts.num_imports = 8;
+  opts.no_hash = 1;
+  opts.section_headers = section_headers;
+
+  char path[64];
+  so_module mod;
+  if (!synth_write(&opts, path, sizeof(path), "nohash") || so_file_load(&mod, path, LOAD_ADDRESS) < 0)
+    fatal_error("Error could not load the module without hash tables.");
+  unlink(path);
+
+  int count = mod.num_dynsym;
+  so_link(&mod, default_dynlib, size_default_dynlib, SO_LINK_RELOCATE | SO_LINK_RESOLVE);
+  so_unload(&mod);
+  return count;
+}
+
+static int check_dynsym_fallback(void) {
+  // Every symbol from the section header, up to the last ABS32 target (export
+  // 60) from the relocations
+  int from_shdr = dynsym_without_hash(1);
+  int from_rels = dynsym_without_hash(0);
+
+  printf("\"dynsym_from_shdr\":%d,\"dynsym_from_rels\":%d,", from_shdr, from_rels);
+  return from_shdr == 1 + 8 + 64 && from_rels == 1 + 8 + 60 + 1;
+}
+
+// Two overlapping writes where the later entry sits at the lower address
+static int check_patch_overlap(const char *so_path) {
+  so_module mod;
+  if (so_file_load(&mod, so_path, LOAD_ADDRESS) < 0)
+    fatal_error("Error could not load %s.", so_path);
+
+  static const uint8_t first[4] = { 0xAA, 0xAA, 0xAA, 0xAA };
+  static const uint8_t second[8] = { 0xBB, 0xBB, 0xBB, 0xBB, 0xBB, 0xBB, 0xBB, 0xBB };
+  so_patch patches[2];
+  memset(patches, 0, sizeof(patches));
+  patches[0].offset = 0x104;
+  patches[0].kind = SO_PATCH_WRITE;
+  patches[0].data = first;
+  patches[0].size = sizeof(first);
+  patches[1].offset = 0x100;
+  patches[1].kind = SO_PATCH_WRITE;
+  patches[1].data = second;
+  patches[1].size = sizeof(second);
+
+  int ok = so_patch_apply(&mod, patches, 2, SO_PATCH_VALIDATE) == 0 &&
+           memcmp((void *)(mod.text_base + 0x100), second, sizeof(second)) == 0;
+  so_unload(&mod);
+
+  printf("\"patch_overlap\":%s,", ok ? "true" : "false");
+  return ok;
+}
+
+static void bench_apk_load(const char *apk_path) {
+  SceUInt64 t_load[ITERATIONS];
+  so_module mod;
+
+  for (int i = 0; i < ITERATIONS; i++) {
+    SceUInt64 start = sceKernelGetProcessTimeWide();
+    if (so_zip_load(&mod, apk_path, APK_SO_ENTRY, LOAD_ADDRESS) < 0)
+      fatal_error("Error could not load %s from %s.", APK_SO_ENTRY, apk_path);
+    t_load[i] = sceKernelGetProcessTimeWide() - start;
+    so_unload(&mod);
+  }
+
+  printf("\"apk_load_us\":%llu,", (unsigned long long)median(t_load, ITERATIONS));
+}
+
+static void bench_link(const char *so_path) {
+  SceUInt64 t_load[ITERATIONS], t_relocate[ITERATIONS], t_resolve[ITERATIONS], t_link[ITERATIONS];
+  so_module mod;
+
+  for (int i = 0; i < ITERATIONS; i++) {
+    SceUInt64 start = sceKernelGetProcessTimeWide();
+    if (so_file_load(&mod, so_path, LOAD_ADDRESS) < 0)
+      fatal_error("Error could not load %s.", so_path);
+    t_load[i] = sceKernelGetProcessTimeWide() - start;
+
+    start = sceKernelGetProcessTimeWide();
+    so_relocate(&mod);
+    t_relocate[i] = sceKernelGetProcessTimeWide() - start;
+
+    start = sceKernelGetProcessTimeWide();
+    so_resolve(&mod, default_dynlib, size_default_dynlib, 0);
+    t_resolve[i] = sceKernelGetProcessTimeWide() - start;
+
+    so_unload(&mod);
+
+    so_file_load(&mod, so_path, LOAD_ADDRESS);
+    start = sceKernelGetProcessTimeWide();
+    so_link(&mod, default_dynlib, size_default_dynlib, SO_LINK_RELOCATE | SO_LINK_RESOLVE);
+    t_link[i] = sceKernelGetProcessTimeWide() - start;
+
+    if (i < ITERATIONS - 1)
+      so_unload(&mod);
+  }
+
+  printf("\"reldyn\":%d,\"relplt\":%d,\"dynsym\":%d,", mod.num_reldyn, mod.num_relplt, mod.num_dynsym);
+  printf("\"load_us\":%llu,\"relocate_us\":%llu,\"resolve_us\":%llu,\"link_us\":%llu,",
+         (unsigned long long)median(t_load, ITERATIONS), (unsigned long long)median(t_relocate, ITERATIONS),
+         (unsigned long long)median(t_resolve, ITERATIONS), (unsigned long long)median(t_link, ITERATIONS));
+
+  // Every dynsym name, defined ones hit and undefined ones miss
+  int found = 0;
+  SceUInt64 start = sceKernelGetProcessTimeWide();
+  for (int i = 1; i < mod.num_dynsym; i++)
+    found += so_symbol(&mod, mod.dynstr + mod.dynsym[i].st_name) != 0;
+  SceUInt64 t_dynsym = sceKernelGetProcessTimeWide() - start;
+
+  // The names the loader itself patches
+  int loader_found = 0;
+  start = sceKernelGetProcessTimeWide();
+  for (int i = 0; i < num_loader_symbols; i++)
+    loader_found += so_symbol(&mod, loader_symbols[i]) != 0;
+  SceUInt64 t_loader = sceKernelGetProcessTimeWide() - start;
+
+  printf("\"symbol_lookups\":%d,\"symbol_found\":%d,\"symbol_us\":%llu,", mod.num_dynsym - 1, found, (unsigned long long)t_dynsym);
+  printf("\"loader_symbols\":%d,\"loader_symbols_found\":%d,\"loader_symbols_us\":%llu,", num_loader_symbols, loader_found, (unsigned long long)t_loader);
+
+  so_unload(&mod);
+}
+
+static void bench_shader_hash(void) {
+  char *sources[MAX_SHADERS];
+  size_t sizes[MAX_SHADERS];
+  size_t total = 0;
+  int count = 0;
+
+  // The Cg replacements are the closest thing to the game's GLSL we ship
+  DIR *dir = opendir(CG_DIR);
+  struct dirent *entry;
+  while (dir && (entry = readdir(dir)) && count < MAX_SHADERS) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", CG_DIR, entry->d_name);
+    FILE *file = fopen(path, "rb");
+    if (!file || entry->d_name[0] == '.') {
+      if (file)
+        fclose(file);
+      continue;
+    }
+    fseek(file, 0, SEEK_END);
+    sizes[count] = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    sources[count] = malloc(sizes[count] + 1);
+    sizes[count] = fread(sources[count], 1, sizes[count], file);
+    sources[count][sizes[count]] = '\0';
+    total += sizes[count];
+    count++;
+    fclose(file);
+  }
+  if (dir)
+    closedir(dir);
+
+  // Same work as glShaderSourceHook up to the path lookup
+  volatile char sink;
+  SceUInt64 start = sceKernelGetProcessTimeWide();
+  for (int it = 0; it < HASH_ITERATIONS; it++) {
+    for (int i = 0; i < count; i++) {
+      uint32_t sha1[5];
+      SHA1_CTX ctx;
+      sha1_init(&ctx);
+      sha1_update(&ctx, (uint8_t *)sources[i], strlen(sources[i]));
+      sha1_final(&ctx, (uint8_t *)sha1);
+
+      char sha_name[64];
+      snprintf(sha_name, sizeof(sha_name), "%08x%08x%08x%08x%08x", sha1[0], sha1[1], sha1[2], sha1[3], sha1[4]);
+      sink = sha_name[0];
+    }
+  }
+  SceUInt64 elapsed = sceKernelGetProcessTimeWide() - start;
+  (void)sink;
+
+  printf("\"shaders\":%d,\"shader_bytes\":%zu,\"shader_hash_us\":%.3f", count, total, count ? (double)elapsed / HASH_ITERATIONS : 0.0);
+
+  for (int i = 0; i < count; i++)
+    free(sources[i]);
+}
+
+int main(int argc, char *argv[]) {
+  const char *so_path = argc > 1 ? argv[1] : NULL;
+  const char *apk_path = argc > 2 ? argv[2] : NULL;
+  const char *tmp_path = NULL;
+
+  if (!so_path) {
+    tmp_path = so_path = synth_path();
+    if (!so_path)
+      fatal_error("Error could not write the synthetic module.");
+  }
+
+  printf("{\"input\":\"%s\",", tmp_path ? "synthetic" : so_path);
+  int ok = check_dynsym_fallback();
+  ok &= check_patch_overlap(so_path);
+  bench_link(so_path);
+  if (apk_path)
+    bench_apk_load(apk_path);
+  bench_shader_hash();
+  printf(",\"ok\":%s}\n", ok ? "true" : "false");
+
+  if (tmp_path)
+    unlink(tmp_path);
+
+  return ok ? 0 : 1;
+}
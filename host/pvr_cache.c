@@ -0,0 +1,169 @@
+/* pvr_cache.c -- fill the PVRTC transcode cache from an extracted OBB
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * Walks a directory tree and looks for PVR v2 ("PVR!") and v3 headers at
+ * any 4 byte aligned offset, so textures packed inside the game's own
+ * archives are found as well. Every level the loader would transcode is
+ * decoded into the cache directory, to be copied to ux0:data/crazytaxi/tex:
+ *   ./pvr_cache <obb_dir> <cache_dir>
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "dialog.h"
+#include "pvrtc.h"
+#include "transcode.h"
+
+#define PVR2_HEADER_SIZE 52
+#define PVR2_TAG 0x21525650 // 'PVR!'
+#define PVR2_PVRTC2 0x18
+#define PVR2_PVRTC4 0x19
+
+#define PVR3_HEADER_SIZE 52
+#define PVR3_VERSION 0x03525650
+#define PVR3_PVRTC4_RGB 2
+#define PVR3_PVRTC4_RGBA 3
+
+#define MAX_SIZE 4096
+
+typedef struct {
+  int files;
+  int textures;
+  int square;
+  int levels;
+  int cached;
+  uint64_t bytes;
+} scan_stats;
+
+static scan_stats stats;
+
+static uint32_t read32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static int valid_size(uint32_t size) {
+  return size > 0 && size <= MAX_SIZE && (size & (size - 1)) == 0;
+}
+
+// Returns how many bytes of payload the levels took
+static size_t add_levels(const uint8_t *data, size_t avail, GLenum format, int width, int height, int levels) {
+  if (width == height) {
+    stats.square++;
+    return 0;
+  }
+
+  size_t offset = 0;
+  for (int level = 0; level < levels; level++) {
+    uint32_t size = pvrtc_4bpp_size(width, height);
+    if (offset + size > avail)
+      break;
+
+    int cached;
+    uint8_t *rgba = transcode_level(format, width, height, data + offset, size, &cached);
+    if (rgba) {
+      stats.levels++;
+      stats.cached += cached;
+      stats.bytes += width * height * 4;
+      free(rgba);
+    }
+
+    offset += size;
+    width = width > 1 ? width / 2 : 1;
+    height = height > 1 ? height / 2 : 1;
+  }
+
+  stats.textures++;
+  return offset;
+}
+
+static void scan_buffer(const uint8_t *buf, size_t len) {
+  for (size_t i = 0; i + 4 <= len; i += 4) {
+    uint32_t word = read32(buf + i);
+
+    if (word == PVR2_TAG && i >= 44 && i - 44 + PVR2_HEADER_SIZE <= len) {
+      const uint8_t *header = buf + i - 44;
+      uint32_t height = read32(header + 4), width = read32(header + 8);
+      uint32_t mips = read32(header + 12), flags = read32(header + 16), data_len = read32(header + 20);
+      size_t start = i - 44 + read32(header);
+      if (read32(header) != PVR2_HEADER_SIZE || (flags & 0xff) != PVR2_PVRTC4 ||
+          !valid_size(width) || !valid_size(height) || start + data_len > len)
+        continue;
+
+      // The alpha mask tells the RGBA variant apart
+      GLenum format = read32(header + 40) ? GL_COMPRESSED_RGBA_PVRTC_4BPPV1_IMG : GL_COMPRESSED_RGB_PVRTC_4BPPV1_IMG;
+      add_levels(buf + start, data_len, format, width, height, mips + 1);
+    } else if (word == PVR3_VERSION && i + PVR3_HEADER_SIZE <= len) {
+      const uint8_t *header = buf + i;
+      uint32_t pixel_format = read32(header + 8), pixel_format_hi = read32(header + 12);
+      uint32_t height = read32(header + 24), width = read32(header + 28);
+      uint32_t mips = read32(header + 44), meta = read32(header + 48);
+      size_t start = i + PVR3_HEADER_SIZE + meta;
+      if (pixel_format_hi != 0 || (pixel_format != PVR3_PVRTC4_RGB && pixel_format != PVR3_PVRTC4_RGBA) ||
+          !valid_size(width) || !valid_size(height) || start > len)
+        continue;
+
+      GLenum format = pixel_format == PVR3_PVRTC4_RGBA ? GL_COMPRESSED_RGBA_PVRTC_4BPPV1_IMG : GL_COMPRESSED_RGB_PVRTC_4BPPV1_IMG;
+      add_levels(buf + start, len - start, format, width, height, mips ? mips : 1);
+    }
+  }
+}
+
+static void scan_path(const char *path) {
+  struct stat st;
+  if (stat(path, &st) < 0)
+    return;
+
+  if (S_ISDIR(st.st_mode)) {
+    DIR *dir = opendir(path);
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir))) {
+      if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        continue;
+      char child[1024];
+      snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+      scan_path(child);
+    }
+    if (dir)
+      closedir(dir);
+    return;
+  }
+
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return;
+
+  uint8_t *buf = malloc(st.st_size);
+  if (buf && fread(buf, 1, st.st_size, file) == st.st_size) {
+    stats.files++;
+    scan_buffer(buf, st.st_size);
+  }
+
+  free(buf);
+  fclose(file);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3)
+    fatal_error("Usage: %s <obb_dir> <cache_dir>", argv[0]);
+
+  mkdir(argv[2], 0777);
+  transcode_init(argv[2]);
+
+  scan_path(argv[1]);
+
+  printf("{\"files\":%d,\"textures\":%d,\"square_skipped\":%d,\"levels\":%d,\"already_cached\":%d,\"rgba_bytes\":%llu}\n",
+         stats.files, stats.textures, stats.square, stats.levels, stats.cached, (unsigned long long)stats.bytes);
+
+  return 0;
+}
@@ -0,0 +1,179 @@
+/* residency_bench.c -- host harness for texture residency
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * Uploads more textures than the budget holds, then draws a moving working
+ * set of them per frame through the bind hook. Checks that the resident
+ * bytes stay under the budget, that the store spills to disk once full and
+ * that every texture comes back bit-identical when it is bound again, and
+ * that losing a spill file only costs that texture.
+ * Prints one JSON object:
+ *   ./residency_bench
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "texture.h"
+#include "residency.h"
+#include "gl_stubs.h"
+
+#define TEXTURES 48
+#define SIZE 256
+#define WORKING_SET 8
+#define FRAMES 60
+
+#define TEXTURE_BYTES (SIZE * SIZE * 4)
+#define BUDGET (16 * TEXTURE_BYTES)
+#define STORE_BUDGET (2 * TEXTURE_BYTES)
+
+// Smooth gradients with some noise, about what the game's art deflates to
+static uint8_t *make_texture(int seed) {
+  uint8_t *data = malloc(TEXTURE_BYTES);
+  uint32_t state = seed * 2654435761u + 1;
+  for (int y = 0; y < SIZE; y++) {
+    for (int x = 0; x < SIZE; x++) {
+      uint8_t *p = data + (y * SIZE + x) * 4;
+      state = state * 1103515245 + 12345;
+      p[0] = x + seed;
+      p[1] = y;
+      p[2] = (x + y) / 2 + ((state >> 16) & 3);
+      p[3] = 255;
+    }
+  }
+  return data;
+}
+
+static void remove_dir(const char *path) {
+  DIR *dir = opendir(path);
+  struct dirent *entry;
+  while (dir && (entry = readdir(dir))) {
+    if (entry->d_name[0] == '.')
+      continue;
+    char file[512];
+    snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+    unlink(file);
+  }
+  if (dir)
+    closedir(dir);
+  rmdir(path);
+}
+
+int main(int argc, char *argv[]) {
+  char spill[64];
+  snprintf(spill, sizeof(spill), "/tmp/residency_bench_%d", getpid());
+
+  uint8_t *data[TEXTURES];
+  for (int i = 0; i < TEXTURES; i++)
+    data[i] = make_texture(i);
+
+  gl_stubs_reset();
+  texture_init(NULL);
+  residency_init(BUDGET, STORE_BUDGET, spill);
+  residency_stats *stats = residency_get_stats();
+
+  for (int i = 0; i < TEXTURES; i++) {
+    glBindTextureHook(GL_TEXTURE_2D, i + 1);
+    glTexImage2DHook(GL_TEXTURE_2D, 0, GL_RGBA, SIZE, SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, data[i]);
+  }
+  glBindTextureHook(GL_TEXTURE_2D, 0);
+  uint64_t peak_unmanaged = (uint64_t)TEXTURES * TEXTURE_BYTES;
+
+  // The loading frame counts as a use, nothing leaves before the next one
+  texture_frame();
+
+  // The working set slides by one texture every few frames
+  int ok = 1;
+  uint64_t peak = 0, max_store = 0, max_spilled = 0;
+  uint32_t evictions = 0, restores = 0;
+  uint64_t evict_time = 0, restore_time = 0;
+  for (int frame = 0; frame < FRAMES; frame++) {
+    int first = (frame / 2) % TEXTURES;
+    for (int i = 0; i < WORKING_SET; i++) {
+      GLuint texture = (first + i) % TEXTURES + 1;
+      glActiveTextureHook(GL_TEXTURE0 + (i & 1));
+      glBindTextureHook(GL_TEXTURE_2D, texture);
+      const uint8_t *level0 = gl_stubs_texture_level(texture, 0);
+      ok &= level0 && memcmp(level0, data[texture - 1], TEXTURE_BYTES) == 0;
+    }
+    glActiveTextureHook(GL_TEXTURE0);
+
+    evictions += stats->evictions;
+    restores += stats->restores;
+    evict_time += stats->evict_time;
+    restore_time += stats->restore_time;
+    stats->evictions = stats->restores = 0;
+    stats->evict_time = stats->restore_time = 0;
+
+    texture_frame();
+    ok &= stats->resident_bytes <= BUDGET;
+    if (stats->resident_bytes > peak)
+      peak = stats->resident_bytes;
+    if (stats->store_bytes > max_store)
+      max_store = stats->store_bytes;
+    if (stats->spilled_bytes > max_spilled)
+      max_spilled = stats->spilled_bytes;
+  }
+  evictions += stats->evictions;
+  evict_time += stats->evict_time;
+  uint64_t held = stats->store_bytes + stats->spilled_bytes;
+  double ratio = held ? (double)stats->evicted * TEXTURE_BYTES / held : 0.0;
+
+  // Everything that ever left comes back the same
+  for (int i = 0; i < TEXTURES; i++) {
+    glBindTextureHook(GL_TEXTURE_2D, i + 1);
+    const uint8_t *level0 = gl_stubs_texture_level(i + 1, 0);
+    ok &= level0 && memcmp(level0, data[i], TEXTURE_BYTES) == 0;
+  }
+  ok &= evictions > 0 && restores > 0 && max_spilled > 0;
+
+  // Deleting drops both the store and any spill file
+  GLuint ids[TEXTURES];
+  for (int i = 0; i < TEXTURES; i++)
+    ids[i] = i + 1;
+  glBindTextureHook(GL_TEXTURE_2D, 0);
+  texture_frame();
+
+  // A spill file that went missing leaves its texture on the placeholder
+  texture_frame();
+  GLuint missing = 0;
+  for (int i = TEXTURES; i > 0 && !missing; i--) {
+    char file[128];
+    snprintf(file, sizeof(file), "%s/%d.bin", spill, i);
+    if (unlink(file) == 0)
+      missing = i;
+  }
+  uint32_t evicted = stats->evicted;
+  glBindTextureHook(GL_TEXTURE_2D, missing);
+  glBindTextureHook(GL_TEXTURE_2D, 0);
+  ok &= missing && stats->lost == 1 && stats->evicted == evicted - 1;
+
+  glDeleteTexturesHook(TEXTURES, ids);
+  ok &= stats->resident == 0 && stats->evicted == 0 && stats->resident_bytes == 0 &&
+        stats->store_bytes == 0 && stats->spilled_bytes == 0;
+
+  printf("{\"textures\":%d,\"texture_bytes\":%d,\"budget\":%d,\"unmanaged_bytes\":%llu,\"peak_resident_bytes\":%llu,"
+         "\"evictions\":%u,\"restores\":%u,\"max_store_bytes\":%llu,\"max_spilled_bytes\":%llu,"
+         "\"compression_ratio\":%.2f,\"evict_us\":%.1f,\"restore_us\":%.1f,\"lost\":%u,\"ok\":%s}\n",
+         TEXTURES, TEXTURE_BYTES, BUDGET, (unsigned long long)peak_unmanaged, (unsigned long long)peak,
+         evictions, restores, (unsigned long long)max_store, (unsigned long long)max_spilled,
+         ratio,
+         evictions ? (double)evict_time / evictions : 0.0, restores ? (double)restore_time / restores : 0.0,
+         stats->lost, ok ? "true" : "false");
+
+  for (int i = 0; i < TEXTURES; i++)
+    free(data[i]);
+  remove_dir(spill);
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,274 @@
+/* shader_bench.c -- host harness for the shader binary cache
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * Feeds generated GLSL through glShaderSourceHook/glCompileShaderHook with
+ * the stand-in compiler from gl_stubs.c. A cold pass fills the cache, a warm
+ * pass must not compile anything, a pass after editing one .cg must
+ * recompile exactly that one and GLSL without a replacement must reach the
+ * compiler untouched. A warm-up pass against an empty cache must leave
+ * nothing for the game to compile, also when the game sources its shaders
+ * while the worker is still running. The packed archive is checked against the
+ * loose files it was built from. Prints one JSON object:
+ *   ./shader_bench [cg_dir] [shaders.bin]
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dialog.h"
+#include "sha1.h"
+#include "shader.h"
+#include "shader_index.h"
+#include "shader_variant.h"
+#include "gl_stubs.h"
+
+#define MAX_SHADERS 64
+
+static char glsl[MAX_SHADERS][64];
+static int num_shaders = 0;
+
+static void write_file(const char *path, const void *data, size_t size) {
+  FILE *file = fopen(path, "wb");
+  if (!file || fwrite(data, 1, size, file) != size)
+    fatal_error("Error could not write %s.", path);
+  fclose(file);
+}
+
+static void *read_file(const char *path, size_t *size) {
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return NULL;
+  fseek(file, 0, SEEK_END);
+  *size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  void *data = malloc(*size);
+  *size = fread(data, 1, *size, file);
+  fclose(file);
+  return data;
+}
+
+static void glsl_cg_path(char *path, size_t len, const char *dir, const char *source) {
+  uint32_t sha1[5];
+  SHA1_CTX ctx;
+  sha1_init(&ctx);
+  sha1_update(&ctx, (uint8_t *)source, strlen(source));
+  sha1_final(&ctx, (uint8_t *)sha1);
+  snprintf(path, len, "%s/%08x%08x%08x%08x%08x.cg", dir, sha1[0], sha1[1], sha1[2], sha1[3], sha1[4]);
+}
+
+// Pairs each shipped .cg with a made-up GLSL string that hashes to its copy
+static void setup(const char *src_dir, const char *cg_dir) {
+  DIR *dir = opendir(src_dir);
+  if (!dir)
+    fatal_error("Error could not open %s.", src_dir);
+
+  struct dirent *entry;
+  while ((entry = readdir(dir)) && num_shaders < MAX_SHADERS) {
+    if (entry->d_name[0] == '.')
+      continue;
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", src_dir, entry->d_name);
+    size_t size;
+    void *data = read_file(path, &size);
+    if (!data)
+      continue;
+
+    snprintf(glsl[num_shaders], sizeof(glsl[0]), "// glsl %d\nvoid main() {}\n", num_shaders);
+    glsl_cg_path(path, sizeof(path), cg_dir, glsl[num_shaders]);
+    write_file(path, data, size);
+    free(data);
+    num_shaders++;
+  }
+
+  closedir(dir);
+}
+
+static SceUInt64 run_pass(int *compiles, int *hits) {
+  shader_stats before = *shader_cache_stats();
+
+  // Every pass is a fresh boot as far as the GL side is concerned
+  gl_stubs_reset();
+
+  SceUInt64 start = sceKernelGetProcessTimeWide();
+  for (int i = 0; i < num_shaders; i++) {
+    const GLchar *sources[] = { glsl[i] };
+    glShaderSourceHook(i + 1, 1, sources, NULL);
+    glCompileShaderHook(i + 1);
+
+    GLint compiled = GL_FALSE;
+    glGetShaderiv(i + 1, GL_COMPILE_STATUS, &compiled);
+    if (!compiled)
+      fatal_error("Error shader %d did not end up compiled.", i);
+  }
+  SceUInt64 elapsed = sceKernelGetProcessTimeWide() - start;
+
+  *compiles = gl_calls.compiles;
+  *hits = shader_cache_stats()->hits - before.hits;
+  return elapsed;
+}
+
+// Every loose .cg must come back byte for byte from the archive
+static int check_pack(const char *src_dir, const char *pack_path, SceUInt64 *t_dir, SceUInt64 *t_pack) {
+  SceUInt64 start = sceKernelGetProcessTimeWide();
+  int dir_count = shader_index_load(src_dir);
+  *t_dir = sceKernelGetProcessTimeWide() - start;
+
+  start = sceKernelGetProcessTimeWide();
+  int pack_count = shader_index_load_pack(pack_path);
+  *t_pack = sceKernelGetProcessTimeWide() - start;
+
+  if (pack_count < 0 || pack_count != dir_count)
+    return 0;
+
+  DIR *dir = opendir(src_dir);
+  struct dirent *entry;
+  int matched = 0;
+  while (dir && (entry = readdir(dir))) {
+    uint32_t key[5];
+    if (sscanf(entry->d_name, "%8x%8x%8x%8x%8x.cg", &key[0], &key[1], &key[2], &key[3], &key[4]) != 5)
+      continue;
+
+    char path[512];
+    size_t size;
+    snprintf(path, sizeof(path), "%s/%s", src_dir, entry->d_name);
+    char *data = read_file(path, &size);
+    shader_index_entry *found = shader_index_find(key);
+    if (data && found && found->size == size && memcmp(shader_index_source(found), data, size) == 0)
+      matched++;
+    free(data);
+  }
+  if (dir)
+    closedir(dir);
+
+  shader_index_free();
+  return matched == pack_count;
+}
+
+static void remove_dir(const char *path) {
+  DIR *dir = opendir(path);
+  struct dirent *entry;
+  while (dir && (entry = readdir(dir))) {
+    if (entry->d_name[0] == '.')
+      continue;
+    char file[512];
+    snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+    unlink(file);
+  }
+  if (dir)
+    closedir(dir);
+  rmdir(path);
+}
+
+int main(int argc, char *argv[]) {
+  const char *src_dir = argc > 1 ? argv[1] : CG_DIR;
+  const char *pack_path = argc > 2 ? argv[2] : SHADER_PACK;
+
+  char root[64], cg_dir[128], cache_dir[128];
+  snprintf(root, sizeof(root), "/tmp/shader_bench_%d", getpid());
+  snprintf(cg_dir, sizeof(cg_dir), "%s/cg", root);
+  snprintf(cache_dir, sizeof(cache_dir), "%s/gxp", root);
+  sceIoMkdir(root, 0777);
+  sceIoMkdir(cg_dir, 0777);
+
+  setup(src_dir, cg_dir);
+  shader_cache_init(NULL, cg_dir, cache_dir);
+
+  int cold_compiles, cold_hits, warm_compiles, warm_hits, edit_compiles, edit_hits;
+  SceUInt64 t_cold = run_pass(&cold_compiles, &cold_hits);
+  // Reindexing drops the binaries held in memory, like a reboot would
+  shader_cache_init(NULL, cg_dir, cache_dir);
+  SceUInt64 t_warm = run_pass(&warm_compiles, &warm_hits);
+
+  // Touching a .cg must invalidate its binary and nothing else
+  char path[512];
+  glsl_cg_path(path, sizeof(path), cg_dir, glsl[0]);
+  FILE *file = fopen(path, "ab");
+  if (file) {
+    fputs("\n", file);
+    fclose(file);
+  }
+  shader_cache_init(NULL, cg_dir, cache_dir);
+  run_pass(&edit_compiles, &edit_hits);
+
+  const GLchar *unknown[] = { "// no replacement\n" };
+  int misses = shader_cache_stats()->misses;
+  glShaderSourceHook(1, 1, unknown, NULL);
+  glCompileShaderHook(1);
+  int passthrough = shader_cache_stats()->misses == misses + 1 && gl_stubs_source(1) && strcmp(gl_stubs_source(1), unknown[0]) == 0;
+
+  int ok = num_shaders > 0 &&
+           cold_compiles == num_shaders && cold_hits == 0 &&
+           warm_compiles == 0 && warm_hits == num_shaders &&
+           edit_compiles == 1 && edit_hits == num_shaders - 1 &&
+           passthrough;
+
+  // Boot with an empty cache and let the warm-up thread fill it
+  char warm_dir[128];
+  snprintf(warm_dir, sizeof(warm_dir), "%s/warm", root);
+  shader_cache_init(NULL, cg_dir, warm_dir);
+  shader_warmup_start();
+  shader_warmup_wait();
+  int vertex = gl_calls.shark_vertex, fragment = gl_calls.shark_fragment;
+  int warmup_compiles, warmup_hits;
+  SceUInt64 t_warmup = run_pass(&warmup_compiles, &warmup_hits);
+
+  // Shaders with VARIANT_* blocks get every specialization built as well
+  int variants = 0;
+  for (int i = 0; i < shader_index_count(); i++)
+    variants += variant_has_defines(shader_index_get(i)) ? VARIANT_COUNT - 1 : 0;
+  ok = ok && vertex + fragment == num_shaders + variants && warmup_compiles == 0 && warmup_hits == num_shaders;
+
+  // Boot again and source the shaders, last first, while the worker is still
+  // busy. Each one only waits for its own entry and must still be a hit
+  char overlap_dir[128];
+  snprintf(overlap_dir, sizeof(overlap_dir), "%s/overlap", root);
+  shader_cache_init(NULL, cg_dir, overlap_dir);
+  gl_stubs_reset();
+  int overlap_hits = shader_cache_stats()->hits;
+  SceUInt64 start = sceKernelGetProcessTimeWide();
+  shader_warmup_start();
+  for (int i = num_shaders - 1; i >= 0; i--) {
+    const GLchar *sources[] = { glsl[i] };
+    glShaderSourceHook(i + 1, 1, sources, NULL);
+    glCompileShaderHook(i + 1);
+  }
+  SceUInt64 t_overlap = sceKernelGetProcessTimeWide() - start;
+  int overlap_compiles = gl_calls.compiles;
+  shader_warmup_wait();
+  overlap_hits = shader_cache_stats()->hits - overlap_hits;
+  ok = ok && overlap_compiles == 0 && overlap_hits == num_shaders;
+
+  SceUInt64 t_dir, t_pack;
+  int pack_ok = check_pack(src_dir, pack_path, &t_dir, &t_pack);
+  ok = ok && pack_ok;
+
+  printf("{\"shaders\":%d,\"saves\":%d,", num_shaders, shader_cache_stats()->saves);
+  printf("\"cold_compiles\":%d,\"cold_us\":%llu,", cold_compiles, (unsigned long long)t_cold);
+  printf("\"warm_compiles\":%d,\"warm_hits\":%d,\"warm_us\":%llu,", warm_compiles, warm_hits, (unsigned long long)t_warm);
+  printf("\"edit_compiles\":%d,\"passthrough\":%s,", edit_compiles, passthrough ? "true" : "false");
+  printf("\"warmup_vertex\":%d,\"warmup_fragment\":%d,\"warmup_variants\":%d,\"warmup_compiles\":%d,\"warmup_us\":%llu,",
+         vertex, fragment, variants, warmup_compiles, (unsigned long long)t_warmup);
+  printf("\"overlap_compiles\":%d,\"overlap_hits\":%d,\"overlap_us\":%llu,",
+         overlap_compiles, overlap_hits, (unsigned long long)t_overlap);
+  printf("\"dir_index_us\":%llu,\"pack_index_us\":%llu,\"pack\":%s,", (unsigned long long)t_dir, (unsigned long long)t_pack, pack_ok ? "true" : "false");
+  printf("\"ok\":%s}\n", ok ? "true" : "false");
+
+  remove_dir(warm_dir);
+  remove_dir(overlap_dir);
+  remove_dir(cache_dir);
+  remove_dir(cg_dir);
+  rmdir(root);
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,234 @@
+/* stubs.c -- host stand-ins for the Vita services used by the loader core
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <kubridge.h>
+#include <psp2/apputil.h>
+#include <psp2/system_param.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "main.h"
+#include "dialog.h"
+#include "so_util.h"
+
+#define MAX_MEMBLOCKS 64
+
+typedef struct {
+  void *base;
+  size_t size;
+} host_memblock;
+
+// Index 0 is never handed out so a zeroed blockid stays invalid
+static host_memblock memblocks[MAX_MEMBLOCKS];
+
+so_module crazytaxi_mod;
+
+static SceUID memblock_alloc(uintptr_t addr, SceSize size, int exec) {
+  int prot = PROT_READ | PROT_WRITE | (exec ? PROT_EXEC : 0);
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  void *base;
+
+  // The module keeps 32-bit addresses around, so every block has to live in the low 4GB
+  if (addr) {
+    base = mmap((void *)addr, size, prot, flags | MAP_FIXED_NOREPLACE, -1, 0);
+  } else {
+    base = mmap(NULL, size, prot, flags | MAP_32BIT, -1, 0);
+  }
+
+  if (base == MAP_FAILED)
+    return -1;
+
+  for (int i = 1; i < MAX_MEMBLOCKS; i++) {
+    if (!memblocks[i].base) {
+      memblocks[i].base = base;
+      memblocks[i].size = size;
+      return i;
+    }
+  }
+
+  munmap(base, size);
+  return -1;
+}
+
+SceUID kuKernelAllocMemBlock(const char *name, SceUInt32 type, SceSize size, SceKernelAllocMemBlockKernelOpt *opt) {
+  return memblock_alloc(opt ? opt->field_C : 0, size, type != SCE_KERNEL_MEMBLOCK_TYPE_USER_RW);
+}
+
+SceUID sceKernelAllocMemBlock(const char *name, SceUInt32 type, SceSize size, void *opt) {
+  return memblock_alloc(0, size, 0);
+}
+
+int sceKernelGetMemBlockBase(SceUID uid, void **base) {
+  if (uid <= 0 || uid >= MAX_MEMBLOCKS || !memblocks[uid].base)
+    return -1;
+  *base = memblocks[uid].base;
+  return 0;
+}
+
+int sceKernelFreeMemBlock(SceUID uid) {
+  if (uid <= 0 || uid >= MAX_MEMBLOCKS || !memblocks[uid].base)
+    return -1;
+  munmap(memblocks[uid].base, memblocks[uid].size);
+  memset(&memblocks[uid], 0, sizeof(host_memblock));
+  return 0;
+}
+
+int kuKernelCpuUnrestrictedMemcpy(void *dst, const void *src, SceSize len) {
+  memcpy(dst, src, len);
+  return 0;
+}
+
+void kuKernelFlushCaches(const void *ptr, SceSize len) {
+}
+
+SceUInt64 sceKernelGetProcessTimeWide(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (SceUInt64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+SceUID sceIoOpen(const char *file, int flags, SceMode mode) {
+  int oflags = 0;
+
+  if ((flags & SCE_O_RDWR) == SCE_O_RDWR)
+    oflags = O_RDWR;
+  else if (flags & SCE_O_WRONLY)
+    oflags = O_WRONLY;
+  else
+    oflags = O_RDONLY;
+
+  if (flags & SCE_O_APPEND)
+    oflags |= O_APPEND;
+  if (flags & SCE_O_CREAT)
+    oflags |= O_CREAT;
+  if (flags & SCE_O_TRUNC)
+    oflags |= O_TRUNC;
+
+  int fd = open(file, oflags, mode ? mode : 0644);
+  return fd < 0 ? -1 : fd;
+}
+
+int sceIoClose(SceUID fd) {
+  return close(fd);
+}
+
+int sceIoRead(SceUID fd, void *data, SceSize size) {
+  return read(fd, data, size);
+}
+
+int sceIoWrite(SceUID fd, const void *data, SceSize size) {
+  return write(fd, data, size);
+}
+
+SceOff sceIoLseek(SceUID fd, SceOff offset, int whence) {
+  return lseek(fd, offset, whence == SCE_SEEK_END ? SEEK_END : (whence == SCE_SEEK_CUR ? SEEK_CUR : SEEK_SET));
+}
+
+int sceIoMkdir(const char *dir, SceMode mode) {
+  return mkdir(dir, mode);
+}
+
+int sceIoRemove(const char *file) {
+  return unlink(file);
+}
+
+#define MAX_DIRS 8
+
+typedef struct {
+  DIR *dir;
+  char path[256];
+} host_dir;
+
+static host_dir dirs[MAX_DIRS];
+
+SceUID sceIoDopen(const char *dirname) {
+  for (int i = 1; i < MAX_DIRS; i++) {
+    if (!dirs[i].dir) {
+      dirs[i].dir = opendir(dirname);
+      if (!dirs[i].dir)
+        return -1;
+      snprintf(dirs[i].path, sizeof(dirs[i].path), "%s", dirname);
+      return i;
+    }
+  }
+  return -1;
+}
+
+int sceIoDread(SceUID fd, SceIoDirent *dir) {
+  if (fd <= 0 || fd >= MAX_DIRS || !dirs[fd].dir)
+    return -1;
+
+  struct dirent *entry;
+  do {
+    entry = readdir(dirs[fd].dir);
+  } while (entry && (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0));
+  if (!entry)
+    return 0;
+
+  char path[512];
+  struct stat st;
+  snprintf(path, sizeof(path), "%s/%s", dirs[fd].path, entry->d_name);
+  memset(dir, 0, sizeof(SceIoDirent));
+  if (stat(path, &st) == 0) {
+    dir->d_stat.st_mode = st.st_mode;
+    dir->d_stat.st_size = st.st_size;
+  }
+  snprintf(dir->d_name, sizeof(dir->d_name), "%s", entry->d_name);
+  return 1;
+}
+
+int sceIoDclose(SceUID fd) {
+  if (fd <= 0 || fd >= MAX_DIRS || !dirs[fd].dir)
+    return -1;
+  closedir(dirs[fd].dir);
+  dirs[fd].dir = NULL;
+  return 0;
+}
+
+int sceAppUtilSystemParamGetInt(unsigned int paramId, int *value) {
+  *value = SCE_SYSTEM_PARAM_LANG_ENGLISH_US;
+  return 0;
+}
+
+void fatal_error(const char *fmt, ...) {
+  va_list list;
+
+  va_start(list, fmt);
+  vfprintf(stderr, fmt, list);
+  va_end(list);
+
+  fputc('\n', stderr);
+  exit(1);
+}
+
+int debugPrintf(char *text, ...) {
+  if (!getenv("LOADER_DEBUG"))
+    return 0;
+
+  va_list list;
+
+  va_start(list, text);
+  vfprintf(stderr, text, list);
+  va_end(list);
+
+  return 0;
+}
+
+int ret0(void) {
+  return 0;
+}
@@ -0,0 +1,193 @@
+/* symbol_bench.c -- host benchmark for so_symbol lookups
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * Build and run on the host:
+ *   cc -O2 -Iloader host/symbol_bench.c loader/so_hash.c -o symbol_bench
+ *   ./symbol_bench libgl2jni.so loader/main.c loader/jni_patch.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "elf.h"
+#include "so_hash.h"
+
+#define ITERATIONS 1000
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+static void *read_file(const char *path, size_t *size) {
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return NULL;
+  fseek(file, 0, SEEK_END);
+  *size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  char *data = malloc(*size + 1);
+  if (fread(data, 1, *size, file) != *size) {
+    free(data);
+    fclose(file);
+    return NULL;
+  }
+  data[*size] = '\0';
+  fclose(file);
+  return data;
+}
+
+static int add_name(const char ***names, int count, const char *p) {
+  const char *end = strchr(p, '"');
+  if (!end)
+    return count;
+  *names = realloc(*names, (count + 1) * sizeof(char *));
+  (*names)[count++] = strndup(p, end - p);
+  return count;
+}
+
+// Collect every name the loader looks up, either directly through
+// so_symbol(&crazytaxi_mod, "...") or through the HOOK/WRITE/IMPORT patch table
+static int load_names(const char *path, const char ***names, int count) {
+  static const char *macros[] = { "HOOK(\"", "WRITE(\"", "IMPORT(\"" };
+
+  size_t size;
+  char *src = read_file(path, &size);
+  if (!src)
+    return count;
+
+  const char *pattern = "so_symbol(&crazytaxi_mod, \"";
+  for (char *p = strstr(src, pattern); p; p = strstr(p, pattern)) {
+    p += strlen(pattern);
+    count = add_name(names, count, p);
+  }
+
+  // Table entries only count at the start of a line, so commented ones don't
+  for (char *line = src; line; line = strchr(line, '\n')) {
+    line += strspn(line, "\n \t");
+    for (int i = 0; i < sizeof(macros) / sizeof(*macros); i++) {
+      if (strncmp(line, macros[i], strlen(macros[i])) == 0)
+        count = add_name(names, count, line + strlen(macros[i]));
+    }
+  }
+
+  free(src);
+  return count;
+}
+
+static int linear_find(const Elf32_Sym *dynsym, int num_dynsym, const char *dynstr, const char *symbol) {
+  for (int i = 0; i < num_dynsym; i++) {
+    if (dynsym[i].st_shndx == SHN_UNDEF)
+      continue;
+    if (dynsym[i].st_info != SHN_UNDEF && strcmp(dynstr + dynsym[i].st_name, symbol) == 0)
+      return i;
+  }
+  return -1;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s libgl2jni.so source.c...\n", argv[0]);
+    return 1;
+  }
+
+  size_t so_size;
+  uint8_t *so_data = read_file(argv[1], &so_size);
+  if (!so_data || memcmp(so_data, ELFMAG, SELFMAG) != 0) {
+    fprintf(stderr, "could not read %s\n", argv[1]);
+    return 1;
+  }
+
+  const char **hits = NULL;
+  int num_hits = 0;
+  for (int i = 2; i < argc; i++)
+    num_hits = load_names(argv[i], &hits, num_hits);
+
+  Elf32_Ehdr *ehdr = (Elf32_Ehdr *)so_data;
+  Elf32_Shdr *shdr = (Elf32_Shdr *)(so_data + ehdr->e_shoff);
+  char *shstr = (char *)so_data + shdr[ehdr->e_shstrndx].sh_offset;
+
+  Elf32_Sym *dynsym = NULL;
+  int num_dynsym = 0;
+  char *dynstr = NULL;
+  uint32_t *hash = NULL, *gnu_hash = NULL;
+
+  for (int i = 0; i < ehdr->e_shnum; i++) {
+    char *sh_name = shstr + shdr[i].sh_name;
+    void *sh_data = so_data + shdr[i].sh_offset;
+    if (strcmp(sh_name, ".dynsym") == 0) {
+      dynsym = sh_data;
+      num_dynsym = shdr[i].sh_size / sizeof(Elf32_Sym);
+    } else if (strcmp(sh_name, ".dynstr") == 0) {
+      dynstr = sh_data;
+    } else if (strcmp(sh_name, ".hash") == 0) {
+      hash = sh_data;
+    } else if (strcmp(sh_name, ".gnu.hash") == 0) {
+      gnu_hash = sh_data;
+    }
+  }
+
+  if (!dynsym || !dynstr) {
+    fprintf(stderr, "missing .dynsym/.dynstr in %s\n", argv[1]);
+    return 1;
+  }
+
+  // Undefined names are what so_resolve_link asks modules that don't have them
+  const char **misses = malloc(num_dynsym * sizeof(char *));
+  int num_misses = 0;
+  for (int i = 1; i < num_dynsym; i++) {
+    if (dynsym[i].st_shndx == SHN_UNDEF)
+      misses[num_misses++] = dynstr + dynsym[i].st_name;
+  }
+
+  const char **sets[2] = { hits, misses };
+  int counts[2] = { num_hits, num_misses };
+  const char *set_names[2] = { "hit", "miss" };
+
+  printf("{\"dynsym\":%d,\"lookups\":%d,\"misses\":%d", num_dynsym, num_hits, num_misses);
+
+  for (int s = 0; s < 2; s++) {
+    volatile int sink = 0;
+    int found[3] = { 0, 0, 0 };
+
+    double start = now_us();
+    for (int it = 0; it < ITERATIONS; it++)
+      for (int i = 0; i < counts[s]; i++)
+        found[0] += (sink = linear_find(dynsym, num_dynsym, dynstr, sets[s][i])) >= 0;
+    printf(",\"%s_linear_us\":%.3f", set_names[s], (now_us() - start) / ITERATIONS);
+
+    if (hash) {
+      start = now_us();
+      for (int it = 0; it < ITERATIONS; it++)
+        for (int i = 0; i < counts[s]; i++)
+          found[1] += (sink = so_sysv_hash_find(hash, dynsym, dynstr, sets[s][i])) >= 0;
+      printf(",\"%s_sysv_us\":%.3f", set_names[s], (now_us() - start) / ITERATIONS);
+      if (found[1] != found[0]) {
+        fprintf(stderr, "\nmismatch: sysv found %d, linear found %d\n", found[1], found[0]);
+        return 1;
+      }
+    }
+
+    if (gnu_hash) {
+      start = now_us();
+      for (int it = 0; it < ITERATIONS; it++)
+        for (int i = 0; i < counts[s]; i++)
+          found[2] += (sink = so_gnu_hash_find(gnu_hash, dynsym, dynstr, sets[s][i], so_gnu_hash((const uint8_t *)sets[s][i]))) >= 0;
+      printf(",\"%s_gnu_us\":%.3f", set_names[s], (now_us() - start) / ITERATIONS);
+      if (found[2] != found[0]) {
+        fprintf(stderr, "\nmismatch: gnu found %d, linear found %d\n", found[2], found[0]);
+        return 1;
+      }
+    }
+  }
+
+  printf("}\n");
+  return 0;
+}
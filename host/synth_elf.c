@@ -0,0 +1,278 @@
+/* synth_elf.c -- synthetic ARM shared objects for the host harness
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elf.h"
+#include "so_hash.h"
+#include "synth_elf.h"
+
+#define PAGE_SZ 0x1000
+#define BSS_SZ 0x4000
+#define NUM_PHDR 3
+
+#define ALIGN(x, a) (((x) + ((a) - 1)) & ~((a) - 1))
+
+typedef struct {
+  const char *name;
+  uint32_t gnu_hash;
+  uint32_t bucket;
+} synth_export;
+
+static int synth_export_cmp(const void *a, const void *b) {
+  const synth_export *x = a, *y = b;
+  return x->bucket < y->bucket ? -1 : (x->bucket > y->bucket);
+}
+
+uint8_t *synth_elf_build(const synth_elf_opts *opts, size_t *size) {
+  int num_imports = opts->num_imports;
+  int num_exports = opts->num_exports;
+  int num_dynsym = 1 + num_imports + num_exports;
+  int num_abs = num_exports / 4;
+
+  // Exports are named up front so they can be sorted into GNU hash bucket order
+  uint32_t gnu_nbuckets = num_exports / 4 > 0 ? num_exports / 4 : 1;
+  synth_export *exports = calloc(num_exports, sizeof(synth_export));
+  char *export_names = malloc(num_exports * 16);
+  for (int i = 0; i < num_exports; i++) {
+    snprintf(export_names + i * 16, 16, "synth_%d", i);
+    exports[i].name = i < opts->num_names ? opts->names[i] : export_names + i * 16;
+    exports[i].gnu_hash = so_gnu_hash((const uint8_t *)exports[i].name);
+    exports[i].bucket = exports[i].gnu_hash % gnu_nbuckets;
+  }
+  qsort(exports, num_exports, sizeof(synth_export), synth_export_cmp);
+
+  const char *soname = "libsynth.so";
+  size_t dynstr_size = 1 + strlen(soname) + 1;
+  for (int i = 0; i < num_imports; i++)
+    dynstr_size += strlen(opts->imports[i]) + 1;
+  for (int i = 0; i < num_exports; i++)
+    dynstr_size += strlen(exports[i].name) + 1;
+
+  uint32_t sysv_nbucket = num_dynsym / 2 + 1;
+  size_t hash_size = (2 + sysv_nbucket + num_dynsym) * sizeof(uint32_t);
+
+  uint32_t bloom_size = 1;
+  while (bloom_size * 32 < (uint32_t)num_exports)
+    bloom_size <<= 1;
+  size_t gnu_hash_size = opts->gnu_hash ? (4 + bloom_size + gnu_nbuckets + num_exports) * sizeof(uint32_t) : 0;
+
+  int num_reldyn = opts->num_init + opts->num_relative + num_abs + num_imports;
+  int num_relplt = num_imports;
+
+  // RX segment: headers, dynamic tables, then code
+  size_t off_dynsym = ALIGN(sizeof(Elf32_Ehdr) + NUM_PHDR * sizeof(Elf32_Phdr), 4);
+  size_t off_dynstr = off_dynsym + num_dynsym * sizeof(Elf32_Sym);
+  size_t off_hash = ALIGN(off_dynstr + dynstr_size, 4);
+  size_t off_gnu_hash = off_hash + hash_size;
+  size_t off_reldyn = off_gnu_hash + gnu_hash_size;
+  size_t off_relplt = off_reldyn + num_reldyn * sizeof(Elf32_Rel);
+  size_t off_text = ALIGN(off_relplt + num_relplt * sizeof(Elf32_Rel), 16);
+  size_t text_end = off_text + ALIGN(opts->text_size, 4);
+
+  // RW segment: dynamic, init_array, GOT and data words, mapped one page above its file offset
+  int num_dyn = 17;
+  size_t off_data = ALIGN(text_end, PAGE_SZ);
+  uint32_t data_vaddr = off_data + PAGE_SZ;
+  size_t dyn_size = num_dyn * sizeof(Elf32_Dyn);
+  uint32_t init_vaddr = data_vaddr + dyn_size;
+  uint32_t got_vaddr = init_vaddr + opts->num_init * 4;
+  uint32_t words_vaddr = got_vaddr + num_imports * 2 * 4;
+  size_t data_size = dyn_size + (opts->num_init + num_imports * 2 + opts->num_relative + num_abs) * 4;
+
+  // Section headers go last, past everything that gets mapped
+  size_t off_shdr = ALIGN(off_data + data_size, 4);
+  int num_shdr = opts->section_headers ? 2 : 0;
+
+  *size = num_shdr ? off_shdr + num_shdr * sizeof(Elf32_Shdr) : off_data + data_size;
+  uint8_t *image = calloc(1, *size);
+  if (!image) {
+    free(exports);
+    free(export_names);
+    return NULL;
+  }
+
+  Elf32_Ehdr *ehdr = (Elf32_Ehdr *)image;
+  memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+  ehdr->e_ident[EI_CLASS] = ELFCLASS32;
+  ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
+  ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+  ehdr->e_type = ET_DYN;
+  ehdr->e_machine = EM_ARM;
+  ehdr->e_version = EV_CURRENT;
+  ehdr->e_phoff = sizeof(Elf32_Ehdr);
+  ehdr->e_flags = 0x5000000;
+  ehdr->e_ehsize = sizeof(Elf32_Ehdr);
+  ehdr->e_phentsize = sizeof(Elf32_Phdr);
+  ehdr->e_phnum = NUM_PHDR;
+  ehdr->e_shentsize = sizeof(Elf32_Shdr);
+  if (num_shdr) {
+    ehdr->e_shoff = off_shdr;
+    ehdr->e_shnum = num_shdr;
+
+    Elf32_Shdr *shdr = (Elf32_Shdr *)(image + off_shdr);
+    shdr[1].sh_type = SHT_DYNSYM;
+    shdr[1].sh_flags = SHF_ALLOC;
+    shdr[1].sh_addr = shdr[1].sh_offset = off_dynsym;
+    shdr[1].sh_size = num_dynsym * sizeof(Elf32_Sym);
+    shdr[1].sh_info = 1 + num_imports;
+    shdr[1].sh_addralign = 4;
+    shdr[1].sh_entsize = sizeof(Elf32_Sym);
+  }
+
+  Elf32_Phdr *phdr = (Elf32_Phdr *)(image + ehdr->e_phoff);
+  phdr[0].p_type = PT_LOAD;
+  phdr[0].p_filesz = phdr[0].p_memsz = text_end;
+  phdr[0].p_flags = PF_R | PF_X;
+  phdr[0].p_align = PAGE_SZ;
+  phdr[1].p_type = PT_LOAD;
+  phdr[1].p_offset = off_data;
+  phdr[1].p_vaddr = phdr[1].p_paddr = data_vaddr;
+  phdr[1].p_filesz = data_size;
+  phdr[1].p_memsz = data_size + BSS_SZ;
+  phdr[1].p_flags = PF_R | PF_W;
+  phdr[1].p_align = PAGE_SZ;
+  phdr[2].p_type = PT_DYNAMIC;
+  phdr[2].p_offset = off_data;
+  phdr[2].p_vaddr = phdr[2].p_paddr = data_vaddr;
+  phdr[2].p_filesz = phdr[2].p_memsz = dyn_size;
+  phdr[2].p_flags = PF_R | PF_W;
+  phdr[2].p_align = 4;
+
+  // Symbols: null, imports, then exports in bucket order
+  Elf32_Sym *dynsym = (Elf32_Sym *)(image + off_dynsym);
+  char *dynstr = (char *)(image + off_dynstr);
+  size_t str = 1;
+
+  uint32_t soname_off = str;
+  strcpy(dynstr + str, soname);
+  str += strlen(soname) + 1;
+
+  for (int i = 0; i < num_imports; i++) {
+    Elf32_Sym *sym = &dynsym[1 + i];
+    sym->st_name = str;
+    sym->st_info = ELF32_ST_INFO(STB_GLOBAL, STT_FUNC);
+    strcpy(dynstr + str, opts->imports[i]);
+    str += strlen(opts->imports[i]) + 1;
+  }
+
+  for (int i = 0; i < num_exports; i++) {
+    Elf32_Sym *sym = &dynsym[1 + num_imports + i];
+    sym->st_name = str;
+    sym->st_value = off_text + ((i * 64) % ALIGN(opts->text_size, 4));
+    sym->st_size = 64;
+    sym->st_info = ELF32_ST_INFO(STB_GLOBAL, STT_FUNC);
+    sym->st_shndx = 7;
+    strcpy(dynstr + str, exports[i].name);
+    str += strlen(exports[i].name) + 1;
+  }
+
+  uint32_t *hash = (uint32_t *)(image + off_hash);
+  uint32_t *bucket = &hash[2];
+  uint32_t *chain = &bucket[sysv_nbucket];
+  hash[0] = sysv_nbucket;
+  hash[1] = num_dynsym;
+  for (int i = 1; i < num_dynsym; i++) {
+    uint32_t h = so_hash((const uint8_t *)dynstr + dynsym[i].st_name) % sysv_nbucket;
+    chain[i] = bucket[h];
+    bucket[h] = i;
+  }
+
+  if (opts->gnu_hash) {
+    uint32_t symoffset = 1 + num_imports;
+    uint32_t *gnu_hash = (uint32_t *)(image + off_gnu_hash);
+    uint32_t *bloom = &gnu_hash[4];
+    uint32_t *buckets = &bloom[bloom_size];
+    uint32_t *gnu_chain = &buckets[gnu_nbuckets];
+    gnu_hash[0] = gnu_nbuckets;
+    gnu_hash[1] = symoffset;
+    gnu_hash[2] = bloom_size;
+    gnu_hash[3] = 5;
+    for (int i = 0; i < num_exports; i++) {
+      uint32_t h = exports[i].gnu_hash;
+      bloom[(h / 32) % bloom_size] |= (1u << (h % 32)) | (1u << ((h >> 5) % 32));
+      if (buckets[exports[i].bucket] == 0)
+        buckets[exports[i].bucket] = symoffset + i;
+      gnu_chain[i] = h & ~1;
+      if (i == num_exports - 1 || exports[i + 1].bucket != exports[i].bucket)
+        gnu_chain[i] |= 1;
+    }
+  }
+
+  // Filler code, a cheap LCG over a few common ARM opcodes so it compresses like real code
+  uint32_t *text = (uint32_t *)(image + off_text);
+  uint32_t seed = 0x12345678;
+  static const uint32_t opcodes[] = { 0xe1a00000, 0xe59f0000, 0xe3a00000, 0xe12fff1e, 0xe92d4000, 0xe8bd8000, 0xeb000000, 0xe2800001 };
+  for (size_t i = 0; i < ALIGN(opts->text_size, 4) / 4; i++) {
+    seed = seed * 1103515245 + 12345;
+    text[i] = opcodes[(seed >> 16) & 7] | ((seed >> 8) & 0xff);
+  }
+
+  Elf32_Rel *reldyn = (Elf32_Rel *)(image + off_reldyn);
+  Elf32_Rel *relplt = (Elf32_Rel *)(image + off_relplt);
+  uint32_t *data = (uint32_t *)(image + off_data + dyn_size);
+  int r = 0;
+
+  // Android's linker packs RELATIVE relocations first
+  for (int i = 0; i < opts->num_init; i++) {
+    reldyn[r].r_offset = init_vaddr + i * 4;
+    reldyn[r++].r_info = ELF32_R_INFO(0, R_ARM_RELATIVE);
+    data[i] = off_text + ((i * 256) % ALIGN(opts->text_size, 4));
+  }
+
+  uint32_t *words = data + opts->num_init + num_imports * 2;
+  for (int i = 0; i < opts->num_relative; i++) {
+    reldyn[r].r_offset = words_vaddr + i * 4;
+    reldyn[r++].r_info = ELF32_R_INFO(0, R_ARM_RELATIVE);
+    words[i] = (i & 1) ? off_text + ((i * 4) % ALIGN(opts->text_size, 4)) : data_vaddr + ((i * 4) % data_size);
+  }
+
+  for (int i = 0; i < num_abs; i++) {
+    reldyn[r].r_offset = words_vaddr + (opts->num_relative + i) * 4;
+    reldyn[r++].r_info = ELF32_R_INFO(1 + num_imports + i * 4, R_ARM_ABS32);
+  }
+
+  for (int i = 0; i < num_imports; i++) {
+    reldyn[r].r_offset = got_vaddr + i * 4;
+    reldyn[r++].r_info = ELF32_R_INFO(1 + i, R_ARM_GLOB_DAT);
+    relplt[i].r_offset = got_vaddr + (num_imports + i) * 4;
+    relplt[i].r_info = ELF32_R_INFO(1 + i, R_ARM_JUMP_SLOT);
+  }
+
+  Elf32_Dyn *dyn = (Elf32_Dyn *)(image + off_data);
+  int d = 0;
+  dyn[d].d_tag = DT_SONAME;   dyn[d++].d_un.d_val = soname_off;
+  if (!opts->no_hash) {
+    dyn[d].d_tag = DT_HASH;
+    dyn[d++].d_un.d_ptr = off_hash;
+  }
+  if (opts->gnu_hash && !opts->no_hash) {
+    dyn[d].d_tag = DT_GNU_HASH;
+    dyn[d++].d_un.d_ptr = off_gnu_hash;
+  }
+  dyn[d].d_tag = DT_STRTAB;   dyn[d++].d_un.d_ptr = off_dynstr;
+  dyn[d].d_tag = DT_SYMTAB;   dyn[d++].d_un.d_ptr = off_dynsym;
+  dyn[d].d_tag = DT_STRSZ;    dyn[d++].d_un.d_val = dynstr_size;
+  dyn[d].d_tag = DT_SYMENT;   dyn[d++].d_un.d_val = sizeof(Elf32_Sym);
+  dyn[d].d_tag = DT_REL;      dyn[d++].d_un.d_ptr = off_reldyn;
+  dyn[d].d_tag = DT_RELSZ;    dyn[d++].d_un.d_val = num_reldyn * sizeof(Elf32_Rel);
+  dyn[d].d_tag = DT_RELENT;   dyn[d++].d_un.d_val = sizeof(Elf32_Rel);
+  dyn[d].d_tag = DT_JMPREL;   dyn[d++].d_un.d_ptr = off_relplt;
+  dyn[d].d_tag = DT_PLTRELSZ; dyn[d++].d_un.d_val = num_relplt * sizeof(Elf32_Rel);
+  dyn[d].d_tag = DT_PLTREL;   dyn[d++].d_un.d_val = DT_REL;
+  dyn[d].d_tag = DT_INIT_ARRAY; dyn[d++].d_un.d_ptr = init_vaddr;
+  dyn[d].d_tag = DT_INIT_ARRAYSZ; dyn[d++].d_un.d_val = opts->num_init * 4;
+  dyn[d].d_tag = DT_NULL;
+
+  free(exports);
+  free(export_names);
+
+  return image;
+}
@@ -0,0 +1,26 @@
+#ifndef __SYNTH_ELF_H__
+#define __SYNTH_ELF_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+  int num_exports;          // defined FUNC symbols
+  int num_relative;         // R_ARM_RELATIVE relocations
+  int num_init;             // .init_array entries
+  size_t text_size;         // bytes of filler code
+  const char **imports;     // undefined symbols, each gets a GLOB_DAT and a JUMP_SLOT
+  int num_imports;
+  const char **names;       // names for the first exports, the rest are "synth_%d"
+  int num_names;
+  int gnu_hash;             // emit .gnu.hash next to .hash
+  int no_hash;              // leave both hash tables out of PT_DYNAMIC
+  int section_headers;      // append a section header table holding .dynsym
+} synth_elf_opts;
+
+// Builds an ARM ET_DYN image laid out like the NDK output: one RX and one RW
+// PT_LOAD, PT_DYNAMIC and no section headers unless asked for. Exports past
+// opts->names are named "synth_%d".
+uint8_t *synth_elf_build(const synth_elf_opts *opts, size_t *size);
+
+#endif
@@ -0,0 +1,291 @@
+/* texture_bench.c -- host harness for the mipmap pipeline
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * Uploads a set of textures without mips through the hooks, lets the worker
+ * build their chains and checks what reaches GL: every level present, box
+ * filtered, and the min filter switched to a mipmapped one. Then does the
+ * same again as after a reboot to time the disk cache, and checks that
+ * textures with their own mips or in-place updates are left alone. Last,
+ * uploads a non-square PVRTC texture twice to time decoding against the
+ * transcode cache, and checks that decoding on the worker keeps levels in
+ * order and finishes before an update without waiting on the others
+ * queued. Prints one JSON object:
+ *   ./texture_bench
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "texture.h"
+#include "transcode.h"
+#include "pvrtc.h"
+#include "gl_stubs.h"
+
+#define TEXTURES 16
+#define SIZE 256
+#define LEVELS 9
+#define DISTANCE_LEVEL 3 // drawn at 1/8 of its size
+
+#define PVR_W 512
+#define PVR_H 256
+#define PVR_QUEUED 6
+#define PVR_FIRST 30
+
+static uint8_t *make_texture(int seed) {
+  uint8_t *data = malloc(SIZE * SIZE * 4);
+  for (int y = 0; y < SIZE; y++) {
+    for (int x = 0; x < SIZE; x++) {
+      uint8_t *p = data + (y * SIZE + x) * 4;
+      p[0] = ((x ^ y) & 1) ? 255 : 0; // checker, averages to mid grey
+      p[1] = seed * 8;
+      p[2] = x;
+      p[3] = 255;
+    }
+  }
+  return data;
+}
+
+// Opaque magenta for both colors, so every texel decodes the same, except
+// punch-through words where modulation 2 is transparent
+static uint8_t *make_pvrtc(int punch) {
+  uint32_t size = pvrtc_4bpp_size(PVR_W, PVR_H);
+  uint8_t *data = malloc(size);
+  for (uint32_t i = 0; i < size; i += 8) {
+    uint32_t modulation = punch ? 0xaaaaaaaa : 0;
+    uint32_t color = 0x80000000 | (31 << 26) | (31 << 16) | 0x8000 | (31 << 10) | 0x1e | punch;
+    memcpy(data + i, &modulation, 4);
+    memcpy(data + i + 4, &color, 4);
+  }
+  return data;
+}
+
+static int check_pvrtc(GLuint texture, int punch) {
+  const uint8_t *rgba = gl_stubs_texture_level(texture, 0);
+  if (!rgba)
+    return 0;
+  for (int i = 0; i < PVR_W * PVR_H; i++) {
+    if (rgba[i * 4] != 255 || rgba[i * 4 + 1] != 0 || rgba[i * 4 + 2] != 255 || rgba[i * 4 + 3] != (punch ? 0 : 255))
+      return 0;
+  }
+  return 1;
+}
+
+static void remove_dir(const char *path) {
+  DIR *dir = opendir(path);
+  struct dirent *entry;
+  while (dir && (entry = readdir(dir))) {
+    if (entry->d_name[0] == '.')
+      continue;
+    char file[512];
+    snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+    unlink(file);
+  }
+  if (dir)
+    closedir(dir);
+  rmdir(path);
+}
+
+// Uploads every texture, then runs frames until all chains are in
+static SceUInt64 upload_pass(uint8_t **data, SceUInt64 *frame_time) {
+  SceUInt64 start = sceKernelGetProcessTimeWide();
+  for (int i = 0; i < TEXTURES; i++) {
+    glBindTexture(GL_TEXTURE_2D, i + 1);
+    glTexImage2DHook(GL_TEXTURE_2D, 0, GL_RGBA, SIZE, SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, data[i]);
+    glTexParameteriHook(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  }
+
+  SceUInt64 frame_start = sceKernelGetProcessTimeWide();
+  texture_frame();
+  texture_wait();
+  texture_frame();
+  *frame_time = sceKernelGetProcessTimeWide() - frame_start;
+
+  return sceKernelGetProcessTimeWide() - start;
+}
+
+static int check_chains(uint8_t **data) {
+  for (int i = 0; i < TEXTURES; i++) {
+    if (gl_stubs_min_filter(i + 1) != TEXTURE_MIP_FILTER)
+      return 0;
+
+    for (int level = 1; level < LEVELS; level++) {
+      if (!gl_stubs_texture_level(i + 1, level))
+        return 0;
+    }
+
+    // The checker and the ramp average out, the constant channels survive
+    const uint8_t *level1 = gl_stubs_texture_level(i + 1, 1);
+    const uint8_t *last = gl_stubs_texture_level(i + 1, LEVELS - 1);
+    if (level1[0] != 128 || level1[1] != data[i][1] || level1[2] != 1 || level1[3] != 255)
+      return 0;
+    if (last[1] != data[i][1] || last[3] != 255)
+      return 0;
+  }
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
+  char cache[64];
+  snprintf(cache, sizeof(cache), "/tmp/texture_bench_%d", getpid());
+
+  uint8_t *data[TEXTURES];
+  for (int i = 0; i < TEXTURES; i++)
+    data[i] = make_texture(i);
+
+  gl_stubs_reset();
+  texture_init(cache);
+
+  // Level 0 only, what the loader used to keep
+  uint64_t level0_bytes = (uint64_t)TEXTURES * SIZE * SIZE * 4;
+
+  SceUInt64 cold_frame, warm_frame;
+  SceUInt64 cold = upload_pass(data, &cold_frame);
+  texture_stats cold_stats = *texture_get_stats();
+  int ok = check_chains(data);
+  int cold_levels = gl_calls.mip_images;
+
+  // Same content after a reboot comes off the disk
+  GLuint ids[TEXTURES];
+  for (int i = 0; i < TEXTURES; i++)
+    ids[i] = i + 1;
+  glDeleteTexturesHook(TEXTURES, ids);
+  gl_stubs_reset();
+  memset(texture_get_stats(), 0, sizeof(texture_stats));
+
+  SceUInt64 warm = upload_pass(data, &warm_frame);
+  texture_stats warm_stats = *texture_get_stats();
+  ok &= check_chains(data) && warm_stats.cache_hits == TEXTURES;
+
+  // Supplied mips are kept and nothing gets generated on top
+  gl_stubs_reset();
+  memset(texture_get_stats(), 0, sizeof(texture_stats));
+  glBindTexture(GL_TEXTURE_2D, 40);
+  glTexImage2DHook(GL_TEXTURE_2D, 0, GL_RGBA, SIZE, SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, data[0]);
+  for (int level = 1, size = SIZE / 2; level < LEVELS; level++, size /= 2)
+    glTexImage2DHook(GL_TEXTURE_2D, level, GL_RGBA, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, data[1]);
+  texture_frame();
+  texture_wait();
+  texture_frame();
+  ok &= texture_get_stats()->levels_kept == LEVELS - 1 && texture_get_stats()->generated == 0 &&
+        gl_calls.mip_images == LEVELS - 1;
+
+  // An in-place update drops back to the game's filter
+  glBindTexture(GL_TEXTURE_2D, 41);
+  glTexImage2DHook(GL_TEXTURE_2D, 0, GL_RGBA, SIZE, SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, data[2]);
+  glTexParameteriHook(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  texture_frame();
+  texture_wait();
+  texture_frame();
+  int generated = gl_stubs_min_filter(41) == TEXTURE_MIP_FILTER;
+  glBindTexture(GL_TEXTURE_2D, 41);
+  glTexSubImage2DHook(GL_TEXTURE_2D, 0, 0, 0, 16, 16, GL_RGBA, GL_UNSIGNED_BYTE, data[3]);
+  ok &= generated && gl_stubs_min_filter(41) == GL_LINEAR;
+
+  // Non-square PVRTC is decoded on the worker on first sight and loaded
+  // afterwards, the hook only leaves the placeholder behind
+  char tex_cache[80];
+  snprintf(tex_cache, sizeof(tex_cache), "%s_tex", cache);
+  transcode_init(tex_cache);
+  uint8_t *pvr = make_pvrtc(0), *pvr_punch = make_pvrtc(1);
+  SceUInt64 pvr_hook[2], pvr_time[2];
+  for (int pass = 0; pass < 2; pass++) {
+    memset(texture_get_stats(), 0, sizeof(texture_stats));
+    SceUInt64 start = sceKernelGetProcessTimeWide();
+    glBindTexture(GL_TEXTURE_2D, 50);
+    glCompressedTexImage2DHook(GL_TEXTURE_2D, 0, GL_COMPRESSED_RGBA_PVRTC_4BPPV1_IMG, PVR_W, PVR_H, 0, pvrtc_4bpp_size(PVR_W, PVR_H), pvr);
+    glBindTexture(GL_TEXTURE_2D, 51);
+    glCompressedTexImage2DHook(GL_TEXTURE_2D, 0, GL_COMPRESSED_RGBA_PVRTC_4BPPV1_IMG, PVR_W, PVR_H, 0, pvrtc_4bpp_size(PVR_W, PVR_H), pvr_punch);
+    pvr_hook[pass] = sceKernelGetProcessTimeWide() - start;
+
+    const uint8_t *shown = gl_stubs_texture_level(50, 0);
+    ok &= shown && shown[3] == 0;
+
+    texture_wait();
+    texture_frame();
+    pvr_time[pass] = texture_get_stats()->transcode_time;
+    ok &= check_pvrtc(50, 0) && check_pvrtc(51, 1) && texture_get_stats()->deferred == 2 &&
+          texture_get_stats()->transcoded == 2 && texture_get_stats()->transcode_hits == (pass ? 2 : 0);
+  }
+
+  // Levels queued behind level 0 land after it
+  glBindTexture(GL_TEXTURE_2D, 53);
+  glCompressedTexImage2DHook(GL_TEXTURE_2D, 0, GL_COMPRESSED_RGBA_PVRTC_4BPPV1_IMG, PVR_W, PVR_H, 0, pvrtc_4bpp_size(PVR_W, PVR_H), pvr);
+  glCompressedTexImage2DHook(GL_TEXTURE_2D, 1, GL_COMPRESSED_RGBA_PVRTC_4BPPV1_IMG, PVR_W / 2, PVR_H / 2, 0, pvrtc_4bpp_size(PVR_W / 2, PVR_H / 2), pvr);
+  texture_wait();
+  texture_frame();
+  const uint8_t *level1 = gl_stubs_texture_level(53, 1);
+  ok &= check_pvrtc(53, 0) && level1 && level1[0] == 255 && level1[3] == 255;
+
+  // An update to a texture still decoding waits for it first
+  uint8_t patch[4] = { 1, 2, 3, 4 };
+  glBindTexture(GL_TEXTURE_2D, 54);
+  glCompressedTexImage2DHook(GL_TEXTURE_2D, 0, GL_COMPRESSED_RGBA_PVRTC_4BPPV1_IMG, PVR_W, PVR_H, 0, pvrtc_4bpp_size(PVR_W, PVR_H), pvr);
+  glTexSubImage2DHook(GL_TEXTURE_2D, 0, 0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, patch);
+  const uint8_t *updated = gl_stubs_texture_level(54, 0);
+  ok &= updated && memcmp(updated, patch, 4) == 0 && updated[4] == 255 && updated[7] == 255;
+
+  // Only the updated texture is waited on, the decodes queued ahead of it
+  // stay on the worker. Uncached, so those take a while.
+  transcode_init(NULL);
+  for (int i = 0; i < PVR_QUEUED; i++) {
+    glBindTexture(GL_TEXTURE_2D, PVR_FIRST + i);
+    glCompressedTexImage2DHook(GL_TEXTURE_2D, 0, GL_COMPRESSED_RGBA_PVRTC_4BPPV1_IMG, PVR_W, PVR_H, 0, pvrtc_4bpp_size(PVR_W, PVR_H), pvr);
+  }
+  glTexSubImage2DHook(GL_TEXTURE_2D, 0, 0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, patch);
+  updated = gl_stubs_texture_level(PVR_FIRST + PVR_QUEUED - 1, 0);
+  ok &= updated && memcmp(updated, patch, 4) == 0 && updated[4] == 255;
+  int still_decoding = 0;
+  for (int i = 0; i < PVR_QUEUED - 1; i++) {
+    const uint8_t *shown = gl_stubs_texture_level(PVR_FIRST + i, 0);
+    still_decoding += shown && shown[3] == 0;
+  }
+  texture_wait();
+  texture_frame();
+  ok &= still_decoding > 0;
+  for (int i = 0; i < PVR_QUEUED - 1; i++)
+    ok &= check_pvrtc(PVR_FIRST + i, 0);
+
+  // Square PVRTC stays compressed
+  memset(texture_get_stats(), 0, sizeof(texture_stats));
+  int compressed = gl_calls.tex_images;
+  glBindTexture(GL_TEXTURE_2D, 52);
+  glCompressedTexImage2DHook(GL_TEXTURE_2D, 0, GL_COMPRESSED_RGBA_PVRTC_4BPPV1_IMG, PVR_H, PVR_H, 0, pvrtc_4bpp_size(PVR_H, PVR_H), pvr);
+  ok &= gl_calls.tex_images == compressed + 1 && texture_get_stats()->deferred == 0;
+
+  // Bytes a draw at 1/8 scale samples from, level 0 against its mip
+  uint64_t distance_level0 = (uint64_t)SIZE * SIZE * 4;
+  uint64_t distance_mip = (uint64_t)(SIZE >> DISTANCE_LEVEL) * (SIZE >> DISTANCE_LEVEL) * 4;
+
+  printf("{\"textures\":%d,\"size\":%d,\"levels\":%d,\"generated_levels\":%d,"
+         "\"level0_bytes\":%llu,\"mip_bytes\":%llu,"
+         "\"cold_us\":%llu,\"cold_gen_us\":%llu,\"cold_frame_us\":%llu,"
+         "\"warm_us\":%llu,\"warm_gen_us\":%llu,\"warm_frame_us\":%llu,\"cache_hits\":%u,"
+         "\"distance_bytes_no_mips\":%llu,\"distance_bytes_mips\":%llu,"
+         "\"pvrtc_hook_us\":%llu,\"pvrtc_decode_us\":%llu,\"pvrtc_cached_us\":%llu,\"still_decoding\":%d,\"ok\":%s}\n",
+         TEXTURES, SIZE, LEVELS, cold_levels,
+         (unsigned long long)level0_bytes, (unsigned long long)(cold_stats.bytes - level0_bytes),
+         (unsigned long long)cold, (unsigned long long)cold_stats.gen_time, (unsigned long long)cold_frame,
+         (unsigned long long)warm, (unsigned long long)warm_stats.gen_time, (unsigned long long)warm_frame,
+         warm_stats.cache_hits, (unsigned long long)distance_level0, (unsigned long long)distance_mip,
+         (unsigned long long)pvr_hook[0], (unsigned long long)pvr_time[0], (unsigned long long)pvr_time[1], still_decoding, ok ? "true" : "false");
+
+  for (int i = 0; i < TEXTURES; i++)
+    free(data[i]);
+  free(pvr);
+  free(pvr_punch);
+  remove_dir(cache);
+  remove_dir(tex_cache);
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,270 @@
+/* variant_bench.c -- host harness for the shader variants
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * Builds a program on the branching vertex shader, then draws with a sweep
+ * of vsShaderParam values through the hooks. For every draw it checks that
+ * the bound variant got the uniforms the game set, and that the color the
+ * variant computes matches the generic shader's expression for the same
+ * inputs. The variants have to come from the warm-up worker without a
+ * compile on the game side. Uniforms set through the state cache are only
+ * compared by the variants' own record. A uniform with a long name must
+ * reach the variants, one set through a location the loader never saw must
+ * keep the program on the game's shader, and the game's shaders must go
+ * away with the program. Prints one JSON object:
+ *   ./variant_bench [cg_dir]
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dialog.h"
+#include "gl_state.h"
+#include "sha1.h"
+#include "shader.h"
+#include "shader_index.h"
+#include "shader_variant.h"
+#include "uniform_cache.h"
+#include "gl_stubs.h"
+
+#define VARIANT_VS "67fdd997d7bb747c3c2cddc56672409e0a1bddfc.cg"
+#define PLAIN_FS "0f81aafba1fe95c1bbbadf14b6ac5b1c1f6e57e1.cg"
+
+// Longer than anything the loader used to keep a name for
+#define LONG_NAME "vLongUniformNameThatTheVariantsStillNeed"
+
+static const char *vs_glsl = "// variant vs\n";
+static const char *fs_glsl = "// variant fs\n";
+
+static void cg_path(char *path, size_t len, const char *cg_dir, const char *glsl) {
+  uint32_t sha1[5];
+  SHA1_CTX ctx;
+  sha1_init(&ctx);
+  sha1_update(&ctx, (const uint8_t *)glsl, strlen(glsl));
+  sha1_final(&ctx, (uint8_t *)sha1);
+  snprintf(path, len, "%s/%08x%08x%08x%08x%08x.cg", cg_dir, sha1[0], sha1[1], sha1[2], sha1[3], sha1[4]);
+}
+
+static void unlink_cg(const char *cg_dir, const char *glsl) {
+  char path[512];
+  cg_path(path, sizeof(path), cg_dir, glsl);
+  unlink(path);
+}
+
+static void copy_cg(const char *src_dir, const char *name, const char *cg_dir, const char *glsl) {
+  char path[512];
+  snprintf(path, sizeof(path), "%s/%s", src_dir, name);
+  FILE *in = fopen(path, "rb");
+  if (!in)
+    fatal_error("Error could not open %s.", path);
+
+  cg_path(path, sizeof(path), cg_dir, glsl);
+
+  FILE *out = fopen(path, "wb");
+  if (!out)
+    fatal_error("Error could not write %s.", path);
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+    fwrite(buf, 1, n, out);
+  fclose(in);
+  fclose(out);
+}
+
+// Out.Color of the generic shader and of each specialization, per component
+static float color_generic(const float *param, float lit, float diffuse, float color) {
+  return param[0] > 0.5f ? lit : (param[2] * diffuse) + ((1.0f - param[2]) * color);
+}
+
+static float color_variant(int variant, const float *param, float lit, float diffuse, float color) {
+  switch (variant) {
+    case VARIANT_LIT:
+      return lit;
+    case VARIANT_COLOR:
+      return color;
+    case VARIANT_DIFFUSE:
+      return diffuse;
+    case VARIANT_BLEND:
+      return (param[2] * diffuse) + ((1.0f - param[2]) * color);
+    default:
+      return color_generic(param, lit, diffuse, color);
+  }
+}
+
+static int bound_variant(void) {
+  const char *source = gl_stubs_source(gl_stubs_program_shader(gl_stubs_bound_program(), 0));
+  if (!source || strncmp(source, "#define VARIANT_", 16) != 0)
+    return VARIANT_GENERIC;
+  if (strncmp(source + 16, "LIT", 3) == 0)
+    return VARIANT_LIT;
+  if (strncmp(source + 16, "COLOR", 5) == 0)
+    return VARIANT_COLOR;
+  if (strncmp(source + 16, "DIFFUSE", 7) == 0)
+    return VARIANT_DIFFUSE;
+  return VARIANT_BLEND;
+}
+
+static void remove_dir(const char *path) {
+  DIR *dir = opendir(path);
+  struct dirent *entry;
+  while (dir && (entry = readdir(dir))) {
+    if (entry->d_name[0] == '.')
+      continue;
+    char file[512];
+    snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+    unlink(file);
+  }
+  if (dir)
+    closedir(dir);
+  rmdir(path);
+}
+
+int main(int argc, char *argv[]) {
+  const char *src_dir = argc > 1 ? argv[1] : CG_DIR;
+
+  char cg_dir[64];
+  snprintf(cg_dir, sizeof(cg_dir), "/tmp/variant_bench_%d", getpid());
+  sceIoMkdir(cg_dir, 0777);
+  copy_cg(src_dir, VARIANT_VS, cg_dir, vs_glsl);
+  copy_cg(src_dir, PLAIN_FS, cg_dir, fs_glsl);
+
+  char cache_dir[64];
+  snprintf(cache_dir, sizeof(cache_dir), "/tmp/variant_bench_cache_%d", getpid());
+
+  // Boot like the loader does, the worker builds the variants in the background
+  gl_stubs_reset();
+  shader_cache_init(NULL, cg_dir, cache_dir);
+  shader_warmup_start();
+
+  glShaderSourceHook(1, 1, &vs_glsl, NULL);
+  glCompileShaderHook(1);
+  glShaderSourceHook(2, 1, &fs_glsl, NULL);
+  glCompileShaderHook(2);
+
+  GLuint prog = glCreateProgram();
+  glAttachShaderHook(prog, 1);
+  glAttachShaderHook(prog, 2);
+  glBindAttribLocation(prog, 0, "In.Pos");
+  variant_bind_attrib(prog, 0, "In.Pos");
+  glLinkProgram(prog);
+  glDeleteShaderHook(1);
+  glDeleteShaderHook(2);
+
+  GLint param_loc = glGetUniformLocationHook(prog, "vsShaderParam");
+  GLint diffuse_loc = glGetUniformLocationHook(prog, "vDiffuseColor");
+  GLint matrix_loc = glGetUniformLocationHook(prog, "matWorldViewProj");
+  GLint long_loc = glGetUniformLocationHook(prog, LONG_NAME);
+
+  static const float xs[] = { 0.0f, 0.5f, 0.50001f, 1.0f };
+  static const float zs[] = { 0.0f, 1.0f, 0.25f, 0.999f, 0.0f };
+
+  srand(1);
+  int draws = 0, mismatches = 0, stale = 0;
+  glUseProgramHook(prog);
+
+  float matrix[16];
+  for (int i = 0; i < 16; i++)
+    matrix[i] = i;
+  glUniformMatrix4fvHook(matrix_loc, 1, GL_FALSE, matrix);
+  float long_value[4] = { 1.0f, 2.0f, 3.0f, 4.0f };
+  glUniform4fvHook(long_loc, 1, long_value);
+
+  for (int xi = 0; xi < sizeof(xs) / sizeof(*xs); xi++) {
+    for (int zi = 0; zi < sizeof(zs) / sizeof(*zs); zi++) {
+      float param[4] = { xs[xi], 0.0f, zs[zi], 0.01f * draws };
+      float diffuse[4];
+      for (int i = 0; i < 4; i++)
+        diffuse[i] = (float)rand() / RAND_MAX;
+      glUniform4fvHook(param_loc, 1, param);
+      glUniform4fvHook(diffuse_loc, 1, diffuse);
+      glDrawArraysHook(GL_TRIANGLES, 0, 3);
+      draws++;
+
+      // The variant has to see the same values the game set on its program
+      GLuint bound = gl_stubs_bound_program();
+      const GLfloat *p = gl_stubs_uniform(bound, "vsShaderParam");
+      const GLfloat *d = gl_stubs_uniform(bound, "vDiffuseColor");
+      const GLfloat *m = gl_stubs_uniform(bound, "matWorldViewProj");
+      const GLfloat *l = gl_stubs_uniform(bound, LONG_NAME);
+      if (!p || !d || !m || !l || memcmp(p, param, sizeof(param)) || memcmp(d, diffuse, sizeof(diffuse)) ||
+          memcmp(m, matrix, sizeof(matrix)) || memcmp(l, long_value, sizeof(long_value)))
+        stale++;
+
+      int variant = bound_variant();
+      for (int i = 0; i < 64; i++) {
+        float lit = (float)rand() / RAND_MAX;
+        float color = (float)rand() / RAND_MAX;
+        for (int c = 0; c < 4; c++) {
+          if (color_variant(variant, param, lit, diffuse[c], color) != color_generic(param, lit, diffuse[c], color))
+            mismatches++;
+        }
+      }
+    }
+  }
+
+  int compiles = gl_calls.compiles;
+
+  // The state cache leaves the program's uniforms to the variants, a value
+  // set again after another variant drew still reaches the next one
+  gl_state_init(NULL, 1);
+  glUseProgramCached(prog);
+  float lit_param[4] = { 1.0f, 0.0f, 0.0f, 0.0f };
+  float blend_param[4] = { 0.0f, 0.0f, 0.5f, 0.0f };
+  glUniform4fvCached(param_loc, 1, lit_param);
+  glDrawArraysHook(GL_TRIANGLES, 0, 3);
+  glUniform4fvCached(param_loc, 1, blend_param);
+  glDrawArraysHook(GL_TRIANGLES, 0, 3);
+  glUniform4fvCached(param_loc, 1, lit_param);
+  glUniform4fvCached(param_loc, 1, lit_param);
+  glDrawArraysHook(GL_TRIANGLES, 0, 3);
+  const GLfloat *lp = gl_stubs_uniform(gl_stubs_bound_program(), "vsShaderParam");
+  int one_shadow = uniform_cache_get_stats()->calls == 0 && bound_variant() == VARIANT_LIT &&
+                   lp && memcmp(lp, lit_param, sizeof(lit_param)) == 0;
+
+  // A location the hooks never handed out goes to the game's program, which
+  // then has to draw since the variants never got the value
+  float fog[4] = { 0.5f, 0.25f, 0.125f, 1.0f };
+  glUniform4fvHook(glGetUniformLocation(prog, "vFogColor"), 1, fog);
+  const GLfloat *f = gl_stubs_uniform(prog, "vFogColor");
+  int direct = f && memcmp(f, fog, sizeof(fog)) == 0;
+  glDrawArraysHook(GL_TRIANGLES, 0, 3);
+  direct = direct && gl_stubs_bound_program() == prog;
+
+  // Deleted while the program still needed them, gone along with it
+  int kept = gl_stubs_source(1) && gl_stubs_source(2);
+  glDeleteProgramHook(prog);
+  int deleted = kept && !gl_stubs_source(1) && !gl_stubs_source(2);
+
+  // The rest of the index is still warming up in the background
+  shader_warmup_wait();
+
+  variant_stats *stats = shader_variant_stats();
+  int ok = stats->programs == 1 && stats->builds == VARIANT_COUNT - 1 && mismatches == 0 && stale == 0 &&
+           stats->draws[VARIANT_GENERIC] == 1 && compiles == 0 && one_shadow && direct && deleted;
+
+  printf("{\"draws\":%d,\"builds\":%d,\"lit\":%d,\"color\":%d,\"diffuse\":%d,\"blend\":%d,",
+         draws, stats->builds, stats->draws[VARIANT_LIT], stats->draws[VARIANT_COLOR],
+         stats->draws[VARIANT_DIFFUSE], stats->draws[VARIANT_BLEND]);
+  printf("\"use_programs\":%d,\"uniform_calls\":%d,\"stale\":%d,\"mismatches\":%d,",
+         gl_calls.use_programs, gl_calls.uniforms, stale, mismatches);
+  printf("\"warmed\":%d,\"compiles\":%d,\"one_shadow\":%s,\"direct\":%s,\"deleted\":%s,\"ok\":%s}\n",
+         shader_cache_stats()->warmed, compiles, one_shadow ? "true" : "false", direct ? "true" : "false", deleted ? "true" : "false", ok ? "true" : "false");
+
+
+  shader_index_free();
+  unlink_cg(cg_dir, vs_glsl);
+  unlink_cg(cg_dir, fs_glsl);
+  rmdir(cg_dir);
+  remove_dir(cache_dir);
+
+  return ok ? 0 : 1;
+}
@@ -2,6 +2,8 @@
 #define __CONFIG_H__
 
 // #define DEBUG
+// #define LAZY_BIND
+// #define GL_TRACE
 
 #define LOAD_ADDRESS 0x98000000
 
@@ -10,10 +12,32 @@
 
 #define DATA_PATH "ux0:data/crazytaxi"
 #define CG_PATH "app0:cg"
+#define SHADER_PACK_PATH "app0:shaders.bin"
+#define SHADER_CACHE_PATH DATA_PATH "/gxp"
+#define TEXTURE_CACHE_PATH DATA_PATH "/mip"
+#define TRANSCODE_CACHE_PATH DATA_PATH "/tex"
+#define RESIDENCY_SPILL_PATH DATA_PATH "/evict"
+#define PRELINK_PATH DATA_PATH "/prelink.bin"
+#define GL_TRACE_PATH DATA_PATH "/gl_trace.bin"
+#define SO_PATH DATA_PATH "/libgl2jni.so"
+#define APK_PATH DATA_PATH "/base.apk"
+#define APK_SO_ENTRY "lib/armeabi-v7a/libgl2jni.so"
+#define STARTUP_REPORT_PATH DATA_PATH "/startup.txt"
+#define STARTUP_HISTORY_PATH DATA_PATH "/startup_history.txt"
+#define STARTUP_HISTORY_SIZE 32
 
 #define SCREEN_W 960
 #define SCREEN_H 544
 
+#define FRAME_STATS_INTERVAL 300
+#define FB_READBACK_LATENCY 1
+
+#define TEXTURE_MIP_MIN_SIZE 32
+#define TEXTURE_MIP_FILTER GL_LINEAR_MIPMAP_NEAREST
+
+#define TEXTURE_BUDGET_MB 64
+#define TEXTURE_STORE_MB 32
+
 #define ANALOG_CENTER 128
 #define ANALOG_THRESHOLD 32
 
@@ -0,0 +1,602 @@
+/* dedup.c -- sharing of identical texture uploads
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * The game uploads the same payload under several names, like the shop signs
+ * MendReplaceTex swaps between. Level 0 uploads are hashed into a table, and
+ * a name whose contents match the bytes of a texture already in video memory
+ * is pointed at that texture instead of getting a copy of its own. Binding a name binds
+ * whatever texture backs it. Before anything writes to a shared texture
+ * (sub image updates, differing parameters, mips that don't match, render
+ * targets) the writer gets a private copy made from the shared storage.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "config.h"
+#include "dedup.h"
+#include "gl_state.h"
+#include "residency.h"
+#include "murmur.h"
+#include "texture.h"
+#include "transcode.h"
+
+#define MAX_UNITS 8
+#define MAX_LEVELS 16
+
+enum {
+  PARAM_MIN_FILTER,
+  PARAM_MAG_FILTER,
+  PARAM_WRAP_S,
+  PARAM_WRAP_T,
+  NUM_PARAMS,
+};
+
+static const GLenum param_names[NUM_PARAMS] = {
+  GL_TEXTURE_MIN_FILTER, GL_TEXTURE_MAG_FILTER, GL_TEXTURE_WRAP_S, GL_TEXTURE_WRAP_T,
+};
+
+static const GLint param_defaults[NUM_PARAMS] = {
+  GL_NEAREST_MIPMAP_LINEAR, GL_LINEAR, GL_REPEAT, GL_REPEAT,
+};
+
+typedef struct {
+  GLuint backing;     // texture this name samples, 0 while that is its own
+  int aliases;        // other names backed by this name's texture
+  int deleted;        // the game deleted the name, or the loader made it
+  int stored;         // the name's own texture holds something
+  uint32_t params_set; // bit per params[] entry off its default
+  GLint params[NUM_PARAMS];
+  int keyed;          // level 0 is known and can be shared
+  uint64_t hash;
+  GLuint next;        // next keyed name in the same bucket
+  GLint internalformat;
+  GLsizei width;
+  GLsizei height;
+  GLenum format;
+  GLenum type;
+  int compressed;
+  uint32_t size;      // level 0 bytes
+  uint32_t bytes;     // every level the game uploaded
+  uint32_t levels;    // bit per level above 0 the game uploaded
+  uint64_t level_hash[MAX_LEVELS];
+} dedup_name;
+
+static dedup_name *names = NULL;
+static int num_names = 0;
+
+// Keyed names chained by the low bits of their hash
+static GLuint *buckets = NULL;
+static uint32_t bucket_mask = 0;
+static int num_keyed = 0;
+
+static GLuint bound[MAX_UNITS];
+static int unit = 0;
+
+// Uploads the loader makes to fill a copy go straight through
+static int copying = 0;
+
+static dedup_stats stats;
+
+static dedup_name *name_get(GLuint texture) {
+  if (texture >= num_names) {
+    int count = num_names ? num_names : 256;
+    while (count <= texture)
+      count *= 2;
+    dedup_name *grown = realloc(names, count * sizeof(dedup_name));
+    if (!grown)
+      return NULL;
+    memset(grown + num_names, 0, (count - num_names) * sizeof(dedup_name));
+    names = grown;
+    num_names = count;
+  }
+
+  return &names[texture];
+}
+
+static dedup_name *name_find(GLuint texture) {
+  return texture < num_names ? &names[texture] : NULL;
+}
+
+GLuint dedup_backing(GLuint texture) {
+  dedup_name *name = name_find(texture);
+  return name && name->backing ? name->backing : texture;
+}
+
+// Live names whose level 0 is this name's texture
+static int users(GLuint texture) {
+  dedup_name *name = name_find(texture);
+  if (!name)
+    return 1;
+  return name->aliases + (!name->deleted && !name->backing);
+}
+
+static GLint param_value(dedup_name *name, int i) {
+  return name->params_set & (1 << i) ? name->params[i] : param_defaults[i];
+}
+
+static int param_index(GLenum pname) {
+  for (int i = 0; i < NUM_PARAMS; i++) {
+    if (param_names[i] == pname)
+      return i;
+  }
+  return -1;
+}
+
+static void bind_backing(GLuint texture) {
+  glBindTexture(GL_TEXTURE_2D, texture);
+  residency_bind(texture);
+}
+
+static GLuint *bucket_of(uint64_t hash) {
+  return &buckets[(uint32_t)hash & bucket_mask];
+}
+
+static void unlink_key(GLuint texture) {
+  dedup_name *name = &names[texture];
+  if (!name->keyed)
+    return;
+
+  GLuint *link = bucket_of(name->hash);
+  while (*link != texture)
+    link = &names[*link].next;
+  *link = name->next;
+  name->next = 0;
+  name->keyed = 0;
+  num_keyed--;
+}
+
+static int grow_buckets(void) {
+  uint32_t size = buckets ? (bucket_mask + 1) * 2 : 64;
+  GLuint *grown = calloc(size, sizeof(GLuint));
+  if (!grown)
+    return -1;
+
+  free(buckets);
+  buckets = grown;
+  bucket_mask = size - 1;
+  for (int i = 1; i < num_names; i++) {
+    if (names[i].keyed) {
+      GLuint *head = bucket_of(names[i].hash);
+      names[i].next = *head;
+      *head = i;
+    }
+  }
+  return 0;
+}
+
+// Without room in the table the name just isn't shared
+static void link_key(GLuint texture, uint64_t hash) {
+  unlink_key(texture);
+  if (num_keyed * 2 >= (buckets ? bucket_mask + 1 : 0) && grow_buckets() < 0 && !buckets)
+    return;
+
+  dedup_name *name = &names[texture];
+  GLuint *head = bucket_of(hash);
+  name->keyed = 1;
+  name->hash = hash;
+  name->next = *head;
+  *head = texture;
+  num_keyed++;
+}
+
+static void forget_key(GLuint texture) {
+  unlink_key(texture);
+  names[texture].levels = 0;
+  names[texture].bytes = 0;
+}
+
+// Returns 1 once nothing uses the texture and its GL name can go
+static int release(GLuint texture) {
+  dedup_name *name = name_find(texture);
+  if (!name || users(texture) > 0)
+    return 0;
+
+  if (!name->deleted) {
+    forget_key(texture);
+    return 0;
+  }
+
+  unlink_key(texture);
+  memset(name, 0, sizeof(dedup_name));
+  return 1;
+}
+
+static void unlink_backing(GLuint texture) {
+  GLuint backing = names[texture].backing;
+  if (!backing)
+    return;
+
+  gl_state_forget_texture(texture);
+  names[texture].backing = 0;
+  names[backing].aliases--;
+  if (release(backing))
+    texture_delete(1, &backing);
+}
+
+static void link_backing(GLuint texture, GLuint backing) {
+  unlink_backing(texture);
+  if (backing != texture) {
+    gl_state_forget_texture(texture);
+    names[backing].aliases++;
+    names[texture].backing = backing;
+  }
+}
+
+// The name's own texture has nothing left to show, give its memory back
+static void empty_storage(GLuint texture) {
+  copying = 1;
+  bind_backing(texture);
+  glTexImage2DHook(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  copying = 0;
+
+  forget_key(texture);
+  names[texture].stored = 0;
+}
+
+// Moves the name off a shared texture onto one of its own and binds that. The
+// parameters come along, the contents are up to the caller.
+static GLuint make_private(GLuint texture) {
+  GLuint current = dedup_backing(texture);
+  if (users(current) <= 1)
+    return current;
+
+  // Others sample the name's own texture, so the copy needs a fresh one
+  GLuint own = texture;
+  if (names[texture].aliases) {
+    glGenTextures(1, &own);
+    if (!name_get(own)) {
+      debugPrintf("Warning: could not track a copy of texture %d, writing the shared one\n", current);
+      glDeleteTextures(1, &own);
+      bind_backing(current);
+      return current;
+    }
+    names[own].deleted = 1;
+  }
+
+  dedup_name *shared = &names[current];
+  uint32_t params_set = shared->params_set;
+  GLint params[NUM_PARAMS];
+  memcpy(params, shared->params, sizeof(params));
+
+  link_backing(texture, own);
+
+  dedup_name *entry = &names[own];
+  forget_key(own);
+  entry->stored = 0;
+  entry->params_set = params_set;
+  memcpy(entry->params, params, sizeof(params));
+
+  bind_backing(own);
+  copying = 1;
+  for (int i = 0; i < NUM_PARAMS; i++)
+    glTexParameteriHook(GL_TEXTURE_2D, param_names[i], param_value(entry, i));
+  copying = 0;
+
+  return own;
+}
+
+// Gives the name a private copy of what it samples before it gets written to
+static GLuint unshare(GLuint texture) {
+  GLuint current = dedup_backing(texture);
+  if (users(current) <= 1)
+    return current;
+
+  // Binding brings the shared texture back first if it was evicted. The others
+  // keep sampling it, so its storage stays valid to copy from.
+  dedup_name key = names[current];
+  bind_backing(current);
+  const void *data = vglGetTexDataPointer(GL_TEXTURE_2D);
+  if (!residency_present(current))
+    data = NULL;
+
+  GLuint own = make_private(texture);
+  if (own == current)
+    return own;
+  if (!data) {
+    debugPrintf("Warning: could not read shared texture %d, the copy starts empty\n", current);
+    return own;
+  }
+
+  copying = 1;
+  if (key.compressed)
+    glCompressedTexImage2DHook(GL_TEXTURE_2D, 0, key.format, key.width, key.height, 0, key.size, data);
+  else
+    glTexImage2DHook(GL_TEXTURE_2D, 0, key.internalformat, key.width, key.height, 0, key.format, key.type, data);
+
+  // Supplied mips can't be read back, a generated chain stands in for them
+  if (key.levels)
+    glGenerateMipmapHook(GL_TEXTURE_2D);
+  copying = 0;
+
+  dedup_name *entry = &names[own];
+  entry->stored = 1;
+  link_key(own, key.hash);
+  entry->internalformat = key.internalformat;
+  entry->width = key.width;
+  entry->height = key.height;
+  entry->format = key.format;
+  entry->type = key.type;
+  entry->compressed = key.compressed;
+  entry->size = key.size;
+  entry->bytes = key.bytes;
+  entry->levels = key.levels;
+  memcpy(entry->level_hash, key.level_hash, sizeof(key.level_hash));
+
+  stats.copies++;
+  return own;
+}
+
+// A hash match only picks the candidates, the bytes in video memory decide
+static GLuint find_match(GLuint current, dedup_name *key, const void *data) {
+  if (!buckets)
+    return 0;
+
+  dedup_name *params = &names[current];
+  GLuint match = 0, compared = 0;
+  for (GLuint i = *bucket_of(key->hash); i && !match; i = names[i].next) {
+    dedup_name *name = &names[i];
+    if (i == current || users(i) == 0)
+      continue;
+
+    if (name->hash != key->hash ||
+        name->size != key->size ||
+        name->width != key->width ||
+        name->height != key->height ||
+        name->internalformat != key->internalformat ||
+        name->format != key->format ||
+        name->type != key->type ||
+        name->compressed != key->compressed)
+      continue;
+
+    // Sampling state is shared too. Games set it after the upload, so only
+    // what the name already set has to agree, the rest it takes over.
+    int same = 1;
+    for (int j = 0; j < NUM_PARAMS; j++) {
+      if (params->params_set & (1 << j))
+        same &= param_value(name, j) == param_value(params, j);
+    }
+    if (!same)
+      continue;
+
+    bind_backing(i);
+    compared = i;
+    const void *contents = vglGetTexDataPointer(GL_TEXTURE_2D);
+    if (contents && residency_present(i) && memcmp(contents, data, key->size) == 0)
+      match = i;
+  }
+
+  // The upload goes to whatever is bound
+  if (compared && !match)
+    bind_backing(current);
+  return match;
+}
+
+static int dedup_level(GLuint texture, GLint level, const void *data, uint32_t size) {
+  GLuint current = dedup_backing(texture);
+  dedup_name *entry = name_find(current);
+  if (!entry || !entry->keyed)
+    return 0;
+
+  if (level >= MAX_LEVELS || !data) {
+    unshare(texture);
+    forget_key(dedup_backing(texture));
+    return 0;
+  }
+
+  uint64_t start = sceKernelGetProcessTimeWide();
+  uint64_t hash = murmur64(data, size);
+  stats.hashed++;
+  stats.hash_bytes += size;
+  stats.hash_time += sceKernelGetProcessTimeWide() - start;
+
+  if (users(current) > 1) {
+    if ((entry->levels & (1 << level)) && entry->level_hash[level] == hash) {
+      stats.hits++;
+      stats.hit_bytes += size;
+      return 1;
+    }
+    current = unshare(texture);
+    entry = &names[current];
+  }
+
+  entry->levels |= 1 << level;
+  entry->level_hash[level] = hash;
+  entry->bytes += size;
+  return 0;
+}
+
+int dedup_image(GLint level, GLint internalformat, GLsizei width, GLsizei height, GLenum format, GLenum type, const void *data, uint32_t size, int compressed) {
+  GLuint texture = bound[unit];
+  if (copying || !texture || !name_get(texture))
+    return 0;
+
+  if (level > 0)
+    return dedup_level(texture, level, data, size);
+
+  GLuint current = dedup_backing(texture);
+  int shareable = data && residency_snapshot_layout(width, format, type, compressed) &&
+                  !(compressed && transcode_needed(format, width, height));
+
+  if (shareable) {
+    dedup_name key;
+    key.internalformat = internalformat;
+    key.width = width;
+    key.height = height;
+    key.format = format;
+    key.type = type;
+    key.compressed = compressed;
+    key.size = size;
+
+    uint64_t start = sceKernelGetProcessTimeWide();
+    key.hash = murmur64(data, size);
+    stats.hashed++;
+    stats.hash_bytes += size;
+    stats.hash_time += sceKernelGetProcessTimeWide() - start;
+
+    GLuint match = find_match(current, &key, data);
+    if (match) {
+      // Nobody else needs what the name held before
+      if (!names[texture].backing && !names[texture].aliases && names[texture].stored)
+        empty_storage(texture);
+
+      link_backing(texture, match);
+      bind_backing(match);
+      stats.hits++;
+      stats.hit_bytes += size;
+      return 1;
+    }
+
+    GLuint own = make_private(texture);
+    dedup_name *entry = &names[own];
+    forget_key(own);
+    entry->stored = 1;
+    link_key(own, key.hash);
+    entry->internalformat = internalformat;
+    entry->width = width;
+    entry->height = height;
+    entry->format = format;
+    entry->type = type;
+    entry->compressed = compressed;
+    entry->size = size;
+    entry->bytes = size;
+    return 0;
+  }
+
+  // New contents, whatever was shared stays with the other names
+  GLuint own = make_private(texture);
+  forget_key(own);
+  names[own].stored = 1;
+  return 0;
+}
+
+void dedup_write(void) {
+  GLuint texture = bound[unit];
+  if (copying || !texture || texture >= num_names)
+    return;
+
+  // The contents no longer match their hash
+  GLuint own = unshare(texture);
+  forget_key(own);
+}
+
+void dedup_parameter(GLenum pname, GLint param) {
+  GLuint texture = bound[unit];
+  if (copying || !texture || !name_get(texture))
+    return;
+
+  int i = param_index(pname);
+  GLuint current = dedup_backing(texture);
+  if (i >= 0 && param_value(&names[current], i) == param)
+    return;
+
+  if (users(current) > 1)
+    current = unshare(texture);
+  if (i >= 0) {
+    names[current].params_set |= 1 << i;
+    names[current].params[i] = param;
+  }
+}
+
+GLuint dedup_attach(GLuint texture) {
+  if (!texture || texture >= num_names)
+    return texture;
+
+  // Rendering into it makes it a texture of its own
+  GLuint own = unshare(texture);
+  forget_key(own);
+  bind_backing(dedup_backing(bound[unit]));
+  return own;
+}
+
+GLuint dedup_bind(GLuint texture) {
+  bound[unit] = texture;
+  return dedup_backing(texture);
+}
+
+void dedup_active(GLenum texture_unit) {
+  unit = texture_unit - GL_TEXTURE0;
+  if (unit < 0 || unit >= MAX_UNITS)
+    unit = 0;
+}
+
+// Fills doomed with the GL names to actually delete, at most 2 per name
+int dedup_delete(GLsizei n, const GLuint *textures, GLuint *doomed) {
+  int count = 0;
+
+  for (int i = 0; i < n; i++) {
+    GLuint texture = textures[i];
+    if (!texture)
+      continue;
+
+    for (int j = 0; j < MAX_UNITS; j++) {
+      if (bound[j] == texture) {
+        bound[j] = 0;
+        // GL would leave the backing bound, and the next upload would land in it
+        if (j == unit)
+          bind_backing(0);
+      }
+    }
+
+    dedup_name *name = name_find(texture);
+    if (!name || name->deleted) {
+      doomed[count++] = texture;
+      continue;
+    }
+
+    GLuint backing = name->backing;
+    name->deleted = 1;
+    name->backing = 0;
+    if (backing) {
+      names[backing].aliases--;
+      if (release(backing))
+        doomed[count++] = backing;
+    }
+
+    // Still backing other names, the GL name lives on until they go
+    if (release(texture))
+      doomed[count++] = texture;
+  }
+
+  return count;
+}
+
+dedup_stats *dedup_get_stats(void) {
+  stats.shared = 0;
+  stats.saved_bytes = 0;
+  for (int i = 1; i < num_names; i++) {
+    dedup_name *name = &names[i];
+    if (name->backing && users(name->backing) > 1)
+      stats.shared++;
+    if (name->keyed && users(i) > 1)
+      stats.saved_bytes += (uint64_t)(users(i) - 1) * name->bytes;
+  }
+  return &stats;
+}
+
+void dedup_frame(void) {
+  if (++stats.frames < FRAME_STATS_INTERVAL)
+    return;
+
+  dedup_get_stats();
+  debugPrintf("Dedup %u names share %.2f MB, %u of %u uploads skipped (%.2f MB) %u copies, %.3f ms hashing\n",
+              stats.shared, stats.saved_bytes / 1048576.0f, stats.hits, stats.hashed,
+              stats.hit_bytes / 1048576.0f, stats.copies, stats.hash_time / 1000.0f);
+
+  stats.frames = 0;
+  stats.hashed = 0;
+  stats.hash_bytes = 0;
+  stats.hash_time = 0;
+  stats.hits = 0;
+  stats.hit_bytes = 0;
+  stats.copies = 0;
+}
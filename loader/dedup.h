@@ -0,0 +1,30 @@
+#ifndef __DEDUP_H__
+#define __DEDUP_H__
+
+#include <vitaGL.h>
+
+typedef struct {
+  uint32_t frames;
+  uint32_t hashed;      // uploads hashed against the shared textures
+  uint64_t hash_bytes;
+  uint64_t hash_time;   // microseconds spent hashing
+  uint32_t hits;        // uploads skipped because the contents were already there
+  uint64_t hit_bytes;
+  uint32_t copies;      // shared textures copied before a write
+  uint32_t shared;      // names currently sampling another name's texture
+  uint64_t saved_bytes; // video memory those names would otherwise take
+} dedup_stats;
+
+dedup_stats *dedup_get_stats(void);
+void dedup_frame(void);
+
+GLuint dedup_backing(GLuint texture);
+GLuint dedup_bind(GLuint texture);
+void dedup_active(GLenum unit);
+int dedup_image(GLint level, GLint internalformat, GLsizei width, GLsizei height, GLenum format, GLenum type, const void *data, uint32_t size, int compressed);
+void dedup_write(void);
+void dedup_parameter(GLenum pname, GLint param);
+GLuint dedup_attach(GLuint texture);
+int dedup_delete(GLsizei n, const GLuint *textures, GLuint *doomed);
+
+#endif
@@ -0,0 +1,400 @@
+/* framebuffer.c -- framebuffer object emulation
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * Framebuffers whose color attachment is a renderable texture are real
+ * vitaGL framebuffers, so the game draws straight into the texture. Any
+ * other attachment keeps the old behaviour: the game draws to the screen and
+ * the attach copies the screen into the texture with glReadPixels.
+ *
+ * Copies only read back the part of the screen drawn while a copy-path
+ * framebuffer was bound and go through a ring of buffers. With
+ * FB_READBACK_LATENCY frames of latency a readback is uploaded after the swap
+ * that passes its fence, or earlier when the ring needs its slot back.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "config.h"
+#include "dedup.h"
+#include "framebuffer.h"
+
+enum {
+  FB_NONE,
+  FB_NATIVE, // bound for real, draws land in the attachment
+  FB_COPY,   // drawn to the screen and copied out on attach
+};
+
+typedef struct {
+  int mode;
+  GLuint texture;
+  GLuint renderbuffer;
+  GLenum renderbuffer_attachment;
+} fb_info;
+
+typedef struct {
+  GLenum format;
+  GLenum type;
+  int screen_sized; // storage reallocated by the copy path
+} fb_texture;
+
+typedef struct {
+  int x, y, w, h;
+} fb_rect;
+
+typedef struct {
+  GLuint texture; // 0 while free
+  uint32_t frame; // fence, the frame the pixels were read in
+  fb_rect rect;
+  void *data;
+} readback_slot;
+
+#define READBACK_SLOTS (FB_READBACK_LATENCY + 1)
+
+static fb_info *framebuffers = NULL;
+static int num_framebuffers = 0;
+
+static fb_texture *textures = NULL;
+static int num_textures = 0;
+
+static GLuint bound = 0;
+
+static readback_slot ring[READBACK_SLOTS];
+static int ring_head = 0;
+static uint32_t frame = 0;
+
+// Screen area drawn for copy-path framebuffers since the last copy
+static fb_rect viewport = { 0, 0, SCREEN_W, SCREEN_H };
+static fb_rect scissor = { 0, 0, SCREEN_W, SCREEN_H };
+static int scissor_test = 0;
+static fb_rect dirty = { 0, 0, 0, 0 };
+
+static framebuffer_stats stats;
+static uint64_t last_frame = 0;
+
+framebuffer_stats *framebuffer_get_stats(void) {
+  return &stats;
+}
+
+static void *grow(void *array, int *count, size_t size, GLuint index) {
+  if (index < *count)
+    return array;
+
+  int new_count = *count ? *count : 64;
+  while (new_count <= index)
+    new_count *= 2;
+
+  uint8_t *grown = realloc(array, new_count * size);
+  if (!grown)
+    return NULL;
+  memset(grown + *count * size, 0, (new_count - *count) * size);
+  *count = new_count;
+  return grown;
+}
+
+static fb_info *fb_get(GLuint framebuffer) {
+  void *grown = grow(framebuffers, &num_framebuffers, sizeof(fb_info), framebuffer);
+  if (!grown)
+    return NULL;
+  framebuffers = grown;
+  return &framebuffers[framebuffer];
+}
+
+static fb_texture *texture_get(GLuint texture) {
+  void *grown = grow(textures, &num_textures, sizeof(fb_texture), texture);
+  if (!grown)
+    return NULL;
+  textures = grown;
+  return &textures[texture];
+}
+
+void framebuffer_texture_image(GLenum target, GLint level, GLenum format, GLenum type) {
+  if (target != GL_TEXTURE_2D || level != 0)
+    return;
+
+  GLint texture = 0;
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+
+  fb_texture *info = texture_get(texture);
+  if (info) {
+    info->format = format;
+    info->type = type;
+    info->screen_sized = 0;
+  }
+}
+
+// Color formats vitaGL can render into
+static int texture_renderable(GLuint texture) {
+  fb_texture *info = texture < num_textures ? &textures[texture] : NULL;
+  if (!info)
+    return 0;
+
+  return (info->format == GL_RGBA && info->type == GL_UNSIGNED_BYTE) ||
+         (info->format == GL_RGB && info->type == GL_UNSIGNED_BYTE) ||
+         (info->format == GL_RGB && info->type == GL_UNSIGNED_SHORT_5_6_5);
+}
+
+static fb_rect rect_intersect(fb_rect a, fb_rect b) {
+  fb_rect r;
+  r.x = a.x > b.x ? a.x : b.x;
+  r.y = a.y > b.y ? a.y : b.y;
+  int x1 = a.x + a.w < b.x + b.w ? a.x + a.w : b.x + b.w;
+  int y1 = a.y + a.h < b.y + b.h ? a.y + a.h : b.y + b.h;
+  r.w = x1 > r.x ? x1 - r.x : 0;
+  r.h = y1 > r.y ? y1 - r.y : 0;
+  return r;
+}
+
+static fb_rect rect_union(fb_rect a, fb_rect b) {
+  if (a.w == 0 || a.h == 0)
+    return b;
+  if (b.w == 0 || b.h == 0)
+    return a;
+
+  fb_rect r;
+  r.x = a.x < b.x ? a.x : b.x;
+  r.y = a.y < b.y ? a.y : b.y;
+  int x1 = a.x + a.w > b.x + b.w ? a.x + a.w : b.x + b.w;
+  int y1 = a.y + a.h > b.y + b.h ? a.y + a.h : b.y + b.h;
+  r.w = x1 - r.x;
+  r.h = y1 - r.y;
+  return r;
+}
+
+void framebuffer_draw(void) {
+  // Only draws meant for a copy-path framebuffer end up in a texture
+  fb_info *info = bound < num_framebuffers ? &framebuffers[bound] : NULL;
+  if (!bound || (info && info->mode == FB_NATIVE))
+    return;
+
+  static const fb_rect screen = { 0, 0, SCREEN_W, SCREEN_H };
+  fb_rect area = rect_intersect(viewport, screen);
+  if (scissor_test)
+    area = rect_intersect(area, scissor);
+  dirty = rect_union(dirty, area);
+}
+
+static void readback_upload(readback_slot *slot) {
+  fb_texture *info = texture_get(slot->texture);
+
+  // Put the game's binding back, the GL state cache assumes it never changed
+  GLint bound = 0;
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+  glBindTexture(GL_TEXTURE_2D, slot->texture);
+
+  // Storage is allocated once, later copies only update what changed
+  if (!info || !info->screen_sized) {
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, SCREEN_W, SCREEN_H, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    if (info)
+      info->screen_sized = 1;
+  }
+
+  glTexSubImage2D(GL_TEXTURE_2D, 0, slot->rect.x, slot->rect.y, slot->rect.w, slot->rect.h, GL_RGBA, GL_UNSIGNED_BYTE, slot->data);
+
+  glBindTexture(GL_TEXTURE_2D, bound);
+
+  slot->texture = 0;
+  stats.uploads++;
+}
+
+static void framebuffer_copy(GLuint texture) {
+  uint64_t start = sceKernelGetProcessTimeWide();
+
+  fb_rect rect = dirty;
+  dirty.w = dirty.h = 0;
+
+  // The first copy into a texture has to fill all of it
+  fb_texture *info = texture < num_textures ? &textures[texture] : NULL;
+  if (!info || !info->screen_sized) {
+    rect.x = rect.y = 0;
+    rect.w = SCREEN_W;
+    rect.h = SCREEN_H;
+  }
+
+  if (rect.w > 0 && rect.h > 0) {
+    readback_slot *slot = &ring[ring_head];
+    ring_head = (ring_head + 1) % READBACK_SLOTS;
+
+    // Still waiting for its fence, better early than never
+    if (slot->texture) {
+      readback_upload(slot);
+      stats.early++;
+    }
+    if (!slot->data)
+      slot->data = malloc(SCREEN_W * SCREEN_H * 4);
+
+    if (slot->data) {
+      glReadPixels(rect.x, rect.y, rect.w, rect.h, GL_RGBA, GL_UNSIGNED_BYTE, slot->data);
+      slot->texture = texture;
+      slot->frame = frame;
+      slot->rect = rect;
+      stats.bytes += rect.w * rect.h * 4;
+
+      if (FB_READBACK_LATENCY == 0)
+        readback_upload(slot);
+    }
+  }
+
+  stats.copies++;
+  stats.copy_time += sceKernelGetProcessTimeWide() - start;
+}
+
+void glViewportHook(GLint x, GLint y, GLsizei width, GLsizei height) {
+  viewport.x = x;
+  viewport.y = y;
+  viewport.w = width;
+  viewport.h = height;
+  glViewport(x, y, width, height);
+}
+
+void glScissorHook(GLint x, GLint y, GLsizei width, GLsizei height) {
+  scissor.x = x;
+  scissor.y = y;
+  scissor.w = width;
+  scissor.h = height;
+  glScissor(x, y, width, height);
+}
+
+void glEnableHook(GLenum cap) {
+  if (cap == GL_SCISSOR_TEST)
+    scissor_test = 1;
+  glEnable(cap);
+}
+
+void glDisableHook(GLenum cap) {
+  if (cap == GL_SCISSOR_TEST)
+    scissor_test = 0;
+  glDisable(cap);
+}
+
+void glClearHook(GLbitfield mask) {
+  if (mask & GL_COLOR_BUFFER_BIT)
+    framebuffer_draw();
+  glClear(mask);
+}
+
+void glBindFramebufferHook(GLenum target, GLuint framebuffer) {
+  bound = framebuffer;
+
+  // Framebuffers on the copy path keep drawing to the screen
+  fb_info *info = framebuffer < num_framebuffers ? &framebuffers[framebuffer] : NULL;
+  if (framebuffer && (!info || info->mode != FB_NATIVE))
+    framebuffer = 0;
+
+  glBindFramebuffer(target, framebuffer);
+}
+
+void glDeleteFramebuffersHook(GLsizei n, const GLuint *ids) {
+  for (int i = 0; i < n; i++) {
+    if (ids[i] < num_framebuffers)
+      memset(&framebuffers[ids[i]], 0, sizeof(fb_info));
+    if (ids[i] == bound)
+      bound = 0;
+  }
+
+  glDeleteFramebuffers(n, ids);
+}
+
+void glFramebufferTexture2DHook(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level) {
+  if (attachment == GL_COLOR_ATTACHMENT0)
+    texture = dedup_attach(texture);
+
+  fb_info *info = bound ? fb_get(bound) : NULL;
+  if (!info || texture == 0) {
+    if (info && attachment == GL_COLOR_ATTACHMENT0) {
+      info->texture = 0;
+      info->mode = FB_NONE;
+    }
+    return;
+  }
+
+  if (attachment != GL_COLOR_ATTACHMENT0)
+    return;
+
+  info->texture = texture;
+
+  if (texture_renderable(texture)) {
+    glBindFramebuffer(target, bound);
+    glFramebufferTexture2D(target, attachment, textarget, texture, level);
+    if (info->renderbuffer)
+      glFramebufferRenderbuffer(target, info->renderbuffer_attachment, GL_RENDERBUFFER, info->renderbuffer);
+
+    if (glCheckFramebufferStatus(target) == GL_FRAMEBUFFER_COMPLETE) {
+      info->mode = FB_NATIVE;
+      stats.native++;
+      return;
+    }
+
+    debugPrintf("Warning: framebuffer %d is incomplete, falling back to copies\n", bound);
+    glBindFramebuffer(target, 0);
+  }
+
+  info->mode = FB_COPY;
+  framebuffer_copy(texture);
+}
+
+void glFramebufferRenderbufferHook(GLenum target, GLenum attachment, GLenum renderbuffertarget, GLuint renderbuffer) {
+  fb_info *info = bound ? fb_get(bound) : NULL;
+  if (!info)
+    return;
+
+  // Only matters once the color attachment makes this a real framebuffer
+  info->renderbuffer = renderbuffer;
+  info->renderbuffer_attachment = attachment;
+  if (info->mode == FB_NATIVE)
+    glFramebufferRenderbuffer(target, attachment, renderbuffertarget, renderbuffer);
+}
+
+GLenum glCheckFramebufferStatusHook(GLenum target) {
+  // The copy path always works from the game's point of view
+  fb_info *info = bound < num_framebuffers ? &framebuffers[bound] : NULL;
+  if (bound && (!info || info->mode != FB_NATIVE))
+    return GL_FRAMEBUFFER_COMPLETE;
+  return glCheckFramebufferStatus(target);
+}
+
+void framebuffer_delete_textures(GLsizei n, const GLuint *ids) {
+  for (int i = 0; i < n; i++) {
+    if (ids[i] < num_textures)
+      memset(&textures[ids[i]], 0, sizeof(fb_texture));
+    for (int j = 0; j < READBACK_SLOTS; j++) {
+      if (ring[j].texture == ids[i])
+        ring[j].texture = 0;
+    }
+  }
+}
+
+void framebuffer_frame(void) {
+  uint64_t now = sceKernelGetProcessTimeWide();
+  if (last_frame)
+    stats.frame_time += now - last_frame;
+  last_frame = now;
+
+  frame++;
+
+  // Oldest first, anything fenced at least FB_READBACK_LATENCY frames back
+  for (int i = 0; i < READBACK_SLOTS; i++) {
+    readback_slot *slot = &ring[(ring_head + i) % READBACK_SLOTS];
+    if (slot->texture && frame - slot->frame >= FB_READBACK_LATENCY)
+      readback_upload(slot);
+  }
+
+  if (++stats.frames < FRAME_STATS_INTERVAL)
+    return;
+
+  debugPrintf("Frame %.3f ms, %.2f copies %.3f ms %u bytes, %d native attaches, %d early uploads\n",
+              stats.frame_time / 1000.0f / stats.frames, (float)stats.copies / stats.frames,
+              stats.copy_time / 1000.0f / stats.frames, (unsigned int)(stats.bytes / stats.frames),
+              stats.native, stats.early);
+
+  memset(&stats, 0, sizeof(framebuffer_stats));
+}
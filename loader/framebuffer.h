@@ -0,0 +1,35 @@
+#ifndef __FRAMEBUFFER_H__
+#define __FRAMEBUFFER_H__
+
+#include <vitaGL.h>
+
+typedef struct {
+  uint32_t frames;
+  uint64_t frame_time;  // microseconds across those frames
+  uint32_t native;      // attaches rendering straight into the texture
+  uint32_t copies;      // attaches served by the glReadPixels fallback
+  uint64_t copy_time;   // microseconds spent in the fallback
+  uint64_t bytes;       // read back from the screen
+  uint32_t uploads;     // readbacks uploaded into their texture
+  uint32_t early;       // readbacks uploaded before their fence to free a slot
+} framebuffer_stats;
+
+framebuffer_stats *framebuffer_get_stats(void);
+void framebuffer_texture_image(GLenum target, GLint level, GLenum format, GLenum type);
+void framebuffer_draw(void);
+void framebuffer_delete_textures(GLsizei n, const GLuint *textures);
+void framebuffer_frame(void);
+
+void glViewportHook(GLint x, GLint y, GLsizei width, GLsizei height);
+void glScissorHook(GLint x, GLint y, GLsizei width, GLsizei height);
+void glEnableHook(GLenum cap);
+void glDisableHook(GLenum cap);
+void glClearHook(GLbitfield mask);
+
+void glBindFramebufferHook(GLenum target, GLuint framebuffer);
+void glDeleteFramebuffersHook(GLsizei n, const GLuint *framebuffers);
+void glFramebufferTexture2DHook(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level);
+void glFramebufferRenderbufferHook(GLenum target, GLenum attachment, GLenum renderbuffertarget, GLuint renderbuffer);
+GLenum glCheckFramebufferStatusHook(GLenum target);
+
+#endif
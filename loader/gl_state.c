@@ -0,0 +1,521 @@
+/* gl_state.c -- state cache between the game and vitaGL
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * The game sets its whole render state before every draw, most of it to the
+ * values already set, and vitaGL does work for each of those calls anyway.
+ * The state setters it imports are pointed here instead. Each one keeps what
+ * it last passed on and drops calls that would set the same value again.
+ * Nothing is known until the first call, and deletes forget bindings to the
+ * names they free. Texture bindings are kept by the game's name, so dedup.c
+ * has every unit holding a name forget it when the texture behind the name
+ * changes. The loader's other GL work below this layer puts back any binding
+ * it changes, so what is kept here stays what GL has.
+ *
+ * Uniform uploads are dropped the same way against a shadow copy of the
+ * current program's values, kept in uniform_cache.c. Programs with shader
+ * variants are left out, shader_variant.c records their values itself and
+ * drops repeats there.
+ *
+ * With a trace path, every call the game makes through here is also written
+ * out, so a session can be replayed on the host to see what the cache drops.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "config.h"
+#include "framebuffer.h"
+#include "gl_state.h"
+#include "shader_variant.h"
+#include "texture.h"
+#include "uniform_cache.h"
+
+#define MAX_UNITS 8
+#define TRACE_BUFFER_SIZE (64 * 1024)
+
+enum {
+  KNOWN_ACTIVE_TEXTURE = 1 << 0,
+  KNOWN_PROGRAM = 1 << 1,
+  KNOWN_BLEND_FUNC = 1 << 2,
+  KNOWN_DEPTH_FUNC = 1 << 3,
+  KNOWN_DEPTH_MASK = 1 << 4,
+  KNOWN_CULL_FACE = 1 << 5,
+  KNOWN_COLOR_MASK = 1 << 6,
+  KNOWN_CLEAR_COLOR = 1 << 7,
+  KNOWN_VIEWPORT = 1 << 8,
+  KNOWN_SCISSOR = 1 << 9,
+};
+
+static const GLenum caps[] = {
+  GL_BLEND,
+  GL_CULL_FACE,
+  GL_DEPTH_TEST,
+  GL_DITHER,
+  GL_POLYGON_OFFSET_FILL,
+  GL_SCISSOR_TEST,
+  GL_STENCIL_TEST,
+};
+
+#define NUM_CAPS (sizeof(caps) / sizeof(GLenum))
+
+static const GLenum buffer_targets[] = {
+  GL_ARRAY_BUFFER,
+  GL_ELEMENT_ARRAY_BUFFER,
+};
+
+#define NUM_BUFFER_TARGETS (sizeof(buffer_targets) / sizeof(GLenum))
+
+static const char *call_names[GL_STATE_CALLS] = {
+  "glActiveTexture",
+  "glBindTexture",
+  "glBindBuffer",
+  "glUseProgram",
+  "glEnable",
+  "glDisable",
+  "glBlendFunc",
+  "glDepthFunc",
+  "glDepthMask",
+  "glCullFace",
+  "glColorMask",
+  "glClearColor",
+  "glViewport",
+  "glScissor",
+  "glUniform1i",
+  "glUniform1fv",
+  "glUniform2fv",
+  "glUniform3fv",
+  "glUniform4fv",
+  "glUniformMatrix2fv",
+  "glUniformMatrix3fv",
+  "glUniformMatrix4fv",
+};
+
+static gl_state_stats stats;
+
+static int filter = 1;
+static FILE *trace = NULL;
+
+static uint32_t known = 0;
+static uint32_t textures_known = 0; // bit per unit
+static uint32_t buffers_known = 0;  // bit per buffer target
+static uint32_t caps_known = 0;     // bit per cap
+static uint32_t caps_enabled = 0;
+
+static int unit = 0;
+static GLuint textures[MAX_UNITS];
+static GLuint buffers[NUM_BUFFER_TARGETS];
+static GLuint program;
+static GLenum blend_func[2];
+static GLenum depth_func;
+static GLboolean depth_mask;
+static GLenum cull_face;
+static GLboolean color_mask[4];
+static GLfloat clear_color[4];
+static GLint viewport[4];
+static GLint scissor[4];
+
+static void trace_record(int call, const uint32_t *args, int count) {
+  uint16_t header[2] = { call, count };
+  fwrite(header, sizeof(header), 1, trace);
+  if (count > 0)
+    fwrite(args, sizeof(uint32_t), count, trace);
+}
+
+#define TRACE(call, ...) \
+  do { \
+    if (trace) { \
+      uint32_t args[] = { __VA_ARGS__ }; \
+      trace_record(call, args, sizeof(args) / sizeof(uint32_t)); \
+    } \
+  } while (0)
+
+static uint32_t float_bits(GLfloat value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+// Returns 1 if the call can be dropped
+static int hit(int call, int same) {
+  if (filter && same) {
+    stats.hits[call]++;
+    return 1;
+  }
+  stats.misses[call]++;
+  return 0;
+}
+
+static int known_same(int call, uint32_t bit, int same) {
+  if (hit(call, (known & bit) && same))
+    return 1;
+  known |= bit;
+  return 0;
+}
+
+static int cap_index(GLenum cap) {
+  for (int i = 0; i < NUM_CAPS; i++) {
+    if (caps[i] == cap)
+      return i;
+  }
+  return -1;
+}
+
+static int buffer_index(GLenum target) {
+  for (int i = 0; i < NUM_BUFFER_TARGETS; i++) {
+    if (buffer_targets[i] == target)
+      return i;
+  }
+  return -1;
+}
+
+void gl_state_init(const char *trace_path, int filter_calls) {
+  if (trace)
+    fclose(trace);
+  trace = NULL;
+
+  memset(&stats, 0, sizeof(stats));
+  filter = filter_calls;
+  known = textures_known = buffers_known = caps_known = 0;
+  unit = 0;
+  uniform_cache_reset();
+
+  if (!trace_path)
+    return;
+
+  trace = fopen(trace_path, "wb");
+  if (!trace) {
+    debugPrintf("Could not open GL trace %s\n", trace_path);
+    return;
+  }
+  setvbuf(trace, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+
+  uint32_t magic = GL_TRACE_MAGIC;
+  fwrite(&magic, sizeof(magic), 1, trace);
+}
+
+gl_state_stats *gl_state_get_stats(void) {
+  return &stats;
+}
+
+const char *gl_state_call_name(int call) {
+  return call >= 0 && call < GL_STATE_CALLS ? call_names[call] : NULL;
+}
+
+void glActiveTextureCached(GLenum texture) {
+  TRACE(GL_STATE_ACTIVE_TEXTURE, texture);
+
+  // Binds on units past the ones kept go straight through
+  int index = texture - GL_TEXTURE0;
+  if (index < 0 || index >= MAX_UNITS) {
+    hit(GL_STATE_ACTIVE_TEXTURE, 0);
+    known &= ~KNOWN_ACTIVE_TEXTURE;
+    glActiveTextureHook(texture);
+    return;
+  }
+
+  if (known_same(GL_STATE_ACTIVE_TEXTURE, KNOWN_ACTIVE_TEXTURE, unit == index))
+    return;
+  unit = index;
+  glActiveTextureHook(texture);
+}
+
+void glBindTextureCached(GLenum target, GLuint texture) {
+  TRACE(GL_STATE_BIND_TEXTURE, target, texture);
+
+  // Only 2D bindings are kept, and only once the active unit is known
+  if (target != GL_TEXTURE_2D || !(known & KNOWN_ACTIVE_TEXTURE)) {
+    hit(GL_STATE_BIND_TEXTURE, 0);
+    glBindTextureHook(target, texture);
+    return;
+  }
+
+  uint32_t bit = 1 << unit;
+  if (hit(GL_STATE_BIND_TEXTURE, (textures_known & bit) && textures[unit] == texture))
+    return;
+  textures_known |= bit;
+  textures[unit] = texture;
+  glBindTextureHook(target, texture);
+}
+
+void glBindBufferCached(GLenum target, GLuint buffer) {
+  TRACE(GL_STATE_BIND_BUFFER, target, buffer);
+
+  int index = buffer_index(target);
+  if (index < 0) {
+    hit(GL_STATE_BIND_BUFFER, 0);
+    glBindBuffer(target, buffer);
+    return;
+  }
+
+  uint32_t bit = 1 << index;
+  if (hit(GL_STATE_BIND_BUFFER, (buffers_known & bit) && buffers[index] == buffer))
+    return;
+  buffers_known |= bit;
+  buffers[index] = buffer;
+  glBindBuffer(target, buffer);
+}
+
+void glUseProgramCached(GLuint prog) {
+  TRACE(GL_STATE_USE_PROGRAM, prog);
+
+  if (known_same(GL_STATE_USE_PROGRAM, KNOWN_PROGRAM, program == prog))
+    return;
+  program = prog;
+  glUseProgramHook(prog);
+}
+
+static int cap_same(int call, GLenum cap, int enable) {
+  int index = cap_index(cap);
+  if (index < 0)
+    return hit(call, 0);
+
+  uint32_t bit = 1 << index;
+  if (hit(call, (caps_known & bit) && !!(caps_enabled & bit) == enable))
+    return 1;
+  caps_known |= bit;
+  if (enable)
+    caps_enabled |= bit;
+  else
+    caps_enabled &= ~bit;
+  return 0;
+}
+
+void glEnableCached(GLenum cap) {
+  TRACE(GL_STATE_ENABLE, cap);
+
+  if (!cap_same(GL_STATE_ENABLE, cap, 1))
+    glEnableHook(cap);
+}
+
+void glDisableCached(GLenum cap) {
+  TRACE(GL_STATE_DISABLE, cap);
+
+  if (!cap_same(GL_STATE_DISABLE, cap, 0))
+    glDisableHook(cap);
+}
+
+void glBlendFuncCached(GLenum sfactor, GLenum dfactor) {
+  TRACE(GL_STATE_BLEND_FUNC, sfactor, dfactor);
+
+  if (known_same(GL_STATE_BLEND_FUNC, KNOWN_BLEND_FUNC, blend_func[0] == sfactor && blend_func[1] == dfactor))
+    return;
+  blend_func[0] = sfactor;
+  blend_func[1] = dfactor;
+  glBlendFunc(sfactor, dfactor);
+}
+
+void glDepthFuncCached(GLenum func) {
+  TRACE(GL_STATE_DEPTH_FUNC, func);
+
+  if (known_same(GL_STATE_DEPTH_FUNC, KNOWN_DEPTH_FUNC, depth_func == func))
+    return;
+  depth_func = func;
+  glDepthFunc(func);
+}
+
+void glDepthMaskCached(GLboolean flag) {
+  TRACE(GL_STATE_DEPTH_MASK, flag);
+
+  if (known_same(GL_STATE_DEPTH_MASK, KNOWN_DEPTH_MASK, depth_mask == flag))
+    return;
+  depth_mask = flag;
+  glDepthMask(flag);
+}
+
+void glCullFaceCached(GLenum mode) {
+  TRACE(GL_STATE_CULL_FACE, mode);
+
+  if (known_same(GL_STATE_CULL_FACE, KNOWN_CULL_FACE, cull_face == mode))
+    return;
+  cull_face = mode;
+  glCullFace(mode);
+}
+
+void glColorMaskCached(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha) {
+  TRACE(GL_STATE_COLOR_MASK, red, green, blue, alpha);
+
+  GLboolean mask[4] = { red, green, blue, alpha };
+  if (known_same(GL_STATE_COLOR_MASK, KNOWN_COLOR_MASK, memcmp(color_mask, mask, sizeof(mask)) == 0))
+    return;
+  memcpy(color_mask, mask, sizeof(mask));
+  glColorMask(red, green, blue, alpha);
+}
+
+// Compared as bits, so a NaN the game sets again is still a repeat
+void glClearColorCached(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha) {
+  TRACE(GL_STATE_CLEAR_COLOR, float_bits(red), float_bits(green), float_bits(blue), float_bits(alpha));
+
+  GLfloat color[4] = { red, green, blue, alpha };
+  if (known_same(GL_STATE_CLEAR_COLOR, KNOWN_CLEAR_COLOR, memcmp(clear_color, color, sizeof(color)) == 0))
+    return;
+  memcpy(clear_color, color, sizeof(color));
+  glClearColor(red, green, blue, alpha);
+}
+
+void glViewportCached(GLint x, GLint y, GLsizei width, GLsizei height) {
+  TRACE(GL_STATE_VIEWPORT, x, y, width, height);
+
+  GLint rect[4] = { x, y, width, height };
+  if (known_same(GL_STATE_VIEWPORT, KNOWN_VIEWPORT, memcmp(viewport, rect, sizeof(rect)) == 0))
+    return;
+  memcpy(viewport, rect, sizeof(rect));
+  glViewportHook(x, y, width, height);
+}
+
+void glScissorCached(GLint x, GLint y, GLsizei width, GLsizei height) {
+  TRACE(GL_STATE_SCISSOR, x, y, width, height);
+
+  GLint rect[4] = { x, y, width, height };
+  if (known_same(GL_STATE_SCISSOR, KNOWN_SCISSOR, memcmp(scissor, rect, sizeof(rect)) == 0))
+    return;
+  memcpy(scissor, rect, sizeof(rect));
+  glScissorHook(x, y, width, height);
+}
+
+// What the units holding the name have bound is no longer what it stands for
+void gl_state_forget_texture(GLuint texture) {
+  for (int i = 0; i < MAX_UNITS; i++) {
+    if (textures[i] == texture)
+      textures_known &= ~(1 << i);
+  }
+}
+
+// GL unbinds deleted names from every unit
+void glDeleteTexturesCached(GLsizei n, const GLuint *ids) {
+  if (trace)
+    trace_record(GL_TRACE_DELETE_TEXTURES, ids, n);
+
+  for (int i = 0; i < n; i++)
+    gl_state_forget_texture(ids[i]);
+  glDeleteTexturesHook(n, ids);
+}
+
+void glDeleteBuffersCached(GLsizei n, const GLuint *ids) {
+  if (trace)
+    trace_record(GL_TRACE_DELETE_BUFFERS, ids, n);
+
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < NUM_BUFFER_TARGETS; j++) {
+      if (buffers[j] == ids[i])
+        buffers_known &= ~(1 << j);
+    }
+  }
+  glDeleteBuffers(n, ids);
+}
+
+// A name freed while current can come back as another program
+void glDeleteProgramCached(GLuint prog) {
+  TRACE(GL_TRACE_DELETE_PROGRAM, prog);
+
+  if (program == prog)
+    known &= ~KNOWN_PROGRAM;
+  uniform_cache_forget(prog);
+  glDeleteProgramHook(prog);
+}
+
+// Relinking can change what binding the program installs, let the next bind through
+void glLinkProgramCached(GLuint prog) {
+  TRACE(GL_TRACE_LINK_PROGRAM, prog);
+
+  if (program == prog)
+    known &= ~KNOWN_PROGRAM;
+  uniform_cache_forget(prog);
+  glLinkProgram(prog);
+}
+
+static void trace_uniform(int call, GLint location, GLsizei count, const void *value, uint32_t size) {
+  uint32_t words = size / sizeof(uint32_t);
+  if (words + 2 > 0xffff)
+    return;
+
+  uint16_t header[2] = { call, words + 2 };
+  uint32_t args[2] = { location, count };
+  fwrite(header, sizeof(header), 1, trace);
+  fwrite(args, sizeof(args), 1, trace);
+  fwrite(value, sizeof(uint32_t), words, trace);
+}
+
+// Only compared while the current program is known, so the values land in its shadow
+static int uniform_same(int call, GLint location, GLsizei count, const void *value, uint32_t size) {
+  if (trace)
+    trace_uniform(call, location, count, value, size);
+
+  return hit(call, filter && (known & KNOWN_PROGRAM) && !variant_tracked(program) &&
+                   uniform_cache_same(program, location, call, count, value, size));
+}
+
+void glUniform1iCached(GLint location, GLint v0) {
+  if (!uniform_same(GL_STATE_UNIFORM_1I, location, 1, &v0, sizeof(GLint)))
+    glUniform1iHook(location, v0);
+}
+
+void glUniform1fvCached(GLint location, GLsizei count, const GLfloat *value) {
+  if (!uniform_same(GL_STATE_UNIFORM_1F, location, count, value, count * sizeof(GLfloat)))
+    glUniform1fvHook(location, count, value);
+}
+
+void glUniform2fvCached(GLint location, GLsizei count, const GLfloat *value) {
+  if (!uniform_same(GL_STATE_UNIFORM_2F, location, count, value, count * 2 * sizeof(GLfloat)))
+    glUniform2fvHook(location, count, value);
+}
+
+void glUniform3fvCached(GLint location, GLsizei count, const GLfloat *value) {
+  if (!uniform_same(GL_STATE_UNIFORM_3F, location, count, value, count * 3 * sizeof(GLfloat)))
+    glUniform3fvHook(location, count, value);
+}
+
+void glUniform4fvCached(GLint location, GLsizei count, const GLfloat *value) {
+  if (!uniform_same(GL_STATE_UNIFORM_4F, location, count, value, count * 4 * sizeof(GLfloat)))
+    glUniform4fvHook(location, count, value);
+}
+
+// GLES2 only allows untransposed matrices, the trace leaves transpose out
+void glUniformMatrix2fvCached(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value) {
+  if (!uniform_same(GL_STATE_UNIFORM_MATRIX2, location, count, value, count * 4 * sizeof(GLfloat)))
+    glUniformMatrix2fvHook(location, count, transpose, value);
+}
+
+void glUniformMatrix3fvCached(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value) {
+  if (!uniform_same(GL_STATE_UNIFORM_MATRIX3, location, count, value, count * 9 * sizeof(GLfloat)))
+    glUniformMatrix3fvHook(location, count, transpose, value);
+}
+
+void glUniformMatrix4fvCached(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value) {
+  if (!uniform_same(GL_STATE_UNIFORM_MATRIX4, location, count, value, count * 16 * sizeof(GLfloat)))
+    glUniformMatrix4fvHook(location, count, transpose, value);
+}
+
+void gl_state_frame(void) {
+  if (trace)
+    trace_record(GL_TRACE_FRAME, NULL, 0);
+  uniform_cache_frame();
+
+  if (++stats.frames < FRAME_STATS_INTERVAL)
+    return;
+
+  uint32_t hits = 0, calls = 0;
+  char line[1024];
+  int len = 0;
+  for (int i = 0; i < GL_STATE_CALLS; i++) {
+    uint32_t total = stats.hits[i] + stats.misses[i];
+    hits += stats.hits[i];
+    calls += total;
+    if (total && len < sizeof(line))
+      len += snprintf(line + len, sizeof(line) - len, " %s %u/%u", call_names[i], stats.hits[i], total);
+  }
+  debugPrintf("GL state %u of %u calls dropped:%s\n", hits, calls, len ? line : "");
+
+  if (trace)
+    fflush(trace);
+
+  memset(&stats, 0, sizeof(stats));
+}
@@ -0,0 +1,83 @@
+#ifndef __GL_STATE_H__
+#define __GL_STATE_H__
+
+#include <vitaGL.h>
+
+#define GL_TRACE_MAGIC 0x52544c47 // 'GLTR'
+
+// Trace records are a uint16_t call and a uint16_t count of uint32_t arguments
+// following it, floats are stored as their bits. Uniforms are the location and
+// count followed by the values
+enum {
+  GL_STATE_ACTIVE_TEXTURE,
+  GL_STATE_BIND_TEXTURE,
+  GL_STATE_BIND_BUFFER,
+  GL_STATE_USE_PROGRAM,
+  GL_STATE_ENABLE,
+  GL_STATE_DISABLE,
+  GL_STATE_BLEND_FUNC,
+  GL_STATE_DEPTH_FUNC,
+  GL_STATE_DEPTH_MASK,
+  GL_STATE_CULL_FACE,
+  GL_STATE_COLOR_MASK,
+  GL_STATE_CLEAR_COLOR,
+  GL_STATE_VIEWPORT,
+  GL_STATE_SCISSOR,
+  GL_STATE_UNIFORM_1I,
+  GL_STATE_UNIFORM_1F,
+  GL_STATE_UNIFORM_2F,
+  GL_STATE_UNIFORM_3F,
+  GL_STATE_UNIFORM_4F,
+  GL_STATE_UNIFORM_MATRIX2,
+  GL_STATE_UNIFORM_MATRIX3,
+  GL_STATE_UNIFORM_MATRIX4,
+  GL_STATE_CALLS,
+
+  // Only in traces, they drop what the cache knows
+  GL_TRACE_DELETE_TEXTURES = GL_STATE_CALLS,
+  GL_TRACE_DELETE_BUFFERS,
+  GL_TRACE_DELETE_PROGRAM,
+  GL_TRACE_LINK_PROGRAM,
+  GL_TRACE_FRAME,
+};
+
+typedef struct {
+  uint32_t frames;
+  uint32_t hits[GL_STATE_CALLS];   // calls dropped because nothing changed
+  uint32_t misses[GL_STATE_CALLS]; // calls passed on to vitaGL
+} gl_state_stats;
+
+void gl_state_init(const char *trace_path, int filter);
+gl_state_stats *gl_state_get_stats(void);
+const char *gl_state_call_name(int call);
+void gl_state_frame(void);
+void gl_state_forget_texture(GLuint texture);
+
+void glActiveTextureCached(GLenum texture);
+void glBindTextureCached(GLenum target, GLuint texture);
+void glBindBufferCached(GLenum target, GLuint buffer);
+void glUseProgramCached(GLuint program);
+void glEnableCached(GLenum cap);
+void glDisableCached(GLenum cap);
+void glBlendFuncCached(GLenum sfactor, GLenum dfactor);
+void glDepthFuncCached(GLenum func);
+void glDepthMaskCached(GLboolean flag);
+void glCullFaceCached(GLenum mode);
+void glColorMaskCached(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha);
+void glClearColorCached(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha);
+void glViewportCached(GLint x, GLint y, GLsizei width, GLsizei height);
+void glScissorCached(GLint x, GLint y, GLsizei width, GLsizei height);
+void glDeleteTexturesCached(GLsizei n, const GLuint *textures);
+void glDeleteBuffersCached(GLsizei n, const GLuint *buffers);
+void glDeleteProgramCached(GLuint program);
+void glLinkProgramCached(GLuint program);
+void glUniform1iCached(GLint location, GLint v0);
+void glUniform1fvCached(GLint location, GLsizei count, const GLfloat *value);
+void glUniform2fvCached(GLint location, GLsizei count, const GLfloat *value);
+void glUniform3fvCached(GLint location, GLsizei count, const GLfloat *value);
+void glUniform4fvCached(GLint location, GLsizei count, const GLfloat *value);
+void glUniformMatrix2fvCached(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value);
+void glUniformMatrix3fvCached(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value);
+void glUniformMatrix4fvCached(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value);
+
+#endif
@@ -47,6 +47,14 @@
 #include "so_util.h"
 #include "jni_patch.h"
 #include "sha1.h"
+#include "profile.h"
+#include "shader.h"
+#include "shader_variant.h"
+#include "framebuffer.h"
+#include "texture.h"
+#include "transcode.h"
+#include "residency.h"
+#include "gl_state.h"
 
 int pstv_mode = 0;
 
@@ -1009,59 +1017,73 @@ int VibStart(int id, int strength) {
 
 //static int (*taxi_game_accelerometer)(float x, float y, float z);
 
-void patch_game(void) {
-  hook_addr(so_symbol(&crazytaxi_mod, "__cxa_guard_acquire"), (uintptr_t)&__cxa_guard_acquire);
-  hook_addr(so_symbol(&crazytaxi_mod, "__cxa_guard_release"), (uintptr_t)&__cxa_guard_release);
+#define HOOK(sym, dst) { sym, 0, SO_PATCH_HOOK, .target = (uintptr_t)(dst) }
+#define WRITE(sym, off, ptr, len) { sym, off, SO_PATCH_WRITE, .data = (ptr), .size = (len) }
+#define IMPORT(sym, var) { sym, 0, SO_PATCH_IMPORT, .out = (void *)&(var) }
 
-  hook_addr(so_symbol(&crazytaxi_mod, "_ZNSt6__ndk113random_deviceC2ERKNS_12basic_stringIcNS_11char_traitsIcEENS_9allocatorIcEEEE"), (uintptr_t)&ret0);
-  hook_addr(so_symbol(&crazytaxi_mod, "_ZNSt6__ndk113random_deviceD2Ev"), (uintptr_t)&ret0);
-  
-  g_GameCT = (void *)so_symbol(&crazytaxi_mod, "g_GameCT");
-  GameCT__Update = (void *)so_symbol(&crazytaxi_mod, "_ZN6GameCT6UpdateEv");
-  //taxi_game_accelerometer = (void *)so_symbol(&crazytaxi_mod, "_Z23taxi_game_accelerometerfff");
-  hook_addr(so_symbol(&crazytaxi_mod, "_Z16taxi_game_updatev"), (uintptr_t)&taxi_game_update);
+static const uint16_t exec_KyakuMain_branch = 0xE04F; // b #0xa2
+
+static so_patch game_patches[] = {
+  HOOK("__cxa_guard_acquire", &__cxa_guard_acquire),
+  HOOK("__cxa_guard_release", &__cxa_guard_release),
+
+  HOOK("_ZNSt6__ndk113random_deviceC2ERKNS_12basic_stringIcNS_11char_traitsIcEENS_9allocatorIcEEEE", &ret0),
+  HOOK("_ZNSt6__ndk113random_deviceD2Ev", &ret0),
+
+  IMPORT("g_GameCT", g_GameCT),
+  IMPORT("_ZN6GameCT6UpdateEv", GameCT__Update),
+  //IMPORT("_Z23taxi_game_accelerometerfff", taxi_game_accelerometer),
+  HOOK("_Z16taxi_game_updatev", &taxi_game_update),
 
   // Nuke touch widgets
-  nlSprPut = (void *)so_symbol(&crazytaxi_mod, "nlSprPut");
-  hook_addr(so_symbol(&crazytaxi_mod, "_Z9putGameUIffffffff"), (uintptr_t)&putGameUI);
+  IMPORT("nlSprPut", nlSprPut),
+  HOOK("_Z9putGameUIffffffff", &putGameUI),
 
   // Restore original location names
-  uint8_t *LandmarksPtrs = (uint8_t *)so_symbol(&crazytaxi_mod, "LandmarkID");
-  kuKernelCpuUnrestrictedMemcpy((void *)(LandmarksPtrs + 0x24), &PizzaHutStr, 4);
-  kuKernelCpuUnrestrictedMemcpy((void *)(LandmarksPtrs + 0x8C), &PizzaHutStr, 4);
-  kuKernelCpuUnrestrictedMemcpy((void *)(LandmarksPtrs + 0x3C), &KFCStr, 4);
-  kuKernelCpuUnrestrictedMemcpy((void *)(LandmarksPtrs + 0x9C), &KFCStr, 4);
-  kuKernelCpuUnrestrictedMemcpy((void *)(LandmarksPtrs + 0x30), &FILAStr, 4);
-  kuKernelCpuUnrestrictedMemcpy((void *)(LandmarksPtrs + 0x90), &FILAStr, 4);
-  kuKernelCpuUnrestrictedMemcpy((void *)(LandmarksPtrs + 0x34), &LeviStr, 4);
-  kuKernelCpuUnrestrictedMemcpy((void *)(LandmarksPtrs + 0x94), &LeviStr, 4);
-  kuKernelCpuUnrestrictedMemcpy((void *)(LandmarksPtrs + 0x38), &TowerStr, 4);
-  kuKernelCpuUnrestrictedMemcpy((void *)(LandmarksPtrs + 0x98), &TowerStr, 4);
-  
+  WRITE("LandmarkID", 0x24, &PizzaHutStr, 4),
+  WRITE("LandmarkID", 0x8C, &PizzaHutStr, 4),
+  WRITE("LandmarkID", 0x3C, &KFCStr, 4),
+  WRITE("LandmarkID", 0x9C, &KFCStr, 4),
+  WRITE("LandmarkID", 0x30, &FILAStr, 4),
+  WRITE("LandmarkID", 0x90, &FILAStr, 4),
+  WRITE("LandmarkID", 0x34, &LeviStr, 4),
+  WRITE("LandmarkID", 0x94, &LeviStr, 4),
+  WRITE("LandmarkID", 0x38, &TowerStr, 4),
+  WRITE("LandmarkID", 0x98, &TowerStr, 4),
+
   // Restoring FILA as possible destination
-  uint8_t *exec_KyakuMain = (uint8_t *)so_symbol(&crazytaxi_mod, "_Z14exec_KyakuMainv");
-  uint16_t instr = 0xE04F; // b #0xa2
-  kuKernelCpuUnrestrictedMemcpy((void *)(exec_KyakuMain + 0x3A0), &instr, 2);
+  WRITE("_Z14exec_KyakuMainv", 0x3A0, &exec_KyakuMain_branch, 2),
 
   // Restoring voicelines for cut contents
-  Voice_ShutUp = (void *)so_symbol(&crazytaxi_mod, "_Z12Voice_ShutUpi");
-  Voice_Request = (void *)so_symbol(&crazytaxi_mod, "_Z13Voice_RequestP13tagVOICEENTRYiii");
-  hook_addr(so_symbol(&crazytaxi_mod, "_Z20Chat_TellDestinationPv"), (uintptr_t)&Chat_TellDestination);
-  
+  IMPORT("_Z12Voice_ShutUpi", Voice_ShutUp),
+  IMPORT("_Z13Voice_RequestP13tagVOICEENTRYiii", Voice_Request),
+  HOOK("_Z20Chat_TellDestinationPv", &Chat_TellDestination),
+
   // Restore Pizza Hut and FILA models
-  hook_addr(so_symbol(&crazytaxi_mod, "_Z10MendNoDrawiRbfRiPf"), (uintptr_t)&ret0);
-  
+  HOOK("_Z10MendNoDrawiRbfRiPf", &ret0),
+
   // Restore original brands textures
-  hook_addr(so_symbol(&crazytaxi_mod, "_Z14MendReplaceTexi"), (uintptr_t)&MendReplaceTex);
-  
+  HOOK("_Z14MendReplaceTexi", &MendReplaceTex),
+
   // Restore original landsmark previews
-  hook_addr(so_symbol(&crazytaxi_mod, "_Z20MendReplaceTexReloadi"), (uintptr_t)&ret0);
-  
+  HOOK("_Z20MendReplaceTexReloadi", &ret0),
+
   // Fix Pizza Hut text not showing up
-  hook_addr(so_symbol(&crazytaxi_mod, "_Z15MendChangeZBiasiPiRi"), (uintptr_t)&MendChangeZBias);
-  
+  HOOK("_Z15MendChangeZBiasiPiRi", &MendChangeZBias),
+
   // Add vibration support for PSTV
-  hook_addr(so_symbol(&crazytaxi_mod, "_ZN11GuiJoystick8VibStartEii"), (uintptr_t)&VibStart);
+  HOOK("_ZN11GuiJoystick8VibStartEii", &VibStart),
+};
+
+void patch_game(void) {
+  // The whole text segment is flushed right after this, so only validate here
+#ifdef DEBUG
+  int flags = SO_PATCH_VALIDATE;
+#else
+  int flags = 0;
+#endif
+  if (so_patch_apply(&crazytaxi_mod, game_patches, sizeof(game_patches) / sizeof(so_patch), flags) < 0)
+    fatal_error("Error could not patch %s.", "libgl2jni.so");
 }
 
 extern void *__cxa_atexit;
@@ -1129,35 +1151,6 @@ int sysinfo_fake(unsigned long *info) {
   return 0;
 }
 
-void glShaderSourceHook(GLuint shader, GLsizei count, const GLchar **string, const GLint *length) {
-  uint32_t sha1[5];
-  SHA1_CTX ctx;
-
-  sha1_init(&ctx);
-  sha1_update(&ctx, (uint8_t *)*string, strlen(*string));
-  sha1_final(&ctx, (uint8_t *)sha1);
-
-  char sha_name[64];
-  snprintf(sha_name, sizeof(sha_name), "%08x%08x%08x%08x%08x", sha1[0], sha1[1], sha1[2], sha1[3], sha1[4]);
-
-  char cg_path[128];
-  snprintf(cg_path, sizeof(cg_path), "%s/%s.cg", CG_PATH, sha_name);
-
-  FILE *file = fopen(cg_path, "rb");
-  fseek(file, 0, SEEK_END);
-  long size = ftell(file);
-  fseek(file, 0, SEEK_SET);
-  char *source = malloc(size + 1);
-  fread(source, 1, size, file);
-  source[size] = '\0';
-  fclose(file);
-
-  const GLchar *sources[] = { source };
-  glShaderSource(shader, 1, sources, NULL);
-
-  free(source);
-}
-
 void glBindAttribLocationHook(GLuint prog, GLuint index, const GLchar *name) {
   char *new_name = "";
   if (strcmp(name, "xlat_attrib_position") == 0)
@@ -1169,6 +1162,7 @@ void glBindAttribLocationHook(GLuint prog, GLuint index, const GLchar *name) {
   else if (strcmp(name, "xlat_attrib_normal") == 0)
     new_name = "In.Normal";
   glBindAttribLocation(prog, index, new_name);
+  variant_bind_attrib(prog, index, new_name);
 }
 
 const GLubyte *glGetStringHook(GLenum name) {
@@ -1177,27 +1171,6 @@ const GLubyte *glGetStringHook(GLenum name) {
   return glGetString(name);
 }
 
-void glTexImage2DHook(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void *data) {
-  if (level == 0)
-    glTexImage2D(target, level, internalformat, width, height, border, format, type, data);
-}
-
-void glCompressedTexImage2DHook(GLenum target, GLint level, GLenum format, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const void *data) {
-  if (level == 0)
-    glCompressedTexImage2D(target, level, format, width, height, border, imageSize, data);
-}
-
-static void *fb_data = NULL;
-void glFramebufferTexture2DHook(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level) {
-  if (texture != 0) {
-    if (!fb_data)
-      fb_data = malloc(SCREEN_W * SCREEN_H * 4);
-    glReadPixels(0, 0, SCREEN_W, SCREEN_H, GL_RGBA, GL_UNSIGNED_BYTE, fb_data);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, SCREEN_W, SCREEN_H, 0, GL_RGBA, GL_UNSIGNED_BYTE, fb_data);
- }
-}
-
 void *sceClibMemclr(void *dst, SceSize len) {
   return sceClibMemset(dst, 0, len);
 }
@@ -1315,49 +1288,49 @@ static so_default_dynlib default_dynlib[] = {
   // { "getsockopt", (uintptr_t)&getsockopt },
   { "gettimeofday", (uintptr_t)&gettimeofday },
   // { "getuid", (uintptr_t)&getuid },
-  { "glActiveTexture", (uintptr_t)&glActiveTexture },
-  { "glAttachShader", (uintptr_t)&glAttachShader },
+  { "glActiveTexture", (uintptr_t)&glActiveTextureCached },
+  { "glAttachShader", (uintptr_t)&glAttachShaderHook },
   { "glBindAttribLocation", (uintptr_t)&glBindAttribLocationHook },
-  { "glBindBuffer", (uintptr_t)&glBindBuffer },
-  { "glBindFramebuffer", (uintptr_t)&ret0 },
-  { "glBindRenderbuffer", (uintptr_t)&ret0 },
-  { "glBindTexture", (uintptr_t)&glBindTexture },
-  { "glBlendFunc", (uintptr_t)&glBlendFunc },
+  { "glBindBuffer", (uintptr_t)&glBindBufferCached },
+  { "glBindFramebuffer", (uintptr_t)&glBindFramebufferHook },
+  { "glBindRenderbuffer", (uintptr_t)&glBindRenderbuffer },
+  { "glBindTexture", (uintptr_t)&glBindTextureCached },
+  { "glBlendFunc", (uintptr_t)&glBlendFuncCached },
   { "glBufferData", (uintptr_t)&glBufferData },
   { "glBufferSubData", (uintptr_t)&glBufferSubData },
-  { "glCheckFramebufferStatus", (uintptr_t)&glCheckFramebufferStatus },
-  { "glClear", (uintptr_t)&glClear },
-  { "glClearColor", (uintptr_t)&glClearColor },
+  { "glCheckFramebufferStatus", (uintptr_t)&glCheckFramebufferStatusHook },
+  { "glClear", (uintptr_t)&glClearHook },
+  { "glClearColor", (uintptr_t)&glClearColorCached },
   { "glClearDepthf", (uintptr_t)&glClearDepthf },
   { "glClearStencil", (uintptr_t)&glClearStencil },
-  { "glColorMask", (uintptr_t)&glColorMask },
-  { "glCompileShader", (uintptr_t)&glCompileShader },
+  { "glColorMask", (uintptr_t)&glColorMaskCached },
+  { "glCompileShader", (uintptr_t)&glCompileShaderHook },
   { "glCompressedTexImage2D", (uintptr_t)&glCompressedTexImage2DHook },
   // { "glCopyTexImage2D", (uintptr_t)&glCopyTexImage2D },
   { "glCreateProgram", (uintptr_t)&glCreateProgram },
   { "glCreateShader", (uintptr_t)&glCreateShader },
-  { "glCullFace", (uintptr_t)&glCullFace },
-  { "glDeleteBuffers", (uintptr_t)&glDeleteBuffers },
-  { "glDeleteFramebuffers", (uintptr_t)&glDeleteFramebuffers },
-  { "glDeleteProgram", (uintptr_t)&glDeleteProgram },
-  { "glDeleteRenderbuffers", (uintptr_t)&ret0 },
-  { "glDeleteShader", (uintptr_t)&glDeleteShader },
-  { "glDeleteTextures", (uintptr_t)&glDeleteTextures },
-  { "glDepthFunc", (uintptr_t)&glDepthFunc },
-  { "glDepthMask", (uintptr_t)&glDepthMask },
-  { "glDisable", (uintptr_t)&glDisable },
+  { "glCullFace", (uintptr_t)&glCullFaceCached },
+  { "glDeleteBuffers", (uintptr_t)&glDeleteBuffersCached },
+  { "glDeleteFramebuffers", (uintptr_t)&glDeleteFramebuffersHook },
+  { "glDeleteProgram", (uintptr_t)&glDeleteProgramCached },
+  { "glDeleteRenderbuffers", (uintptr_t)&glDeleteRenderbuffers },
+  { "glDeleteShader", (uintptr_t)&glDeleteShaderHook },
+  { "glDeleteTextures", (uintptr_t)&glDeleteTexturesCached },
+  { "glDepthFunc", (uintptr_t)&glDepthFuncCached },
+  { "glDepthMask", (uintptr_t)&glDepthMaskCached },
+  { "glDisable", (uintptr_t)&glDisableCached },
   { "glDisableVertexAttribArray", (uintptr_t)&glDisableVertexAttribArray },
-  { "glDrawArrays", (uintptr_t)&glDrawArrays },
-  { "glDrawElements", (uintptr_t)&glDrawElements },
-  { "glEnable", (uintptr_t)&glEnable },
+  { "glDrawArrays", (uintptr_t)&glDrawArraysHook },
+  { "glDrawElements", (uintptr_t)&glDrawElementsHook },
+  { "glEnable", (uintptr_t)&glEnableCached },
   { "glEnableVertexAttribArray", (uintptr_t)&glEnableVertexAttribArray },
-  { "glFramebufferRenderbuffer", (uintptr_t)&ret0 },
+  { "glFramebufferRenderbuffer", (uintptr_t)&glFramebufferRenderbufferHook },
   { "glFramebufferTexture2D", (uintptr_t)&glFramebufferTexture2DHook },
   { "glGenBuffers", (uintptr_t)&glGenBuffers },
   { "glGenFramebuffers", (uintptr_t)&glGenFramebuffers },
-  { "glGenRenderbuffers", (uintptr_t)&ret0 },
+  { "glGenRenderbuffers", (uintptr_t)&glGenRenderbuffers },
   { "glGenTextures", (uintptr_t)&glGenTextures },
-  { "glGenerateMipmap", (uintptr_t)&glGenerateMipmap },
+  { "glGenerateMipmap", (uintptr_t)&glGenerateMipmapHook },
   { "glGetFramebufferAttachmentParameteriv", (uintptr_t)&ret0 },
   { "glGetIntegerv", (uintptr_t)&glGetIntegerv },
   { "glGetProgramInfoLog", (uintptr_t)&glGetProgramInfoLog },
@@ -1365,29 +1338,29 @@ static so_default_dynlib default_dynlib[] = {
   { "glGetShaderInfoLog", (uintptr_t)&glGetShaderInfoLog },
   { "glGetShaderiv", (uintptr_t)&glGetShaderiv },
   { "glGetString", (uintptr_t)&glGetStringHook },
-  { "glGetUniformLocation", (uintptr_t)&glGetUniformLocation },
-  { "glLinkProgram", (uintptr_t)&glLinkProgram },
+  { "glGetUniformLocation", (uintptr_t)&glGetUniformLocationHook },
+  { "glLinkProgram", (uintptr_t)&glLinkProgramCached },
   { "glReadPixels", (uintptr_t)&glReadPixels },
-  { "glRenderbufferStorage", (uintptr_t)&ret0 },
-  { "glScissor", (uintptr_t)&glScissor },
+  { "glRenderbufferStorage", (uintptr_t)&glRenderbufferStorage },
+  { "glScissor", (uintptr_t)&glScissorCached },
   { "glShaderSource", (uintptr_t)&glShaderSourceHook },
   { "glStencilFunc", (uintptr_t)&glStencilFunc },
   { "glStencilMask", (uintptr_t)&glStencilMask },
   { "glStencilOp", (uintptr_t)&glStencilOp },
   { "glTexImage2D", (uintptr_t)&glTexImage2DHook },
-  { "glTexParameteri", (uintptr_t)&glTexParameteri },
-  { "glTexSubImage2D", (uintptr_t)&glTexSubImage2D },
-  { "glUniform1fv", (uintptr_t)&glUniform1fv },
-  { "glUniform1i", (uintptr_t)&glUniform1i },
-  { "glUniform2fv", (uintptr_t)&glUniform2fv },
-  { "glUniform3fv", (uintptr_t)&glUniform3fv },
-  { "glUniform4fv", (uintptr_t)&glUniform4fv },
-  { "glUniformMatrix2fv", (uintptr_t)&glUniformMatrix2fv },
-  { "glUniformMatrix3fv", (uintptr_t)&glUniformMatrix3fv },
-  { "glUniformMatrix4fv", (uintptr_t)&glUniformMatrix4fv },
-  { "glUseProgram", (uintptr_t)&glUseProgram },
+  { "glTexParameteri", (uintptr_t)&glTexParameteriHook },
+  { "glTexSubImage2D", (uintptr_t)&glTexSubImage2DHook },
+  { "glUniform1fv", (uintptr_t)&glUniform1fvCached },
+  { "glUniform1i", (uintptr_t)&glUniform1iCached },
+  { "glUniform2fv", (uintptr_t)&glUniform2fvCached },
+  { "glUniform3fv", (uintptr_t)&glUniform3fvCached },
+  { "glUniform4fv", (uintptr_t)&glUniform4fvCached },
+  { "glUniformMatrix2fv", (uintptr_t)&glUniformMatrix2fvCached },
+  { "glUniformMatrix3fv", (uintptr_t)&glUniformMatrix3fvCached },
+  { "glUniformMatrix4fv", (uintptr_t)&glUniformMatrix4fvCached },
+  { "glUseProgram", (uintptr_t)&glUseProgramCached },
   { "glVertexAttribPointer", (uintptr_t)&glVertexAttribPointer },
-  { "glViewport", (uintptr_t)&glViewport },
+  { "glViewport", (uintptr_t)&glViewportCached },
   { "gmtime", (uintptr_t)&gmtime },
   { "gmtime_r", (uintptr_t)&gmtime_r },
   // { "inet_ntop", (uintptr_t)&inet_ntop },
@@ -1658,21 +1631,65 @@ int main(int argc, char *argv[]) {
   if (!file_exists("ur0:/data/libshacccg.suprx") && !file_exists("ur0:/data/external/libshacccg.suprx"))
     fatal_error("Error libshacccg.suprx is not installed.");
 
-  if (so_file_load(&crazytaxi_mod, DATA_PATH "/libgl2jni.so", LOAD_ADDRESS) < 0)
-    fatal_error("Error could not load %s.", DATA_PATH "/libgl2jni.so");
-  so_relocate(&crazytaxi_mod);
-  so_resolve(&crazytaxi_mod, default_dynlib, sizeof(default_dynlib), 0);
+  int phase = profile_begin("so_load");
+  if (file_exists(SO_PATH)) {
+    if (so_file_load(&crazytaxi_mod, SO_PATH, LOAD_ADDRESS) < 0)
+      fatal_error("Error could not load %s.", SO_PATH);
+  } else if (so_zip_load(&crazytaxi_mod, APK_PATH, APK_SO_ENTRY, LOAD_ADDRESS) < 0) {
+    fatal_error("Error could not load %s from %s.", APK_SO_ENTRY, APK_PATH);
+  }
+  profile_end(phase);
+
+  phase = profile_begin("so_link");
+#ifdef LAZY_BIND
+  // Binding stubs live in the patch arena, which the prelink cache doesn't cover
+  so_link(&crazytaxi_mod, default_dynlib, sizeof(default_dynlib), SO_LINK_RELOCATE | SO_LINK_RESOLVE | SO_LINK_LAZY);
+#else
+  if (so_prelink_load(&crazytaxi_mod, PRELINK_PATH, default_dynlib, sizeof(default_dynlib)) < 0) {
+    so_link(&crazytaxi_mod, default_dynlib, sizeof(default_dynlib), SO_LINK_RELOCATE | SO_LINK_RESOLVE);
+    so_prelink_save(&crazytaxi_mod, PRELINK_PATH, default_dynlib, sizeof(default_dynlib));
+  }
+#endif
+  profile_end(phase);
 
+  phase = profile_begin("patch_game");
   patch_game();
+  profile_end(phase);
+
+  phase = profile_begin("flush_caches");
   so_flush_caches(&crazytaxi_mod);
+  profile_end(phase);
 
+  phase = profile_begin("so_initialize");
   so_initialize(&crazytaxi_mod);
+  profile_end(phase);
 
+  phase = profile_begin("vgl_init");
   vglSetupRuntimeShaderCompiler(SHARK_OPT_UNSAFE, SHARK_ENABLE, SHARK_ENABLE, SHARK_ENABLE);
   vglInitExtended(0, SCREEN_W, SCREEN_H, MEMORY_VITAGL_THRESHOLD_MB * 1024 * 1024, SCE_GXM_MULTISAMPLE_4X);
   vgl_inited = 1;
+  profile_end(phase);
+
+  phase = profile_begin("shader_init");
+  shader_cache_init(SHADER_PACK_PATH, CG_PATH, SHADER_CACHE_PATH);
+  shader_warmup_start();
+  profile_end(phase);
+
+  phase = profile_begin("texture_init");
+  texture_init(TEXTURE_CACHE_PATH);
+  transcode_init(TRANSCODE_CACHE_PATH);
+  residency_init(TEXTURE_BUDGET_MB * 1024 * 1024, TEXTURE_STORE_MB * 1024 * 1024, RESIDENCY_SPILL_PATH);
+  profile_end(phase);
+
+#ifdef GL_TRACE
+  gl_state_init(GL_TRACE_PATH, 1);
+#else
+  gl_state_init(NULL, 1);
+#endif
 
+  phase = profile_begin("jni_load");
   jni_load();
+  profile_end(phase);
 
   int (* Java_com_sega_CrazyTaxi_GL2JNILib_init)(void *env, void *obj, int width, int height) = (void *)so_symbol(&crazytaxi_mod, "Java_com_sega_CrazyTaxi_GL2JNILib_init");
   int (* Java_com_sega_CrazyTaxi_GL2JNILib_resume)(void) = (void *)so_symbol(&crazytaxi_mod, "Java_com_sega_CrazyTaxi_GL2JNILib_resume");
@@ -1680,9 +1697,17 @@ int main(int argc, char *argv[]) {
   int (* Java_com_sega_CrazyTaxi_GL2JNILib_onJoystickActive)(void *env, void *obj, int active) = (void *)so_symbol(&crazytaxi_mod, "Java_com_sega_CrazyTaxi_GL2JNILib_onJoystickActive");
   int (* Java_com_sega_CrazyTaxi_GL2JNILib_onJoyButton)(void *env, void *obj, int scan_code, int state, int disable_touch) = (void *)so_symbol(&crazytaxi_mod, "Java_com_sega_CrazyTaxi_GL2JNILib_onJoyButton");
 
+  phase = profile_begin("jni_init");
   Java_com_sega_CrazyTaxi_GL2JNILib_onJoystickActive(fake_env, 0, 1);
   Java_com_sega_CrazyTaxi_GL2JNILib_init(fake_env, 0, SCREEN_W, SCREEN_H);
+  profile_end(phase);
+
+  phase = profile_begin("jni_resume");
   Java_com_sega_CrazyTaxi_GL2JNILib_resume();
+  profile_end(phase);
+
+  shader_warmup_report();
+  profile_report(STARTUP_REPORT_PATH, STARTUP_HISTORY_PATH, STARTUP_HISTORY_SIZE, __DATE__ " " __TIME__);
 
   uint32_t cur_buttons = 0, old_buttons = 0, changed_buttons = 0;
 
@@ -1715,6 +1740,9 @@ int main(int argc, char *argv[]) {
 
     Java_com_sega_CrazyTaxi_GL2JNILib_step();
     vglSwapBuffers(GL_FALSE);
+    framebuffer_frame();
+    texture_frame();
+    gl_state_frame();
 
     // Handling vibration
     if (rumble_tick != 0) {
@@ -0,0 +1,42 @@
+/* murmur.c -- fast non-cryptographic hash for in-memory caches
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <string.h>
+
+#include "murmur.h"
+
+// MurmurHash64A, eight bytes per step
+uint64_t murmur64(const void *data, size_t len) {
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  uint64_t h = 0x8445d61a4e774912ULL ^ (len * m);
+
+  const uint8_t *p = data;
+  const uint8_t *end = p + (len & ~7);
+  for (; p != end; p += 8) {
+    uint64_t k;
+    memcpy(&k, p, 8);
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+
+  uint64_t tail = 0;
+  memcpy(&tail, p, len & 7);
+  if (len & 7) {
+    h ^= tail;
+    h *= m;
+  }
+
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
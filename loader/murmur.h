@@ -0,0 +1,9 @@
+#ifndef __MURMUR_H__
+#define __MURMUR_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint64_t murmur64(const void *data, size_t len);
+
+#endif
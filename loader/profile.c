@@ -0,0 +1,138 @@
+/* profile.c -- boot phase timers
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "profile.h"
+
+static profile_phase phases[PROFILE_MAX_PHASES];
+static int num_phases = 0;
+static int depth = 0;
+
+// Work done off the main thread, reported apart and left out of the total
+static profile_phase background[PROFILE_MAX_PHASES];
+static int num_background = 0;
+
+int profile_begin(const char *fmt, ...) {
+  if (num_phases >= PROFILE_MAX_PHASES)
+    return -1;
+
+  profile_phase *phase = &phases[num_phases];
+
+  va_list list;
+  va_start(list, fmt);
+  vsnprintf(phase->name, PROFILE_NAME_LEN, fmt, list);
+  va_end(list);
+
+  phase->depth = depth++;
+  phase->time = 0;
+  phase->start = sceKernelGetProcessTimeWide();
+
+  return num_phases++;
+}
+
+void profile_end(int id) {
+  uint64_t now = sceKernelGetProcessTimeWide();
+
+  if (id < 0)
+    return;
+
+  phases[id].time = now - phases[id].start;
+  depth = phases[id].depth;
+}
+
+void profile_add_background(uint64_t time, const char *fmt, ...) {
+  if (num_background >= PROFILE_MAX_PHASES)
+    return;
+
+  profile_phase *phase = &background[num_background++];
+
+  va_list list;
+  va_start(list, fmt);
+  vsnprintf(phase->name, PROFILE_NAME_LEN, fmt, list);
+  va_end(list);
+
+  phase->depth = 0;
+  phase->start = 0;
+  phase->time = time;
+}
+
+// Keeps the newest history_size - 1 lines so the new entry fits
+static void profile_append_history(const char *path, int history_size, const char *entry) {
+  char **lines = calloc(history_size, sizeof(char *));
+  int num_lines = 0;
+
+  FILE *file = fopen(path, "r");
+  if (file) {
+    char line[1024];
+    while (fgets(line, sizeof(line), file)) {
+      if (num_lines == history_size - 1) {
+        free(lines[0]);
+        memmove(lines, lines + 1, (num_lines - 1) * sizeof(char *));
+        num_lines--;
+      }
+      lines[num_lines++] = strdup(line);
+    }
+    fclose(file);
+  }
+
+  file = fopen(path, "w");
+  if (file) {
+    for (int i = 0; i < num_lines; i++)
+      fputs(lines[i], file);
+    fputs(entry, file);
+    fclose(file);
+  }
+
+  for (int i = 0; i < num_lines; i++)
+    free(lines[i]);
+  free(lines);
+}
+
+void profile_report(const char *report_path, const char *history_path, int history_size, const char *build) {
+  uint64_t total = 0;
+  for (int i = 0; i < num_phases; i++) {
+    if (phases[i].depth == 0)
+      total += phases[i].time;
+  }
+
+  FILE *file = fopen(report_path, "w");
+  if (file) {
+    fprintf(file, "build %s\n", build);
+    fprintf(file, "%-40s %10.3f ms\n", "total", total / 1000.0f);
+    for (int i = 0; i < num_phases; i++)
+      fprintf(file, "%*s%-*s %10.3f ms\n", phases[i].depth * 2, "", 40 - phases[i].depth * 2, phases[i].name, phases[i].time / 1000.0f);
+    if (num_background > 0)
+      fprintf(file, "background\n");
+    for (int i = 0; i < num_background; i++)
+      fprintf(file, "  %-38s %10.3f ms\n", background[i].name, background[i].time / 1000.0f);
+    fclose(file);
+  }
+
+  // One line per boot with only the top level phases, in microseconds
+  char entry[1024];
+  int len = snprintf(entry, sizeof(entry), "[%s] total=%llu", build, (unsigned long long)total);
+  for (int i = 0; i < num_phases && len < sizeof(entry); i++) {
+    if (phases[i].depth == 0)
+      len += snprintf(entry + len, sizeof(entry) - len, " %s=%llu", phases[i].name, (unsigned long long)phases[i].time);
+  }
+  if (len >= sizeof(entry) - 1)
+    len = sizeof(entry) - 2;
+  entry[len++] = '\n';
+  entry[len] = '\0';
+
+  profile_append_history(history_path, history_size, entry);
+
+  debugPrintf("Startup took %.3f ms\n", total / 1000.0f);
+}
@@ -0,0 +1,22 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <stdint.h>
+
+#define PROFILE_MAX_PHASES 128
+#define PROFILE_NAME_LEN 32
+
+typedef struct {
+  char name[PROFILE_NAME_LEN];
+  uint64_t start;
+  uint64_t time;
+  int depth;
+} profile_phase;
+
+int profile_begin(const char *fmt, ...);
+void profile_end(int id);
+void profile_add_background(uint64_t time, const char *fmt, ...);
+
+void profile_report(const char *report_path, const char *history_path, int history_size, const char *build);
+
+#endif
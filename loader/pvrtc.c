@@ -0,0 +1,158 @@
+/* pvrtc.c -- PVRTC 4bpp decoder
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * Every 64 bit word holds 16 two bit modulation values and two low
+ * resolution colors. Both colors are bilinearly upscaled between the
+ * centers of the four nearest words, then blended per texel by the
+ * modulation value. Words are stored in Morton order.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pvrtc.h"
+
+typedef struct {
+  uint8_t a[4]; // r, g, b in 5 bits, alpha in 4
+  uint8_t b[4];
+  uint8_t punch; // modulation mode bit
+} pvrtc_colors;
+
+uint32_t pvrtc_4bpp_size(int width, int height) {
+  width = width < 8 ? 8 : width;
+  height = height < 8 ? 8 : height;
+  return width * height / 2;
+}
+
+static uint32_t read32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Interleaves the bits of the smaller axis, the rest of the larger one goes on top
+static uint32_t twiddle(uint32_t width, uint32_t height, uint32_t x, uint32_t y) {
+  uint32_t min_dim = width < height ? width : height;
+  uint32_t rest = width < height ? y : x;
+  uint32_t out = 0;
+  int shift = 0;
+
+  for (uint32_t bit = 1; bit < min_dim; bit <<= 1, shift++) {
+    if (y & bit)
+      out |= 1 << (2 * shift);
+    if (x & bit)
+      out |= 1 << (2 * shift + 1);
+  }
+
+  return out | ((rest >> shift) << (2 * shift));
+}
+
+static void unpack_colors(uint32_t data, pvrtc_colors *out) {
+  out->punch = data & 1;
+
+  // Color A, opaque RGB554 or ARGB3443
+  if (data & 0x8000) {
+    out->a[0] = (data & 0x7c00) >> 10;
+    out->a[1] = (data & 0x3e0) >> 5;
+    out->a[2] = (data & 0x1e) | ((data & 0x1e) >> 4);
+    out->a[3] = 0xf;
+  } else {
+    out->a[0] = ((data & 0xf00) >> 7) | ((data & 0xf00) >> 11);
+    out->a[1] = ((data & 0xf0) >> 3) | ((data & 0xf0) >> 7);
+    out->a[2] = ((data & 0xe) << 1) | ((data & 0xe) >> 2);
+    out->a[3] = (data & 0x7000) >> 11;
+  }
+
+  // Color B, opaque RGB555 or ARGB3444
+  if (data & 0x80000000) {
+    out->b[0] = (data & 0x7c000000) >> 26;
+    out->b[1] = (data & 0x3e00000) >> 21;
+    out->b[2] = (data & 0x1f0000) >> 16;
+    out->b[3] = 0xf;
+  } else {
+    out->b[0] = ((data & 0xf000000) >> 23) | ((data & 0xf000000) >> 27);
+    out->b[1] = ((data & 0xf00000) >> 19) | ((data & 0xf00000) >> 23);
+    out->b[2] = ((data & 0xf0000) >> 15) | ((data & 0xf0000) >> 19);
+    out->b[3] = (data & 0x70000000) >> 27;
+  }
+}
+
+void pvrtc_decompress_4bpp(const uint8_t *src, int width, int height, uint8_t *dst) {
+  int blocks_w = (width < 8 ? 8 : width) / 4;
+  int blocks_h = (height < 8 ? 8 : height) / 4;
+
+  // Colors are needed four times over, unpack them once in raster order
+  pvrtc_colors *colors = malloc(blocks_w * blocks_h * sizeof(pvrtc_colors));
+  uint32_t *modulation = malloc(blocks_w * blocks_h * sizeof(uint32_t));
+  if (!colors || !modulation) {
+    free(colors);
+    free(modulation);
+    memset(dst, 0, width * height * 4);
+    return;
+  }
+
+  for (int by = 0; by < blocks_h; by++) {
+    for (int bx = 0; bx < blocks_w; bx++) {
+      const uint8_t *word = src + twiddle(blocks_w, blocks_h, bx, by) * 8;
+      modulation[by * blocks_w + bx] = read32(word);
+      unpack_colors(read32(word + 4), &colors[by * blocks_w + bx]);
+    }
+  }
+
+  for (int y = 0; y < height; y++) {
+    // Word centers sit at 2, 6, 10..., wrap around the edges
+    int fy = y - 2 + blocks_h * 4;
+    int by0 = (fy / 4) % blocks_h;
+    int by1 = (by0 + 1) % blocks_h;
+    int wy = fy % 4;
+
+    for (int x = 0; x < width; x++) {
+      int fx = x - 2 + blocks_w * 4;
+      int bx0 = (fx / 4) % blocks_w;
+      int bx1 = (bx0 + 1) % blocks_w;
+      int wx = fx % 4;
+
+      const pvrtc_colors *p = &colors[by0 * blocks_w + bx0];
+      const pvrtc_colors *q = &colors[by0 * blocks_w + bx1];
+      const pvrtc_colors *r = &colors[by1 * blocks_w + bx0];
+      const pvrtc_colors *s = &colors[by1 * blocks_w + bx1];
+      int w00 = (4 - wx) * (4 - wy), w10 = wx * (4 - wy), w01 = (4 - wx) * wy, w11 = wx * wy;
+
+      int block = (y / 4) * blocks_w + (x / 4);
+      int mod = (modulation[block] >> (2 * ((y & 3) * 4 + (x & 3)))) & 3;
+      int punch = 0;
+
+      // Punch-through words trade the 3/8 and 5/8 steps for a transparent half
+      if (colors[block].punch) {
+        static const int punch_weights[] = { 0, 4, 4, 8 };
+        punch = mod == 2;
+        mod = punch_weights[mod];
+      } else {
+        static const int weights[] = { 0, 3, 5, 8 };
+        mod = weights[mod];
+      }
+
+      uint8_t *out = dst + (y * width + x) * 4;
+      for (int i = 0; i < 4; i++) {
+        // Scaled by 16, expanded from 5 or 4 bits to 8
+        int a = p->a[i] * w00 + q->a[i] * w10 + r->a[i] * w01 + s->a[i] * w11;
+        int b = p->b[i] * w00 + q->b[i] * w10 + r->b[i] * w01 + s->b[i] * w11;
+        if (i < 3) {
+          a = (a >> 6) + (a >> 1);
+          b = (b >> 6) + (b >> 1);
+        } else {
+          a = (a >> 4) + a;
+          b = (b >> 4) + b;
+        }
+        out[i] = (a * (8 - mod) + b * mod) / 8;
+      }
+      if (punch)
+        out[3] = 0;
+    }
+  }
+
+  free(colors);
+  free(modulation);
+}
@@ -0,0 +1,12 @@
+#ifndef __PVRTC_H__
+#define __PVRTC_H__
+
+#include <stdint.h>
+
+// Payload size of one 4bpp level, small levels still take 8x8 texels
+uint32_t pvrtc_4bpp_size(int width, int height);
+
+// Decodes a PVRTC 4bpp level into width * height RGBA8888 texels
+void pvrtc_decompress_4bpp(const uint8_t *src, int width, int height, uint8_t *dst);
+
+#endif
@@ -0,0 +1,391 @@
+/* residency.c -- texture residency under a video memory budget
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * Textures the game uploads with data are tracked with their size and the
+ * frame they were last bound in. Past the budget, the least recently used
+ * ones are snapshotted straight out of their vitaGL storage, deflated into
+ * system RAM (or to disk once the store is full) and shrunk to 1x1. Binding
+ * an evicted texture uploads it again. A snapshot that can't be read back
+ * leaves the texture on its 1x1 placeholder instead of stopping the game.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "main.h"
+#include "config.h"
+#include "residency.h"
+#include "texture.h"
+
+#define MAX_UNITS 8
+
+typedef struct {
+  int tracked;       // level 0 came with data in a layout we can snapshot
+  int pinned;        // the game supplied its own mips, keep it resident
+  int compressed;
+  GLint internalformat;
+  GLenum format;
+  GLenum type;
+  GLsizei width;
+  GLsizei height;
+  uint32_t size;       // level 0 bytes
+  uint32_t chain_size; // generated levels on top
+  uint32_t last_used;
+  int evicted;
+  int lost;            // the snapshot couldn't be read back, 1x1 until the next upload
+  int spilled;         // the store went to disk
+  uint8_t *store;
+  uint32_t store_size;
+} res_info;
+
+static res_info *textures = NULL;
+static int num_textures = 0;
+
+static GLuint bound[MAX_UNITS];
+static int unit = 0;
+
+static uint64_t budget;
+static uint64_t store_budget;
+static const char *spill_dir = NULL;
+static uint32_t frame = 0;
+
+static residency_stats stats;
+
+void residency_init(uint64_t budget_bytes, uint64_t store_budget_bytes, const char *spill_path) {
+  budget = budget_bytes;
+  store_budget = store_budget_bytes;
+  spill_dir = spill_path;
+  if (spill_dir)
+    sceIoMkdir(spill_dir, 0777);
+}
+
+residency_stats *residency_get_stats(void) {
+  return &stats;
+}
+
+static res_info *res_get(GLuint texture) {
+  if (texture >= num_textures) {
+    int count = num_textures ? num_textures : 256;
+    while (count <= texture)
+      count *= 2;
+    res_info *grown = realloc(textures, count * sizeof(res_info));
+    if (!grown)
+      return NULL;
+    memset(grown + num_textures, 0, (count - num_textures) * sizeof(res_info));
+    textures = grown;
+    num_textures = count;
+  }
+
+  return &textures[texture];
+}
+
+static uint64_t res_bytes(res_info *info) {
+  return info->size + info->chain_size;
+}
+
+// vitaGL keeps these formats in one plain buffer, rows are only padded below 8 texels
+int residency_snapshot_layout(GLsizei width, GLenum format, GLenum type, int compressed) {
+  if (compressed)
+    return 1;
+  if (width % 8)
+    return 0;
+  return (format == GL_RGBA && type == GL_UNSIGNED_BYTE) ||
+         type == GL_UNSIGNED_SHORT_5_6_5 ||
+         type == GL_UNSIGNED_SHORT_4_4_4_4 ||
+         type == GL_UNSIGNED_SHORT_5_5_5_1;
+}
+
+static void spill_path(char *path, size_t size, GLuint texture) {
+  snprintf(path, size, "%s/%u.bin", spill_dir, texture);
+}
+
+static void drop_store(GLuint texture, res_info *info) {
+  if (info->spilled) {
+    char path[256];
+    spill_path(path, sizeof(path), texture);
+    sceIoRemove(path);
+    stats.spilled_bytes -= info->store_size;
+  } else if (info->store) {
+    stats.store_bytes -= info->store_size;
+  }
+
+  free(info->store);
+  info->store = NULL;
+  info->store_size = 0;
+  info->spilled = 0;
+}
+
+void residency_forget(GLuint texture) {
+  res_info *info = texture < num_textures ? &textures[texture] : NULL;
+  if (!info || !info->tracked)
+    return;
+
+  if (info->evicted) {
+    drop_store(texture, info);
+    stats.evicted--;
+  } else if (!info->lost) {
+    stats.resident--;
+    stats.resident_bytes -= res_bytes(info);
+  }
+
+  memset(info, 0, sizeof(res_info));
+}
+
+void residency_upload(GLuint texture, GLint internalformat, GLsizei width, GLsizei height, GLenum format, GLenum type, uint32_t size, int compressed) {
+  residency_forget(texture);
+
+  if (!residency_snapshot_layout(width, format, type, compressed))
+    return;
+
+  res_info *info = res_get(texture);
+  if (!info)
+    return;
+
+  info->tracked = 1;
+  info->compressed = compressed;
+  info->internalformat = internalformat;
+  info->format = format;
+  info->type = type;
+  info->width = width;
+  info->height = height;
+  info->size = size;
+  info->last_used = frame;
+
+  stats.resident++;
+  stats.resident_bytes += size;
+}
+
+void residency_chain(GLuint texture, uint32_t size) {
+  res_info *info = texture < num_textures ? &textures[texture] : NULL;
+  if (!info || !info->tracked || info->evicted || info->lost)
+    return;
+
+  stats.resident_bytes = stats.resident_bytes - info->chain_size + size;
+  info->chain_size = size;
+}
+
+void residency_pin(GLuint texture) {
+  res_info *info = texture < num_textures ? &textures[texture] : NULL;
+  if (info && info->tracked)
+    info->pinned = 1;
+}
+
+static int is_bound(GLuint texture) {
+  for (int i = 0; i < MAX_UNITS; i++) {
+    if (bound[i] == texture)
+      return 1;
+  }
+  return 0;
+}
+
+static int evict(GLuint texture, res_info *info) {
+  uint64_t start = sceKernelGetProcessTimeWide();
+
+  glBindTexture(GL_TEXTURE_2D, texture);
+  const uint8_t *data = vglGetTexDataPointer(GL_TEXTURE_2D);
+  if (!data)
+    return -1;
+
+  uLongf store_size = compressBound(info->size);
+  uint8_t *store = malloc(store_size);
+  if (!store)
+    return -1;
+  if (compress2(store, &store_size, data, info->size, 1) != Z_OK) {
+    free(store);
+    return -1;
+  }
+
+  // A full store pushes the snapshot out to disk
+  if (spill_dir && stats.store_bytes + store_size > store_budget) {
+    char path[256];
+    spill_path(path, sizeof(path), texture);
+    FILE *file = fopen(path, "wb");
+    if (!file || fwrite(store, 1, store_size, file) != store_size) {
+      if (file)
+        fclose(file);
+      free(store);
+      return -1;
+    }
+    fclose(file);
+    free(store);
+    store = NULL;
+    info->spilled = 1;
+    stats.spilled_bytes += store_size;
+  } else {
+    info->store = realloc(store, store_size);
+    if (!info->store)
+      info->store = store;
+    stats.store_bytes += store_size;
+  }
+  info->store_size = store_size;
+
+  // Respecifying frees the storage and any mips, the name stays valid
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+  stats.resident--;
+  stats.resident_bytes -= res_bytes(info);
+  stats.evicted++;
+  stats.evictions++;
+  info->chain_size = 0;
+  info->evicted = 1;
+  texture_evicted(texture);
+
+  stats.evict_time += sceKernelGetProcessTimeWide() - start;
+  return 0;
+}
+
+// Runs with the texture bound
+static void restore(GLuint texture, res_info *info) {
+  uint64_t start = sceKernelGetProcessTimeWide();
+
+  uint8_t *store = info->store;
+  int lost = 0;
+  if (info->spilled) {
+    char path[256];
+    spill_path(path, sizeof(path), texture);
+    FILE *file = fopen(path, "rb");
+    store = file ? malloc(info->store_size) : NULL;
+    if (store && fread(store, 1, info->store_size, file) != info->store_size) {
+      free(store);
+      store = NULL;
+      lost = 1;
+    }
+    if (!file)
+      lost = 1;
+    if (file)
+      fclose(file);
+  }
+
+  uint8_t *data = store ? malloc(info->size) : NULL;
+  uLongf size = info->size;
+  if (data && (uncompress(data, &size, store, info->store_size) != Z_OK || size != info->size))
+    lost = 1;
+
+  if (lost || !data) {
+    if (store != info->store)
+      free(store);
+    free(data);
+
+    // Out of memory keeps the snapshot for the next bind, a bad one is gone
+    // for good and the texture stays 1x1 until the game uploads it again
+    if (lost) {
+      debugPrintf("Warning: could not read back texture %d, leaving the placeholder\n", texture);
+      drop_store(texture, info);
+      info->evicted = 0;
+      info->lost = 1;
+      stats.evicted--;
+      stats.lost++;
+    } else {
+      debugPrintf("Warning: no memory to restore texture %d, keeping it evicted\n", texture);
+    }
+    return;
+  }
+
+  if (store != info->store)
+    free(store);
+  drop_store(texture, info);
+
+  if (info->compressed)
+    glCompressedTexImage2D(GL_TEXTURE_2D, 0, info->format, info->width, info->height, 0, info->size, data);
+  else
+    glTexImage2D(GL_TEXTURE_2D, 0, info->internalformat, info->width, info->height, 0, info->format, info->type, data);
+
+  info->evicted = 0;
+  stats.evicted--;
+  stats.resident++;
+  stats.resident_bytes += info->size;
+  stats.restores++;
+
+  // Generated mips come back through the mip cache
+  texture_restored(texture, info->width, info->height, info->format, info->type, info->compressed ? NULL : data);
+  free(data);
+
+  stats.restore_time += sceKernelGetProcessTimeWide() - start;
+}
+
+void residency_active(GLenum texture_unit) {
+  unit = texture_unit - GL_TEXTURE0;
+  if (unit < 0 || unit >= MAX_UNITS)
+    unit = 0;
+}
+
+// A texture stays in use for as long as it is bound, which with repeated binds
+// dropped by the GL state cache can be many frames after its last bind
+void residency_bind(GLuint texture) {
+  GLuint previous = bound[unit];
+  if (previous < num_textures && textures[previous].tracked)
+    textures[previous].last_used = frame;
+  bound[unit] = texture;
+
+  res_info *info = texture < num_textures ? &textures[texture] : NULL;
+  if (!info || !info->tracked)
+    return;
+
+  info->last_used = frame;
+  if (info->evicted)
+    restore(texture, info);
+}
+
+// 0 while the texture's level 0 isn't what the game uploaded
+int residency_present(GLuint texture) {
+  res_info *info = texture < num_textures ? &textures[texture] : NULL;
+  return !info || !info->tracked || (!info->evicted && !info->lost);
+}
+
+static res_info *least_recent(GLuint *texture) {
+  res_info *oldest = NULL;
+  for (int i = 1; i < num_textures; i++) {
+    res_info *info = &textures[i];
+    if (!info->tracked || info->evicted || info->lost || info->pinned || info->last_used >= frame || is_bound(i))
+      continue;
+    if (!oldest || info->last_used < oldest->last_used) {
+      oldest = info;
+      *texture = i;
+    }
+  }
+  return oldest;
+}
+
+// A zero budget leaves every texture resident
+void residency_frame(void) {
+  if (budget && stats.resident_bytes > budget) {
+    GLint current = 0;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &current);
+
+    GLuint texture;
+    res_info *info;
+    while (stats.resident_bytes > budget && (info = least_recent(&texture))) {
+      if (evict(texture, info) < 0)
+        info->pinned = 1;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, current);
+  }
+
+  frame++;
+
+  if (++stats.frames < FRAME_STATS_INTERVAL)
+    return;
+
+  debugPrintf("Residency %u textures %.2f MB resident, %u evicted %.2f MB stored %.2f MB spilled %u lost, "
+              "%.2f evictions %.3f ms %.2f restores %.3f ms per frame\n",
+              stats.resident, stats.resident_bytes / 1048576.0f, stats.evicted,
+              stats.store_bytes / 1048576.0f, stats.spilled_bytes / 1048576.0f, stats.lost,
+              (float)stats.evictions / stats.frames, stats.evict_time / 1000.0f / stats.frames,
+              (float)stats.restores / stats.frames, stats.restore_time / 1000.0f / stats.frames);
+
+  stats.frames = 0;
+  stats.evictions = 0;
+  stats.restores = 0;
+  stats.evict_time = 0;
+  stats.restore_time = 0;
+}
@@ -0,0 +1,33 @@
+#ifndef __RESIDENCY_H__
+#define __RESIDENCY_H__
+
+#include <vitaGL.h>
+
+typedef struct {
+  uint32_t frames;
+  uint32_t resident;       // tracked textures in video memory
+  uint32_t evicted;        // tracked textures held in the store
+  uint64_t resident_bytes;
+  uint64_t store_bytes;    // compressed bytes held in RAM
+  uint64_t spilled_bytes;  // compressed bytes written out to disk
+  uint32_t lost;           // snapshots that couldn't be read back
+  uint32_t evictions;
+  uint32_t restores;
+  uint64_t evict_time;     // microseconds spent snapshotting and compressing
+  uint64_t restore_time;   // microseconds spent bringing textures back
+} residency_stats;
+
+void residency_init(uint64_t budget, uint64_t store_budget, const char *spill_path);
+residency_stats *residency_get_stats(void);
+
+int residency_snapshot_layout(GLsizei width, GLenum format, GLenum type, int compressed);
+void residency_upload(GLuint texture, GLint internalformat, GLsizei width, GLsizei height, GLenum format, GLenum type, uint32_t size, int compressed);
+void residency_chain(GLuint texture, uint32_t size);
+void residency_pin(GLuint texture);
+void residency_forget(GLuint texture);
+void residency_bind(GLuint texture);
+int residency_present(GLuint texture);
+void residency_active(GLenum unit);
+void residency_frame(void);
+
+#endif
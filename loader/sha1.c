@@ -17,56 +17,71 @@
 /****************************** MACROS ******************************/
 #define ROTLEFT(a, b) ((a << b) | (a >> (32 - b)))
 
+// Big endian word load, unaligned input is fine
+#define LOADBE(p) ({ WORD w; memcpy(&w, (p), 4); __builtin_bswap32(w); })
+
+// Message schedule kept as a rolling window of 16 words
+#define SCHED(i) (m[(i) & 15] = ROTLEFT((m[((i) + 13) & 15] ^ m[((i) + 8) & 15] ^ m[((i) + 2) & 15] ^ m[(i) & 15]), 1))
+
+#define F0(b, c, d) (d ^ (b & (c ^ d)))
+#define F1(b, c, d) (b ^ c ^ d)
+#define F2(b, c, d) ((b & c) | (d & (b | c)))
+
+#define ROUND(a, b, c, d, e, f, k, w) do { \
+	e += ROTLEFT(a, 5) + f(b, c, d) + k + w; \
+	b = ROTLEFT(b, 30); \
+} while (0)
+
+#define ROUND5(i, f, k, w) do { \
+	ROUND(a, b, c, d, e, f, k, w(i)); \
+	ROUND(e, a, b, c, d, f, k, w(i + 1)); \
+	ROUND(d, e, a, b, c, f, k, w(i + 2)); \
+	ROUND(c, d, e, a, b, f, k, w(i + 3)); \
+	ROUND(b, c, d, e, a, f, k, w(i + 4)); \
+} while (0)
+
+#define K0 0x5a827999
+#define K1 0x6ed9eba1
+#define K2 0x8f1bbcdc
+#define K3 0xca62c1d6
+
 /*********************** FUNCTION DEFINITIONS ***********************/
 void sha1_transform(SHA1_CTX *ctx, const BYTE data[])
 {
-	WORD a, b, c, d, e, i, j, t, m[80];
-
-	for (i = 0, j = 0; i < 16; ++i, j += 4)
-		m[i] = (data[j] << 24) + (data[j + 1] << 16) + (data[j + 2] << 8) + (data[j + 3]);
-	for ( ; i < 80; ++i) {
-		m[i] = (m[i - 3] ^ m[i - 8] ^ m[i - 14] ^ m[i - 16]);
-		m[i] = (m[i] << 1) | (m[i] >> 31);
-	}
+	WORD a, b, c, d, e, m[16];
 
+	// Fully unrolled: the variables rotate roles instead of being shuffled
+#define LOAD(i) (m[i] = LOADBE(data + (i) * 4))
 	a = ctx->state[0];
 	b = ctx->state[1];
 	c = ctx->state[2];
 	d = ctx->state[3];
 	e = ctx->state[4];
 
-	for (i = 0; i < 20; ++i) {
-		t = ROTLEFT(a, 5) + ((b & c) ^ (~b & d)) + e + ctx->k[0] + m[i];
-		e = d;
-		d = c;
-		c = ROTLEFT(b, 30);
-		b = a;
-		a = t;
-	}
-	for ( ; i < 40; ++i) {
-		t = ROTLEFT(a, 5) + (b ^ c ^ d) + e + ctx->k[1] + m[i];
-		e = d;
-		d = c;
-		c = ROTLEFT(b, 30);
-		b = a;
-		a = t;
-	}
-	for ( ; i < 60; ++i) {
-		t = ROTLEFT(a, 5) + ((b & c) ^ (b & d) ^ (c & d))  + e + ctx->k[2] + m[i];
-		e = d;
-		d = c;
-		c = ROTLEFT(b, 30);
-		b = a;
-		a = t;
-	}
-	for ( ; i < 80; ++i) {
-		t = ROTLEFT(a, 5) + (b ^ c ^ d) + e + ctx->k[3] + m[i];
-		e = d;
-		d = c;
-		c = ROTLEFT(b, 30);
-		b = a;
-		a = t;
-	}
+	ROUND5(0, F0, K0, LOAD);
+	ROUND5(5, F0, K0, LOAD);
+	ROUND5(10, F0, K0, LOAD);
+	ROUND(a, b, c, d, e, F0, K0, LOAD(15));
+	ROUND(e, a, b, c, d, F0, K0, SCHED(16));
+	ROUND(d, e, a, b, c, F0, K0, SCHED(17));
+	ROUND(c, d, e, a, b, F0, K0, SCHED(18));
+	ROUND(b, c, d, e, a, F0, K0, SCHED(19));
+
+	ROUND5(20, F1, K1, SCHED);
+	ROUND5(25, F1, K1, SCHED);
+	ROUND5(30, F1, K1, SCHED);
+	ROUND5(35, F1, K1, SCHED);
+
+	ROUND5(40, F2, K2, SCHED);
+	ROUND5(45, F2, K2, SCHED);
+	ROUND5(50, F2, K2, SCHED);
+	ROUND5(55, F2, K2, SCHED);
+
+	ROUND5(60, F1, K3, SCHED);
+	ROUND5(65, F1, K3, SCHED);
+	ROUND5(70, F1, K3, SCHED);
+	ROUND5(75, F1, K3, SCHED);
+#undef LOAD
 
 	ctx->state[0] += a;
 	ctx->state[1] += b;
@@ -84,25 +99,34 @@ void sha1_init(SHA1_CTX *ctx)
 	ctx->state[2] = 0x98BADCFE;
 	ctx->state[3] = 0x10325476;
 	ctx->state[4] = 0xc3d2e1f0;
-	ctx->k[0] = 0x5a827999;
-	ctx->k[1] = 0x6ed9eba1;
-	ctx->k[2] = 0x8f1bbcdc;
-	ctx->k[3] = 0xca62c1d6;
 }
 
 void sha1_update(SHA1_CTX *ctx, const BYTE data[], size_t len)
 {
-	size_t i;
-
-	for (i = 0; i < len; ++i) {
-		ctx->data[ctx->datalen] = data[i];
-		ctx->datalen++;
-		if (ctx->datalen == 64) {
-			sha1_transform(ctx, ctx->data);
-			ctx->bitlen += 512;
-			ctx->datalen = 0;
-		}
+	// Top up a partially filled block first
+	if (ctx->datalen) {
+		size_t n = 64 - ctx->datalen;
+		if (n > len)
+			n = len;
+		memcpy(ctx->data + ctx->datalen, data, n);
+		ctx->datalen += n;
+		data += n;
+		len -= n;
+		if (ctx->datalen < 64)
+			return;
+		sha1_transform(ctx, ctx->data);
+		ctx->bitlen += 512;
+		ctx->datalen = 0;
+	}
+
+	// Whole blocks straight from the input
+	for ( ; len >= 64; data += 64, len -= 64) {
+		sha1_transform(ctx, data);
+		ctx->bitlen += 512;
 	}
+
+	memcpy(ctx->data, data, len);
+	ctx->datalen = len;
 }
 
 void sha1_final(SHA1_CTX *ctx, BYTE hash[])
@@ -0,0 +1,564 @@
+/* shader.c -- shader replacement and compiled binary cache
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <vitashark.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "config.h"
+#include "profile.h"
+#include "sha1.h"
+#include "shader.h"
+#include "shader_index.h"
+#include "shader_variant.h"
+
+#define GXP_MAGIC 0x43505847 // 'GXPC'
+#define GXP_VERSION 1
+#define GXP_MAX_SIZE 0x20000
+
+#define WARMUP_STACK_SIZE (512 * 1024)
+
+enum {
+  SHADER_NONE,
+  SHADER_SOURCE, // compiled at runtime, binary still to be saved
+  SHADER_BINARY, // uploaded from a binary, nothing to compile
+};
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint8_t cg_hash[20]; // SHA1 of the .cg source the binary was compiled from
+  uint32_t size;
+} gxp_header;
+
+typedef struct {
+  int state;
+  shader_index_entry *entry;
+} shader_slot;
+
+// A specialization of an entry's source, VARIANT_GENERIC is the entry itself
+typedef struct {
+  shader_binary binary;
+  uint8_t cg_hash[20]; // SHA1 of the define followed by the source
+  int hashed;
+} variant_slot;
+
+static const char *cache_dir = NULL;
+
+static shader_slot *slots = NULL;
+static int num_slots = 0;
+
+static variant_slot *variants = NULL; // VARIANT_COUNT per index entry
+static int num_variants = 0;
+
+static shader_stats stats;
+
+static pthread_t warmup_thread;
+static int warmup_running = 0;
+static uint64_t warmup_start_time;
+static uint64_t warmup_end_time;
+static uint64_t warmup_wait_time;
+static uint32_t *warmup_times = NULL;
+
+// The worker marks jobs ready one by one, the game thread only waits for the
+// job it is about to use and the worker moves that one to the front. Jobs are
+// every entry first, then the variants of the entries that have them
+static pthread_mutex_t warmup_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t warmup_cond = PTHREAD_COND_INITIALIZER;
+static uint8_t *warmup_ready = NULL;
+static int warmup_wanted = -1;
+
+// vitaShaRK is not reentrant, runtime compiles take turns with the worker
+static pthread_mutex_t compile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void shader_cache_init(const char *pack_path, const char *cg_path, const char *cache_path) {
+  shader_warmup_wait();
+
+  // The packed archive ships in the VPK, loose .cg files are for development
+  int count = pack_path ? shader_index_load_pack(pack_path) : -1;
+  if (count >= 0) {
+    debugPrintf("Indexed %d shaders in %s\n", count, pack_path);
+  } else {
+    count = shader_index_load(cg_path);
+    if (count < 0)
+      debugPrintf("Warning: could not index shaders in %s\n", cg_path);
+    else
+      debugPrintf("Indexed %d shaders in %s\n", count, cg_path);
+  }
+
+  cache_dir = cache_path;
+  if (cache_dir)
+    sceIoMkdir(cache_dir, 0777);
+
+  if (variants) {
+    for (int i = 0; i < num_variants; i++)
+      free(variants[i].binary.data);
+    free(variants);
+  }
+  num_variants = shader_index_count() * VARIANT_COUNT;
+  variants = calloc(num_variants, sizeof(variant_slot));
+  if (!variants)
+    num_variants = 0;
+}
+
+shader_stats *shader_cache_stats(void) {
+  return &stats;
+}
+
+static shader_slot *shader_slot_get(GLuint shader) {
+  if (shader >= num_slots) {
+    int count = num_slots ? num_slots : 64;
+    while (count <= shader)
+      count *= 2;
+    shader_slot *grown = realloc(slots, count * sizeof(shader_slot));
+    if (!grown)
+      return NULL;
+    memset(grown + num_slots, 0, (count - num_slots) * sizeof(shader_slot));
+    slots = grown;
+    num_slots = count;
+  }
+
+  return &slots[shader];
+}
+
+shader_index_entry *shader_get_entry(GLuint shader) {
+  return shader < num_slots ? slots[shader].entry : NULL;
+}
+
+static void *read_file(const char *path, long *size) {
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return NULL;
+
+  fseek(file, 0, SEEK_END);
+  *size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  char *data = malloc(*size + 1);
+  if (data && fread(data, 1, *size, file) != *size) {
+    free(data);
+    data = NULL;
+  }
+  if (data)
+    data[*size] = '\0';
+
+  fclose(file);
+  return data;
+}
+
+static int entry_index(shader_index_entry *entry) {
+  return entry - shader_index_get(0);
+}
+
+static shader_binary *binary_get(shader_index_entry *entry, int variant) {
+  if (variant == VARIANT_GENERIC)
+    return &entry->binary;
+  int i = entry_index(entry) * VARIANT_COUNT + variant;
+  return i < num_variants ? &variants[i].binary : NULL;
+}
+
+static const uint8_t *binary_cg_hash(shader_index_entry *entry, int variant) {
+  if (variant == VARIANT_GENERIC)
+    return shader_index_cg_hash(entry);
+
+  variant_slot *v = &variants[entry_index(entry) * VARIANT_COUNT + variant];
+  if (!v->hashed) {
+    const char *define = variant_define(variant);
+    SHA1_CTX ctx;
+    sha1_init(&ctx);
+    sha1_update(&ctx, (const uint8_t *)define, strlen(define));
+    sha1_update(&ctx, (const uint8_t *)shader_index_source(entry), entry->size);
+    sha1_final(&ctx, v->cg_hash);
+    v->hashed = 1;
+  }
+  return v->cg_hash;
+}
+
+// The source a job compiles, variants prepend their define
+static char *binary_source(shader_index_entry *entry, int variant) {
+  if (variant == VARIANT_GENERIC)
+    return (char *)shader_index_source(entry);
+
+  const char *define = variant_define(variant);
+  size_t len = strlen(define) + entry->size;
+  char *source = malloc(len + 1);
+  if (source)
+    snprintf(source, len + 1, "%s%s", define, shader_index_source(entry));
+  return source;
+}
+
+static void free_source(char *source, int variant) {
+  if (variant != VARIANT_GENERIC)
+    free(source);
+}
+
+static void binary_path(char *path, size_t size, shader_index_entry *entry, int variant) {
+  const uint32_t *key = entry->key;
+  if (variant == VARIANT_GENERIC)
+    snprintf(path, size, "%s/%08x%08x%08x%08x%08x.gxp", cache_dir, key[0], key[1], key[2], key[3], key[4]);
+  else
+    snprintf(path, size, "%s/%08x%08x%08x%08x%08x.v%d.gxp", cache_dir, key[0], key[1], key[2], key[3], key[4], variant);
+}
+
+// Pulls the cached binary of an entry off disk, no GL involved
+static int shader_read_binary(shader_index_entry *entry, int variant) {
+  shader_binary *binary = binary_get(entry, variant);
+  if (!binary)
+    return -1;
+  if (binary->data)
+    return 0;
+  if (!cache_dir || binary->checked)
+    return -1;
+
+  binary->checked = 1;
+
+  char path[256];
+  binary_path(path, sizeof(path), entry, variant);
+
+  long size;
+  uint8_t *data = read_file(path, &size);
+  if (!data)
+    return -1;
+
+  // A binary is only good for the exact .cg source it was compiled from
+  gxp_header *header = (gxp_header *)data;
+  if (size < sizeof(gxp_header) ||
+      header->magic != GXP_MAGIC ||
+      header->version != GXP_VERSION ||
+      header->size != size - sizeof(gxp_header) ||
+      memcmp(header->cg_hash, binary_cg_hash(entry, variant), sizeof(header->cg_hash)) != 0) {
+    free(data);
+    return -1;
+  }
+
+  binary->size = header->size;
+  binary->data = malloc(binary->size);
+  if (!binary->data) {
+    free(data);
+    return -1;
+  }
+  memcpy(binary->data, data + sizeof(gxp_header), binary->size);
+
+  free(data);
+  return 0;
+}
+
+static int shader_write_binary(shader_index_entry *entry, int variant, const void *binary, uint32_t size) {
+  if (!cache_dir)
+    return -1;
+
+  gxp_header header;
+  header.magic = GXP_MAGIC;
+  header.version = GXP_VERSION;
+  memcpy(header.cg_hash, binary_cg_hash(entry, variant), sizeof(header.cg_hash));
+  header.size = size;
+
+  char path[256];
+  binary_path(path, sizeof(path), entry, variant);
+
+  FILE *file = fopen(path, "wb");
+  if (!file)
+    return -1;
+
+  int ret = fwrite(&header, 1, sizeof(gxp_header), file) == sizeof(gxp_header) &&
+            fwrite(binary, 1, size, file) == size ? 0 : -1;
+  fclose(file);
+  return ret;
+}
+
+static void shader_save_binary(GLuint shader, shader_index_entry *entry, int variant) {
+  shader_binary *binary = binary_get(entry, variant);
+  if (!binary)
+    return;
+
+  uint8_t *data = malloc(GXP_MAX_SIZE);
+  if (!data)
+    return;
+
+  GLsizei size = 0;
+  vglGetShaderBinary(shader, GXP_MAX_SIZE, &size, data);
+
+  // A full buffer means the program may have been cut off
+  if (size > 0 && size < GXP_MAX_SIZE) {
+    if (shader_write_binary(entry, variant, data, size) == 0) {
+      pthread_mutex_lock(&warmup_lock);
+      stats.saves++;
+      pthread_mutex_unlock(&warmup_lock);
+    }
+
+    // Further shader objects with the same source skip the compiler
+    if (!binary->data) {
+      binary->data = realloc(data, size);
+      binary->size = size;
+      if (binary->data)
+        return;
+    }
+  }
+
+  free(data);
+}
+
+static int warmup_job(int i, int variant) {
+  return variant == VARIANT_GENERIC ? i : shader_index_count() + i * (VARIANT_COUNT - 1) + variant - 1;
+}
+
+static int warmup_next(int count, int *cursor) {
+  pthread_mutex_lock(&warmup_lock);
+  int job = warmup_wanted;
+  if (job < 0 || warmup_ready[job]) {
+    while (*cursor < count && warmup_ready[*cursor])
+      (*cursor)++;
+    job = *cursor < count ? *cursor : -1;
+  }
+  pthread_mutex_unlock(&warmup_lock);
+  return job;
+}
+
+static void *shader_warmup_thread(void *arg) {
+  int count = shader_index_count();
+  int cursor = 0;
+
+  for (int job = warmup_next(count * VARIANT_COUNT, &cursor); job >= 0; job = warmup_next(count * VARIANT_COUNT, &cursor)) {
+    int i = job < count ? job : (job - count) / (VARIANT_COUNT - 1);
+    int variant = job < count ? VARIANT_GENERIC : (job - count) % (VARIANT_COUNT - 1) + 1;
+    shader_index_entry *entry = shader_index_get(i);
+    shader_binary *binary = binary_get(entry, variant);
+    int compiled = 0, saved = 0;
+
+    if (binary && (variant == VARIANT_GENERIC || variant_has_defines(entry)) && shader_read_binary(entry, variant) != 0) {
+      // The replacements follow the naming of the Cg they were ported to
+      char *source = binary_source(entry, variant);
+      shark_type type = strstr(shader_index_source(entry), "VS_OUT") ? SHARK_VERTEX_SHADER : SHARK_FRAGMENT_SHADER;
+
+      pthread_mutex_lock(&compile_lock);
+      uint64_t start = sceKernelGetProcessTimeWide();
+      uint32_t size = 0;
+      uint8_t *data = source ? shark_compile_shader_extended(source, &size, type, SHARK_OPT_UNSAFE, SHARK_ENABLE, SHARK_ENABLE, SHARK_ENABLE) : NULL;
+      warmup_times[job] = sceKernelGetProcessTimeWide() - start;
+
+      if (data && size > 0) {
+        binary->data = malloc(size);
+        if (binary->data) {
+          memcpy(binary->data, data, size);
+          binary->size = size;
+          compiled = 1;
+        }
+      }
+      shark_clear_output();
+      pthread_mutex_unlock(&compile_lock);
+      free_source(source, variant);
+
+      saved = compiled && shader_write_binary(entry, variant, binary->data, binary->size) == 0;
+    }
+
+    pthread_mutex_lock(&warmup_lock);
+    stats.warmed += compiled;
+    stats.saves += saved;
+    warmup_ready[job] = 1;
+    pthread_cond_broadcast(&warmup_cond);
+    pthread_mutex_unlock(&warmup_lock);
+  }
+
+  warmup_end_time = sceKernelGetProcessTimeWide();
+  return NULL;
+}
+
+void shader_warmup_start(void) {
+  int count = shader_index_count() * VARIANT_COUNT;
+  if (warmup_running || count == 0)
+    return;
+
+  warmup_times = calloc(count, sizeof(uint32_t));
+  warmup_ready = calloc(count, sizeof(uint8_t));
+  if (!warmup_times || !warmup_ready) {
+    free(warmup_times);
+    free(warmup_ready);
+    warmup_times = NULL;
+    warmup_ready = NULL;
+    return;
+  }
+  warmup_wanted = -1;
+  warmup_wait_time = 0;
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, WARMUP_STACK_SIZE);
+
+  warmup_start_time = sceKernelGetProcessTimeWide();
+  if (pthread_create(&warmup_thread, &attr, shader_warmup_thread, NULL) == 0) {
+    warmup_running = 1;
+  } else {
+    free(warmup_ready);
+    warmup_ready = NULL;
+  }
+
+  pthread_attr_destroy(&attr);
+}
+
+// Blocks until the worker is done with one job, pulling it ahead of the rest
+static void shader_warmup_wait_job(int job) {
+  if (!warmup_running)
+    return;
+
+  pthread_mutex_lock(&warmup_lock);
+  if (!warmup_ready[job]) {
+    uint64_t start = sceKernelGetProcessTimeWide();
+    warmup_wanted = job;
+    while (!warmup_ready[job])
+      pthread_cond_wait(&warmup_cond, &warmup_lock);
+    warmup_wait_time += sceKernelGetProcessTimeWide() - start;
+  }
+  pthread_mutex_unlock(&warmup_lock);
+}
+
+void shader_warmup_wait(void) {
+  if (!warmup_running)
+    return;
+
+  uint64_t start = sceKernelGetProcessTimeWide();
+  pthread_join(warmup_thread, NULL);
+  warmup_wait_time += sceKernelGetProcessTimeWide() - start;
+  warmup_running = 0;
+
+  free(warmup_ready);
+  warmup_ready = NULL;
+}
+
+void shader_warmup_report(void) {
+  shader_warmup_wait();
+
+  if (!warmup_times)
+    return;
+
+  uint64_t total = warmup_end_time - warmup_start_time;
+  uint64_t overlap = total > warmup_wait_time ? total - warmup_wait_time : 0;
+
+  int count = shader_index_count();
+  for (int i = 0; i < count; i++) {
+    for (int v = 0; v < VARIANT_COUNT; v++) {
+      uint32_t time = warmup_times[warmup_job(i, v)];
+      if (time && v == VARIANT_GENERIC)
+        profile_add_background(time, "warmup %08x", shader_index_get(i)->key[0]);
+      else if (time)
+        profile_add_background(time, "warmup %08x.v%d", shader_index_get(i)->key[0], v);
+    }
+  }
+  profile_add_background(total, "warmup total");
+  profile_add_background(overlap, "warmup overlapped");
+
+  debugPrintf("Shader warm-up compiled %d shaders in %.3f ms, %.3f ms of it hidden behind the boot\n",
+              stats.warmed, total / 1000.0f, overlap / 1000.0f);
+
+  free(warmup_times);
+  warmup_times = NULL;
+}
+
+// Uploads the cached binary of a job into a shader object, 0 on success
+static int shader_load_binary(GLuint shader, shader_index_entry *entry, int variant) {
+  // The worker owns the job until it is marked ready
+  shader_warmup_wait_job(warmup_job(entry_index(entry), variant));
+
+  if (shader_read_binary(entry, variant) != 0)
+    return -1;
+
+  shader_binary *binary = binary_get(entry, variant);
+  glShaderBinary(1, &shader, 0, binary->data, binary->size);
+  if (glGetError() != GL_NO_ERROR)
+    return -1;
+
+  stats.hits++;
+  return 0;
+}
+
+static int shader_compile(GLuint shader, shader_index_entry *entry, int variant) {
+  stats.compiles++;
+  pthread_mutex_lock(&compile_lock);
+  glCompileShader(shader);
+  pthread_mutex_unlock(&compile_lock);
+
+  GLint compiled = GL_FALSE;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+  if (compiled && entry)
+    shader_save_binary(shader, entry, variant);
+  return compiled ? 0 : -1;
+}
+
+GLuint shader_variant_create(shader_index_entry *entry, int variant) {
+  GLuint shader = glCreateShader(GL_VERTEX_SHADER);
+  if (shader_load_binary(shader, entry, variant) == 0)
+    return shader;
+
+  char *source = binary_source(entry, variant);
+  if (!source) {
+    glDeleteShader(shader);
+    return 0;
+  }
+  glShaderSource(shader, 1, (const GLchar **)&source, NULL);
+  free_source(source, variant);
+
+  if (shader_compile(shader, entry, variant) != 0) {
+    glDeleteShader(shader);
+    return 0;
+  }
+  return shader;
+}
+
+void glShaderSourceHook(GLuint shader, GLsizei count, const GLchar **string, const GLint *length) {
+  stats.sources++;
+
+  shader_slot *slot = shader_slot_get(shader);
+  if (slot) {
+    slot->state = SHADER_NONE;
+    slot->entry = NULL;
+  }
+
+  size_t len = strlen(*string);
+  shader_index_entry *entry = shader_index_lookup(*string, len);
+  if (!entry) {
+    uint32_t key[5];
+    shader_index_key(*string, len, key);
+    debugPrintf("Warning: no replacement for %08x%08x%08x%08x%08x (%d bytes), using the original\n",
+                key[0], key[1], key[2], key[3], key[4], (int)len);
+    stats.misses++;
+    glShaderSource(shader, count, string, length);
+    return;
+  }
+
+  if (slot) {
+    slot->entry = entry;
+
+    if (shader_load_binary(shader, entry, VARIANT_GENERIC) == 0) {
+      slot->state = SHADER_BINARY;
+      return;
+    }
+
+    slot->state = SHADER_SOURCE;
+  }
+
+  const GLchar *sources[] = { shader_index_source(entry) };
+  glShaderSource(shader, 1, sources, NULL);
+}
+
+void glCompileShaderHook(GLuint shader) {
+  shader_slot *slot = shader < num_slots ? &slots[shader] : NULL;
+
+  // The program was already uploaded by glShaderBinary
+  if (slot && slot->state == SHADER_BINARY)
+    return;
+
+  shader_compile(shader, slot && slot->state == SHADER_SOURCE ? slot->entry : NULL, VARIANT_GENERIC);
+  if (slot)
+    slot->state = SHADER_NONE;
+}
@@ -0,0 +1,30 @@
+#ifndef __SHADER_H__
+#define __SHADER_H__
+
+#include <vitaGL.h>
+
+#include "shader_index.h"
+
+typedef struct {
+  int sources;   // glShaderSource calls seen
+  int misses;    // shaders without a Cg replacement, passed through as GLSL
+  int hits;      // shaders uploaded from a binary
+  int warmed;    // binaries compiled ahead of time by the warm-up thread
+  int compiles;  // shaders handed to the runtime compiler
+  int saves;     // binaries written to the cache
+} shader_stats;
+
+void shader_cache_init(const char *pack_path, const char *cg_path, const char *cache_path);
+shader_stats *shader_cache_stats(void);
+
+shader_index_entry *shader_get_entry(GLuint shader);
+GLuint shader_variant_create(shader_index_entry *entry, int variant);
+
+void shader_warmup_start(void);
+void shader_warmup_wait(void);
+void shader_warmup_report(void);
+
+void glShaderSourceHook(GLuint shader, GLsizei count, const GLchar **string, const GLint *length);
+void glCompileShaderHook(GLuint shader);
+
+#endif
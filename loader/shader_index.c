@@ -0,0 +1,375 @@
+/* shader_index.c -- in-memory index of the Cg replacement shaders
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "main.h"
+#include "murmur.h"
+#include "sha1.h"
+#include "shader_index.h"
+
+#define SHADER_NAME_LEN 40
+
+#define PACK_MAGIC 0x4b504853 // 'SHPK'
+#define PACK_VERSION 1
+#define PACK_ZLIB (1 << 0)
+
+// Written by tools/pack_shaders.py
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t count;
+  uint32_t flags;
+  uint32_t blob_size;
+  uint32_t packed_size;
+} pack_header;
+
+typedef struct {
+  uint32_t key[5];
+  uint32_t offset;
+  uint32_t size;
+} pack_entry;
+
+static shader_index_entry *entries = NULL;
+static int num_entries = 0;
+
+// Sources, NUL terminated. arena_base is the allocation it lives in
+static char *arena = NULL;
+static void *arena_base = NULL;
+
+// Repeated sources are answered from here without running SHA1 again. The
+// fingerprint only picks the slot, a hit still has to match the source bytes
+typedef struct {
+  uint64_t fingerprint;
+  uint32_t len;
+  int32_t index; // entry, -1 for a known miss
+  char *glsl;    // copy of the source the answer was computed for
+} memo_slot;
+
+static memo_slot *memo = NULL;
+static uint32_t memo_mask = 0;
+static int memo_count = 0;
+
+static int key_cmp(const uint32_t *a, const uint32_t *b) {
+  for (int i = 0; i < 5; i++) {
+    if (a[i] != b[i])
+      return a[i] < b[i] ? -1 : 1;
+  }
+  return 0;
+}
+
+static int entry_cmp(const void *a, const void *b) {
+  return key_cmp(((const shader_index_entry *)a)->key, ((const shader_index_entry *)b)->key);
+}
+
+static int parse_name(const char *name, uint32_t key[5]) {
+  if (strlen(name) != SHADER_NAME_LEN + 3 || strcmp(name + SHADER_NAME_LEN, ".cg") != 0)
+    return -1;
+
+  for (int i = 0; i < 5; i++) {
+    uint32_t word = 0;
+    for (int j = 0; j < 8; j++) {
+      char c = name[i * 8 + j];
+      if (c >= '0' && c <= '9')
+        word = (word << 4) | (c - '0');
+      else if (c >= 'a' && c <= 'f')
+        word = (word << 4) | (c - 'a' + 10);
+      else
+        return -1;
+    }
+    key[i] = word;
+  }
+
+  return 0;
+}
+
+static int read_entry(const char *path, shader_index_entry *entry) {
+  char file_path[256];
+  snprintf(file_path, sizeof(file_path), "%s/%08x%08x%08x%08x%08x.cg", path,
+           entry->key[0], entry->key[1], entry->key[2], entry->key[3], entry->key[4]);
+
+  SceUID fd = sceIoOpen(file_path, SCE_O_RDONLY, 0);
+  if (fd < 0)
+    return -1;
+
+  int res = sceIoRead(fd, arena + entry->offset, entry->size);
+  sceIoClose(fd);
+
+  if (res != entry->size)
+    return -1;
+
+  arena[entry->offset + entry->size] = '\0';
+  return 0;
+}
+
+int shader_index_load(const char *path) {
+  shader_index_free();
+
+  SceUID dfd = sceIoDopen(path);
+  if (dfd < 0)
+    return -1;
+
+  // One scan for names and sizes, then every source goes into a single arena
+  int max_entries = 0;
+  uint32_t arena_size = 0;
+  SceIoDirent dirent;
+  memset(&dirent, 0, sizeof(SceIoDirent));
+
+  while (sceIoDread(dfd, &dirent) > 0) {
+    uint32_t key[5];
+    if (parse_name(dirent.d_name, key) < 0)
+      continue;
+
+    if (num_entries == max_entries) {
+      max_entries = max_entries ? max_entries * 2 : 64;
+      shader_index_entry *grown = realloc(entries, max_entries * sizeof(shader_index_entry));
+      if (!grown)
+        break;
+      entries = grown;
+    }
+
+    shader_index_entry *entry = &entries[num_entries++];
+    memset(entry, 0, sizeof(shader_index_entry));
+    memcpy(entry->key, key, sizeof(key));
+    entry->offset = arena_size;
+    entry->size = dirent.d_stat.st_size;
+    arena_size += entry->size + 1;
+  }
+
+  sceIoDclose(dfd);
+
+  arena = arena_base = malloc(arena_size ? arena_size : 1);
+  if (!arena)
+    goto err_free;
+
+  int count = 0;
+  for (int i = 0; i < num_entries; i++) {
+    if (read_entry(path, &entries[i]) < 0) {
+      debugPrintf("Warning: could not read shader %08x%08x%08x%08x%08x.cg\n",
+                  entries[i].key[0], entries[i].key[1], entries[i].key[2], entries[i].key[3], entries[i].key[4]);
+      continue;
+    }
+    entries[count++] = entries[i];
+  }
+  num_entries = count;
+
+  qsort(entries, num_entries, sizeof(shader_index_entry), entry_cmp);
+  return num_entries;
+
+err_free:
+  shader_index_free();
+  return -1;
+}
+
+int shader_index_load_pack(const char *path) {
+  shader_index_free();
+
+  SceUID fd = sceIoOpen(path, SCE_O_RDONLY, 0);
+  if (fd < 0)
+    return -1;
+
+  // The whole archive comes in with a single read
+  SceOff size = sceIoLseek(fd, 0, SCE_SEEK_END);
+  sceIoLseek(fd, 0, SCE_SEEK_SET);
+
+  uint8_t *data = NULL;
+  if (size >= sizeof(pack_header))
+    data = malloc(size);
+  if (!data || sceIoRead(fd, data, size) != size) {
+    sceIoClose(fd);
+    free(data);
+    return -1;
+  }
+  sceIoClose(fd);
+
+  pack_header *header = (pack_header *)data;
+  pack_entry *pack = (pack_entry *)(data + sizeof(pack_header));
+
+  if (header->magic != PACK_MAGIC ||
+      header->version != PACK_VERSION ||
+      header->count > (size - sizeof(pack_header)) / sizeof(pack_entry))
+    goto err_free_data;
+
+  uint8_t *blob = (uint8_t *)&pack[header->count];
+  if (blob + header->packed_size != data + size)
+    goto err_free_data;
+
+  if (header->flags & PACK_ZLIB) {
+    uLongf blob_size = header->blob_size;
+    arena = arena_base = malloc(blob_size ? blob_size : 1);
+    if (!arena || uncompress((Bytef *)arena, &blob_size, blob, header->packed_size) != Z_OK ||
+        blob_size != header->blob_size)
+      goto err_free_data;
+  } else {
+    if (header->packed_size != header->blob_size)
+      goto err_free_data;
+    arena = (char *)blob;
+    arena_base = data;
+  }
+
+  entries = malloc((header->count ? header->count : 1) * sizeof(shader_index_entry));
+  if (!entries)
+    goto err_free_data;
+
+  for (int i = 0; i < header->count; i++) {
+    // Every source has to end inside the blob with its terminator
+    if ((uint64_t)pack[i].offset + pack[i].size >= header->blob_size || arena[pack[i].offset + pack[i].size] != '\0')
+      goto err_free_data;
+
+    shader_index_entry *entry = &entries[i];
+    memset(entry, 0, sizeof(shader_index_entry));
+    memcpy(entry->key, pack[i].key, sizeof(entry->key));
+    entry->offset = pack[i].offset;
+    entry->size = pack[i].size;
+  }
+  num_entries = header->count;
+
+  if (arena_base != data)
+    free(data);
+
+  return num_entries;
+
+err_free_data:
+  if (arena_base != data)
+    free(data);
+  shader_index_free();
+  return -1;
+}
+
+void shader_index_free(void) {
+  for (int i = 0; i < num_entries; i++)
+    free(entries[i].binary.data);
+  free(entries);
+  free(arena_base);
+  for (uint32_t i = 0; memo && i <= memo_mask; i++)
+    free(memo[i].glsl);
+  free(memo);
+  entries = NULL;
+  arena = NULL;
+  arena_base = NULL;
+  num_entries = 0;
+  memo = NULL;
+  memo_mask = 0;
+  memo_count = 0;
+}
+
+int shader_index_count(void) {
+  return num_entries;
+}
+
+shader_index_entry *shader_index_get(int i) {
+  return &entries[i];
+}
+
+shader_index_entry *shader_index_find(const uint32_t key[5]) {
+  int lo = 0, hi = num_entries - 1;
+
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    int cmp = key_cmp(entries[mid].key, key);
+    if (cmp == 0)
+      return &entries[mid];
+    if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+
+  return NULL;
+}
+
+const char *shader_index_source(shader_index_entry *entry) {
+  return arena + entry->offset;
+}
+
+const uint8_t *shader_index_cg_hash(shader_index_entry *entry) {
+  if (!entry->hashed) {
+    SHA1_CTX ctx;
+    sha1_init(&ctx);
+    sha1_update(&ctx, (uint8_t *)arena + entry->offset, entry->size);
+    sha1_final(&ctx, entry->cg_hash);
+    entry->hashed = 1;
+  }
+
+  return entry->cg_hash;
+}
+
+static memo_slot *memo_find(uint64_t fingerprint, const char *glsl, uint32_t len) {
+  uint32_t pos = (uint32_t)fingerprint & memo_mask;
+  while (memo[pos].glsl) {
+    if (memo[pos].fingerprint == fingerprint && memo[pos].len == len && memcmp(memo[pos].glsl, glsl, len) == 0)
+      return &memo[pos];
+    pos = (pos + 1) & memo_mask;
+  }
+  return &memo[pos];
+}
+
+static int memo_grow(void) {
+  memo_slot *old = memo;
+  uint32_t old_size = old ? memo_mask + 1 : 0;
+  uint32_t size = old_size ? old_size * 2 : 64;
+
+  memo = calloc(size, sizeof(memo_slot));
+  if (!memo) {
+    memo = old;
+    return -1;
+  }
+  memo_mask = size - 1;
+
+  for (uint32_t i = 0; i < old_size; i++) {
+    if (old[i].glsl)
+      *memo_find(old[i].fingerprint, old[i].glsl, old[i].len) = old[i];
+  }
+
+  free(old);
+  return 0;
+}
+
+void shader_index_key(const char *glsl, size_t len, uint32_t key[5]) {
+  SHA1_CTX ctx;
+  sha1_init(&ctx);
+  sha1_update(&ctx, (const uint8_t *)glsl, len);
+  sha1_final(&ctx, (uint8_t *)key);
+}
+
+shader_index_entry *shader_index_lookup(const char *glsl, size_t len) {
+  uint64_t fingerprint = murmur64(glsl, len);
+
+  if (memo) {
+    memo_slot *slot = memo_find(fingerprint, glsl, len);
+    if (slot->glsl)
+      return slot->index >= 0 ? &entries[slot->index] : NULL;
+  }
+
+  // First time this source shows up, the on-disk names are SHA1 digests
+  uint32_t key[5];
+  shader_index_key(glsl, len, key);
+  shader_index_entry *entry = shader_index_find(key);
+
+  if ((memo_count + 1) * 2 > (memo ? memo_mask + 1 : 0) && memo_grow() < 0)
+    return entry;
+
+  char *copy = malloc(len);
+  if (!copy)
+    return entry;
+  memcpy(copy, glsl, len);
+
+  memo_slot *slot = memo_find(fingerprint, glsl, len);
+  slot->fingerprint = fingerprint;
+  slot->len = len;
+  slot->index = entry ? entry - entries : -1;
+  slot->glsl = copy;
+  memo_count++;
+
+  return entry;
+}
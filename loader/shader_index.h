@@ -0,0 +1,35 @@
+#ifndef __SHADER_INDEX_H__
+#define __SHADER_INDEX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+  uint8_t *data;       // compiled GXP program
+  uint32_t size;
+  int checked;         // the on-disk cache was already looked at
+} shader_binary;
+
+typedef struct {
+  uint32_t key[5];     // SHA1 of the game's GLSL, as the words in the file name
+  uint32_t offset;     // source in the arena, NUL terminated
+  uint32_t size;
+  uint8_t cg_hash[20]; // SHA1 of the source, filled on first lookup
+  int hashed;
+  shader_binary binary; // owned by the index
+} shader_index_entry;
+
+int shader_index_load(const char *path);
+int shader_index_load_pack(const char *path);
+void shader_index_free(void);
+
+int shader_index_count(void);
+shader_index_entry *shader_index_get(int i);
+
+shader_index_entry *shader_index_find(const uint32_t key[5]);
+void shader_index_key(const char *glsl, size_t len, uint32_t key[5]);
+shader_index_entry *shader_index_lookup(const char *glsl, size_t len);
+const char *shader_index_source(shader_index_entry *entry);
+const uint8_t *shader_index_cg_hash(shader_index_entry *entry);
+
+#endif
@@ -0,0 +1,540 @@
+/* shader_variant.c -- specialized variants of branching replacement shaders
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * A replacement vertex shader that has VARIANT_* blocks gets specialized
+ * programs with its vsShaderParam branches folded away. Uniforms set on the
+ * game's program are recorded instead of applied, and replayed by name into
+ * whichever variant the current vsShaderParam selects at draw time. Variant
+ * shaders come from the binary cache and the warm-up worker like any other.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "framebuffer.h"
+#include "shader.h"
+#include "shader_index.h"
+#include "shader_variant.h"
+
+#define MAX_ATTRIBS 8
+#define MAX_SHADERS 8
+#define LOCATION_UNKNOWN -2
+
+enum {
+  UNIFORM_NONE,
+  UNIFORM_1I,
+  UNIFORM_1F,
+  UNIFORM_2F,
+  UNIFORM_3F,
+  UNIFORM_4F,
+  UNIFORM_MAT2,
+  UNIFORM_MAT3,
+  UNIFORM_MAT4,
+};
+
+static const int uniform_size[] = { 0, 1, 1, 2, 3, 4, 4, 9, 16 };
+
+static const char *variant_defines[VARIANT_COUNT] = {
+  NULL,
+  "#define VARIANT_LIT\n",
+  "#define VARIANT_COLOR\n",
+  "#define VARIANT_DIFFUSE\n",
+  "#define VARIANT_BLEND\n",
+};
+
+typedef struct {
+  char *name;
+  GLint location; // in the game's program
+  int type;
+  GLsizei count;
+  uint32_t version; // bumped on every change, 0 while never set
+  void *data;
+} variant_uniform;
+
+typedef struct {
+  GLuint program;
+  int failed;
+  int num_locations;
+  GLint *locations;   // per recorded uniform, LOCATION_UNKNOWN until looked up
+  uint32_t *versions; // last uniform version applied
+} variant_program;
+
+typedef struct {
+  int tracked;
+  GLuint vs;
+  GLuint fs;
+  shader_index_entry *entry;
+  int num_attribs;
+  GLuint attrib_index[MAX_ATTRIBS];
+  const GLchar *attrib_name[MAX_ATTRIBS];
+  int num_uniforms;
+  variant_uniform *uniforms;
+  int param;  // vsShaderParam among the uniforms, -1 until queried
+  int direct; // a uniform went straight to the game's program, variants lack it
+  variant_program variants[VARIANT_COUNT];
+} program_info;
+
+typedef struct {
+  shader_index_entry *entry;
+  GLuint shaders[VARIANT_COUNT];
+  int failed[VARIANT_COUNT];
+} variant_shader;
+
+static program_info *programs = NULL;
+static int num_programs = 0;
+
+static variant_shader shaders[MAX_SHADERS];
+static int num_shaders = 0;
+
+// Game shaders deleted while a tracked program still needed them
+static GLuint *doomed = NULL;
+static int num_doomed = 0;
+
+// What the game thinks is bound and what actually is
+static program_info *current = NULL;
+static GLuint bound = 0;
+
+static variant_stats stats;
+
+variant_stats *shader_variant_stats(void) {
+  return &stats;
+}
+
+static program_info *program_get(GLuint prog) {
+  if (prog >= num_programs) {
+    int count = num_programs ? num_programs : 64;
+    while (count <= prog)
+      count *= 2;
+    program_info *grown = realloc(programs, count * sizeof(program_info));
+    if (!grown)
+      return NULL;
+    memset(grown + num_programs, 0, (count - num_programs) * sizeof(program_info));
+    programs = grown;
+    num_programs = count;
+  }
+
+  return &programs[prog];
+}
+
+// Uniforms of a tracked program are recorded here rather than set on it
+int variant_tracked(GLuint prog) {
+  return prog < num_programs && programs[prog].tracked;
+}
+
+int variant_has_defines(shader_index_entry *entry) {
+  return entry && strstr(shader_index_source(entry), "VARIANT_LIT") != NULL;
+}
+
+const char *variant_define(int variant) {
+  return variant_defines[variant];
+}
+
+void variant_bind_attrib(GLuint prog, GLuint index, const GLchar *name) {
+  program_info *info = program_get(prog);
+  if (!info || info->num_attribs == MAX_ATTRIBS)
+    return;
+
+  // The names are string literals from glBindAttribLocationHook
+  info->attrib_index[info->num_attribs] = index;
+  info->attrib_name[info->num_attribs] = name;
+  info->num_attribs++;
+}
+
+void glAttachShaderHook(GLuint prog, GLuint shader) {
+  glAttachShader(prog, shader);
+
+  program_info *info = program_get(prog);
+  if (!info)
+    return;
+
+  shader_index_entry *entry = shader_get_entry(shader);
+  if (variant_has_defines(entry)) {
+    info->vs = shader;
+    info->entry = entry;
+    info->tracked = 1;
+    info->param = -1;
+    info->variants[VARIANT_GENERIC].program = prog;
+    stats.programs++;
+  } else {
+    info->fs = shader;
+  }
+}
+
+static int shader_in_use(GLuint shader) {
+  for (int i = 0; i < num_programs; i++) {
+    if (programs[i].tracked && (programs[i].vs == shader || programs[i].fs == shader))
+      return 1;
+  }
+  return 0;
+}
+
+void glDeleteShaderHook(GLuint shader) {
+  // Variant programs get linked later and still need the game's shaders,
+  // they go once the last program using them is deleted
+  if (shader_in_use(shader)) {
+    GLuint *grown = realloc(doomed, (num_doomed + 1) * sizeof(GLuint));
+    if (grown) {
+      doomed = grown;
+      doomed[num_doomed++] = shader;
+    }
+    return;
+  }
+  glDeleteShader(shader);
+}
+
+static void delete_doomed_shaders(void) {
+  for (int i = 0; i < num_doomed;) {
+    if (shader_in_use(doomed[i])) {
+      i++;
+      continue;
+    }
+    glDeleteShader(doomed[i]);
+    doomed[i] = doomed[--num_doomed];
+  }
+}
+
+void glDeleteProgramHook(GLuint prog) {
+  program_info *info = prog < num_programs ? &programs[prog] : NULL;
+
+  if (info && info->tracked) {
+    for (int v = 0; v < VARIANT_COUNT; v++) {
+      variant_program *vp = &info->variants[v];
+      if (v != VARIANT_GENERIC && vp->program) {
+        if (bound == vp->program)
+          bound = 0;
+        glDeleteProgram(vp->program);
+      }
+      free(vp->locations);
+      free(vp->versions);
+    }
+    for (int i = 0; i < info->num_uniforms; i++) {
+      free(info->uniforms[i].name);
+      free(info->uniforms[i].data);
+    }
+    free(info->uniforms);
+    if (current == info)
+      current = NULL;
+  }
+
+  int tracked = info && info->tracked;
+  if (info)
+    memset(info, 0, sizeof(program_info));
+  if (bound == prog)
+    bound = 0;
+
+  glDeleteProgram(prog);
+  if (tracked)
+    delete_doomed_shaders();
+}
+
+void glUseProgramHook(GLuint prog) {
+  program_info *info = prog < num_programs ? &programs[prog] : NULL;
+
+  // Tracked programs are bound at draw time, once the variant is known
+  if (info && info->tracked) {
+    current = info;
+    return;
+  }
+
+  current = NULL;
+  if (bound != prog) {
+    glUseProgram(prog);
+    bound = prog;
+  }
+}
+
+GLint glGetUniformLocationHook(GLuint prog, const GLchar *name) {
+  GLint location = glGetUniformLocation(prog, name);
+
+  program_info *info = prog < num_programs ? &programs[prog] : NULL;
+  if (!info || !info->tracked || location < 0)
+    return location;
+
+  for (int i = 0; i < info->num_uniforms; i++) {
+    if (info->uniforms[i].location == location)
+      return location;
+  }
+
+  variant_uniform *grown = realloc(info->uniforms, (info->num_uniforms + 1) * sizeof(variant_uniform));
+  if (!grown)
+    return location;
+  info->uniforms = grown;
+
+  variant_uniform *u = &info->uniforms[info->num_uniforms];
+  memset(u, 0, sizeof(variant_uniform));
+  u->name = strdup(name);
+  if (!u->name)
+    return location;
+  u->location = location;
+
+  if (strcmp(name, "vsShaderParam") == 0)
+    info->param = info->num_uniforms;
+  info->num_uniforms++;
+
+  return location;
+}
+
+static variant_uniform *uniform_find(GLint location) {
+  for (int i = 0; i < current->num_uniforms; i++) {
+    if (current->uniforms[i].location == location)
+      return &current->uniforms[i];
+  }
+  return NULL;
+}
+
+// A uniform that can't be recorded has to land on the game's program itself,
+// and only that program has it from then on
+static void uniform_direct(void) {
+  GLuint prog = current->variants[VARIANT_GENERIC].program;
+  current->direct = 1;
+  if (bound != prog) {
+    glUseProgram(prog);
+    bound = prog;
+  }
+}
+
+// Returns 1 when the uniform was recorded for replay
+static int uniform_record(GLint location, int type, GLsizei count, const void *value) {
+  if (!current || location < 0)
+    return 0;
+
+  variant_uniform *u = uniform_find(location);
+  if (!u) {
+    uniform_direct();
+    return 0;
+  }
+
+  size_t size = uniform_size[type] * count * sizeof(GLfloat);
+  if (u->type != type || u->count != count) {
+    void *data = realloc(u->data, size);
+    if (!data) {
+      uniform_direct();
+      return 0;
+    }
+    u->data = data;
+    u->type = type;
+    u->count = count;
+  } else if (memcmp(u->data, value, size) == 0) {
+    return 1;
+  }
+
+  memcpy(u->data, value, size);
+  u->version++;
+  return 1;
+}
+
+static void uniform_apply(GLint location, variant_uniform *u) {
+  switch (u->type) {
+    case UNIFORM_1I:
+      glUniform1i(location, *(GLint *)u->data);
+      break;
+    case UNIFORM_1F:
+      glUniform1fv(location, u->count, u->data);
+      break;
+    case UNIFORM_2F:
+      glUniform2fv(location, u->count, u->data);
+      break;
+    case UNIFORM_3F:
+      glUniform3fv(location, u->count, u->data);
+      break;
+    case UNIFORM_4F:
+      glUniform4fv(location, u->count, u->data);
+      break;
+    case UNIFORM_MAT2:
+      glUniformMatrix2fv(location, u->count, GL_FALSE, u->data);
+      break;
+    case UNIFORM_MAT3:
+      glUniformMatrix3fv(location, u->count, GL_FALSE, u->data);
+      break;
+    case UNIFORM_MAT4:
+      glUniformMatrix4fv(location, u->count, GL_FALSE, u->data);
+      break;
+  }
+}
+
+void glUniform1iHook(GLint location, GLint v0) {
+  if (!uniform_record(location, UNIFORM_1I, 1, &v0))
+    glUniform1i(location, v0);
+}
+
+void glUniform1fvHook(GLint location, GLsizei count, const GLfloat *value) {
+  if (!uniform_record(location, UNIFORM_1F, count, value))
+    glUniform1fv(location, count, value);
+}
+
+void glUniform2fvHook(GLint location, GLsizei count, const GLfloat *value) {
+  if (!uniform_record(location, UNIFORM_2F, count, value))
+    glUniform2fv(location, count, value);
+}
+
+void glUniform3fvHook(GLint location, GLsizei count, const GLfloat *value) {
+  if (!uniform_record(location, UNIFORM_3F, count, value))
+    glUniform3fv(location, count, value);
+}
+
+void glUniform4fvHook(GLint location, GLsizei count, const GLfloat *value) {
+  if (!uniform_record(location, UNIFORM_4F, count, value))
+    glUniform4fv(location, count, value);
+}
+
+void glUniformMatrix2fvHook(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value) {
+  if (!uniform_record(location, UNIFORM_MAT2, count, value))
+    glUniformMatrix2fv(location, count, transpose, value);
+}
+
+void glUniformMatrix3fvHook(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value) {
+  if (!uniform_record(location, UNIFORM_MAT3, count, value))
+    glUniformMatrix3fv(location, count, transpose, value);
+}
+
+void glUniformMatrix4fvHook(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value) {
+  if (!uniform_record(location, UNIFORM_MAT4, count, value))
+    glUniformMatrix4fv(location, count, transpose, value);
+}
+
+static int variant_select(program_info *info) {
+  if (info->direct || info->param < 0 || info->uniforms[info->param].type != UNIFORM_4F)
+    return VARIANT_GENERIC;
+
+  const GLfloat *param = info->uniforms[info->param].data;
+  if (param[0] > 0.5f)
+    return VARIANT_LIT;
+  if (param[2] == 0.0f)
+    return VARIANT_COLOR;
+  if (param[2] == 1.0f)
+    return VARIANT_DIFFUSE;
+  return VARIANT_BLEND;
+}
+
+static GLuint variant_shader_get(shader_index_entry *entry, int variant) {
+  variant_shader *vs = NULL;
+  for (int i = 0; i < num_shaders; i++) {
+    if (shaders[i].entry == entry)
+      vs = &shaders[i];
+  }
+  if (!vs) {
+    if (num_shaders == MAX_SHADERS)
+      return 0;
+    vs = &shaders[num_shaders++];
+    memset(vs, 0, sizeof(variant_shader));
+    vs->entry = entry;
+  }
+
+  if (vs->shaders[variant] || vs->failed[variant])
+    return vs->shaders[variant];
+
+  // Shared by every program built on this vertex shader
+  GLuint shader = shader_variant_create(entry, variant);
+  if (!shader) {
+    debugPrintf("Warning: could not compile shader variant %d\n", variant);
+    vs->failed[variant] = 1;
+    return 0;
+  }
+
+  vs->shaders[variant] = shader;
+  return shader;
+}
+
+static void variant_build(program_info *info, int variant) {
+  variant_program *vp = &info->variants[variant];
+
+  GLuint shader = variant_shader_get(info->entry, variant);
+  if (!shader || !info->fs) {
+    vp->failed = 1;
+    return;
+  }
+
+  GLuint prog = glCreateProgram();
+  glAttachShader(prog, shader);
+  glAttachShader(prog, info->fs);
+  for (int i = 0; i < info->num_attribs; i++)
+    glBindAttribLocation(prog, info->attrib_index[i], info->attrib_name[i]);
+  glLinkProgram(prog);
+
+  GLint linked = GL_FALSE;
+  glGetProgramiv(prog, GL_LINK_STATUS, &linked);
+  if (!linked) {
+    debugPrintf("Warning: could not link shader variant %d\n", variant);
+    glDeleteProgram(prog);
+    vp->failed = 1;
+    return;
+  }
+
+  vp->program = prog;
+  stats.builds++;
+}
+
+static void variant_replay(program_info *info, variant_program *vp) {
+  if (vp->num_locations < info->num_uniforms) {
+    GLint *locations = realloc(vp->locations, info->num_uniforms * sizeof(GLint));
+    uint32_t *versions = realloc(vp->versions, info->num_uniforms * sizeof(uint32_t));
+    if (locations)
+      vp->locations = locations;
+    if (versions)
+      vp->versions = versions;
+    if (!locations || !versions)
+      return;
+    for (int i = vp->num_locations; i < info->num_uniforms; i++) {
+      vp->locations[i] = LOCATION_UNKNOWN;
+      vp->versions[i] = 0;
+    }
+    vp->num_locations = info->num_uniforms;
+  }
+
+  for (int i = 0; i < info->num_uniforms; i++) {
+    variant_uniform *u = &info->uniforms[i];
+    if (vp->versions[i] == u->version)
+      continue;
+
+    // Folded away uniforms are simply missing from the variant
+    if (vp->locations[i] == LOCATION_UNKNOWN)
+      vp->locations[i] = glGetUniformLocation(vp->program, u->name);
+    if (vp->locations[i] >= 0)
+      uniform_apply(vp->locations[i], u);
+    vp->versions[i] = u->version;
+  }
+}
+
+static void variant_prepare_draw(void) {
+  program_info *info = current;
+
+  int variant = variant_select(info);
+  variant_program *vp = &info->variants[variant];
+  if (!vp->program && !vp->failed)
+    variant_build(info, variant);
+  if (!vp->program) {
+    variant = VARIANT_GENERIC;
+    vp = &info->variants[VARIANT_GENERIC];
+  }
+
+  if (bound != vp->program) {
+    glUseProgram(vp->program);
+    bound = vp->program;
+  }
+
+  variant_replay(info, vp);
+  stats.draws[variant]++;
+}
+
+void glDrawArraysHook(GLenum mode, GLint first, GLsizei count) {
+  framebuffer_draw();
+  if (current)
+    variant_prepare_draw();
+  glDrawArrays(mode, first, count);
+}
+
+void glDrawElementsHook(GLenum mode, GLsizei count, GLenum type, const void *indices) {
+  framebuffer_draw();
+  if (current)
+    variant_prepare_draw();
+  glDrawElements(mode, count, type, indices);
+}
@@ -0,0 +1,49 @@
+#ifndef __SHADER_VARIANT_H__
+#define __SHADER_VARIANT_H__
+
+#include <vitaGL.h>
+
+#include "shader_index.h"
+
+enum {
+  VARIANT_GENERIC, // the game's own program, branches on vsShaderParam
+  VARIANT_LIT,     // vsShaderParam.x > 0.5
+  VARIANT_COLOR,   // vertex color only, vsShaderParam.z == 0
+  VARIANT_DIFFUSE, // diffuse color only, vsShaderParam.z == 1
+  VARIANT_BLEND,   // lerp between the two
+  VARIANT_COUNT
+};
+
+typedef struct {
+  int programs;             // game programs with a specializable vertex shader
+  int builds;               // variant programs linked
+  int draws[VARIANT_COUNT]; // draws per variant
+} variant_stats;
+
+variant_stats *shader_variant_stats(void);
+
+int variant_tracked(GLuint prog);
+int variant_has_defines(shader_index_entry *entry);
+const char *variant_define(int variant);
+
+void variant_bind_attrib(GLuint prog, GLuint index, const GLchar *name);
+
+void glAttachShaderHook(GLuint prog, GLuint shader);
+void glDeleteShaderHook(GLuint shader);
+void glDeleteProgramHook(GLuint prog);
+void glUseProgramHook(GLuint prog);
+GLint glGetUniformLocationHook(GLuint prog, const GLchar *name);
+
+void glUniform1iHook(GLint location, GLint v0);
+void glUniform1fvHook(GLint location, GLsizei count, const GLfloat *value);
+void glUniform2fvHook(GLint location, GLsizei count, const GLfloat *value);
+void glUniform3fvHook(GLint location, GLsizei count, const GLfloat *value);
+void glUniform4fvHook(GLint location, GLsizei count, const GLfloat *value);
+void glUniformMatrix2fvHook(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value);
+void glUniformMatrix3fvHook(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value);
+void glUniformMatrix4fvHook(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value);
+
+void glDrawArraysHook(GLenum mode, GLint first, GLsizei count);
+void glDrawElementsHook(GLenum mode, GLsizei count, GLenum type, const void *indices);
+
+#endif
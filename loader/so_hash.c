@@ -0,0 +1,162 @@
+/* so_hash.c -- symbol hashing and lookup tables for .so modules
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "so_hash.h"
+
+#define INDEX_NAME(idx, i) (*(const char **)((idx)->table + (size_t)(i) * (idx)->stride))
+
+uint32_t so_hash(const uint8_t *name) {
+  uint64_t h = 0, g;
+  while (*name) {
+    h = (h << 4) + *name++;
+    if ((g = (h & 0xf0000000)) != 0)
+      h ^= g >> 24;
+    h &= 0x0fffffff;
+  }
+  return h;
+}
+
+uint32_t so_gnu_hash(const uint8_t *name) {
+  uint32_t h = 5381;
+  while (*name)
+    h = (h << 5) + h + *name++;
+  return h;
+}
+
+int so_sysv_hash_find(const uint32_t *hash, const Elf32_Sym *dynsym, const char *dynstr, const char *symbol) {
+  uint32_t nbucket = hash[0];
+  const uint32_t *bucket = &hash[2];
+  const uint32_t *chain = &bucket[nbucket];
+
+  for (int i = bucket[so_hash((const uint8_t *)symbol) % nbucket]; i; i = chain[i]) {
+    if (dynsym[i].st_shndx == SHN_UNDEF)
+      continue;
+    if (dynsym[i].st_info != SHN_UNDEF && strcmp(dynstr + dynsym[i].st_name, symbol) == 0)
+      return i;
+  }
+
+  return -1;
+}
+
+int so_gnu_hash_count(const uint32_t *gnu_hash) {
+  uint32_t nbuckets = gnu_hash[0];
+  uint32_t symoffset = gnu_hash[1];
+  uint32_t bloom_size = gnu_hash[2];
+  const uint32_t *buckets = &gnu_hash[4 + bloom_size];
+  const uint32_t *chain = &buckets[nbuckets];
+
+  uint32_t last = 0;
+  for (uint32_t i = 0; i < nbuckets; i++) {
+    if (buckets[i] > last)
+      last = buckets[i];
+  }
+
+  if (last < symoffset)
+    return symoffset;
+
+  // Walk the last chain up to its terminator
+  while (!(chain[last - symoffset] & 1))
+    last++;
+
+  return last + 1;
+}
+
+int so_gnu_hash_find(const uint32_t *gnu_hash, const Elf32_Sym *dynsym, const char *dynstr, const char *symbol, uint32_t hash) {
+  uint32_t nbuckets = gnu_hash[0];
+  uint32_t symoffset = gnu_hash[1];
+  uint32_t bloom_size = gnu_hash[2];
+  uint32_t bloom_shift = gnu_hash[3];
+  const uint32_t *bloom = &gnu_hash[4];
+  const uint32_t *buckets = &bloom[bloom_size];
+  const uint32_t *chain = &buckets[nbuckets];
+
+  // Most misses are rejected here without touching the symbol table
+  uint32_t word = bloom[(hash / 32) % bloom_size];
+  uint32_t mask = (1u << (hash % 32)) | (1u << ((hash >> bloom_shift) % 32));
+  if ((word & mask) != mask)
+    return -1;
+
+  uint32_t i = buckets[hash % nbuckets];
+  if (i < symoffset)
+    return -1;
+
+  for (;; i++) {
+    uint32_t chain_hash = chain[i - symoffset];
+    if ((hash | 1) == (chain_hash | 1) &&
+        dynsym[i].st_shndx != SHN_UNDEF &&
+        strcmp(dynstr + dynsym[i].st_name, symbol) == 0)
+      return i;
+    // The lowest bit marks the end of the chain
+    if (chain_hash & 1)
+      break;
+  }
+
+  return -1;
+}
+
+int so_index_build(so_index *idx, const void *table, size_t stride, int count) {
+  uint32_t size = 16;
+
+  // Keep the load factor at or below 50% so probe sequences stay short
+  while (size < (uint32_t)count * 2)
+    size <<= 1;
+
+  memset(idx, 0, sizeof(so_index));
+  idx->slots = malloc(size * sizeof(so_index_slot));
+  if (!idx->slots)
+    return -1;
+
+  idx->table = (const uint8_t *)table;
+  idx->stride = stride;
+  idx->count = count;
+  idx->mask = size - 1;
+
+  for (uint32_t i = 0; i < size; i++)
+    idx->slots[i].index = -1;
+
+  for (int i = 0; i < count; i++) {
+    const char *name = INDEX_NAME(idx, i);
+    uint32_t hash = so_hash((const uint8_t *)name);
+    uint32_t pos = hash & idx->mask;
+
+    // The first entry wins on duplicates, same as a linear scan would
+    while (idx->slots[pos].index >= 0) {
+      if (idx->slots[pos].hash == hash && strcmp(INDEX_NAME(idx, idx->slots[pos].index), name) == 0)
+        break;
+      pos = (pos + 1) & idx->mask;
+    }
+
+    if (idx->slots[pos].index < 0) {
+      idx->slots[pos].hash = hash;
+      idx->slots[pos].index = i;
+    }
+  }
+
+  return 0;
+}
+
+int so_index_find(const so_index *idx, const char *name) {
+  if (!idx->slots)
+    return -1;
+
+  uint32_t hash = so_hash((const uint8_t *)name);
+  for (uint32_t pos = hash & idx->mask; idx->slots[pos].index >= 0; pos = (pos + 1) & idx->mask) {
+    if (idx->slots[pos].hash == hash && strcmp(INDEX_NAME(idx, idx->slots[pos].index), name) == 0)
+      return idx->slots[pos].index;
+  }
+
+  return -1;
+}
+
+void so_index_free(so_index *idx) {
+  free(idx->slots);
+  memset(idx, 0, sizeof(so_index));
+}
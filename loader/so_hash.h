@@ -0,0 +1,34 @@
+#ifndef __SO_HASH_H__
+#define __SO_HASH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "elf.h"
+
+typedef struct {
+  uint32_t hash;
+  int32_t index;
+} so_index_slot;
+
+// Open addressing index over a table whose entries start with a name pointer
+typedef struct {
+  const uint8_t *table;
+  size_t stride;
+  int count;
+  uint32_t mask;
+  so_index_slot *slots;
+} so_index;
+
+uint32_t so_hash(const uint8_t *name);
+uint32_t so_gnu_hash(const uint8_t *name);
+
+int so_sysv_hash_find(const uint32_t *hash, const Elf32_Sym *dynsym, const char *dynstr, const char *symbol);
+int so_gnu_hash_count(const uint32_t *gnu_hash);
+int so_gnu_hash_find(const uint32_t *gnu_hash, const Elf32_Sym *dynsym, const char *dynstr, const char *symbol, uint32_t hash);
+
+int so_index_build(so_index *idx, const void *table, size_t stride, int count);
+int so_index_find(const so_index *idx, const char *name);
+void so_index_free(so_index *idx);
+
+#endif
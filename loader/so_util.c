@@ -16,11 +16,18 @@
 #include "main.h"
 #include "dialog.h"
 #include "so_util.h"
+#include "so_hash.h"
+#include "sha1.h"
+#include "profile.h"
 
 #ifndef SCE_KERNEL_MEMBLOCK_TYPE_USER_RX
 #define SCE_KERNEL_MEMBLOCK_TYPE_USER_RX                 (0x0C20D050)
 #endif
 
+#define HOOK_MAX_SZ 12
+#define PATCH_LINE_SZ 32
+#define PATCH_RUN_GAP 16
+
 typedef struct b_enc {
 	union {
 		struct __attribute__((__packed__)) {
@@ -57,30 +64,66 @@ typedef struct ldst_enc {
 #define LDR_OFFS(RT, RN, IMM) ((ldst_enc){.bits = {.cond = 0b1110, .enc = 0b010, .p = 1, .u = (IMM >= 0), .b = 0, .w = 0, .bit20_1 = 1, .rn = RN, .rt = RT, .imm12 = (IMM >= 0) ? IMM : -IMM}})
 
 #define PATCH_SZ 0x10000 //64 KB-ish arenas
+
+#define PRELINK_MAGIC 0x4B4E4C50 // 'PLNK'
+#define PRELINK_VERSION 1
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint8_t so_hash[SHA1_BLOCK_SIZE];
+	uint8_t build_hash[SHA1_BLOCK_SIZE];
+	uint32_t text_base;
+	uint32_t num_runs;
+	uint32_t num_words;
+} so_prelink_header;
+
+// Followed by num_runs of { r_offset, count, value[count] }
 static so_module *head = NULL, *tail = NULL;
 
+static so_index dynlib_index;
+static so_default_dynlib *dynlib_index_table = NULL;
+
+// Encodes a branch to dst at addr, returns the number of bytes and where they start
+static int hook_encode(uintptr_t addr, uintptr_t dst, uint8_t *out, uintptr_t *start) {
+	uint32_t hook[2];
+	int size = 0;
+
+	if (addr & 1) {
+		addr &= ~1;
+		*start = addr;
+		if (addr & 2) {
+			uint16_t nop = 0xbf00;
+			memcpy(out, &nop, sizeof(nop));
+			size += sizeof(nop);
+		}
+		hook[0] = 0xf000f8df; // LDR PC, [PC]
+	} else {
+		*start = addr;
+		hook[0] = 0xe51ff004; // LDR PC, [PC, #-0x4]
+	}
+	hook[1] = dst;
+	memcpy(out + size, hook, sizeof(hook));
+
+	return size + sizeof(hook);
+}
+
 void hook_thumb(uintptr_t addr, uintptr_t dst) {
 	if (addr == 0)
 		return;
-	addr &= ~1;
-	if (addr & 2) {
-		uint16_t nop = 0xbf00;
-		kuKernelCpuUnrestrictedMemcpy((void *)addr, &nop, sizeof(nop));
-		addr += 2;
-	}
-	uint32_t hook[2];
-	hook[0] = 0xf000f8df; // LDR PC, [PC]
-	hook[1] = dst;
-	kuKernelCpuUnrestrictedMemcpy((void *)addr, hook, sizeof(hook));
+	uint8_t hook[HOOK_MAX_SZ];
+	uintptr_t start;
+	int size = hook_encode(addr | 1, dst, hook, &start);
+	kuKernelCpuUnrestrictedMemcpy((void *)start, hook, size);
 }
 
 void hook_arm(uintptr_t addr, uintptr_t dst) {
 	if (addr == 0)
 		return;
-	uint32_t hook[2];
-	hook[0] = 0xe51ff004; // LDR PC, [PC, #-0x4]
-	hook[1] = dst;
-	kuKernelCpuUnrestrictedMemcpy((void *)addr, hook, sizeof(hook));
+	uint8_t hook[HOOK_MAX_SZ];
+	uintptr_t start;
+	int size = hook_encode(addr, dst, hook, &start);
+	kuKernelCpuUnrestrictedMemcpy((void *)start, hook, size);
 }
 
 void hook_addr(uintptr_t addr, uintptr_t dst) {
@@ -96,25 +139,201 @@ void so_flush_caches(so_module *mod) {
 	kuKernelFlushCaches((void *)mod->text_base, mod->text_size);
 }
 
-int _so_load(so_module *mod, SceUID so_blockid, void *so_data, uintptr_t load_addr) {
+#define STREAM_CHUNK_SZ 0x10000
+
+static int so_stream_read_at(so_stream *stream, size_t offset, void *buf, size_t size) {
+	if (offset != stream->pos) {
+		if (stream->seek) {
+			if (stream->seek(stream, offset) < 0)
+				return -1;
+		} else {
+			// Forward-only streams skip by reading
+			uint8_t skip[256];
+			if (offset < stream->pos)
+				return -1;
+			while (stream->pos < offset) {
+				size_t n = offset - stream->pos;
+				if (n > sizeof(skip))
+					n = sizeof(skip);
+				int res = stream->read(stream, skip, n);
+				if (res <= 0)
+					return -1;
+				stream->pos += res;
+			}
+		}
+		stream->pos = offset;
+	}
+
+	while (size > 0) {
+		int res = stream->read(stream, buf, size);
+		if (res <= 0)
+			return -1;
+		sha1_update(&stream->sha1, buf, res);
+		stream->pos += res;
+		buf = (uint8_t *)buf + res;
+		size -= res;
+	}
+
+	return 0;
+}
+
+static int so_parse_dynamic(so_module *mod) {
+	Elf32_Phdr *dynamic = NULL;
+	for (int i = 0; i < mod->ehdr->e_phnum; i++) {
+		if (mod->phdr[i].p_type == PT_DYNAMIC)
+			dynamic = &mod->phdr[i];
+	}
+
+	if (!dynamic)
+		return -1;
+
+	mod->dynamic = (Elf32_Dyn *)(mod->text_base + dynamic->p_vaddr);
+	mod->num_dynamic = dynamic->p_memsz / sizeof(Elf32_Dyn);
+
+	for (int i = 0; i < mod->num_dynamic; i++) {
+		uintptr_t ptr = mod->text_base + mod->dynamic[i].d_un.d_ptr;
+		switch (mod->dynamic[i].d_tag) {
+		case DT_STRTAB:
+			mod->dynstr = (char *)ptr;
+			break;
+		case DT_SYMTAB:
+			mod->dynsym = (Elf32_Sym *)ptr;
+			break;
+		case DT_REL:
+			mod->reldyn = (Elf32_Rel *)ptr;
+			break;
+		case DT_RELSZ:
+			mod->num_reldyn = mod->dynamic[i].d_un.d_val / sizeof(Elf32_Rel);
+			break;
+		case DT_JMPREL:
+			mod->relplt = (Elf32_Rel *)ptr;
+			break;
+		case DT_PLTRELSZ:
+			mod->num_relplt = mod->dynamic[i].d_un.d_val / sizeof(Elf32_Rel);
+			break;
+		case DT_INIT_ARRAY:
+			mod->init_array = (void *)ptr;
+			break;
+		case DT_INIT_ARRAYSZ:
+			mod->num_init_array = mod->dynamic[i].d_un.d_val / sizeof(void *);
+			break;
+		case DT_HASH:
+			mod->hash = (uint32_t *)ptr;
+			break;
+		case DT_GNU_HASH:
+			mod->gnu_hash = (uint32_t *)ptr;
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (mod->dynstr == NULL ||
+		mod->dynsym == NULL ||
+		mod->reldyn == NULL ||
+		mod->relplt == NULL)
+		return -1;
+
+	// The hash tables cover every symbol, so_stream_load falls back otherwise
+	if (mod->hash)
+		mod->num_dynsym = mod->hash[1];
+	else if (mod->gnu_hash)
+		mod->num_dynsym = so_gnu_hash_count(mod->gnu_hash);
+
+	for (int i = 0; i < mod->num_dynamic; i++) {
+		switch (mod->dynamic[i].d_tag) {
+		case DT_SONAME:
+			mod->soname = mod->dynstr + mod->dynamic[i].d_un.d_ptr;
+			break;
+		default:
+			break;
+		}
+	}
+
+	return 0;
+}
+
+// Without hash tables the .dynsym section header sizes the table, if the
+// stream can still get to it, otherwise the relocations show how far it goes
+static void so_count_dynsym(so_module *mod, so_stream *stream) {
+	Elf32_Ehdr *ehdr = mod->ehdr;
+	if (ehdr->e_shoff && ehdr->e_shnum && ehdr->e_shentsize == sizeof(Elf32_Shdr) &&
+		(stream->seek || ehdr->e_shoff >= stream->pos)) {
+		Elf32_Shdr *shdr = malloc(ehdr->e_shnum * sizeof(Elf32_Shdr));
+		if (shdr && so_stream_read_at(stream, ehdr->e_shoff, shdr, ehdr->e_shnum * sizeof(Elf32_Shdr)) == 0) {
+			for (int i = 0; i < ehdr->e_shnum; i++) {
+				if (shdr[i].sh_type == SHT_DYNSYM)
+					mod->num_dynsym = shdr[i].sh_size / sizeof(Elf32_Sym);
+			}
+		}
+		free(shdr);
+		if (mod->num_dynsym)
+			return;
+	}
+
+	for (int i = 0; i < mod->num_reldyn; i++) {
+		if (ELF32_R_SYM(mod->reldyn[i].r_info) >= mod->num_dynsym)
+			mod->num_dynsym = ELF32_R_SYM(mod->reldyn[i].r_info) + 1;
+	}
+	for (int i = 0; i < mod->num_relplt; i++) {
+		if (ELF32_R_SYM(mod->relplt[i].r_info) >= mod->num_dynsym)
+			mod->num_dynsym = ELF32_R_SYM(mod->relplt[i].r_info) + 1;
+	}
+}
+
+/*
+ * so_stream_load: loads a module without staging the whole file in memory.
+ * Only the ELF and program headers are read up front, then each segment is read
+ * straight into its final block. Everything else is found through PT_DYNAMIC.
+ */
+int so_stream_load(so_module *mod, so_stream *stream, uintptr_t load_addr) {
 	int res = 0;
 	uintptr_t data_addr = 0;
-	
-	if (memcmp(so_data, ELFMAG, SELFMAG) != 0) {
+	uint8_t *head_data = NULL;
+	uint8_t *chunk = NULL;
+
+	memset(mod, 0, sizeof(so_module));
+
+	stream->pos = 0;
+	sha1_init(&stream->sha1);
+
+	mod->ehdr = malloc(sizeof(Elf32_Ehdr));
+	if (!mod->ehdr)
+		return -1;
+
+	if (so_stream_read_at(stream, 0, mod->ehdr, sizeof(Elf32_Ehdr)) < 0 ||
+		memcmp(mod->ehdr, ELFMAG, SELFMAG) != 0) {
+		res = -1;
+		goto err_free_headers;
+	}
+
+	// The text segment usually starts at offset 0 and contains the headers as well
+	size_t head_size = mod->ehdr->e_phoff + mod->ehdr->e_phnum * sizeof(Elf32_Phdr);
+	head_data = malloc(head_size);
+	mod->phdr = malloc(mod->ehdr->e_phnum * sizeof(Elf32_Phdr));
+	if (!head_data || !mod->phdr) {
 		res = -1;
-		goto err_free_so;
+		goto err_free_headers;
 	}
 
-	mod->ehdr = (Elf32_Ehdr *)so_data;
-	mod->phdr = (Elf32_Phdr *)((uintptr_t)so_data + mod->ehdr->e_phoff);
-	mod->shdr = (Elf32_Shdr *)((uintptr_t)so_data + mod->ehdr->e_shoff);
+	memcpy(head_data, mod->ehdr, sizeof(Elf32_Ehdr));
+	if (so_stream_read_at(stream, sizeof(Elf32_Ehdr), head_data + sizeof(Elf32_Ehdr), head_size - sizeof(Elf32_Ehdr)) < 0) {
+		res = -1;
+		goto err_free_headers;
+	}
+	memcpy(mod->phdr, head_data + mod->ehdr->e_phoff, mod->ehdr->e_phnum * sizeof(Elf32_Phdr));
 
-	mod->shstr = (char *)((uintptr_t)so_data + mod->shdr[mod->ehdr->e_shstrndx].sh_offset);
+	chunk = malloc(STREAM_CHUNK_SZ);
+	if (!chunk) {
+		res = -1;
+		goto err_free_headers;
+	}
 
 	for (int i = 0; i < mod->ehdr->e_phnum; i++) {
 		if (mod->phdr[i].p_type == PT_LOAD) {
 			void *prog_data;
 			size_t prog_size;
+			int text = 0;
 
 			if ((mod->phdr[i].p_flags & PF_X) == PF_X) {
 				// Allocate arena for code patches, trampolines, etc
@@ -127,9 +346,9 @@ int _so_load(so_module *mod, SceUID so_blockid, void *so_data, uintptr_t load_ad
 				opt.field_C = (SceUInt32)load_addr - mod->patch_size;
 				res = mod->patch_blockid = kuKernelAllocMemBlock("rx_block", SCE_KERNEL_MEMBLOCK_TYPE_USER_RX, mod->patch_size, &opt);
 				if (res < 0)
-					goto err_free_so;
+					goto err_free_chunk;
 
-				sceKernelGetMemBlockBase(mod->patch_blockid, &mod->patch_base);
+				sceKernelGetMemBlockBase(mod->patch_blockid, (void **)&mod->patch_base);
 				mod->patch_head = mod->patch_base;
 				
 				prog_size = ALIGN_MEM(mod->phdr[i].p_memsz, mod->phdr[i].p_align);
@@ -139,7 +358,7 @@ int _so_load(so_module *mod, SceUID so_blockid, void *so_data, uintptr_t load_ad
 				opt.field_C = (SceUInt32)load_addr;
 				res = mod->text_blockid = kuKernelAllocMemBlock("rx_block", SCE_KERNEL_MEMBLOCK_TYPE_USER_RX, prog_size, &opt);
 				if (res < 0)
-					goto err_free_so;
+					goto err_free_chunk;
 
 				sceKernelGetMemBlockBase(mod->text_blockid, &prog_data);
 
@@ -151,15 +370,16 @@ int _so_load(so_module *mod, SceUID so_blockid, void *so_data, uintptr_t load_ad
 				// Use the .text segment padding as a code cave
 				// Word-align it to make it simpler for instruction arena allocation
 				mod->cave_size = ALIGN_MEM(prog_size - mod->phdr[i].p_memsz, 0x4);
-				mod->cave_base = mod->cave_head = prog_data + mod->phdr[i].p_memsz;
+				mod->cave_base = mod->cave_head = (uintptr_t)prog_data + mod->phdr[i].p_memsz;
 				mod->cave_base = ALIGN_MEM(mod->cave_base, 0x4);
 				mod->cave_head = mod->cave_base;
 				debugPrintf("code cave: %d bytes (@0x%08X).\n", mod->cave_size, mod->cave_base);
 
 				data_addr = (uintptr_t)prog_data + prog_size;
+				text = 1;
 			} else {
 				if (data_addr == 0)
-					goto err_free_so;
+					goto err_free_chunk;
 
 				if (mod->n_data >= MAX_DATA_SEG)
 					goto err_free_data;
@@ -185,61 +405,70 @@ int _so_load(so_module *mod, SceUID so_blockid, void *so_data, uintptr_t load_ad
 				mod->n_data++;
 			}
 
-			char *zero = malloc(prog_size - mod->phdr[i].p_filesz);
-			memset(zero, 0, prog_size - mod->phdr[i].p_filesz);
-			kuKernelCpuUnrestrictedMemcpy(prog_data + mod->phdr[i].p_filesz, zero, prog_size - mod->phdr[i].p_filesz);
-			free(zero);
+			uint8_t *dst = (uint8_t *)mod->phdr[i].p_vaddr;
+			size_t offset = mod->phdr[i].p_offset;
+			size_t left = mod->phdr[i].p_filesz;
+
+			// Bytes that were already read as part of the headers
+			if (offset < head_size) {
+				size_t n = head_size - offset;
+				if (n > left)
+					n = left;
+				if (text)
+					kuKernelCpuUnrestrictedMemcpy(dst, head_data + offset, n);
+				else
+					memcpy(dst, head_data + offset, n);
+				dst += n;
+				offset += n;
+				left -= n;
+			}
 
-			kuKernelCpuUnrestrictedMemcpy((void *)mod->phdr[i].p_vaddr, (void *)((uintptr_t)so_data + mod->phdr[i].p_offset), mod->phdr[i].p_filesz);
-		}
-	}
+			if (text) {
+				// The text block can only be written through kubridge, bounce it through a small buffer
+				while (left > 0) {
+					size_t n = left < STREAM_CHUNK_SZ ? left : STREAM_CHUNK_SZ;
+					if (so_stream_read_at(stream, offset, chunk, n) < 0) {
+						res = -3;
+						goto err_free_data;
+					}
+					kuKernelCpuUnrestrictedMemcpy(dst, chunk, n);
+					dst += n;
+					offset += n;
+					left -= n;
+				}
 
-	for (int i = 0; i < mod->ehdr->e_shnum; i++) {
-		char *sh_name = mod->shstr + mod->shdr[i].sh_name;
-		uintptr_t sh_addr = mod->text_base + mod->shdr[i].sh_addr;
-		size_t sh_size = mod->shdr[i].sh_size;
-		if (strcmp(sh_name, ".dynamic") == 0) {
-			mod->dynamic = (Elf32_Dyn *)sh_addr;
-			mod->num_dynamic = sh_size / sizeof(Elf32_Dyn);
-		} else if (strcmp(sh_name, ".dynstr") == 0) {
-			mod->dynstr = (char *)sh_addr;
-		} else if (strcmp(sh_name, ".dynsym") == 0) {
-			mod->dynsym = (Elf32_Sym *)sh_addr;
-			mod->num_dynsym = sh_size / sizeof(Elf32_Sym);
-		} else if (strcmp(sh_name, ".rel.dyn") == 0) {
-			mod->reldyn = (Elf32_Rel *)sh_addr;
-			mod->num_reldyn = sh_size / sizeof(Elf32_Rel);
-		} else if (strcmp(sh_name, ".rel.plt") == 0) {
-			mod->relplt = (Elf32_Rel *)sh_addr;
-			mod->num_relplt = sh_size / sizeof(Elf32_Rel);
-		} else if (strcmp(sh_name, ".init_array") == 0) {
-			mod->init_array = (void *)sh_addr;
-			mod->num_init_array = sh_size / sizeof(void *);
-		} else if (strcmp(sh_name, ".hash") == 0) {
-			mod->hash = (void *)sh_addr;
+				memset(chunk, 0, STREAM_CHUNK_SZ);
+				for (size_t zero = (uintptr_t)prog_data + prog_size - (uintptr_t)dst; zero > 0; ) {
+					size_t n = zero < STREAM_CHUNK_SZ ? zero : STREAM_CHUNK_SZ;
+					kuKernelCpuUnrestrictedMemcpy(dst, chunk, n);
+					dst += n;
+					zero -= n;
+				}
+			} else {
+				if (left > 0 && so_stream_read_at(stream, offset, dst, left) < 0) {
+					res = -3;
+					goto err_free_data;
+				}
+				memset(dst + left, 0, (uintptr_t)prog_data + prog_size - (uintptr_t)(dst + left));
+			}
 		}
 	}
 
-	if (mod->dynamic == NULL ||
-		mod->dynstr == NULL ||
-		mod->dynsym == NULL ||
-		mod->reldyn == NULL ||
-		mod->relplt == NULL) {
+	free(chunk);
+	chunk = NULL;
+	free(head_data);
+	head_data = NULL;
+
+	if (so_parse_dynamic(mod) < 0) {
 		res = -2;
 		goto err_free_data;
 	}
 
-	for (int i = 0; i < mod->num_dynamic; i++) {
-		switch (mod->dynamic[i].d_tag) {
-		case DT_SONAME:
-			mod->soname = mod->dynstr + mod->dynamic[i].d_un.d_ptr;
-			break;
-		default:
-			break;
-		}
-	}
+	// The hash covers what gets mapped, not the section headers read after it
+	sha1_final(&stream->sha1, mod->sha1);
 
-	sceKernelFreeMemBlock(so_blockid);
+	if (mod->num_dynsym == 0)
+		so_count_dynsym(mod, stream);
 
 	if (!head && !tail) {
 		head = mod;
@@ -256,86 +485,106 @@ err_free_data:
 		sceKernelFreeMemBlock(mod->data_blockid[i]);
 err_free_text:
 	sceKernelFreeMemBlock(mod->text_blockid);
-err_free_so:
-	sceKernelFreeMemBlock(so_blockid);
+err_free_chunk:
+	free(chunk);
+err_free_headers:
+	free(head_data);
+	free(mod->phdr);
+	free(mod->ehdr);
+	mod->phdr = NULL;
+	mod->ehdr = NULL;
 
 	return res;
 }
 
-int so_mem_load(so_module *mod, void *buffer, size_t so_size, uintptr_t load_addr) {
-	SceUID so_blockid;
-	void *so_data;
-
-	memset(mod, 0, sizeof(so_module));
-
-	so_blockid = sceKernelAllocMemBlock("so block", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, (so_size + 0xfff) & ~0xfff, NULL);
-	if (so_blockid < 0)
-		return so_blockid;
+typedef struct {
+	so_stream stream;
+	const uint8_t *data;
+	size_t size;
+} so_mem_stream;
+
+static int so_mem_stream_read(so_stream *stream, void *buf, size_t size) {
+	so_mem_stream *mem = (so_mem_stream *)stream;
+	if (stream->pos >= mem->size)
+		return 0;
+	if (size > mem->size - stream->pos)
+		size = mem->size - stream->pos;
+	memcpy(buf, mem->data + stream->pos, size);
+	return size;
+}
 
-	sceKernelGetMemBlockBase(so_blockid, &so_data);
-	sceClibMemcpy(so_data, buffer, so_size);
-	
-	return _so_load(mod, so_blockid, so_data, load_addr);
+static int so_mem_stream_seek(so_stream *stream, size_t offset) {
+	return offset <= ((so_mem_stream *)stream)->size ? 0 : -1;
 }
 
-int so_file_load(so_module *mod, const char *filename, uintptr_t load_addr) {
-	SceUID so_blockid;
-	void *so_data;
+int so_mem_load(so_module *mod, void *buffer, size_t so_size, uintptr_t load_addr) {
+	so_mem_stream mem;
+	memset(&mem, 0, sizeof(so_mem_stream));
+	mem.stream.read = so_mem_stream_read;
+	mem.stream.seek = so_mem_stream_seek;
+	mem.data = buffer;
+	mem.size = so_size;
+
+	return so_stream_load(mod, &mem.stream, load_addr);
+}
 
-	memset(mod, 0, sizeof(so_module));
+typedef struct {
+	so_stream stream;
+	SceUID fd;
+} so_file_stream;
 
-	SceUID fd = sceIoOpen(filename, SCE_O_RDONLY, 0);
-	if (fd < 0)
-		return fd;
+static int so_file_stream_read(so_stream *stream, void *buf, size_t size) {
+	return sceIoRead(((so_file_stream *)stream)->fd, buf, size);
+}
 
-	size_t so_size = sceIoLseek(fd, 0, SCE_SEEK_END);
-	sceIoLseek(fd, 0, SCE_SEEK_SET);
+static int so_file_stream_seek(so_stream *stream, size_t offset) {
+	return sceIoLseek(((so_file_stream *)stream)->fd, offset, SCE_SEEK_SET) == offset ? 0 : -1;
+}
 
-	so_blockid = sceKernelAllocMemBlock("so block", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, (so_size + 0xfff) & ~0xfff, NULL);
-	if (so_blockid < 0)
-		return so_blockid;
+int so_file_load(so_module *mod, const char *filename, uintptr_t load_addr) {
+	so_file_stream file;
+	memset(&file, 0, sizeof(so_file_stream));
+	file.stream.read = so_file_stream_read;
+	file.stream.seek = so_file_stream_seek;
 
-	sceKernelGetMemBlockBase(so_blockid, &so_data);
+	file.fd = sceIoOpen(filename, SCE_O_RDONLY, 0);
+	if (file.fd < 0)
+		return file.fd;
 
-	sceIoRead(fd, so_data, so_size);
-	sceIoClose(fd);
+	int res = so_stream_load(mod, &file.stream, load_addr);
+	sceIoClose(file.fd);
 
-	return _so_load(mod, so_blockid, so_data, load_addr);
+	return res;
 }
 
-int so_relocate(so_module *mod) {
-	for (int i = 0; i < mod->num_reldyn + mod->num_relplt; i++) {
-		Elf32_Rel *rel = i < mod->num_reldyn ? &mod->reldyn[i] : &mod->relplt[i - mod->num_reldyn];
-		Elf32_Sym *sym = &mod->dynsym[ELF32_R_SYM(rel->r_info)];
-		uintptr_t *ptr = (uintptr_t *)(mod->text_base + rel->r_offset);
-
-		int type = ELF32_R_TYPE(rel->r_info);
-		switch (type) {
-		case R_ARM_ABS32:
-			if (sym->st_shndx != SHN_UNDEF)
-				*ptr += mod->text_base + sym->st_value;
-			else
-				*ptr = mod->text_base + rel->r_offset; // make it crash for debugging
-			break;
-		case R_ARM_RELATIVE:
-			*ptr += mod->text_base;
-			break;
-		case R_ARM_GLOB_DAT:
-		case R_ARM_JUMP_SLOT:
-		{
-			if (sym->st_shndx != SHN_UNDEF)
-				*ptr = mod->text_base + sym->st_value;
-			else
-				*ptr = mod->text_base + rel->r_offset; // make it crash for debugging
-			break;
-		}
-		default:
-			fatal_error("Error unknown relocation type %x\n", type);
-			break;
+void so_unload(so_module *mod) {
+	if (head == mod) {
+		head = mod->next;
+		if (tail == mod)
+			tail = NULL;
+	} else {
+		for (so_module *curr = head; curr; curr = curr->next) {
+			if (curr->next == mod) {
+				curr->next = mod->next;
+				if (tail == mod)
+					tail = curr;
+				break;
+			}
 		}
 	}
 
-	return 0;
+	// Other modules may have cached names from this one's dynstr
+	for (so_module *curr = head; curr; curr = curr->next)
+		memset(curr->neg_symbol, 0, sizeof(curr->neg_symbol));
+
+	for (int i = 0; i < mod->n_data; i++)
+		sceKernelFreeMemBlock(mod->data_blockid[i]);
+	sceKernelFreeMemBlock(mod->text_blockid);
+	sceKernelFreeMemBlock(mod->patch_blockid);
+
+	free(mod->phdr);
+	free(mod->ehdr);
+	memset(mod, 0, sizeof(so_module));
 }
 
 uintptr_t so_resolve_link(so_module *mod, const char *symbol) {
@@ -401,58 +650,51 @@ void reloc_err(uintptr_t got0)
 	fatal_error("Unknown symbol \"???\" (%p).\n", (void*)got0);
 }
 
+#ifdef __arm__
 __attribute__((naked)) void plt0_stub()
 {
 	register uintptr_t got0 asm("r12");
 	reloc_err(got0);
 }
+#else
+// Host builds only load and link the module, nothing ever jumps here
+void plt0_stub()
+{
+	reloc_err(0);
+}
+#endif
 
-int so_resolve(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, int default_dynlib_only) {
-	for (int i = 0; i < mod->num_reldyn + mod->num_relplt; i++) {
-		Elf32_Rel *rel = i < mod->num_reldyn ? &mod->reldyn[i] : &mod->relplt[i - mod->num_reldyn];
-		Elf32_Sym *sym = &mod->dynsym[ELF32_R_SYM(rel->r_info)];
-		uintptr_t *ptr = (uintptr_t *)(mod->text_base + rel->r_offset);
+static void so_default_dynlib_index(so_default_dynlib *default_dynlib, int size_default_dynlib) {
+	// Build the hash index once per import table instead of scanning it for every import
+	if (dynlib_index_table != default_dynlib) {
+		so_index_free(&dynlib_index);
+		if (so_index_build(&dynlib_index, default_dynlib, sizeof(so_default_dynlib), size_default_dynlib / sizeof(so_default_dynlib)) < 0)
+			fatal_error("Error could not build import index.\n");
+		dynlib_index_table = default_dynlib;
+	}
+}
 
-		int type = ELF32_R_TYPE(rel->r_info);
-		switch (type) {
-		case R_ARM_ABS32:
-		case R_ARM_GLOB_DAT:
-		case R_ARM_JUMP_SLOT:
-		{
-			if (sym->st_shndx == SHN_UNDEF) {
-				int resolved = 0;
-				if (!default_dynlib_only) {
-					uintptr_t link = so_resolve_link(mod, mod->dynstr + sym->st_name);
-					if (link) {
-						// debugPrintf("Resolved from dependencies: %s\n", mod->dynstr + sym->st_name);
-						*ptr = link;
-						resolved = 1;
-					}
-				}
+static so_default_dynlib *so_default_dynlib_find(so_default_dynlib *default_dynlib, int size_default_dynlib, const char *symbol) {
+	so_default_dynlib_index(default_dynlib, size_default_dynlib);
 
-				for (int j = 0; j < size_default_dynlib / sizeof(so_default_dynlib); j++) {
-					if (strcmp(mod->dynstr + sym->st_name, default_dynlib[j].symbol) == 0) {
-						*ptr = default_dynlib[j].func;
-						resolved = 1;
-						break;
-					}
-				}
+	int index = so_index_find(&dynlib_index, symbol);
+	if (index < 0)
+		return NULL;
 
-				if (!resolved) {
-					if (type == R_ARM_JUMP_SLOT) {
-						printf("Unresolved import: %s\n", mod->dynstr + sym->st_name);
-						*ptr = (uintptr_t)&plt0_stub;
-					}
-					else {
-						fatal_error("Unresolved import: %s\n", mod->dynstr + sym->st_name);
-					}
-				}
-			}
+	return &default_dynlib[index];
+}
 
-			break;
-		}
-		default:
-			break;
+static uintptr_t so_resolve_import(so_module *mod, const char *symbol, so_default_dynlib *default_dynlib, int size_default_dynlib, int default_dynlib_only) {
+	// default_dynlib takes precedence over dependencies
+	so_default_dynlib *entry = so_default_dynlib_find(default_dynlib, size_default_dynlib, symbol);
+	if (entry)
+		return entry->func;
+
+	if (!default_dynlib_only) {
+		uintptr_t link = so_resolve_link(mod, symbol);
+		if (link) {
+			// debugPrintf("Resolved from dependencies: %s\n", symbol);
+			return link;
 		}
 	}
 
@@ -463,7 +705,7 @@ int so_resolve_with_dummy(so_module *mod, so_default_dynlib *default_dynlib, int
 	for (int i = 0; i < mod->num_reldyn + mod->num_relplt; i++) {
 		Elf32_Rel *rel = i < mod->num_reldyn ? &mod->reldyn[i] : &mod->relplt[i - mod->num_reldyn];
 		Elf32_Sym *sym = &mod->dynsym[ELF32_R_SYM(rel->r_info)];
-		uintptr_t *ptr = (uintptr_t *)(mod->text_base + rel->r_offset);
+		uint32_t *ptr = (uint32_t *)(mod->text_base + rel->r_offset);
 
 		int type = ELF32_R_TYPE(rel->r_info);
 		switch (type) {
@@ -472,12 +714,8 @@ int so_resolve_with_dummy(so_module *mod, so_default_dynlib *default_dynlib, int
 		case R_ARM_JUMP_SLOT:
 		{
 			if (sym->st_shndx == SHN_UNDEF) {
-				for (int j = 0; j < size_default_dynlib / sizeof(so_default_dynlib); j++) {
-					if (strcmp(mod->dynstr + sym->st_name, default_dynlib[j].symbol) == 0) {
-						*ptr = &ret0;
-						break;
-					}
-				}
+				if (so_default_dynlib_find(default_dynlib, size_default_dynlib, mod->dynstr + sym->st_name))
+					*ptr = (uintptr_t)&ret0;
 			}
 
 			break;
@@ -490,47 +728,182 @@ int so_resolve_with_dummy(so_module *mod, so_default_dynlib *default_dynlib, int
 	return 0;
 }
 
-void so_initialize(so_module *mod) {
-	for (int i = 0; i < mod->num_init_array; i++) {
-		if (mod->init_array[i])
-			mod->init_array[i]();
+static int so_rel_offset_cmp(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return x < y ? -1 : (x > y);
+}
+
+static void so_prelink_build_hash(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, uint8_t *hash) {
+	// Resolved values point into the loader, so any change to its import table invalidates the cache
+	SHA1_CTX ctx;
+	uintptr_t stubs[3] = { PRELINK_VERSION, (uintptr_t)&plt0_stub, mod->text_base };
+
+	sha1_init(&ctx);
+	sha1_update(&ctx, (BYTE *)stubs, sizeof(stubs));
+	for (int i = 0; i < size_default_dynlib / sizeof(so_default_dynlib); i++) {
+		sha1_update(&ctx, (BYTE *)default_dynlib[i].symbol, strlen(default_dynlib[i].symbol) + 1);
+		sha1_update(&ctx, (BYTE *)&default_dynlib[i].func, sizeof(uintptr_t));
 	}
+	sha1_final(&ctx, hash);
 }
 
-uint32_t so_hash(const uint8_t *name) {
-	uint64_t h = 0, g;
-	while (*name) {
-		h = (h << 4) + *name++;
-		if ((g = (h & 0xf0000000)) != 0)
-			h ^= g >> 24;
-		h &= 0x0fffffff;
+int so_prelink_load(so_module *mod, const char *path, so_default_dynlib *default_dynlib, int size_default_dynlib) {
+	SceUID fd = sceIoOpen(path, SCE_O_RDONLY, 0);
+	if (fd < 0)
+		return fd;
+
+	size_t size = sceIoLseek(fd, 0, SCE_SEEK_END);
+	sceIoLseek(fd, 0, SCE_SEEK_SET);
+
+	if (size < sizeof(so_prelink_header)) {
+		sceIoClose(fd);
+		return -1;
+	}
+
+	uint32_t *data = malloc(size);
+	if (!data) {
+		sceIoClose(fd);
+		return -1;
+	}
+
+	int res = sceIoRead(fd, data, size);
+	sceIoClose(fd);
+
+	uint8_t build_hash[SHA1_BLOCK_SIZE];
+	so_prelink_build_hash(mod, default_dynlib, size_default_dynlib, build_hash);
+
+	so_prelink_header *hdr = (so_prelink_header *)data;
+	if (res != size ||
+		hdr->magic != PRELINK_MAGIC ||
+		hdr->version != PRELINK_VERSION ||
+		hdr->text_base != mod->text_base ||
+		memcmp(hdr->so_hash, mod->sha1, SHA1_BLOCK_SIZE) != 0 ||
+		memcmp(hdr->build_hash, build_hash, SHA1_BLOCK_SIZE) != 0 ||
+		size != sizeof(so_prelink_header) + (hdr->num_runs * 2 + hdr->num_words) * sizeof(uint32_t)) {
+		free(data);
+		return -1;
+	}
+
+	// Runs are sorted by offset, so this is one sequential pass over the relocated words
+	uint32_t *run = (uint32_t *)(hdr + 1);
+	for (int i = 0; i < hdr->num_runs; i++) {
+		uint32_t *ptr = (uint32_t *)(mod->text_base + run[0]);
+		uint32_t count = run[1];
+		uint32_t *value = &run[2];
+		for (int j = 0; j < count; j++)
+			ptr[j] = value[j];
+		run = &value[count];
+	}
+
+	debugPrintf("prelink: applied %d words in %d runs.\n", hdr->num_words, hdr->num_runs);
+
+	free(data);
+	return 0;
+}
+
+int so_prelink_save(so_module *mod, const char *path, so_default_dynlib *default_dynlib, int size_default_dynlib) {
+	int num_rels = mod->num_reldyn + mod->num_relplt;
+	uint32_t *offsets = malloc(num_rels * sizeof(uint32_t));
+	if (!offsets)
+		return -1;
+
+	for (int i = 0; i < num_rels; i++) {
+		Elf32_Rel *rel = i < mod->num_reldyn ? &mod->reldyn[i] : &mod->relplt[i - mod->num_reldyn];
+		offsets[i] = rel->r_offset;
+	}
+	qsort(offsets, num_rels, sizeof(uint32_t), so_rel_offset_cmp);
+
+	// Worst case every relocation is its own run
+	uint32_t *data = malloc(sizeof(so_prelink_header) + num_rels * 3 * sizeof(uint32_t));
+	if (!data) {
+		free(offsets);
+		return -1;
+	}
+
+	so_prelink_header *hdr = (so_prelink_header *)data;
+	memset(hdr, 0, sizeof(so_prelink_header));
+	hdr->magic = PRELINK_MAGIC;
+	hdr->version = PRELINK_VERSION;
+	hdr->text_base = mod->text_base;
+	memcpy(hdr->so_hash, mod->sha1, SHA1_BLOCK_SIZE);
+	so_prelink_build_hash(mod, default_dynlib, size_default_dynlib, hdr->build_hash);
+
+	uint32_t *out = (uint32_t *)(hdr + 1);
+	uint32_t *run = NULL;
+	for (int i = 0; i < num_rels; i++) {
+		if (i > 0 && offsets[i] == offsets[i - 1])
+			continue;
+		if (!run || offsets[i] != run[0] + run[1] * sizeof(uint32_t)) {
+			run = out;
+			run[0] = offsets[i];
+			run[1] = 0;
+			out += 2;
+			hdr->num_runs++;
+		}
+		*out++ = *(uint32_t *)(mod->text_base + offsets[i]);
+		run[1]++;
+		hdr->num_words++;
+	}
+
+	free(offsets);
+
+	size_t size = (uintptr_t)out - (uintptr_t)data;
+	SceUID fd = sceIoOpen(path, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+	if (fd < 0) {
+		free(data);
+		return fd;
+	}
+
+	int res = sceIoWrite(fd, data, size);
+	sceIoClose(fd);
+	free(data);
+
+	return res == size ? 0 : -1;
+}
+
+void so_initialize(so_module *mod) {
+	for (int i = 0; i < mod->num_init_array; i++) {
+		if (mod->init_array[i]) {
+			int phase = profile_begin("init_array[%d] +0x%x", i, (uintptr_t)mod->init_array[i] - mod->text_base);
+			mod->init_array[i]();
+			profile_end(phase);
+		}
 	}
-	return h;
 }
 
 static int so_symbol_index(so_module *mod, const char *symbol)
 {
-	if (mod->hash) {
-		uint32_t hash = so_hash((const uint8_t *)symbol);
-		uint32_t nbucket = mod->hash[0];
-		uint32_t *bucket = &mod->hash[2];
-		uint32_t *chain = &bucket[nbucket];
-		for (int i = bucket[hash % nbucket]; i; i = chain[i]) {
+	uint32_t hash = so_gnu_hash((const uint8_t *)symbol);
+	int slot = hash % NEG_CACHE_SIZE;
+	int index;
+
+	const char *neg = mod->neg_symbol[slot];
+	if (neg && mod->neg_hash[slot] == hash && (neg == symbol || strcmp(neg, symbol) == 0))
+		return -1;
+
+	// A hash table is authoritative, a miss there is a miss in dynsym as well
+	if (mod->gnu_hash) {
+		index = so_gnu_hash_find(mod->gnu_hash, mod->dynsym, mod->dynstr, symbol, hash);
+	} else if (mod->hash) {
+		index = so_sysv_hash_find(mod->hash, mod->dynsym, mod->dynstr, symbol);
+	} else {
+		index = -1;
+		for (int i = 0; i < mod->num_dynsym; i++) {
 			if (mod->dynsym[i].st_shndx == SHN_UNDEF)
 				continue;
-			if (mod->dynsym[i].st_info != SHN_UNDEF && strcmp(mod->dynstr + mod->dynsym[i].st_name, symbol) == 0)
-				return i;
+			if (mod->dynsym[i].st_info != SHN_UNDEF && strcmp(mod->dynstr + mod->dynsym[i].st_name, symbol) == 0) {
+				index = i;
+				break;
+			}
 		}
 	}
 
-	for (int i = 0; i < mod->num_dynsym; i++) {
-		if (mod->dynsym[i].st_shndx == SHN_UNDEF)
-			continue;
-		if (mod->dynsym[i].st_info != SHN_UNDEF && strcmp(mod->dynstr + mod->dynsym[i].st_name, symbol) == 0)
-			return i;
+	if (index == -1) {
+		mod->neg_symbol[slot] = symbol;
+		mod->neg_hash[slot] = hash;
 	}
 
-	return -1;
+	return index;
 }
 
 /*
@@ -568,7 +941,7 @@ static void trampoline_ldm(so_module *mod, uint32_t *dst) {
 	int baseReg = ((*dst) >> 16) & 0xF;
 	int bitMask = (*dst) & 0xFFFF;
 
-	uint32_t stored = NULL;
+	uint32_t stored = 0;
 	for (int i = 0; i < 16; i++) {
 		if (bitMask & (1 << i)) {
 			// If the register we're reading the offset from is the same as the one we're writing,
@@ -587,10 +960,10 @@ static void trampoline_ldm(so_module *mod, uint32_t *dst) {
 	}
 
 	*ptr++ = 0xe51ff004; // LDR PC, [PC, -0x4] ; jmp to [dst+0x4]
-	*ptr++ = dst+1; // .dword <...>	; [dst+0x4]
+	*ptr++ = (uint32_t)(dst+1); // .dword <...>	; [dst+0x4]
 
 	size_t trampoline_sz =	((uintptr_t)ptr - (uintptr_t)&funct[0]);
-	uintptr_t patch_addr = so_alloc_arena(mod, B_RANGE, B_OFFSET(dst), trampoline_sz);
+	uintptr_t patch_addr = so_alloc_arena(mod, B_RANGE, B_OFFSET((uintptr_t)dst), trampoline_sz);
 
 	if (!patch_addr) {
 		fatal_error("Failed to patch LDMIA at 0x%08X, unable to allocate space.\n", dst);
@@ -606,7 +979,7 @@ static void trampoline_ldm(so_module *mod, uint32_t *dst) {
 uintptr_t so_symbol(so_module *mod, const char *symbol) {
 	int index = so_symbol_index(mod, symbol);
 	if (index == -1)
-		return NULL;
+		return 0;
 
 	return mod->text_base + mod->dynsym[index].st_value;
 }
@@ -629,7 +1002,498 @@ void so_symbol_fix_ldmia(so_module *mod, const char *symbol) {
 		//Is this an LDMIA instruction with a R0-R12 base register?
 		if (((inst & 0xFFF00000) == 0xE8900000) && (((inst >> 16) & 0xF) < 13) ) {
 			debugPrintf("Found possibly misaligned LDMIA on 0x%08X, trying to fix it... (instr: 0x%08X, to 0x%08X)\n", addr, *(uint32_t*)addr, mod->patch_head);
-			trampoline_ldm(mod, addr);
+			trampoline_ldm(mod, (uint32_t *)addr);
+		}
+	}
+}
+
+/*
+ * Lazy binding: every JUMP_SLOT starts out pointing at its own stub in the patch arena.
+ * The stub loads its relocation into r12 and enters so_lazy_entry, which resolves the
+ * import, patches the GOT entry and tail-calls the target with the original arguments.
+ */
+uintptr_t so_lazy_bind(Elf32_Rel *rel) {
+	so_module *mod = head;
+	while (mod && (rel < mod->relplt || rel >= mod->relplt + mod->num_relplt))
+		mod = mod->next;
+
+	if (!mod)
+		fatal_error("Error lazy binding for unknown relocation %p.\n", rel);
+
+	Elf32_Sym *sym = &mod->dynsym[ELF32_R_SYM(rel->r_info)];
+	uint32_t *ptr = (uint32_t *)(mod->text_base + rel->r_offset);
+
+	uintptr_t func = so_resolve_import(mod, mod->dynstr + sym->st_name, mod->lazy_dynlib, mod->size_lazy_dynlib, mod->lazy_dynlib_only);
+	if (!func)
+		fatal_error("Unresolved import: %s\n", mod->dynstr + sym->st_name);
+
+	*ptr = func;
+	return func;
+}
+
+#ifdef __arm__
+__attribute__((naked)) void so_lazy_entry(void) {
+	asm volatile(
+		"push {r0-r4, lr}\n"
+		"mov r0, r12\n"
+		"bl so_lazy_bind\n"
+		"mov r12, r0\n"
+		"pop {r0-r4, lr}\n"
+		"bx r12\n"
+	);
+}
+#else
+void so_lazy_entry(void) {
+	fatal_error("Error lazy binding is only supported on ARM.\n");
+}
+#endif
+
+typedef struct {
+	uint32_t offset;
+	uint32_t count;
+} so_reloc_run;
+
+typedef struct {
+	uint32_t offset;
+	uint32_t sym;
+	Elf32_Rel *rel;
+} so_reloc_sym;
+
+#define SO_UNRESOLVED ((uintptr_t)-1)
+
+static int so_reloc_kind(int type) {
+	switch (type) {
+	case R_ARM_RELATIVE:
+		return SO_RELOC_RELATIVE;
+	case R_ARM_ABS32:
+		return SO_RELOC_ABS32;
+	case R_ARM_GLOB_DAT:
+		return SO_RELOC_GLOB_DAT;
+	case R_ARM_JUMP_SLOT:
+		return SO_RELOC_JUMP_SLOT;
+	default:
+		return -1;
+	}
+}
+
+/*
+ * so_link: relocates and/or resolves a module in a single pass over its relocation tables.
+ * Relocations are decoded once into per-type batches, RELATIVE entries are coalesced
+ * into runs of consecutive words and every imported symbol is looked up only once.
+ */
+int so_link(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, int flags) {
+	so_link_stats *stats = &mod->link_stats;
+	uintptr_t base = mod->text_base;
+	int num_rels = mod->num_reldyn + mod->num_relplt;
+	int default_dynlib_only = (flags & SO_LINK_DEFAULT_ONLY) != 0;
+
+	memset(stats, 0, sizeof(so_link_stats));
+	uint64_t time = sceKernelGetProcessTimeWide();
+
+	for (int i = 0; i < num_rels; i++) {
+		Elf32_Rel *rel = i < mod->num_reldyn ? &mod->reldyn[i] : &mod->relplt[i - mod->num_reldyn];
+		int kind = so_reloc_kind(ELF32_R_TYPE(rel->r_info));
+		if (kind >= 0)
+			stats->count[kind]++;
+		else if (flags & SO_LINK_RELOCATE)
+			fatal_error("Error unknown relocation type %x\n", ELF32_R_TYPE(rel->r_info));
+	}
+
+	so_reloc_run *runs = malloc((stats->count[SO_RELOC_RELATIVE] + 1) * sizeof(so_reloc_run));
+	if (!runs)
+		fatal_error("Error could not allocate %d relocation runs.\n", stats->count[SO_RELOC_RELATIVE]);
+	so_reloc_sym *batch[SO_RELOC_MAX];
+	int num_batch[SO_RELOC_MAX] = { 0 };
+	int num_runs = 0;
+
+	for (int k = SO_RELOC_ABS32; k < SO_RELOC_MAX; k++) {
+		batch[k] = malloc((stats->count[k] + 1) * sizeof(so_reloc_sym));
+		if (!batch[k])
+			fatal_error("Error could not allocate %d symbol relocations.\n", stats->count[k]);
+	}
+
+	for (int i = 0; i < num_rels; i++) {
+		Elf32_Rel *rel = i < mod->num_reldyn ? &mod->reldyn[i] : &mod->relplt[i - mod->num_reldyn];
+		int kind = so_reloc_kind(ELF32_R_TYPE(rel->r_info));
+		if (kind < 0)
+			continue;
+
+		if (kind == SO_RELOC_RELATIVE) {
+			if (num_runs > 0 && runs[num_runs - 1].offset + runs[num_runs - 1].count * sizeof(uint32_t) == rel->r_offset) {
+				runs[num_runs - 1].count++;
+			} else {
+				runs[num_runs].offset = rel->r_offset;
+				runs[num_runs].count = 1;
+				num_runs++;
+			}
+		} else {
+			so_reloc_sym *entry = &batch[kind][num_batch[kind]++];
+			entry->offset = rel->r_offset;
+			entry->sym = ELF32_R_SYM(rel->r_info);
+			entry->rel = rel;
+		}
+	}
+
+	uint64_t now = sceKernelGetProcessTimeWide();
+	stats->classify_time = now - time;
+	time = now;
+
+	if (flags & SO_LINK_RELOCATE) {
+		// Consecutive words, so the inner loop can be vectorized
+		for (int i = 0; i < num_runs; i++) {
+			uint32_t *ptr = (uint32_t *)(base + runs[i].offset);
+			uint32_t count = runs[i].count;
+			for (uint32_t j = 0; j < count; j++)
+				ptr[j] += base;
+		}
+	}
+
+	now = sceKernelGetProcessTimeWide();
+	stats->time[SO_RELOC_RELATIVE] = now - time;
+	stats->runs = num_runs;
+	time = now;
+
+	uintptr_t *values = NULL;
+	if (flags & SO_LINK_RESOLVE) {
+		so_default_dynlib_index(default_dynlib, size_default_dynlib);
+		values = mod->num_dynsym ? calloc(mod->num_dynsym, sizeof(uintptr_t)) : NULL;
+		if (mod->num_dynsym && !values)
+			fatal_error("Error could not allocate %d resolved symbols.\n", mod->num_dynsym);
+	}
+
+	uint32_t *stubs = NULL;
+	uintptr_t stubs_addr = 0;
+	int num_stubs = 0;
+	if (flags & SO_LINK_LAZY) {
+		mod->lazy_dynlib = default_dynlib;
+		mod->size_lazy_dynlib = size_default_dynlib;
+		mod->lazy_dynlib_only = default_dynlib_only;
+
+		size_t stubs_size = mod->num_relplt * 4 * sizeof(uint32_t);
+		stubs = malloc(stubs_size);
+		stubs_addr = so_alloc_arena(mod, (uintptr_t)NULL, (uintptr_t)NULL, stubs_size);
+		if (!stubs || !stubs_addr)
+			fatal_error("Error could not allocate %d lazy binding stubs.\n", mod->num_relplt);
+	}
+
+	for (int k = SO_RELOC_ABS32; k < SO_RELOC_MAX; k++) {
+		for (int i = 0; i < num_batch[k]; i++) {
+			so_reloc_sym *entry = &batch[k][i];
+			Elf32_Sym *sym = &mod->dynsym[entry->sym];
+			uint32_t *ptr = (uint32_t *)(base + entry->offset);
+
+			if (sym->st_shndx != SHN_UNDEF) {
+				if (flags & SO_LINK_RELOCATE) {
+					if (k == SO_RELOC_ABS32)
+						*ptr += base + sym->st_value;
+					else
+						*ptr = base + sym->st_value;
+				}
+				continue;
+			}
+
+			stats->imports[k]++;
+
+			if (!(flags & SO_LINK_RESOLVE)) {
+				if (flags & SO_LINK_RELOCATE)
+					*ptr = base + entry->offset; // make it crash for debugging
+				continue;
+			}
+
+			if ((flags & SO_LINK_LAZY) && k == SO_RELOC_JUMP_SLOT && entry->rel >= mod->relplt) {
+				uint32_t *stub = &stubs[num_stubs * 4];
+				stub[0] = 0xe59fc000; // LDR R12, [PC]
+				stub[1] = 0xe59ff000; // LDR PC, [PC]
+				stub[2] = (uintptr_t)entry->rel;
+				stub[3] = (uintptr_t)&so_lazy_entry;
+				*ptr = stubs_addr + num_stubs * 4 * sizeof(uint32_t);
+				num_stubs++;
+				continue;
+			}
+
+			uintptr_t func = entry->sym < mod->num_dynsym ? values[entry->sym] : 0;
+			if (!func) {
+				func = so_resolve_import(mod, mod->dynstr + sym->st_name, default_dynlib, size_default_dynlib, default_dynlib_only);
+				if (entry->sym < mod->num_dynsym)
+					values[entry->sym] = func ? func : SO_UNRESOLVED;
+				stats->lookups++;
+			} else if (func == SO_UNRESOLVED) {
+				func = 0;
+			}
+
+			if (!func) {
+				if (k == SO_RELOC_JUMP_SLOT) {
+					printf("Unresolved import: %s\n", mod->dynstr + sym->st_name);
+					func = (uintptr_t)&plt0_stub;
+				} else {
+					fatal_error("Unresolved import: %s\n", mod->dynstr + sym->st_name);
+				}
+			}
+
+			*ptr = func;
 		}
+
+		now = sceKernelGetProcessTimeWide();
+		stats->time[k] = now - time;
+		time = now;
+	}
+
+	if (num_stubs > 0) {
+		kuKernelCpuUnrestrictedMemcpy((void *)stubs_addr, stubs, num_stubs * 4 * sizeof(uint32_t));
+		kuKernelFlushCaches((void *)stubs_addr, num_stubs * 4 * sizeof(uint32_t));
 	}
+	stats->stubs = num_stubs;
+
+	free(stubs);
+	free(values);
+	for (int k = SO_RELOC_ABS32; k < SO_RELOC_MAX; k++)
+		free(batch[k]);
+	free(runs);
+
+	so_link_report(mod);
+
+	return 0;
+}
+
+void so_link_report(so_module *mod) {
+	static const char *names[SO_RELOC_MAX] = { "RELATIVE", "ABS32", "GLOB_DAT", "JUMP_SLOT" };
+	so_link_stats *stats = &mod->link_stats;
+
+	debugPrintf("link: classify %lluus, %d lookups, %d RELATIVE runs, %d lazy stubs\n",
+		stats->classify_time, stats->lookups, stats->runs, stats->stubs);
+	for (int k = 0; k < SO_RELOC_MAX; k++)
+		debugPrintf("link: %-9s %6d relocs, %6d imports, %6lluus\n", names[k], stats->count[k], stats->imports[k], stats->time[k]);
+}
+
+int so_relocate(so_module *mod) {
+	return so_link(mod, NULL, 0, SO_LINK_RELOCATE);
+}
+
+int so_resolve(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, int default_dynlib_only) {
+	return so_link(mod, default_dynlib, size_default_dynlib, SO_LINK_RESOLVE | (default_dynlib_only ? SO_LINK_DEFAULT_ONLY : 0));
+}
+
+int so_resolve_lazy(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, int default_dynlib_only) {
+	return so_link(mod, default_dynlib, size_default_dynlib, SO_LINK_RESOLVE | SO_LINK_LAZY | (default_dynlib_only ? SO_LINK_DEFAULT_ONLY : 0));
+}
+
+typedef struct {
+	uintptr_t addr;
+	uint32_t size;
+	int order;
+	const uint8_t *src; // NULL for hooks
+	uint8_t hook[HOOK_MAX_SZ];
+} so_patch_write;
+
+static int so_patch_write_cmp(const void *a, const void *b) {
+	const so_patch_write *x = a, *y = b;
+	if (x->addr != y->addr)
+		return x->addr < y->addr ? -1 : 1;
+	return x->order - y->order;
+}
+
+static int so_patch_order_cmp(const void *a, const void *b) {
+	const so_patch_write *x = a, *y = b;
+	return x->order - y->order;
+}
+
+static int so_patch_in_module(so_module *mod, uintptr_t addr, uint32_t size) {
+	if (addr >= mod->text_base && addr + size <= mod->text_base + mod->text_size)
+		return 1;
+	for (int i = 0; i < mod->n_data; i++) {
+		if (addr >= mod->data_base[i] && addr + size <= mod->data_base[i] + mod->data_size[i])
+			return 1;
+	}
+	return 0;
+}
+
+static int so_patch_check(so_module *mod, const so_patch *patch, int sym, uintptr_t site, so_patch_write *write) {
+	const char *name = patch->symbol ? patch->symbol : "<text>";
+
+	if (patch->symbol && sym < 0) {
+		debugPrintf("patch: %s+0x%x is not exported\n", name, patch->offset);
+		return -1;
+	}
+
+	if (patch->kind == SO_PATCH_IMPORT)
+		return 0;
+
+	if (!so_patch_in_module(mod, write->addr, write->size)) {
+		debugPrintf("patch: %s+0x%x (%d bytes) is outside of the module\n", name, patch->offset, write->size);
+		return -1;
+	}
+
+	// Tiny functions get hooked all the time, spilling into padding is usually harmless
+	if (patch->kind == SO_PATCH_HOOK && sym >= 0 && mod->dynsym[sym].st_size > 0) {
+		uintptr_t end = ((mod->text_base + mod->dynsym[sym].st_value) & ~1) + mod->dynsym[sym].st_size;
+		if (write->addr + write->size > end)
+			debugPrintf("patch: warning, hook at %s+0x%x needs %d bytes, function has %d\n", name, patch->offset, write->size, end - write->addr);
+	}
+
+	if (patch->expect && memcmp((void *)(site & ~1), patch->expect, patch->size) != 0) {
+		debugPrintf("patch: %s+0x%x doesn't match the expected original bytes\n", name, patch->offset);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * so_patch_apply: applies a table of patches in one go.
+ * Every symbol is looked up once, all writes are sorted and merged into runs that
+ * each take a single kernel copy, and only the touched cache lines get flushed.
+ * With SO_PATCH_VALIDATE nothing is written unless every site checks out.
+ */
+int so_patch_apply(so_module *mod, const so_patch *patches, int count, int flags) {
+	if (count <= 0)
+		return 0;
+
+	int res = 0;
+	int *syms = malloc(count * sizeof(int));
+	const char **names = malloc(count * sizeof(char *));
+	so_patch_write *writes = malloc(count * sizeof(so_patch_write));
+	if (!syms || !names || !writes) {
+		res = -1;
+		goto out;
+	}
+
+	// Resolve every distinct symbol once
+	for (int i = 0; i < count; i++)
+		names[i] = patches[i].symbol ? patches[i].symbol : "";
+
+	so_index idx;
+	if (so_index_build(&idx, names, sizeof(char *), count) < 0) {
+		res = -1;
+		goto out;
+	}
+
+	for (int i = 0; i < count; i++)
+		syms[i] = -1;
+
+	if (mod->gnu_hash || mod->hash) {
+		for (int i = 0; i < count; i++) {
+			int first = so_index_find(&idx, names[i]);
+			if (!patches[i].symbol)
+				continue;
+			if (first < i)
+				syms[i] = syms[first];
+			else
+				syms[i] = so_symbol_index(mod, names[i]);
+		}
+	} else {
+		// Without a hash table, a single walk over dynsym beats a linear scan per symbol
+		for (int i = 1; i < mod->num_dynsym; i++) {
+			if (mod->dynsym[i].st_shndx == SHN_UNDEF)
+				continue;
+			int first = so_index_find(&idx, mod->dynstr + mod->dynsym[i].st_name);
+			if (first >= 0 && patches[first].symbol && syms[first] < 0)
+				syms[first] = i;
+		}
+		for (int i = 0; i < count; i++) {
+			if (patches[i].symbol)
+				syms[i] = syms[so_index_find(&idx, names[i])];
+		}
+	}
+
+	so_index_free(&idx);
+
+	int num_writes = 0, failed = 0;
+	for (int i = 0; i < count; i++) {
+		const so_patch *patch = &patches[i];
+		uintptr_t site = mod->text_base + patch->offset;
+		if (patch->symbol)
+			site += syms[i] >= 0 ? mod->dynsym[syms[i]].st_value : 0;
+
+		so_patch_write *write = &writes[num_writes];
+		write->order = i;
+		switch (patch->kind) {
+		case SO_PATCH_HOOK:
+			write->size = hook_encode(site, patch->target, write->hook, &write->addr);
+			write->src = NULL; // the entry moves when sorted, copy from its own hook buffer
+			break;
+		case SO_PATCH_WRITE:
+			write->addr = site;
+			write->size = patch->size;
+			write->src = patch->data;
+			break;
+		default:
+			write->addr = site;
+			write->size = 0;
+			break;
+		}
+
+		if (flags & SO_PATCH_VALIDATE) {
+			if (so_patch_check(mod, patch, syms[i], site, write) < 0) {
+				failed++;
+				continue;
+			}
+		} else if (patch->symbol && syms[i] < 0) {
+			// Same as hook_addr(so_symbol(...)) with a missing symbol
+			continue;
+		}
+
+		if (patch->kind == SO_PATCH_IMPORT)
+			*(uintptr_t *)patch->out = site;
+		else
+			num_writes++;
+	}
+
+	if (failed) {
+		debugPrintf("patch: %d of %d patches failed validation, nothing was written\n", failed, count);
+		res = -failed;
+		goto out;
+	}
+
+	qsort(writes, num_writes, sizeof(so_patch_write), so_patch_write_cmp);
+
+	int num_runs = 0;
+	size_t flushed = 0;
+	uintptr_t flush_end = 0;
+	for (int i = 0; i < num_writes; ) {
+		// Merge writes that are close enough, the gaps keep their current bytes
+		uintptr_t start = writes[i].addr, end = start + writes[i].size;
+		int j = i + 1;
+		while (j < num_writes && writes[j].addr <= end + PATCH_RUN_GAP) {
+			if (writes[j].addr + writes[j].size > end)
+				end = writes[j].addr + writes[j].size;
+			j++;
+		}
+
+		uint8_t *run = malloc(end - start);
+		if (!run) {
+			res = -1;
+			goto out;
+		}
+		memcpy(run, (void *)start, end - start);
+		// Later entries of the table win on overlap, whatever their address
+		qsort(writes + i, j - i, sizeof(so_patch_write), so_patch_order_cmp);
+		for (int k = i; k < j; k++)
+			memcpy(run + (writes[k].addr - start), writes[k].src ? writes[k].src : writes[k].hook, writes[k].size);
+		kuKernelCpuUnrestrictedMemcpy((void *)start, run, end - start);
+		free(run);
+
+		if (flags & SO_PATCH_FLUSH) {
+			uintptr_t line = start & ~(PATCH_LINE_SZ - 1);
+			if (line < flush_end)
+				line = flush_end;
+			uintptr_t line_end = ALIGN_MEM(end, PATCH_LINE_SZ);
+			if (line < line_end) {
+				kuKernelFlushCaches((void *)line, line_end - line);
+				flushed += line_end - line;
+				flush_end = line_end;
+			}
+		}
+
+		num_runs++;
+		i = j;
+	}
+
+	debugPrintf("patch: %d patches, %d writes in %d runs, %d bytes flushed\n", count, num_writes, num_runs, flushed);
+
+out:
+	free(writes);
+	free(names);
+	free(syms);
+
+	return res;
 }
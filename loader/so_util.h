@@ -2,9 +2,54 @@
 #define __SO_UTIL_H__
 
 #include "elf.h"
+#include "sha1.h"
 
 #define ALIGN_MEM(x, align) (((x) + ((align) - 1)) & ~((align) - 1))
 #define MAX_DATA_SEG 4
+#define NEG_CACHE_SIZE 64
+
+#define SO_LINK_RELOCATE     (1 << 0) // apply relocations against the module itself
+#define SO_LINK_RESOLVE      (1 << 1) // resolve imports
+#define SO_LINK_LAZY         (1 << 2) // bind JUMP_SLOT imports on first call
+#define SO_LINK_DEFAULT_ONLY (1 << 3) // only resolve imports from default_dynlib
+
+#define SO_PATCH_VALIDATE (1 << 0) // check every site before writing anything
+#define SO_PATCH_FLUSH    (1 << 1) // flush the touched cache lines afterwards
+
+enum {
+  SO_PATCH_HOOK,   // redirect the code at the site to target
+  SO_PATCH_WRITE,  // copy size bytes from data to the site
+  SO_PATCH_IMPORT, // store the address of the site into *out
+};
+
+typedef struct {
+  const char *symbol; // NULL for an offset from the module base
+  uint32_t offset;
+  int kind;
+  uintptr_t target;
+  const void *data;
+  uint32_t size;
+  void *out;
+  const void *expect; // size bytes expected at the site, only checked with SO_PATCH_VALIDATE
+} so_patch;
+
+enum {
+  SO_RELOC_RELATIVE,
+  SO_RELOC_ABS32,
+  SO_RELOC_GLOB_DAT,
+  SO_RELOC_JUMP_SLOT,
+  SO_RELOC_MAX
+};
+
+typedef struct {
+  int count[SO_RELOC_MAX];
+  int imports[SO_RELOC_MAX];
+  uint64_t time[SO_RELOC_MAX];
+  uint64_t classify_time;
+  int lookups;
+  int runs;
+  int stubs;
+} so_link_stats;
 
 typedef struct so_module {
   struct so_module *next;
@@ -16,7 +61,6 @@ typedef struct so_module {
 
   Elf32_Ehdr *ehdr;
   Elf32_Phdr *phdr;
-  Elf32_Shdr *shdr;
 
   Elf32_Dyn *dynamic;
   Elf32_Sym *dynsym;
@@ -25,6 +69,12 @@ typedef struct so_module {
 
   int (** init_array)(void);
   uint32_t *hash;
+  uint32_t *gnu_hash;
+
+  // Recent failed lookups, so repeated misses from so_resolve_link are cheap.
+  // Names point into the importer's dynstr or the loader's own tables
+  uint32_t neg_hash[NEG_CACHE_SIZE];
+  const char *neg_symbol[NEG_CACHE_SIZE];
 
   int num_dynamic;
   int num_dynsym;
@@ -32,12 +82,28 @@ typedef struct so_module {
   int num_relplt;
   int num_init_array;
 
+  uint8_t sha1[20]; // SHA1 of the headers and segments read from the .so
+
+  // Import table used to bind JUMP_SLOTs on first call
+  struct so_default_dynlib *lazy_dynlib;
+  int size_lazy_dynlib;
+  int lazy_dynlib_only;
+
+  so_link_stats link_stats;
+
   char *soname;
-  char *shstr;
   char *dynstr;
 } so_module;
 
-typedef struct {
+// Source of a module image, read mostly sequentially
+typedef struct so_stream {
+  int (* read)(struct so_stream *stream, void *buf, size_t size);
+  int (* seek)(struct so_stream *stream, size_t offset); // NULL for forward-only streams
+  size_t pos;
+  SHA1_CTX sha1;
+} so_stream;
+
+typedef struct so_default_dynlib {
   char *symbol;
   uintptr_t func;
 } so_default_dynlib;
@@ -48,10 +114,19 @@ void hook_addr(uintptr_t addr, uintptr_t dst);
 
 void so_flush_caches(so_module *mod);
 int so_file_load(so_module *mod, const char *filename, uintptr_t load_addr);
+int so_stream_load(so_module *mod, so_stream *stream, uintptr_t load_addr);
+int so_zip_load(so_module *mod, const char *zipname, const char *entry, uintptr_t load_addr);
 int so_mem_load(so_module *mod, void * buffer, size_t so_size, uintptr_t load_addr);
+void so_unload(so_module *mod);
+int so_link(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, int flags);
+void so_link_report(so_module *mod);
 int so_relocate(so_module *mod);
 int so_resolve(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, int default_dynlib_only);
+int so_resolve_lazy(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, int default_dynlib_only);
 int so_resolve_with_dummy(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, int default_dynlib_only);
+int so_prelink_load(so_module *mod, const char *path, so_default_dynlib *default_dynlib, int size_default_dynlib);
+int so_prelink_save(so_module *mod, const char *path, so_default_dynlib *default_dynlib, int size_default_dynlib);
+int so_patch_apply(so_module *mod, const so_patch *patches, int count, int flags);
 void so_symbol_fix_ldmia(so_module *mod, const char *symbol);
 void so_initialize(so_module *mod);
 uintptr_t so_symbol(so_module *mod, const char *symbol);
@@ -0,0 +1,233 @@
+/* so_zip.c -- load .so modules straight out of a zip archive
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include "so_util.h"
+
+#define ZIP_EOCD_SIG 0x06054b50
+#define ZIP_CDIR_SIG 0x02014b50
+#define ZIP_LOCAL_SIG 0x04034b50
+
+#define ZIP_EOCD_SIZE 22
+#define ZIP_CDIR_SIZE 46
+#define ZIP_LOCAL_SIZE 30
+#define ZIP_MAX_COMMENT 0xFFFF
+
+#define ZIP_STORED 0
+#define ZIP_DEFLATED 8
+
+#define ZIP_INPUT_SZ 0x4000
+
+typedef struct {
+  so_stream stream;
+  SceUID fd;
+  int method;
+  uint32_t data_offset;
+  uint32_t comp_size;
+  uint32_t comp_left;
+  z_stream z;
+  uint8_t *input;
+} so_zip_stream;
+
+static uint16_t zip_u16(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t zip_u32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static int zip_read_at(SceUID fd, uint32_t offset, void *buf, size_t size) {
+  if (sceIoLseek(fd, offset, SCE_SEEK_SET) != offset)
+    return -1;
+  return sceIoRead(fd, buf, size) == size ? 0 : -1;
+}
+
+// Finds the local file data of an entry through the central directory
+static int zip_find_entry(so_zip_stream *zip, const char *entry) {
+  SceOff file_size = sceIoLseek(zip->fd, 0, SCE_SEEK_END);
+  if (file_size < ZIP_EOCD_SIZE)
+    return -1;
+
+  // The end of central directory record is followed by a comment of up to 64KB
+  uint32_t tail_size = file_size < ZIP_EOCD_SIZE + ZIP_MAX_COMMENT ? file_size : ZIP_EOCD_SIZE + ZIP_MAX_COMMENT;
+  uint8_t *tail = malloc(tail_size);
+  if (!tail)
+    return -1;
+
+  if (zip_read_at(zip->fd, file_size - tail_size, tail, tail_size) < 0) {
+    free(tail);
+    return -1;
+  }
+
+  uint8_t *eocd = NULL;
+  for (int i = tail_size - ZIP_EOCD_SIZE; i >= 0; i--) {
+    if (zip_u32(tail + i) == ZIP_EOCD_SIG) {
+      eocd = tail + i;
+      break;
+    }
+  }
+
+  if (!eocd) {
+    free(tail);
+    return -1;
+  }
+
+  int num_entries = zip_u16(eocd + 10);
+  uint32_t cdir_size = zip_u32(eocd + 12);
+  uint32_t cdir_offset = zip_u32(eocd + 16);
+  free(tail);
+
+  if (cdir_offset + cdir_size > file_size)
+    return -1;
+
+  uint8_t *cdir = malloc(cdir_size);
+  if (!cdir)
+    return -1;
+
+  if (zip_read_at(zip->fd, cdir_offset, cdir, cdir_size) < 0) {
+    free(cdir);
+    return -1;
+  }
+
+  size_t entry_len = strlen(entry);
+  uint32_t local_offset = 0xFFFFFFFF;
+
+  uint8_t *p = cdir;
+  for (int i = 0; i < num_entries; i++) {
+    if (p + ZIP_CDIR_SIZE > cdir + cdir_size || zip_u32(p) != ZIP_CDIR_SIG)
+      break;
+
+    uint16_t name_len = zip_u16(p + 28);
+    uint16_t extra_len = zip_u16(p + 30);
+    uint16_t comment_len = zip_u16(p + 32);
+
+    if (name_len == entry_len && p + ZIP_CDIR_SIZE + name_len <= cdir + cdir_size &&
+        memcmp(p + ZIP_CDIR_SIZE, entry, entry_len) == 0) {
+      zip->method = zip_u16(p + 10);
+      zip->comp_size = zip_u32(p + 20);
+      local_offset = zip_u32(p + 42);
+      break;
+    }
+
+    p += ZIP_CDIR_SIZE + name_len + extra_len + comment_len;
+  }
+
+  free(cdir);
+
+  if (local_offset == 0xFFFFFFFF)
+    return -1;
+
+  // The local header may carry a different extra field than the central one
+  uint8_t local[ZIP_LOCAL_SIZE];
+  if (zip_read_at(zip->fd, local_offset, local, ZIP_LOCAL_SIZE) < 0 || zip_u32(local) != ZIP_LOCAL_SIG)
+    return -1;
+
+  zip->data_offset = local_offset + ZIP_LOCAL_SIZE + zip_u16(local + 26) + zip_u16(local + 28);
+  if (zip->data_offset + zip->comp_size > file_size)
+    return -1;
+
+  return 0;
+}
+
+static int so_zip_stream_read(so_stream *stream, void *buf, size_t size) {
+  so_zip_stream *zip = (so_zip_stream *)stream;
+
+  if (zip->method == ZIP_STORED) {
+    if (stream->pos >= zip->comp_size)
+      return 0;
+    if (size > zip->comp_size - stream->pos)
+      size = zip->comp_size - stream->pos;
+    return sceIoRead(zip->fd, buf, size);
+  }
+
+  zip->z.next_out = buf;
+  zip->z.avail_out = size;
+
+  while (zip->z.avail_out > 0) {
+    if (zip->z.avail_in == 0 && zip->comp_left > 0) {
+      uint32_t n = zip->comp_left < ZIP_INPUT_SZ ? zip->comp_left : ZIP_INPUT_SZ;
+      if (sceIoRead(zip->fd, zip->input, n) != n)
+        return -1;
+      zip->z.next_in = zip->input;
+      zip->z.avail_in = n;
+      zip->comp_left -= n;
+    }
+
+    int res = inflate(&zip->z, Z_NO_FLUSH);
+    if (res == Z_STREAM_END)
+      break;
+    if (res != Z_OK)
+      return -1;
+  }
+
+  return size - zip->z.avail_out;
+}
+
+static int so_zip_stream_seek(so_stream *stream, size_t offset) {
+  so_zip_stream *zip = (so_zip_stream *)stream;
+  if (offset > zip->comp_size)
+    return -1;
+  return sceIoLseek(zip->fd, zip->data_offset + offset, SCE_SEEK_SET) == zip->data_offset + offset ? 0 : -1;
+}
+
+/*
+ * so_zip_load: loads a module from an entry of a zip archive (e.g. an APK).
+ * Stored entries are read in place, deflated entries are inflated on the fly
+ * through a small input buffer, so nothing is extracted to the memory card.
+ */
+int so_zip_load(so_module *mod, const char *zipname, const char *entry, uintptr_t load_addr) {
+  so_zip_stream zip;
+  memset(&zip, 0, sizeof(so_zip_stream));
+
+  zip.fd = sceIoOpen(zipname, SCE_O_RDONLY, 0);
+  if (zip.fd < 0)
+    return zip.fd;
+
+  int res = -1;
+
+  if (zip_find_entry(&zip, entry) < 0)
+    goto err_close;
+
+  if (sceIoLseek(zip.fd, zip.data_offset, SCE_SEEK_SET) != zip.data_offset)
+    goto err_close;
+
+  zip.stream.read = so_zip_stream_read;
+
+  if (zip.method == ZIP_STORED) {
+    zip.stream.seek = so_zip_stream_seek;
+  } else if (zip.method == ZIP_DEFLATED) {
+    // Deflate can't seek, so_stream_load skips forward by reading instead
+    zip.input = malloc(ZIP_INPUT_SZ);
+    if (!zip.input)
+      goto err_close;
+    zip.comp_left = zip.comp_size;
+    if (inflateInit2(&zip.z, -MAX_WBITS) != Z_OK)
+      goto err_free_input;
+  } else {
+    goto err_close;
+  }
+
+  res = so_stream_load(mod, &zip.stream, load_addr);
+
+  if (zip.method == ZIP_DEFLATED)
+    inflateEnd(&zip.z);
+err_free_input:
+  free(zip.input);
+err_close:
+  sceIoClose(zip.fd);
+
+  return res;
+}
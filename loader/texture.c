@@ -0,0 +1,908 @@
+/* texture.c -- texture uploads and mipmap generation
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * Every level the game uploads is passed on to vitaGL. Textures that come
+ * without mips get a box filtered chain built on a worker thread, cached on
+ * disk under the hash of their level 0 and uploaded back on the main thread
+ * at the end of a frame. Compressed levels that need decoding go through the
+ * same worker, the name shows a placeholder until they are in.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "config.h"
+#include "murmur.h"
+#include "framebuffer.h"
+#include "pvrtc.h"
+#include "texture.h"
+#include "dedup.h"
+#include "residency.h"
+#include "transcode.h"
+
+#define MIP_MAGIC 0x4350494d // 'MIPC'
+#define MIP_VERSION 1
+
+#define WORKER_STACK_SIZE (128 * 1024)
+#define DELETE_BATCH 32
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t width;
+  uint32_t height;
+  uint32_t format;
+  uint32_t type;
+  uint32_t levels;
+  uint32_t size;
+} mip_header;
+
+typedef struct {
+  GLint min_filter;
+  uint32_t levels;     // bit per level the game uploaded
+  uint32_t generation; // bumped whenever level 0 changes
+  int generated;       // the chain came from mip_build
+  int dynamic;         // level 0 gets updated in place, never generate for it
+  int transcoded;      // compressed levels are uploaded as RGBA
+  int decoding;        // level 0 is on the worker, the placeholder is showing
+  uint32_t decode_generation;
+} tex_info;
+
+enum {
+  JOB_MIPS,      // build the chain under level 0
+  JOB_TRANSCODE, // decode a compressed level to RGBA
+};
+
+typedef struct tex_job {
+  struct tex_job *next;
+  int kind;
+  GLuint texture;
+  uint32_t generation;
+  GLint level;
+  GLsizei width;
+  GLsizei height;
+  GLenum format;
+  GLenum type;
+  uint64_t hash;
+  uint8_t *data;       // level 0 on the way in, levels 1 and up on the way out
+  uint32_t size;
+  int num_levels;
+  int cached;          // read from the disk cache rather than built
+  uint32_t frame;      // when a decode was queued
+} tex_job;
+
+static const char *cache_dir = NULL;
+
+static tex_info *textures = NULL;
+static int num_textures = 0;
+
+// Staged jobs wait for the end of the frame, in case the game uploads its own mips
+static tex_job *staged = NULL;
+
+static pthread_t worker_thread;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static tex_job *pending = NULL;
+static tex_job *pending_tail = NULL;
+static tex_job *done = NULL;
+static tex_job *working = NULL; // the job the worker has taken
+static int worker_running = 0;
+
+static texture_stats stats;
+static uint32_t frame_count = 0;
+
+// The worker's share of the stats, under queue_lock until texture_frame folds it in
+static uint64_t worker_gen_time = 0;
+static uint64_t worker_transcode_time = 0;
+
+// Transparent black, so a texture still decoding doesn't show
+static const uint32_t placeholder = 0;
+
+texture_stats *texture_get_stats(void) {
+  return &stats;
+}
+
+static tex_info *tex_get(GLuint texture) {
+  if (texture >= num_textures) {
+    int count = num_textures ? num_textures : 256;
+    while (count <= texture)
+      count *= 2;
+    tex_info *grown = realloc(textures, count * sizeof(tex_info));
+    if (!grown)
+      return NULL;
+    memset(grown + num_textures, 0, (count - num_textures) * sizeof(tex_info));
+    textures = grown;
+    num_textures = count;
+  }
+
+  return &textures[texture];
+}
+
+static GLuint bound_texture(void) {
+  GLint texture = 0;
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+  return texture;
+}
+
+static int texel_size(GLenum format, GLenum type) {
+  switch (type) {
+    case GL_UNSIGNED_BYTE:
+      switch (format) {
+        case GL_RGBA:
+          return 4;
+        case GL_RGB:
+          return 3;
+        case GL_LUMINANCE_ALPHA:
+          return 2;
+        case GL_LUMINANCE:
+        case GL_ALPHA:
+          return 1;
+      }
+      return 0;
+    case GL_UNSIGNED_SHORT_5_6_5:
+    case GL_UNSIGNED_SHORT_4_4_4_4:
+    case GL_UNSIGNED_SHORT_5_5_5_1:
+      return 2;
+  }
+  return 0;
+}
+
+// Field widths of the packed formats, most significant first
+static const uint8_t *packed_fields(GLenum type) {
+  static const uint8_t rgb565[] = { 5, 6, 5, 0 };
+  static const uint8_t rgba4444[] = { 4, 4, 4, 4 };
+  static const uint8_t rgba5551[] = { 5, 5, 5, 1 };
+
+  switch (type) {
+    case GL_UNSIGNED_SHORT_5_6_5:
+      return rgb565;
+    case GL_UNSIGNED_SHORT_4_4_4_4:
+      return rgba4444;
+    case GL_UNSIGNED_SHORT_5_5_5_1:
+      return rgba5551;
+  }
+  return NULL;
+}
+
+static uint16_t average_packed(const uint8_t *a, const uint8_t *b, const uint8_t *c, const uint8_t *d, const uint8_t *fields) {
+  uint16_t p[4];
+  memcpy(&p[0], a, 2);
+  memcpy(&p[1], b, 2);
+  memcpy(&p[2], c, 2);
+  memcpy(&p[3], d, 2);
+
+  uint16_t out = 0;
+  int shift = 16;
+  for (int i = 0; i < 4 && fields[i]; i++) {
+    shift -= fields[i];
+    int mask = (1 << fields[i]) - 1;
+    int sum = ((p[0] >> shift) & mask) + ((p[1] >> shift) & mask) + ((p[2] >> shift) & mask) + ((p[3] >> shift) & mask);
+    out |= ((sum + 2) >> 2) << shift;
+  }
+  return out;
+}
+
+// 2x2 box filter, odd edges drop their last row or column
+static void downsample(const uint8_t *src, int width, int height, uint8_t *dst, GLenum type, int size) {
+  int dst_w = width > 1 ? width / 2 : 1;
+  int dst_h = height > 1 ? height / 2 : 1;
+  int step_x = width > 1 ? size : 0;
+  int step_y = height > 1 ? width * size : 0;
+  const uint8_t *fields = packed_fields(type);
+
+  for (int y = 0; y < dst_h; y++) {
+    const uint8_t *row = src + (height > 1 ? y * 2 : 0) * width * size;
+    for (int x = 0; x < dst_w; x++) {
+      const uint8_t *a = row + (width > 1 ? x * 2 : 0) * size;
+      const uint8_t *b = a + step_x;
+      const uint8_t *c = a + step_y;
+      const uint8_t *d = c + step_x;
+
+      if (fields) {
+        uint16_t p = average_packed(a, b, c, d, fields);
+        memcpy(dst, &p, 2);
+      } else {
+        for (int i = 0; i < size; i++)
+          dst[i] = (a[i] + b[i] + c[i] + d[i] + 2) >> 2;
+      }
+      dst += size;
+    }
+  }
+}
+
+static int mip_levels(int width, int height) {
+  int levels = 1;
+  while (width > 1 || height > 1) {
+    width = width > 1 ? width / 2 : 1;
+    height = height > 1 ? height / 2 : 1;
+    levels++;
+  }
+  return levels;
+}
+
+// Size of levels 1 and up
+static uint32_t mip_chain_size(int width, int height, int size) {
+  uint32_t total = 0;
+  while (width > 1 || height > 1) {
+    width = width > 1 ? width / 2 : 1;
+    height = height > 1 ? height / 2 : 1;
+    total += width * height * size;
+  }
+  return total;
+}
+
+static void mip_path(char *path, size_t size, tex_job *job) {
+  snprintf(path, size, "%s/%016llx.mip", cache_dir, (unsigned long long)job->hash);
+}
+
+static uint8_t *mip_read(tex_job *job, uint32_t size) {
+  if (!cache_dir)
+    return NULL;
+
+  char path[256];
+  mip_path(path, sizeof(path), job);
+
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return NULL;
+
+  mip_header header;
+  uint8_t *data = NULL;
+  if (fread(&header, 1, sizeof(mip_header), file) == sizeof(mip_header) &&
+      header.magic == MIP_MAGIC &&
+      header.version == MIP_VERSION &&
+      header.width == job->width &&
+      header.height == job->height &&
+      header.format == job->format &&
+      header.type == job->type &&
+      header.levels == job->num_levels &&
+      header.size == size) {
+    data = malloc(size);
+    if (data && fread(data, 1, size, file) != size) {
+      free(data);
+      data = NULL;
+    }
+  }
+
+  fclose(file);
+  return data;
+}
+
+static void mip_write(tex_job *job, const uint8_t *data, uint32_t size) {
+  if (!cache_dir)
+    return;
+
+  mip_header header;
+  header.magic = MIP_MAGIC;
+  header.version = MIP_VERSION;
+  header.width = job->width;
+  header.height = job->height;
+  header.format = job->format;
+  header.type = job->type;
+  header.levels = job->num_levels;
+  header.size = size;
+
+  char path[256];
+  mip_path(path, sizeof(path), job);
+
+  FILE *file = fopen(path, "wb");
+  if (file) {
+    fwrite(&header, 1, sizeof(mip_header), file);
+    fwrite(data, 1, size, file);
+    fclose(file);
+  }
+}
+
+// Runs on the worker, swaps the job's level 0 for its levels 1 and up
+static void mip_build(tex_job *job) {
+  int size = texel_size(job->format, job->type);
+  uint32_t chain_size = mip_chain_size(job->width, job->height, size);
+  job->num_levels = mip_levels(job->width, job->height);
+
+  uint8_t *chain = mip_read(job, chain_size);
+  if (chain) {
+    job->cached = 1;
+  } else {
+    chain = malloc(chain_size);
+    if (!chain) {
+      job->num_levels = 0;
+      return;
+    }
+
+    const uint8_t *src = job->data;
+    uint8_t *dst = chain;
+    int width = job->width, height = job->height;
+    while (width > 1 || height > 1) {
+      downsample(src, width, height, dst, job->type, size);
+      width = width > 1 ? width / 2 : 1;
+      height = height > 1 ? height / 2 : 1;
+      src = dst;
+      dst += width * height * size;
+    }
+
+    mip_write(job, chain, chain_size);
+  }
+
+  free(job->data);
+  job->data = chain;
+  job->size = chain_size;
+}
+
+// Runs on the worker, swaps the job's compressed level for RGBA
+static void transcode_build(tex_job *job) {
+  uint8_t *rgba = transcode_level(job->format, job->width, job->height, job->data, job->size, &job->cached);
+  if (!rgba)
+    return;
+
+  free(job->data);
+  job->data = rgba;
+  job->size = job->width * job->height * 4;
+  job->num_levels = 1;
+}
+
+static void *texture_worker(void *arg) {
+  pthread_mutex_lock(&queue_lock);
+
+  while (1) {
+    while (!pending)
+      pthread_cond_wait(&queue_cond, &queue_lock);
+
+    tex_job *job = pending;
+    pending = job->next;
+    if (!pending)
+      pending_tail = NULL;
+    working = job;
+    pthread_mutex_unlock(&queue_lock);
+
+    uint64_t start = sceKernelGetProcessTimeWide();
+    if (job->kind == JOB_TRANSCODE)
+      transcode_build(job);
+    else
+      mip_build(job);
+    uint64_t elapsed = sceKernelGetProcessTimeWide() - start;
+
+    pthread_mutex_lock(&queue_lock);
+    if (job->kind == JOB_TRANSCODE)
+      worker_transcode_time += elapsed;
+    else
+      worker_gen_time += elapsed;
+    job->next = done;
+    done = job;
+    working = NULL;
+    pthread_cond_broadcast(&queue_cond);
+  }
+
+  return NULL;
+}
+
+void texture_init(const char *cache_path) {
+  cache_dir = cache_path;
+  if (cache_dir)
+    sceIoMkdir(cache_dir, 0777);
+
+  if (worker_running)
+    return;
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, WORKER_STACK_SIZE);
+  if (pthread_create(&worker_thread, &attr, texture_worker, NULL) == 0)
+    worker_running = 1;
+  pthread_attr_destroy(&attr);
+}
+
+static void free_job(tex_job *job) {
+  free(job->data);
+  free(job);
+}
+
+static void stage_job(GLuint texture, tex_info *info, GLsizei width, GLsizei height, GLenum format, GLenum type, const void *data) {
+  int size = texel_size(format, type);
+  if (!size || width < TEXTURE_MIP_MIN_SIZE || height < TEXTURE_MIP_MIN_SIZE)
+    return;
+
+  tex_job *job = calloc(1, sizeof(tex_job));
+  if (!job)
+    return;
+
+  job->size = width * height * size;
+  job->data = malloc(job->size);
+  if (!job->data) {
+    free(job);
+    return;
+  }
+  memcpy(job->data, data, job->size);
+
+  job->texture = texture;
+  job->generation = info->generation;
+  job->width = width;
+  job->height = height;
+  job->format = format;
+  job->type = type;
+  job->next = staged;
+  staged = job;
+}
+
+// The worker takes jobs in order, so the levels of a texture land in order
+static void queue_job(tex_job *job) {
+  pthread_mutex_lock(&queue_lock);
+  job->next = NULL;
+  if (pending_tail)
+    pending_tail->next = job;
+  else
+    pending = job;
+  pending_tail = job;
+  pthread_cond_signal(&queue_cond);
+  pthread_mutex_unlock(&queue_lock);
+}
+
+// Jobs only go out once nothing else can be uploaded on top of level 0
+static void submit_staged(void) {
+  while (staged) {
+    tex_job *job = staged;
+    staged = job->next;
+
+    tex_info *info = job->texture < num_textures ? &textures[job->texture] : NULL;
+    if (!info || info->generation != job->generation || info->levels != 1 || info->dynamic) {
+      free_job(job);
+      continue;
+    }
+
+    job->hash = murmur64(job->data, job->size);
+
+    if (!worker_running) {
+      mip_build(job);
+      job->next = done;
+      done = job;
+      continue;
+    }
+
+    queue_job(job);
+  }
+}
+
+static void upload_chain(tex_job *job) {
+  int size = texel_size(job->format, job->type);
+  const uint8_t *data = job->data;
+  int width = job->width, height = job->height;
+
+  glBindTexture(GL_TEXTURE_2D, job->texture);
+  for (int level = 1; level < job->num_levels; level++) {
+    width = width > 1 ? width / 2 : 1;
+    height = height > 1 ? height / 2 : 1;
+    glTexImage2D(GL_TEXTURE_2D, level, job->format, width, height, 0, job->format, job->type, data);
+    data += width * height * size;
+  }
+  stats.bytes += job->size;
+  stats.cache_hits += job->cached;
+  residency_chain(job->texture, job->size);
+
+  // A plain linear filter would never sample the new levels
+  tex_info *info = &textures[job->texture];
+  if (info->min_filter == GL_LINEAR || info->min_filter == 0)
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, TEXTURE_MIP_FILTER);
+  info->generated = 1;
+  stats.generated++;
+}
+
+void texture_wait(void) {
+  submit_staged();
+
+  pthread_mutex_lock(&queue_lock);
+  while (pending || working)
+    pthread_cond_wait(&queue_cond, &queue_lock);
+  pthread_mutex_unlock(&queue_lock);
+}
+
+// Under queue_lock, whether the worker still has something for the texture
+static int texture_queued(GLuint texture) {
+  if (working && working->texture == texture)
+    return 1;
+  for (tex_job *job = pending; job; job = job->next) {
+    if (job->texture == texture)
+      return 1;
+  }
+  return 0;
+}
+
+// Under queue_lock, moves the texture's jobs to the front keeping their order
+static void hurry_jobs(GLuint texture) {
+  tex_job *front = NULL, *front_last = NULL;
+  tex_job *rest = NULL, *rest_last = NULL;
+
+  tex_job *next;
+  for (tex_job *job = pending; job; job = next) {
+    next = job->next;
+    job->next = NULL;
+    if (job->texture == texture) {
+      if (front_last)
+        front_last->next = job;
+      else
+        front = job;
+      front_last = job;
+    } else {
+      if (rest_last)
+        rest_last->next = job;
+      else
+        rest = job;
+      rest_last = job;
+    }
+  }
+
+  if (front_last)
+    front_last->next = rest;
+  pending = front ? front : rest;
+  pending_tail = rest_last ? rest_last : front_last;
+}
+
+static void tex_image(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void *data) {
+  glTexImage2D(target, level, internalformat, width, height, border, format, type, data);
+  if (target != GL_TEXTURE_2D)
+    return;
+
+  if (data) {
+    stats.uploads++;
+    stats.bytes += width * height * (texel_size(format, type) ? texel_size(format, type) : 4);
+  }
+
+  GLuint texture = bound_texture();
+  tex_info *info = tex_get(texture);
+  if (!info)
+    return;
+
+  if (level == 0) {
+    info->levels = 1;
+    info->generation++;
+    info->generated = 0;
+    info->dynamic = 0;
+    info->decoding = 0;
+    framebuffer_texture_image(target, level, format, type);
+    if (data) {
+      residency_upload(texture, internalformat, width, height, format, type, width * height * texel_size(format, type), 0);
+      stage_job(texture, info, width, height, format, type, data);
+    } else {
+      residency_forget(texture);
+    }
+  } else {
+    info->levels |= 1 << level;
+    stats.levels_kept++;
+    residency_pin(texture);
+  }
+}
+
+void glTexImage2DHook(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void *data) {
+  // Contents already in video memory under another name are shared instead
+  if (target == GL_TEXTURE_2D && dedup_image(level, internalformat, width, height, format, type, data, width * height * texel_size(format, type), 0))
+    return;
+
+  tex_image(target, level, internalformat, width, height, border, format, type, data);
+}
+
+static void compressed_image(GLenum target, GLint level, GLenum format, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const void *data) {
+  glCompressedTexImage2D(target, level, format, width, height, border, imageSize, data);
+  if (target != GL_TEXTURE_2D)
+    return;
+
+  stats.uploads++;
+  stats.bytes += imageSize;
+
+  GLuint texture = bound_texture();
+  tex_info *info = tex_get(texture);
+  if (!info)
+    return;
+
+  if (level == 0) {
+    info->levels = 1;
+    info->generation++;
+    info->generated = 0;
+    info->decoding = 0;
+    if (data)
+      residency_upload(texture, format, width, height, format, 0, imageSize, 1);
+    else
+      residency_forget(texture);
+  } else {
+    info->levels |= 1 << level;
+    stats.levels_kept++;
+    residency_pin(texture);
+  }
+}
+
+// Hands a level to the worker to decode, level 0 shows the placeholder meanwhile
+static int queue_transcode(GLuint texture, GLint level, GLenum format, GLsizei width, GLsizei height, GLsizei imageSize, const void *data) {
+  if (!worker_running || !data || imageSize != pvrtc_4bpp_size(width, height))
+    return 0;
+
+  tex_job *job = calloc(1, sizeof(tex_job));
+  if (!job)
+    return 0;
+  job->data = malloc(imageSize);
+  if (!job->data) {
+    free(job);
+    return 0;
+  }
+  memcpy(job->data, data, imageSize);
+
+  tex_info *info = &textures[texture];
+  if (level == 0) {
+    tex_image(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, &placeholder);
+    info->decoding = 1;
+    info->decode_generation = info->generation;
+    job->generation = info->generation;
+  } else {
+    // Levels queued behind level 0 land after it, one generation on
+    job->generation = info->generation + (info->decoding && info->decode_generation == info->generation);
+  }
+
+  job->kind = JOB_TRANSCODE;
+  job->texture = texture;
+  job->level = level;
+  job->width = width;
+  job->height = height;
+  job->format = format;
+  job->size = imageSize;
+  job->frame = frame_count;
+  stats.deferred++;
+  queue_job(job);
+  return 1;
+}
+
+void glCompressedTexImage2DHook(GLenum target, GLint level, GLenum format, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const void *data) {
+  if (target == GL_TEXTURE_2D && dedup_image(level, format, width, height, format, 0, data, imageSize, 1))
+    return;
+
+  // Textures GXM can't sample compressed go in as plain RGBA, all their levels alike
+  GLuint texture = bound_texture();
+  tex_info *info = target == GL_TEXTURE_2D ? tex_get(texture) : NULL;
+  int transcode = transcode_needed(format, width, height) || (info && level > 0 && info->transcoded);
+  if (info && level == 0)
+    info->transcoded = transcode;
+
+  if (transcode && info && queue_transcode(texture, level, format, width, height, imageSize, data))
+    return;
+
+  if (transcode) {
+    uint64_t start = sceKernelGetProcessTimeWide();
+    int cached;
+    uint8_t *rgba = transcode_level(format, width, height, data, imageSize, &cached);
+    if (rgba) {
+      stats.transcoded++;
+      stats.transcode_hits += cached;
+      stats.transcode_time += sceKernelGetProcessTimeWide() - start;
+      tex_image(target, level, GL_RGBA, width, height, border, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+      free(rgba);
+      return;
+    }
+  }
+
+  compressed_image(target, level, format, width, height, border, imageSize, data);
+}
+
+static void apply_transcode(tex_job *job) {
+  glBindTexture(GL_TEXTURE_2D, job->texture);
+
+  if (job->num_levels) {
+    stats.transcoded++;
+    stats.transcode_hits += job->cached;
+    tex_image(GL_TEXTURE_2D, job->level, GL_RGBA, job->width, job->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, job->data);
+  } else {
+    // Couldn't decode it, vitaGL gets the payload as it came
+    compressed_image(GL_TEXTURE_2D, job->level, job->format, job->width, job->height, 0, job->size, job->data);
+  }
+
+  if (job->level == 0)
+    stats.placeholder_frames += frame_count - job->frame;
+}
+
+// Nothing to wait on in vitaGL, finished jobs are picked up here without blocking
+static void complete_jobs(void) {
+  pthread_mutex_lock(&queue_lock);
+  tex_job *jobs = done;
+  done = NULL;
+  pthread_mutex_unlock(&queue_lock);
+
+  if (!jobs)
+    return;
+
+  // The list is newest first, levels have to go in the order they came
+  tex_job *ordered = NULL;
+  while (jobs) {
+    tex_job *job = jobs;
+    jobs = job->next;
+    job->next = ordered;
+    ordered = job;
+  }
+
+  GLuint bound = bound_texture();
+
+  while (ordered) {
+    tex_job *job = ordered;
+    ordered = job->next;
+
+    // The texture may have been respecified or deleted in the meantime
+    tex_info *info = job->texture < num_textures ? &textures[job->texture] : NULL;
+    if (job->kind == JOB_TRANSCODE) {
+      if (info && info->generation == job->generation)
+        apply_transcode(job);
+    } else if (job->num_levels && info && info->generation == job->generation && info->levels == 1 && !info->dynamic) {
+      upload_chain(job);
+    }
+
+    free_job(job);
+  }
+
+  glBindTexture(GL_TEXTURE_2D, bound);
+}
+
+// The game expects the decoded contents under whatever it does next. Only this
+// texture's jobs are waited on, they go ahead of whatever else is queued.
+static void finish_decoding(GLuint texture) {
+  tex_info *info = texture < num_textures ? &textures[texture] : NULL;
+  if (!info || !info->decoding)
+    return;
+
+  pthread_mutex_lock(&queue_lock);
+  hurry_jobs(texture);
+  while (texture_queued(texture))
+    pthread_cond_wait(&queue_cond, &queue_lock);
+  pthread_mutex_unlock(&queue_lock);
+
+  complete_jobs();
+}
+
+void texture_frame(void) {
+  submit_staged();
+
+  pthread_mutex_lock(&queue_lock);
+  stats.gen_time += worker_gen_time;
+  stats.transcode_time += worker_transcode_time;
+  worker_gen_time = 0;
+  worker_transcode_time = 0;
+  pthread_mutex_unlock(&queue_lock);
+
+  if (++stats.frames >= FRAME_STATS_INTERVAL) {
+    debugPrintf("Textures %u uploads %llu bytes per frame, %u levels kept, %u chains generated (%u cached) in %.3f ms, "
+                "%u levels transcoded (%u cached) in %.3f ms, %u deferred, placeholders up %u frames\n",
+                stats.uploads, (unsigned long long)(stats.bytes / stats.frames), stats.levels_kept,
+                stats.generated, stats.cache_hits, stats.gen_time / 1000.0f,
+                stats.transcoded, stats.transcode_hits, stats.transcode_time / 1000.0f,
+                stats.deferred, stats.placeholder_frames);
+    memset(&stats, 0, sizeof(texture_stats));
+  }
+
+  complete_jobs();
+  frame_count++;
+  dedup_frame();
+
+  // Last, so the chains that just landed count against the budget
+  residency_frame();
+}
+
+void glTexSubImage2DHook(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const void *data) {
+  if (target == GL_TEXTURE_2D) {
+    dedup_write();
+    finish_decoding(bound_texture());
+  }
+
+  glTexSubImage2D(target, level, xoffset, yoffset, width, height, format, type, data);
+  if (target != GL_TEXTURE_2D || level != 0)
+    return;
+
+  stats.bytes += width * height * (texel_size(format, type) ? texel_size(format, type) : 4);
+
+  // A generated chain would go stale, sample level 0 only from now on
+  tex_info *info = tex_get(bound_texture());
+  if (!info)
+    return;
+
+  info->dynamic = 1;
+  if (info->generated) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, info->min_filter ? info->min_filter : GL_LINEAR);
+    info->generated = 0;
+  }
+}
+
+void glTexParameteriHook(GLenum target, GLenum pname, GLint param) {
+  if (target == GL_TEXTURE_2D)
+    dedup_parameter(pname, param);
+
+  if (target == GL_TEXTURE_2D && pname == GL_TEXTURE_MIN_FILTER) {
+    tex_info *info = tex_get(bound_texture());
+    if (info) {
+      info->min_filter = param;
+      if (info->generated && param == GL_LINEAR)
+        param = TEXTURE_MIP_FILTER;
+    }
+  }
+
+  glTexParameteri(target, pname, param);
+}
+
+void glGenerateMipmapHook(GLenum target) {
+  if (target == GL_TEXTURE_2D)
+    finish_decoding(bound_texture());
+
+  glGenerateMipmap(target);
+
+  // vitaGL built the chain itself, nothing left to generate
+  GLuint texture = bound_texture();
+  tex_info *info = target == GL_TEXTURE_2D ? tex_get(texture) : NULL;
+  if (info) {
+    info->levels = ~0;
+    residency_pin(texture);
+  }
+}
+
+void glActiveTextureHook(GLenum texture) {
+  dedup_active(texture);
+  residency_active(texture);
+  glActiveTexture(texture);
+}
+
+void glBindTextureHook(GLenum target, GLuint texture) {
+  if (target == GL_TEXTURE_2D)
+    texture = dedup_bind(texture);
+
+  glBindTexture(target, texture);
+  if (target == GL_TEXTURE_2D)
+    residency_bind(texture);
+}
+
+// Jobs still in flight would upload their chain onto the 1x1 placeholder
+void texture_evicted(GLuint texture) {
+  if (texture < num_textures)
+    textures[texture].generation++;
+}
+
+void texture_restored(GLuint texture, GLsizei width, GLsizei height, GLenum format, GLenum type, const void *data) {
+  tex_info *info = texture < num_textures ? &textures[texture] : NULL;
+  if (!info)
+    return;
+
+  // Evicting dropped the chain, sample level 0 until it is back
+  if (info->generated) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, info->min_filter ? info->min_filter : GL_LINEAR);
+    info->generated = 0;
+  }
+
+  info->generation++;
+  if (data && info->levels == 1 && !info->dynamic)
+    stage_job(texture, info, width, height, format, type, data);
+}
+
+void texture_delete(GLsizei n, const GLuint *ids) {
+  for (int i = 0; i < n; i++) {
+    if (ids[i] >= num_textures)
+      continue;
+
+    // The generation survives so a job for the old contents can't match a reused name
+    residency_forget(ids[i]);
+
+    tex_info *info = &textures[ids[i]];
+    uint32_t generation = info->generation + 1;
+    memset(info, 0, sizeof(tex_info));
+    info->generation = generation;
+  }
+
+  framebuffer_delete_textures(n, ids);
+  glDeleteTextures(n, ids);
+}
+
+void glDeleteTexturesHook(GLsizei n, const GLuint *ids) {
+  // Textures other names still sample outlive the name that uploaded them,
+  // each name can doom itself and its backing
+  GLuint doomed[2 * DELETE_BATCH];
+  for (GLsizei i = 0; i < n; i += DELETE_BATCH) {
+    GLsizei count = n - i < DELETE_BATCH ? n - i : DELETE_BATCH;
+    texture_delete(dedup_delete(count, ids + i, doomed), doomed);
+  }
+}
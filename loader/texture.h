@@ -0,0 +1,38 @@
+#ifndef __TEXTURE_H__
+#define __TEXTURE_H__
+
+#include <vitaGL.h>
+
+typedef struct {
+  uint32_t frames;
+  uint32_t uploads;     // glTexImage2D/glCompressedTexImage2D calls with data
+  uint64_t bytes;       // texel data handed to vitaGL, generated levels included
+  uint32_t levels_kept; // mip levels the game supplied
+  uint32_t generated;   // textures that got a generated mip chain
+  uint32_t cache_hits;  // chains read back from the disk cache
+  uint64_t gen_time;    // microseconds the worker spent building chains
+  uint32_t transcoded;     // compressed levels uploaded as RGBA
+  uint32_t transcode_hits; // of those, read from the transcode cache
+  uint64_t transcode_time; // microseconds spent decoding or loading them
+  uint32_t deferred;       // compressed levels handed to the worker to decode
+  uint32_t placeholder_frames; // frames textures showed the placeholder, summed
+} texture_stats;
+
+void texture_init(const char *cache_path);
+texture_stats *texture_get_stats(void);
+void texture_wait(void);
+void texture_frame(void);
+void texture_delete(GLsizei n, const GLuint *textures);
+void texture_evicted(GLuint texture);
+void texture_restored(GLuint texture, GLsizei width, GLsizei height, GLenum format, GLenum type, const void *data);
+
+void glTexImage2DHook(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void *data);
+void glCompressedTexImage2DHook(GLenum target, GLint level, GLenum format, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const void *data);
+void glTexSubImage2DHook(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const void *data);
+void glTexParameteriHook(GLenum target, GLenum pname, GLint param);
+void glGenerateMipmapHook(GLenum target);
+void glDeleteTexturesHook(GLsizei n, const GLuint *textures);
+void glActiveTextureHook(GLenum texture);
+void glBindTextureHook(GLenum target, GLuint texture);
+
+#endif
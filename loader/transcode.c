@@ -0,0 +1,138 @@
+/* transcode.c -- cache of compressed textures converted for the GPU
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * GXM only samples PVRTC from square textures. Non-square 4bpp textures are
+ * decoded to RGBA8888 once, every level of them, stored under the hash of their payload and
+ * loaded from there on later boots. host/pvr_cache fills the same cache
+ * from an extracted OBB.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "pvrtc.h"
+#include "murmur.h"
+#include "transcode.h"
+
+#define TEX_MAGIC 0x43584554 // 'TEXC'
+#define TEX_VERSION 1
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t width;
+  uint32_t height;
+  uint32_t format; // compressed source format
+  uint32_t size;   // RGBA8888 bytes that follow
+} tex_header;
+
+static const char *cache_dir = NULL;
+
+void transcode_init(const char *cache_path) {
+  cache_dir = cache_path;
+  if (cache_dir)
+    sceIoMkdir(cache_dir, 0777);
+}
+
+static int is_pvrtc_4bpp(GLenum format) {
+  return format == GL_COMPRESSED_RGB_PVRTC_4BPPV1_IMG || format == GL_COMPRESSED_RGBA_PVRTC_4BPPV1_IMG;
+}
+
+int transcode_needed(GLenum format, GLsizei width, GLsizei height) {
+  return is_pvrtc_4bpp(format) && width != height;
+}
+
+// Small levels all pad to 8x8 words, the same payload can come in several sizes
+static void tex_path(char *path, size_t size, uint64_t hash, GLsizei width, GLsizei height) {
+  snprintf(path, size, "%s/%016llx_%dx%d.tex", cache_dir, (unsigned long long)hash, width, height);
+}
+
+static uint8_t *tex_read(uint64_t hash, GLenum format, GLsizei width, GLsizei height, uint32_t size) {
+  char path[256];
+  tex_path(path, sizeof(path), hash, width, height);
+
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return NULL;
+
+  // RGB and RGBA PVRTC decode the same, the format only tells the bpp apart
+  tex_header header;
+  uint8_t *data = NULL;
+  if (fread(&header, 1, sizeof(tex_header), file) == sizeof(tex_header) &&
+      header.magic == TEX_MAGIC &&
+      header.version == TEX_VERSION &&
+      header.width == width &&
+      header.height == height &&
+      is_pvrtc_4bpp(header.format) == is_pvrtc_4bpp(format) &&
+      header.size == size) {
+    data = malloc(size);
+    if (data && fread(data, 1, size, file) != size) {
+      free(data);
+      data = NULL;
+    }
+  }
+
+  fclose(file);
+  return data;
+}
+
+static void tex_write(uint64_t hash, GLenum format, GLsizei width, GLsizei height, const uint8_t *data, uint32_t size) {
+  tex_header header;
+  header.magic = TEX_MAGIC;
+  header.version = TEX_VERSION;
+  header.width = width;
+  header.height = height;
+  header.format = format;
+  header.size = size;
+
+  char path[256];
+  tex_path(path, sizeof(path), hash, width, height);
+
+  FILE *file = fopen(path, "wb");
+  if (file) {
+    fwrite(&header, 1, sizeof(tex_header), file);
+    fwrite(data, 1, size, file);
+    fclose(file);
+  }
+}
+
+uint8_t *transcode_level(GLenum format, GLsizei width, GLsizei height, const void *data, GLsizei size, int *cached) {
+  *cached = 0;
+  if (!is_pvrtc_4bpp(format) || !data)
+    return NULL;
+
+  if (size != pvrtc_4bpp_size(width, height)) {
+    debugPrintf("Warning: %dx%d PVRTC level has %d bytes, leaving it to vitaGL\n", width, height, size);
+    return NULL;
+  }
+
+  uint32_t rgba_size = width * height * 4;
+  uint64_t hash = murmur64(data, size);
+
+  if (cache_dir) {
+    uint8_t *rgba = tex_read(hash, format, width, height, rgba_size);
+    if (rgba) {
+      *cached = 1;
+      return rgba;
+    }
+  }
+
+  uint8_t *rgba = malloc(rgba_size);
+  if (!rgba)
+    return NULL;
+  pvrtc_decompress_4bpp(data, width, height, rgba);
+
+  if (cache_dir)
+    tex_write(hash, format, width, height, rgba, rgba_size);
+
+  return rgba;
+}
@@ -0,0 +1,13 @@
+#ifndef __TRANSCODE_H__
+#define __TRANSCODE_H__
+
+#include <vitaGL.h>
+
+void transcode_init(const char *cache_path);
+int transcode_needed(GLenum format, GLsizei width, GLsizei height);
+
+// RGBA8888 texels of a PVRTC 4bpp level, from the cache or decoded and
+// stored there. NULL when the level is left to vitaGL.
+uint8_t *transcode_level(GLenum format, GLsizei width, GLsizei height, const void *data, GLsizei size, int *cached);
+
+#endif
@@ -0,0 +1,171 @@
+/* uniform_cache.c -- shadow copies of the game's uniform values
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * The game uploads matWorldViewProj, vLightDirection, vsShaderParam and the
+ * rest of its uniforms before every draw, mostly with the values the program
+ * already holds. Uniforms belong to the program, so each program keeps the
+ * last value set per location, and an upload matching it can be dropped
+ * until the program is relinked or deleted. Values are compared bitwise,
+ * sixteen bytes at a time with NEON where the size allows.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "config.h"
+#include "uniform_cache.h"
+
+typedef struct {
+  GLint location;
+  int type;
+  GLsizei count;
+  uint32_t size;
+  void *data;
+} shadow_uniform;
+
+typedef struct {
+  int num_uniforms;
+  shadow_uniform *uniforms;
+} shadow_program;
+
+static shadow_program *programs = NULL;
+static int num_programs = 0;
+
+static uniform_cache_stats stats;
+static uint32_t frame_skipped = 0;
+static uint64_t frame_skipped_bytes = 0;
+
+uniform_cache_stats *uniform_cache_get_stats(void) {
+  return &stats;
+}
+
+static shadow_program *program_get(GLuint prog) {
+  if (prog >= num_programs) {
+    int count = num_programs ? num_programs : 64;
+    while (count <= prog)
+      count *= 2;
+    shadow_program *grown = realloc(programs, count * sizeof(shadow_program));
+    if (!grown)
+      return NULL;
+    memset(grown + num_programs, 0, (count - num_programs) * sizeof(shadow_program));
+    programs = grown;
+    num_programs = count;
+  }
+
+  return &programs[prog];
+}
+
+static int values_equal(const void *a, const void *b, uint32_t size) {
+#ifdef __ARM_NEON
+  if ((size & 15) == 0) {
+    const uint32_t *wa = a, *wb = b;
+    uint32x4_t diff = vdupq_n_u32(0);
+    for (uint32_t i = 0; i < size / 4; i += 4)
+      diff = vorrq_u32(diff, veorq_u32(vld1q_u32(wa + i), vld1q_u32(wb + i)));
+    uint32x2_t folded = vorr_u32(vget_low_u32(diff), vget_high_u32(diff));
+    return (vget_lane_u32(folded, 0) | vget_lane_u32(folded, 1)) == 0;
+  }
+#endif
+  return memcmp(a, b, size) == 0;
+}
+
+// Returns 1 when the program already holds the value, otherwise keeps it
+int uniform_cache_same(GLuint program, GLint location, int type, GLsizei count, const void *value, uint32_t size) {
+  stats.calls++;
+  stats.bytes += size;
+
+  shadow_program *p = program_get(program);
+  if (!p)
+    return 0;
+
+  shadow_uniform *u = NULL;
+  for (int i = 0; i < p->num_uniforms; i++) {
+    if (p->uniforms[i].location == location) {
+      u = &p->uniforms[i];
+      break;
+    }
+  }
+
+  if (!u) {
+    shadow_uniform *grown = realloc(p->uniforms, (p->num_uniforms + 1) * sizeof(shadow_uniform));
+    if (!grown)
+      return 0;
+    p->uniforms = grown;
+    u = &p->uniforms[p->num_uniforms++];
+    memset(u, 0, sizeof(shadow_uniform));
+    u->location = location;
+  } else if (u->type == type && u->count == count && values_equal(u->data, value, size)) {
+    stats.skipped++;
+    stats.skipped_bytes += size;
+    frame_skipped++;
+    frame_skipped_bytes += size;
+    return 1;
+  }
+
+  if (u->size != size) {
+    void *data = realloc(u->data, size);
+    if (!data) {
+      u->type = 0;
+      return 0;
+    }
+    u->data = data;
+    u->size = size;
+  }
+  u->type = type;
+  u->count = count;
+  memcpy(u->data, value, size);
+  return 0;
+}
+
+// Linking resets every uniform, deleting frees the name for another program
+void uniform_cache_forget(GLuint program) {
+  if (program >= num_programs)
+    return;
+
+  shadow_program *p = &programs[program];
+  for (int i = 0; i < p->num_uniforms; i++)
+    free(p->uniforms[i].data);
+  free(p->uniforms);
+  memset(p, 0, sizeof(shadow_program));
+}
+
+void uniform_cache_reset(void) {
+  for (int i = 0; i < num_programs; i++)
+    uniform_cache_forget(i);
+  memset(&stats, 0, sizeof(stats));
+  frame_skipped = 0;
+  frame_skipped_bytes = 0;
+}
+
+void uniform_cache_frame(void) {
+  stats.frame_skipped = frame_skipped;
+  stats.frame_skipped_bytes = frame_skipped_bytes;
+  frame_skipped = 0;
+  frame_skipped_bytes = 0;
+
+  if (++stats.frames < FRAME_STATS_INTERVAL)
+    return;
+
+  debugPrintf("Uniforms %u of %u uploads skipped (%.2f of %.2f KB), %.1f per frame\n",
+              stats.skipped, stats.calls, stats.skipped_bytes / 1024.0f, stats.bytes / 1024.0f,
+              (float)stats.skipped / stats.frames);
+
+  stats.frames = 0;
+  stats.calls = 0;
+  stats.bytes = 0;
+  stats.skipped = 0;
+  stats.skipped_bytes = 0;
+}
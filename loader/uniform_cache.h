@@ -0,0 +1,22 @@
+#ifndef __UNIFORM_CACHE_H__
+#define __UNIFORM_CACHE_H__
+
+#include <vitaGL.h>
+
+typedef struct {
+  uint32_t frames;
+  uint32_t calls;         // uniform uploads checked against the shadow
+  uint64_t bytes;
+  uint32_t skipped;       // of those, identical to the program's current value
+  uint64_t skipped_bytes;
+  uint32_t frame_skipped;       // skipped during the last frame
+  uint64_t frame_skipped_bytes;
+} uniform_cache_stats;
+
+void uniform_cache_reset(void);
+uniform_cache_stats *uniform_cache_get_stats(void);
+int uniform_cache_same(GLuint program, GLint location, int type, GLsizei count, const void *value, uint32_t size);
+void uniform_cache_forget(GLuint program);
+void uniform_cache_frame(void);
+
+#endif
@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+# pack_shaders.py -- packs the Cg replacement shaders into one archive
+#
+# Copyright (C) 2021 Andy Nguyen
+#
+# This software may be modified and distributed under the terms
+# of the MIT license.  See the LICENSE file for details.
+#
+# Layout, all little endian (see loader/shader_index.c):
+#   header   magic 'SHPK', version, count, flags, blob_size, packed_size
+#   entries  count x { key[5], offset, size }, sorted by key
+#   blob     the sources back to back, each NUL terminated,
+#            zlib compressed when flags has PACK_ZLIB
+#
+# usage: pack_shaders.py [-z] <cg_dir> <output>
+
+import os
+import struct
+import sys
+import zlib
+
+PACK_MAGIC = 0x4b504853  # 'SHPK'
+PACK_VERSION = 1
+PACK_ZLIB = 1 << 0
+
+
+def parse_name(name):
+  if len(name) != 43 or not name.endswith('.cg'):
+    return None
+  try:
+    return tuple(int(name[i * 8:i * 8 + 8], 16) for i in range(5))
+  except ValueError:
+    return None
+
+
+def main():
+  args = sys.argv[1:]
+  compress = '-z' in args
+  args = [a for a in args if a != '-z']
+  if len(args) != 2:
+    sys.exit('usage: pack_shaders.py [-z] <cg_dir> <output>')
+  cg_dir, output = args
+
+  shaders = []
+  for name in os.listdir(cg_dir):
+    key = parse_name(name)
+    if key is None:
+      continue
+    with open(os.path.join(cg_dir, name), 'rb') as f:
+      shaders.append((key, f.read()))
+  shaders.sort()
+
+  entries = b''
+  blob = b''
+  for key, source in shaders:
+    entries += struct.pack('<7I', *key, len(blob), len(source))
+    blob += source + b'\0'
+
+  flags = 0
+  packed = blob
+  if compress:
+    flags |= PACK_ZLIB
+    packed = zlib.compress(blob, 9)
+
+  with open(output, 'wb') as f:
+    f.write(struct.pack('<6I', PACK_MAGIC, PACK_VERSION, len(shaders), flags, len(blob), len(packed)))
+    f.write(entries)
+    f.write(packed)
+
+
+if __name__ == '__main__':
+  main()